@@ -336,9 +336,9 @@ void Test::Step(Settings* settings)
 
 	if (settings->drawStats)
 	{
-		m_debugDraw.DrawString(5, m_textLine, "proxies(max) = %d(%d), pairs(max) = %d(%d)",
-			m_world->GetProxyCount(), b2_maxProxies,
-			m_world->GetPairCount(), b2_maxPairs);
+		m_debugDraw.DrawString(5, m_textLine, "proxies(capacity) = %d(%d), pairs = %d",
+			m_world->GetProxyCount(), m_world->GetProxyCapacity(),
+			m_world->GetPairCount());
 		m_textLine += 15;
 
 		m_debugDraw.DrawString(5, m_textLine, "bodies/contacts/joints = %d/%d/%d",
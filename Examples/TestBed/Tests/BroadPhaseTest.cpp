@@ -79,15 +79,16 @@ BroadPhaseTest::BroadPhaseTest()
 
 	srand(888);
 
-	b2AABB worldAABB;
-	worldAABB.lowerBound.Set(-5.0f * m_extent, -5.0f * m_extent);
-	worldAABB.upperBound.Set(5.0f * m_extent, 5.0f * m_extent);
+	b2BroadPhaseDef broadPhaseDef;
+	broadPhaseDef.type = e_sweepAndPruneBroadPhase;
+	broadPhaseDef.worldAABB.lowerBound.Set(-5.0f * m_extent, -5.0f * m_extent);
+	broadPhaseDef.worldAABB.upperBound.Set(5.0f * m_extent, 5.0f * m_extent);
 
 	m_overlapCount = 0;
 	m_overlapCountExact = 0;
 	m_callback.m_test = this;
 
-	m_broadPhase = new b2BroadPhase(worldAABB, &m_callback);
+	m_broadPhase = b2BroadPhase::Create(&broadPhaseDef, &m_callback);
 
 	memset(m_overlaps, 0, sizeof(m_overlaps));
 
@@ -97,7 +98,7 @@ BroadPhaseTest::BroadPhaseTest()
 		GetRandomAABB(&actor->aabb);
 		//actor->aabb.minVertex.Set(0.0f, 0.0f);
 		//actor->aabb.maxVertex.Set(k_width, k_width);
-		actor->proxyId = m_broadPhase->CreateProxy(actor->aabb, actor);
+		actor->proxyId = m_broadPhase->CreateProxy(actor->aabb, actor, false);
 		actor->overlapCount = 0;
 		m_broadPhase->Validate();
 	}
@@ -110,7 +111,7 @@ BroadPhaseTest::~BroadPhaseTest()
 {
 	b2BroadPhase::s_validate = false;
 
-	delete m_broadPhase;
+	b2BroadPhase::Destroy(m_broadPhase);
 }
 
 void BroadPhaseTest::GetRandomAABB(b2AABB* aabb)
@@ -150,7 +151,7 @@ void BroadPhaseTest::CreateProxy()
 		{
 			actor->overlapCount = 0;
 			GetRandomAABB(&actor->aabb);
-			actor->proxyId = m_broadPhase->CreateProxy(actor->aabb, actor);
+			actor->proxyId = m_broadPhase->CreateProxy(actor->aabb, actor, false);
 			return;
 		}
 	}
@@ -47,7 +47,7 @@ public:
 	{
 		b2AABB aabb;
 		int32 overlapCount;
-		uint16 proxyId;
+		uint32 proxyId;
 	};
 
 	static Test* Create();
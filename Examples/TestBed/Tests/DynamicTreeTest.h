@@ -86,6 +86,10 @@ public:
 		Query();
 		RayCast();
 
+		m_debugDraw.DrawString(5, m_textLine, "height = %d, max balance = %d, area ratio = %.2f",
+			m_tree.GetHeight(), m_tree.GetMaxBalance(), (float)m_tree.GetAreaRatio());
+		m_textLine += 15;
+
 		for (int32 i = 0; i < e_actorCount; ++i)
 		{
 			Actor* actor = m_actors + i;
@@ -151,24 +155,29 @@ public:
 		}
 	}
 
-	void QueryCallback(const b2AABB& aabb, void* userData)
+	bool QueryCallback(uint32 proxyId)
 	{
-		Actor* actor = (Actor*)userData;
-		actor->overlap = b2TestOverlap(aabb, actor->aabb);
+		Actor* actor = (Actor*)m_tree.GetUserData(proxyId);
+		actor->overlap = b2TestOverlap(m_queryAABB, actor->aabb);
+		return true;
 	}
 
-	void RayCastCallback(b2RayCastOutput* pOutput, const b2RayCastInput& input, void* userData)
+	float32 RayCastCallback(const b2RayCastInput& input, uint32 proxyId)
 	{
-		Actor* actor = (Actor*)userData;
+		Actor* actor = (Actor*)m_tree.GetUserData(proxyId);
 
-		actor->aabb.RayCast(pOutput, input);
+		b2RayCastOutput output;
+		actor->aabb.RayCast(&output, input);
 
-		if (pOutput->hit)
+		if (output.hit)
 		{
-			m_rayCastOutput = *pOutput;
+			m_rayCastOutput = output;
 			m_rayActor = actor;
-			m_rayActor->fraction = pOutput->fraction;
+			m_rayActor->fraction = output.fraction;
+			return output.fraction;
 		}
+
+		return input.maxFraction;
 	}
 
 private:
@@ -178,7 +187,7 @@ private:
 		b2AABB aabb;
 		float32 fraction;
 		bool overlap;
-		uint16 proxyId;
+		uint32 proxyId;
 	};
 
 	void GetRandomAABB(b2AABB* aabb)
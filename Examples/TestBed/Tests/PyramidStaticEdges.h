@@ -80,6 +80,20 @@ public:
 				x += deltaX;
 			}
 		}
+
+		{
+			// A tilted box landing corner first on the edge.
+			b2PolygonDef sd;
+			sd.SetAsBox(0.5f, 0.5f);
+			sd.density = 5.0f;
+
+			b2BodyDef bd;
+			bd.position.Set(5.0f, 4.0f);
+			bd.angle = 0.6f;
+			b2Body* body = m_world->CreateBody(&bd);
+			body->CreateFixture(&sd);
+			body->SetMassFromShapes();
+		}
 	}
 
 	static Test* Create()
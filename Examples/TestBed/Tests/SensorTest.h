@@ -82,38 +82,29 @@ public:
 	}
 
 	// Implement contact listener.
-	void BeginContact(b2Contact* contact)
+	void SensorEvents(const b2SensorEvent* beginEvents, int32 beginCount,
+					  const b2SensorEvent* endEvents, int32 endCount)
 	{
-		b2Fixture* fixtureA = contact->GetFixtureA();
-		b2Fixture* fixtureB = contact->GetFixtureB();
-
-		if (fixtureA == m_sensor)
+		for (int32 i = 0; i < endCount; ++i)
 		{
-			void* userData = fixtureB->GetBody()->GetUserData();
-			bool* touching = (bool*)userData;
-			if(touching)
-				*touching = true;
+			SetTouching(endEvents[i], false);
 		}
 
-		if (fixtureB == m_sensor)
+		for (int32 i = 0; i < beginCount; ++i)
 		{
-			void* userData = fixtureA->GetBody()->GetUserData();
-			bool* touching = (bool*)userData;
-			if(touching)
-				*touching = true;
+			SetTouching(beginEvents[i], true);
 		}
 
-		b2Fixture* fixture = NULL;
-		if(contact->GetFixtureA()->IsSensor())
-		{
-			fixture = contact->GetFixtureB();
-		}
-		else if(contact->GetFixtureB()->IsSensor())
-		{
-			fixture = contact->GetFixtureA();
-		}
-		if(fixture)
+		// The events come after the step, so the world may be changed here. The
+		// events of fixtures destroyed on the way are set to NULL.
+		for (int32 i = 0; i < beginCount; ++i)
 		{
+			b2Fixture* fixture = beginEvents[i].fixture;
+			if (fixture == NULL)
+			{
+				continue;
+			}
+
 			b2CircleDef s;
 			s.radius = 0.7f;
 			s.density = 5;
@@ -154,27 +145,17 @@ public:
 		}
 	}
 
-	// Implement contact listener.
-	void EndContact(b2Contact* contact)
+	void SetTouching(const b2SensorEvent& event, bool touching)
 	{
-		b2Fixture* fixtureA = contact->GetFixtureA();
-		b2Fixture* fixtureB = contact->GetFixtureB();
-
-		if (fixtureA == m_sensor)
+		if (event.sensor != m_sensor)
 		{
-			void* userData = fixtureB->GetBody()->GetUserData();
-			bool* touching = (bool*)userData;
-			if(touching)
-				*touching = false;
+			return;
 		}
 
-		if (fixtureB == m_sensor)
-		{
-			void* userData = fixtureA->GetBody()->GetUserData();
-			bool* touching = (bool*)userData;
-			if(touching)
-				*touching = false;
-		}
+		void* userData = event.fixture->GetBody()->GetUserData();
+		bool* flag = (bool*)userData;
+		if(flag)
+			*flag = touching;
 	}
 
 	void Step(Settings* settings)
@@ -30,6 +30,7 @@ void b2PolygonShape::SetAsBox(float32 hx, float32 hy)
 	m_normals[2].Set(0.0f, 1.0f);
 	m_normals[3].Set(-1.0f, 0.0f);
 	m_centroid.SetZero();
+	UpdateLanes();
 }
 
 void b2PolygonShape::SetAsBox(float32 hx, float32 hy, const b2Vec2& center, float32 angle)
@@ -55,6 +56,8 @@ void b2PolygonShape::SetAsBox(float32 hx, float32 hy, const b2Vec2& center, floa
 		m_vertices[i] = b2Mul(xf, m_vertices[i]);
 		m_normals[i] = b2Mul(xf.R, m_normals[i]);
 	}
+
+	UpdateLanes();
 }
 
 void b2PolygonShape::SetAsEdge(const b2Vec2& v1, const b2Vec2& v2)
@@ -66,6 +69,7 @@ void b2PolygonShape::SetAsEdge(const b2Vec2& v1, const b2Vec2& v2)
 	m_normals[0] = b2Cross(v2 - v1, 1.0f);
 	m_normals[0].Normalize();
 	m_normals[1] = -m_normals[0];
+	UpdateLanes();
 }
 
 static b2Vec2 ComputeCentroid(const b2Vec2* vs, int32 count)
@@ -165,6 +169,8 @@ void b2PolygonShape::Set(const b2Vec2* vertices, int32 count)
 
 	// Compute the polygon centroid.
 	m_centroid = ComputeCentroid(m_vertices, m_vertexCount);
+
+	UpdateLanes();
 }
 
 bool b2PolygonShape::TestPoint(const b2XForm& xf, const b2Vec2& p) const
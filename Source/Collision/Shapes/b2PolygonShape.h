@@ -21,6 +21,11 @@
 
 #include "b2Shape.h"
 
+#ifdef B2_USE_SSE
+/// The polygon lanes are padded to a multiple of the SSE width.
+#define b2_polygonLaneCount ((b2_maxPolygonVertices + 3) & ~3)
+#endif
+
 /// A convex polygon. It is assumed that the interior of the polygon is to
 /// the left of each edge.
 class b2PolygonShape : public b2Shape
@@ -84,10 +89,25 @@ public:
 	/// Get a vertex by index.
 	const b2Vec2& GetVertex(int32 index) const;
 
+	/// Copy the vertices and normals into the lanes used by the SIMD collision code.
+	/// The Set functions do this, so only call it after writing m_vertices or
+	/// m_normals directly.
+	void UpdateLanes();
+
 	b2Vec2 m_centroid;
 	b2Vec2 m_vertices[b2_maxPolygonVertices];
 	b2Vec2 m_normals[b2_maxPolygonVertices];
 	int32 m_vertexCount;
+
+#ifdef B2_USE_SSE
+	/// The vertices and normals stored by coordinate, so the separating axis test
+	/// can load four of them at once. The lanes past the vertex count repeat the
+	/// last vertex and normal.
+	float32 m_vertexX[b2_polygonLaneCount];
+	float32 m_vertexY[b2_polygonLaneCount];
+	float32 m_normalX[b2_polygonLaneCount];
+	float32 m_normalY[b2_polygonLaneCount];
+#endif
 };
 
 inline int32 b2PolygonShape::GetSupport(const b2Vec2& d) const
@@ -130,4 +150,19 @@ inline const b2Vec2& b2PolygonShape::GetVertex(int32 index) const
 	return m_vertices[index];
 }
 
+inline void b2PolygonShape::UpdateLanes()
+{
+#ifdef B2_USE_SSE
+	b2Assert(0 < m_vertexCount && m_vertexCount <= b2_maxPolygonVertices);
+	for (int32 i = 0; i < b2_polygonLaneCount; ++i)
+	{
+		int32 j = b2Min(i, m_vertexCount - 1);
+		m_vertexX[i] = m_vertices[j].x;
+		m_vertexY[i] = m_vertices[j].y;
+		m_normalX[i] = m_normals[j].x;
+		m_normalY[i] = m_normals[j].y;
+	}
+#endif
+}
+
 #endif
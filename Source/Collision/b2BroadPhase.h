@@ -19,140 +19,257 @@
 #ifndef B2_BROAD_PHASE_H
 #define B2_BROAD_PHASE_H
 
-/*
-This broad phase uses the Sweep and Prune algorithm as described in:
-Collision Detection in Interactive 3D Environments by Gino van den Bergen
-Also, some ideas, such as using integral values for fast compares comes from
-Bullet (http:/www.bulletphysics.com).
-*/
-
 #include "../Common/b2Settings.h"
 #include "b2Collision.h"
 #include "b2PairManager.h"
 #include <climits>
 
-#ifdef TARGET_FLOAT32_IS_FIXED
-#define	B2BROADPHASE_MAX	(USHRT_MAX/2)
-#else
-#define	B2BROADPHASE_MAX	USHRT_MAX
-
-#endif
-
-const uint16 b2_invalid = B2BROADPHASE_MAX;
-const uint16 b2_nullEdge = B2BROADPHASE_MAX;
-struct b2BoundValues;
+typedef float32 (*SortKeyFunc)(void* shape);
 
-struct b2Bound
+/// The available broad-phase algorithms.
+enum b2BroadPhaseType
 {
-	bool IsLower() const { return (value & 1) == 0; }
-	bool IsUpper() const { return (value & 1) == 1; }
-
-	uint16 value;
-	uint16 proxyId;
-	uint16 stabbingCount;
+	e_sweepAndPruneBroadPhase,
+	e_dynamicTreeBroadPhase,
+	e_hashGridBroadPhase,
+	e_regionBroadPhase,
 };
 
-struct b2Proxy
+/// A broad-phase definition is used to choose and configure the broad-phase of a world.
+struct b2BroadPhaseDef
 {
-	uint16 GetNext() const { return lowerBounds[0]; }
-	void SetNext(uint16 next) { lowerBounds[0] = next; }
-	bool IsValid() const { return overlapCount != b2_invalid; }
-
-	uint16 lowerBounds[2], upperBounds[2];
-	uint16 overlapCount;
-	uint16 timeStamp;
-	void* userData;
-};
-
-typedef float32 (*SortKeyFunc)(void* shape);
+	/// The constructor sets the default broad-phase definition values.
+	b2BroadPhaseDef()
+	{
+		type = e_dynamicTreeBroadPhase;
+		worldAABB.lowerBound.Set(-100.0f, -100.0f);
+		worldAABB.upperBound.Set(100.0f, 100.0f);
+		proxyCapacity = b2_proxyPoolSize;
+		wideNodes = false;
+		cellSize = 2.0f;
+		regionSize = 100.0f;
+		batchMoves = false;
+	}
 
-class b2BroadPhase
-{
-public:
-	b2BroadPhase(const b2AABB& worldAABB, b2PairCallback* callback);
-	~b2BroadPhase();
+	/// The broad-phase algorithm.
+	b2BroadPhaseType type;
 
-	// Use this to see if your proxy is in range. If it is not in range,
-	// it should be destroyed. Otherwise you may get O(m^2) pairs, where m
-	// is the number of proxies that are out of range.
-	bool InRange(const b2AABB& aabb) const;
+	/// A bounding box that completely encompasses all your shapes. Proxies
+	/// that leave this box are reported as out of range. The region broad-phase
+	/// has no bounds and ignores this.
+	b2AABB worldAABB;
 
-	// Create and destroy proxies. These call Flush first.
-	uint16 CreateProxy(const b2AABB& aabb, void* userData);
-	void DestroyProxy(int32 proxyId);
+	/// The initial number of proxies. Storage grows as needed, so this is only a hint.
+	int32 proxyCapacity;
 
-	// Call MoveProxy as many times as you like, then when you are done
-	// call Commit to finalized the proxy pairs (for your time step).
-	void MoveProxy(int32 proxyId, const b2AABB& aabb);
-	void Commit();
+	/// Query the dynamic tree through its 4-wide node layout. This speeds up queries
+	/// and ray casts, but the layout is rebuilt on every Commit that changed the tree.
+	/// Only used by the dynamic tree broad-phase.
+	bool wideNodes;
 
-	// Get a single proxy. Returns NULL if the id is invalid.
-	b2Proxy* GetProxy(int32 proxyId);
+	/// The size of a grid cell. This should be about the size of a typical proxy.
+	/// Only used by the hashed grid broad-phase.
+	float32 cellSize;
 
-	// Query an AABB for overlapping proxies, returns the user data and
-	// the count, up to the supplied maximum count.
-	int32 Query(const b2AABB& aabb, void** userData, int32 maxCount);
+	/// The size of a region. Each region is quantized on its own, so this trades
+	/// precision for the number of regions a proxy crosses. Only used by the
+	/// region broad-phase.
+	float32 regionSize;
 
-	// Query a segment for overlapping proxies, returns the user data and
-	// the count, up to the supplied maximum count.
-	// If sortKey is provided, then it is a function mapping from proxy userDatas to distances along the segment (between 0 & 1)
-	// Then the returned proxies are sorted on that, before being truncated to maxCount
-	// The sortKey of a proxy is assumed to be larger than the closest point inside the proxy along the segment, this allows for early exits
-	// Proxies with a negative sortKey are discarded
-	int32 QuerySegment(const b2Segment& segment, void** userData, int32 maxCount, SortKeyFunc sortKey);
+	/// Record moves and sort all bounds at once in Commit, instead of shifting
+	/// the bounds of each moved proxy into place. This is faster when many
+	/// proxies move far every step. Used by the sweep and prune broad-phase and
+	/// by the regions of the region broad-phase.
+	bool batchMoves;
+};
 
-	void Validate();
-	void ValidatePairs();
+/// Receives the proxies found by b2BroadPhase::Query.
+class b2BroadPhaseQueryCallback
+{
+public:
+	virtual ~b2BroadPhaseQueryCallback() {}
 
-private:
-	void ComputeBounds(uint16* lowerValues, uint16* upperValues, const b2AABB& aabb);
+	/// Called for each proxy whose AABB overlaps the query AABB.
+	/// @return false to terminate the query.
+	virtual bool QueryCallback(void* userData) = 0;
+};
 
-	bool TestOverlap(b2Proxy* p1, b2Proxy* p2);
-	bool TestOverlap(const b2BoundValues& b, b2Proxy* p);
+/// Receives the proxies found by b2BroadPhase::QueryNearest.
+class b2BroadPhaseNearestCallback
+{
+public:
+	virtual ~b2BroadPhaseNearestCallback() {}
 
-	void Query(int32* lowerIndex, int32* upperIndex, uint16 lowerValue, uint16 upperValue,
-				b2Bound* bounds, int32 boundCount, int32 axis);
-	void IncrementOverlapCount(int32 proxyId);
-	void IncrementTimeStamp();
-	void AddProxyResult(uint16 proxyId, b2Proxy* proxy, int32 maxCount, SortKeyFunc sortKey);
+	/// Called for each proxy whose AABB is within maxDistance of the query point.
+	/// @return the new search distance. Proxies farther away are skipped. Return
+	/// maxDistance to continue or a negative value to terminate the query.
+	virtual float32 NearestCallback(void* userData, float32 maxDistance) = 0;
+};
 
+/// Receives the proxies hit by b2BroadPhase::RayCast.
+class b2BroadPhaseRayCastCallback
+{
 public:
-	friend class b2PairManager;
+	virtual ~b2BroadPhaseRayCastCallback() {}
 
-	b2PairManager m_pairManager;
+	/// Called for each proxy whose AABB may be hit by the ray. Return 0 to terminate the
+	/// ray-cast, a value less than input.maxFraction to clip the ray, input.maxFraction
+	/// to continue, or a negative value to ignore the proxy.
+	virtual float32 RayCastCallback(const b2RayCastInput& input, void* userData) = 0;
+};
 
-	b2Proxy m_proxyPool[b2_maxProxies];
-	uint16 m_freeProxy;
+/// Receives the proxies hit by b2BroadPhase::RayCastBatch.
+class b2BroadPhaseRayBatchCallback
+{
+public:
+	virtual ~b2BroadPhaseRayBatchCallback() {}
+
+	/// Same as b2BroadPhaseRayCastCallback::RayCastCallback for the ray at rayIndex in the batch.
+	virtual float32 RayCastCallback(const b2RayCastInput& input, void* userData, int32 rayIndex) = 0;
+};
 
-	b2Bound m_bounds[2][2*b2_maxProxies];
+/// The broad-phase finds pairs of proxies with overlapping AABBs and reports
+/// them through the pair manager callback. The world only talks to the broad-phase
+/// through this interface, so the algorithm can be chosen per world.
+///
+/// The queries do not write to the broad-phase. Once the pending moves are committed
+/// they may run concurrently with each other, but not with proxy updates.
+class b2BroadPhase
+{
+public:
+	/// Create a broad-phase of the type given by the definition.
+	static b2BroadPhase* Create(const b2BroadPhaseDef* def, b2PairCallback* callback);
+
+	/// Destroy a broad-phase created with Create.
+	static void Destroy(b2BroadPhase* broadPhase);
+
+	b2BroadPhase(const b2AABB& worldAABB, b2PairCallback* callback, int32 proxyCapacity);
+	virtual ~b2BroadPhase() {}
+
+	/// Use this to see if your proxy is in range. If it is not in range,
+	/// it should be destroyed. Otherwise you may get O(m^2) pairs, where m
+	/// is the number of proxies that are out of range.
+	virtual bool InRange(const b2AABB& aabb) const;
+
+	/// Create a proxy. Pairs with the new proxy may be reported immediately or
+	/// during the next Commit.
+	/// @param isStatic marks a proxy that does not move, such as the proxy of a static
+	/// or sleeping body. Pairs between two static proxies are never reported by
+	/// broad-phases that keep static proxies apart.
+	virtual uint32 CreateProxy(const b2AABB& aabb, void* userData, bool isStatic) = 0;
+
+	/// Create many proxies at once. Implementations may build their storage in
+	/// one pass, which is much faster than creating the proxies one at a time.
+	/// @param proxyIds receives the ids of the new proxies.
+	virtual void CreateProxies(const b2AABB* aabbs, void** userData, int32 count, uint32* proxyIds, bool isStatic);
+
+	/// Destroy a proxy. All pairs with this proxy are removed before this returns.
+	virtual void DestroyProxy(uint32 proxyId) = 0;
+
+	/// Call MoveProxy as many times as you like, then when you are done
+	/// call Commit to finalized the proxy pairs (for your time step).
+	virtual void MoveProxy(uint32 proxyId, const b2AABB& aabb) = 0;
+	virtual void Commit() = 0;
+
+	/// Mark a proxy as static or moving. Call this when a body goes to sleep, wakes
+	/// up, or changes between static and dynamic. Existing pairs are kept.
+	virtual void SetProxyStatic(uint32 proxyId, bool isStatic) { B2_NOT_USED(proxyId); B2_NOT_USED(isStatic); }
+
+	/// Get the user data of a live proxy.
+	virtual void* GetUserData(uint32 proxyId) const = 0;
+
+	/// Get the AABB the broad-phase uses for a proxy. This contains the AABB
+	/// provided by the client.
+	virtual b2AABB GetFatAABB(uint32 proxyId) const = 0;
+
+	/// Test the AABBs of two live proxies for overlap.
+	virtual bool TestOverlap(uint32 proxyId1, uint32 proxyId2) const = 0;
+
+	/// Query an AABB for overlapping proxies, returns the user data and
+	/// the count, up to the supplied maximum count.
+	virtual int32 Query(const b2AABB& aabb, void** userData, int32 maxCount) = 0;
+
+	/// Query an AABB for overlapping proxies and report them to the callback as they
+	/// are found. There is no result cap and nothing is copied. The default gathers
+	/// the proxies with the array Query.
+	virtual void Query(b2BroadPhaseQueryCallback* callback, const b2AABB& aabb);
+
+	/// Query a segment for overlapping proxies, returns the user data and
+	/// the count, up to the supplied maximum count.
+	/// If sortKey is provided, then it is a function mapping from proxy userDatas to distances along the segment (between 0 & 1)
+	/// Then the returned proxies are sorted on that, before being truncated to maxCount
+	/// The sortKey of a proxy is assumed to be larger than the closest point inside the proxy along the segment, this allows for early exits
+	/// Proxies with a negative sortKey are discarded
+	virtual int32 QuerySegment(const b2Segment& segment, void** userData, int32 maxCount, SortKeyFunc sortKey) = 0;
+
+	/// Find the proxies near a point. The tree broad-phase visits the proxies nearest
+	/// AABB first and skips every node that is farther away than the search distance
+	/// returned by the callback. The default queries the box around the point in no
+	/// particular order, so keep maxDistance finite for the other broad-phases.
+	virtual void QueryNearest(b2BroadPhaseNearestCallback* callback, const b2Vec2& point, float32 maxDistance);
+
+	/// Ray-cast against the proxies. The callback is called for every proxy the ray
+	/// may hit, with the ray clipped by the earlier callbacks. There is no result cap.
+	/// The default gathers the candidates with QuerySegment and cannot skip
+	/// proxies beyond the clipped ray.
+	/// @param input the ray extends from p1 to p1 + maxFraction * (p2 - p1).
+	virtual void RayCast(b2BroadPhaseRayCastCallback* callback, const b2RayCastInput& input);
+
+	/// Sweep a box with the given half-extents along the ray. The callback gets the ray
+	/// of the box center, with the same return values as for RayCast. A zero translation
+	/// makes this an AABB query. The default queries the AABB of the whole sweep and
+	/// cannot skip proxies beyond the clipped ray.
+	virtual void BoxCast(b2BroadPhaseRayCastCallback* callback, const b2RayCastInput& input, const b2Vec2& extents);
+
+	/// Ray-cast many rays. Rays with a max fraction of zero are skipped. The default
+	/// casts the rays one at a time.
+	virtual void RayCastBatch(b2BroadPhaseRayBatchCallback* callback, const b2RayCastInput* inputs, int32 count);
+
+	/// Perform validation of internal data structures.
+	virtual void Validate() {}
+
+	/// Get the number of proxies that fit before the storage must grow.
+	virtual int32 GetProxyCapacity() const = 0;
+
+	/// Get the number of live proxies.
+	int32 GetProxyCount() const;
+
+	/// Get the number of live pairs.
+	int32 GetPairCount() const;
+
+	/// Get the world bounding box used for range checks.
+	const b2AABB& GetWorldAABB() const;
+
+	/// Get the broad-phase algorithm.
+	b2BroadPhaseType GetType() const;
 
-	uint16 m_queryResults[b2_maxProxies];
-	float32 m_querySortKeys[b2_maxProxies];
-	int32 m_queryResultCount;
+	b2PairManager m_pairManager;
 
 	b2AABB m_worldAABB;
-	b2Vec2 m_quantizationFactor;
 	int32 m_proxyCount;
-	uint16 m_timeStamp;
+	b2BroadPhaseType m_type;
 
 	static bool s_validate;
 };
 
+inline int32 b2BroadPhase::GetProxyCount() const
+{
+	return m_proxyCount;
+}
 
-inline bool b2BroadPhase::InRange(const b2AABB& aabb) const
+inline int32 b2BroadPhase::GetPairCount() const
 {
-	b2Vec2 d = b2Max(aabb.lowerBound - m_worldAABB.upperBound, m_worldAABB.lowerBound - aabb.upperBound);
-	return b2Max(d.x, d.y) < 0.0f;
+	return m_pairManager.GetPairCount();
 }
 
-inline b2Proxy* b2BroadPhase::GetProxy(int32 proxyId)
+inline const b2AABB& b2BroadPhase::GetWorldAABB() const
 {
-	if (proxyId == b2_nullProxy || m_proxyPool[proxyId].IsValid() == false)
-	{
-		return NULL;
-	}
+	return m_worldAABB;
+}
 
-	return m_proxyPool + proxyId;
+inline b2BroadPhaseType b2BroadPhase::GetType() const
+{
+	return m_type;
 }
 
 #endif
@@ -19,6 +19,10 @@
 #include "b2Collision.h"
 #include "Shapes/b2PolygonShape.h"
 
+#ifdef B2_USE_SSE
+#include <xmmintrin.h>
+#endif
+
 // Find the separation between poly1 and poly2 for a give edge normal on poly1.
 static float32 b2EdgeSeparation(const b2PolygonShape* poly1, const b2XForm& xf1, int32 edge1,
 							  const b2PolygonShape* poly2, const b2XForm& xf2)
@@ -56,6 +60,115 @@ static float32 b2EdgeSeparation(const b2PolygonShape* poly1, const b2XForm& xf1,
 	return separation;
 }
 
+#ifndef B2_USE_SSE
+
+// Check that neither neighbor of an edge has a larger separation. This is the
+// local test the hill climb relies on, used to confirm a cached edge.
+static bool b2IsBestEdge(const b2PolygonShape* poly1, const b2XForm& xf1, int32 edge1, float32 separation,
+						 const b2PolygonShape* poly2, const b2XForm& xf2)
+{
+	int32 count1 = poly1->m_vertexCount;
+
+	int32 prevEdge = edge1 - 1 >= 0 ? edge1 - 1 : count1 - 1;
+	if (b2EdgeSeparation(poly1, xf1, prevEdge, poly2, xf2) > separation)
+	{
+		return false;
+	}
+
+	int32 nextEdge = edge1 + 1 < count1 ? edge1 + 1 : 0;
+	return b2EdgeSeparation(poly1, xf1, nextEdge, poly2, xf2) <= separation;
+}
+
+#endif
+
+#ifdef B2_USE_SSE
+
+// Lower the minimum projections of four edge normals by a vertex broadcast to all lanes.
+inline __m128 b2MinProjection(__m128 minDot, __m128 nx, __m128 ny, __m128 x, __m128 y)
+{
+	return _mm_min_ps(minDot, _mm_add_ps(_mm_mul_ps(nx, x), _mm_mul_ps(ny, y)));
+}
+
+// Find the max separation between poly1 and poly2 using edge normals from poly1.
+// The vertices of poly2 are moved into the frame of poly1, then every edge normal
+// is tested against every vertex, four normals per SSE register. This is cheaper
+// than the scalar hill climb, which tests one edge at a time.
+static float32 b2FindMaxSeparation(int32* edgeIndex,
+								 const b2PolygonShape* poly1, const b2XForm& xf1,
+								 const b2PolygonShape* poly2, const b2XForm& xf2)
+{
+	int32 count1 = poly1->m_vertexCount;
+	int32 count2 = poly2->m_vertexCount;
+
+	// The transform from the frame of poly2 into the frame of poly1.
+	b2Mat22 R = b2MulT(xf1.R, xf2.R);
+	b2Vec2 p = b2MulT(xf1.R, xf2.position - xf1.position);
+
+	__m128 r11 = _mm_set1_ps(R.col1.x), r21 = _mm_set1_ps(R.col1.y);
+	__m128 r12 = _mm_set1_ps(R.col2.x), r22 = _mm_set1_ps(R.col2.y);
+	__m128 px = _mm_set1_ps(p.x), py = _mm_set1_ps(p.y);
+
+	// The padding lanes repeat the last vertex, so they do not change the minimum.
+	__m128 x2[b2_polygonLaneCount / 4];
+	__m128 y2[b2_polygonLaneCount / 4];
+	int32 blockCount2 = (count2 + 3) >> 2;
+	for (int32 j = 0; j < blockCount2; ++j)
+	{
+		__m128 vx = _mm_loadu_ps(poly2->m_vertexX + 4 * j);
+		__m128 vy = _mm_loadu_ps(poly2->m_vertexY + 4 * j);
+		x2[j] = _mm_add_ps(px, _mm_add_ps(_mm_mul_ps(r11, vx), _mm_mul_ps(r12, vy)));
+		y2[j] = _mm_add_ps(py, _mm_add_ps(_mm_mul_ps(r21, vx), _mm_mul_ps(r22, vy)));
+	}
+
+	// Polygons have at least two vertices (b2CollidePolyAndEdge passes an edge
+	// as a two vertex polygon), so the first block is always stored and the
+	// reduction below only reads stored lanes.
+	b2Assert(count1 >= 2);
+
+	float32 separations[b2_polygonLaneCount];
+	int32 i = 0;
+	do
+	{
+		__m128 nx = _mm_loadu_ps(poly1->m_normalX + i);
+		__m128 ny = _mm_loadu_ps(poly1->m_normalY + i);
+		__m128 vx = _mm_loadu_ps(poly1->m_vertexX + i);
+		__m128 vy = _mm_loadu_ps(poly1->m_vertexY + i);
+		__m128 offset = _mm_add_ps(_mm_mul_ps(nx, vx), _mm_mul_ps(ny, vy));
+
+		// Project the support vertex of poly2 for -normal.
+		__m128 minDot = _mm_set1_ps(B2_FLT_MAX);
+		for (int32 j = 0; j < blockCount2; ++j)
+		{
+			__m128 x = x2[j];
+			__m128 y = y2[j];
+			minDot = b2MinProjection(minDot, nx, ny, _mm_shuffle_ps(x, x, _MM_SHUFFLE(0, 0, 0, 0)), _mm_shuffle_ps(y, y, _MM_SHUFFLE(0, 0, 0, 0)));
+			minDot = b2MinProjection(minDot, nx, ny, _mm_shuffle_ps(x, x, _MM_SHUFFLE(1, 1, 1, 1)), _mm_shuffle_ps(y, y, _MM_SHUFFLE(1, 1, 1, 1)));
+			minDot = b2MinProjection(minDot, nx, ny, _mm_shuffle_ps(x, x, _MM_SHUFFLE(2, 2, 2, 2)), _mm_shuffle_ps(y, y, _MM_SHUFFLE(2, 2, 2, 2)));
+			minDot = b2MinProjection(minDot, nx, ny, _mm_shuffle_ps(x, x, _MM_SHUFFLE(3, 3, 3, 3)), _mm_shuffle_ps(y, y, _MM_SHUFFLE(3, 3, 3, 3)));
+		}
+
+		_mm_storeu_ps(separations + i, _mm_sub_ps(minDot, offset));
+		i += 4;
+	}
+	while (i < count1);
+
+	int32 bestEdge = 0;
+	float32 maxSeparation = separations[0];
+	for (i = 1; i < count1; ++i)
+	{
+		if (separations[i] > maxSeparation)
+		{
+			bestEdge = i;
+			maxSeparation = separations[i];
+		}
+	}
+
+	*edgeIndex = bestEdge;
+	return maxSeparation;
+}
+
+#else
+
 // Find the max separation between poly1 and poly2 using edge normals from poly1.
 static float32 b2FindMaxSeparation(int32* edgeIndex,
 								 const b2PolygonShape* poly1, const b2XForm& xf1,
@@ -139,6 +252,8 @@ static float32 b2FindMaxSeparation(int32* edgeIndex,
 	return bestSeparation;
 }
 
+#endif
+
 static void b2FindIncidentEdge(b2ClipVertex c[2],
 							 const b2PolygonShape* poly1, const b2XForm& xf1, int32 edge1,
 							 const b2PolygonShape* poly2, const b2XForm& xf2)
@@ -192,20 +307,85 @@ static void b2FindIncidentEdge(b2ClipVertex c[2],
 // The normal points from 1 to 2
 void b2CollidePolygons(b2Manifold* manifold,
 					  const b2PolygonShape* polyA, const b2XForm& xfA,
-					  const b2PolygonShape* polyB, const b2XForm& xfB)
+					  const b2PolygonShape* polyB, const b2XForm& xfB,
+					  b2SeparationCache* cache)
 {
 	manifold->m_pointCount = 0;
 	float32 totalRadius = polyA->m_radius + polyB->m_radius;
 
 	int32 edgeA = 0;
-	float32 separationA = b2FindMaxSeparation(&edgeA, polyA, xfA, polyB, xfB);
-	if (separationA > totalRadius)
-		return;
-
 	int32 edgeB = 0;
-	float32 separationB = b2FindMaxSeparation(&edgeB, polyB, xfB, polyA, xfA);
-	if (separationB > totalRadius)
-		return;
+	float32 separationA = 0.0f;
+	float32 separationB = 0.0f;
+	bool cached = false;
+
+	if (cache != NULL && cache->count > 0 &&
+		cache->edgeA < polyA->m_vertexCount && cache->edgeB < polyB->m_vertexCount)
+	{
+		edgeA = cache->edgeA;
+		edgeB = cache->edgeB;
+
+#ifdef B2_USE_SSE
+		// The SIMD search of a touching pair costs less than confirming its cached
+		// edges, so only pairs that were separated try the cache.
+		bool testEdges = cache->separation > totalRadius;
+#else
+		bool testEdges = true;
+#endif
+
+		if (testEdges)
+		{
+			// Any separating edge proves there is no contact, so a cached edge that
+			// still separates ends the test without checking its neighbors.
+			separationA = b2EdgeSeparation(polyA, xfA, edgeA, polyB, xfB);
+			if (separationA > totalRadius)
+			{
+				cache->separation = separationA;
+				return;
+			}
+
+			separationB = b2EdgeSeparation(polyB, xfB, edgeB, polyA, xfA);
+			if (separationB > totalRadius)
+			{
+				cache->separation = separationB;
+				return;
+			}
+
+#ifndef B2_USE_SSE
+			cached = b2IsBestEdge(polyA, xfA, edgeA, separationA, polyB, xfB) &&
+					 b2IsBestEdge(polyB, xfB, edgeB, separationB, polyA, xfA);
+			if (cached)
+			{
+				cache->separation = b2Max(separationA, separationB);
+			}
+#endif
+		}
+	}
+
+	if (cached == false)
+	{
+		separationA = b2FindMaxSeparation(&edgeA, polyA, xfA, polyB, xfB);
+		if (cache != NULL)
+		{
+			cache->count = 1;
+			cache->edgeA = (uint8)edgeA;
+			cache->edgeB = (uint8)edgeB;
+			cache->separation = separationA;
+		}
+
+		if (separationA > totalRadius)
+			return;
+
+		separationB = b2FindMaxSeparation(&edgeB, polyB, xfB, polyA, xfA);
+		if (cache != NULL)
+		{
+			cache->edgeB = (uint8)edgeB;
+			cache->separation = b2Max(separationA, separationB);
+		}
+
+		if (separationB > totalRadius)
+			return;
+	}
 
 	const b2PolygonShape* poly1;	// reference polygon
 	const b2PolygonShape* poly2;	// incident polygon
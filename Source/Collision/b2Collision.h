@@ -176,6 +176,14 @@ struct b2AABB
 		return 0.5f * (upperBound - lowerBound);
 	}
 
+	/// Get the perimeter length.
+	float32 GetPerimeter() const
+	{
+		float32 wx = upperBound.x - lowerBound.x;
+		float32 wy = upperBound.y - lowerBound.y;
+		return 2.0f * (wx + wy);
+	}
+
 	/// Combine two AABBs into this one.
 	void Combine(const b2AABB& aabb1, const b2AABB& aabb2)
 	{
@@ -184,7 +192,7 @@ struct b2AABB
 	}
 
 	/// Does this aabb contain the provided AABB.
-	bool Contains(const b2AABB& aabb)
+	bool Contains(const b2AABB& aabb) const
 	{
 		bool result = true;
 		result = result && lowerBound.x <= aabb.lowerBound.x;
@@ -210,10 +218,24 @@ void b2CollidePolygonAndCircle(b2Manifold* manifold,
 							   const b2PolygonShape* polygon, const b2XForm& xf1,
 							   const b2CircleShape* circle, const b2XForm& xf2);
 
+/// Used to warm start b2CollidePolygons with the edges of max separation of the
+/// last call. Set count to zero on first call.
+struct b2SeparationCache
+{
+	float32 separation;	///< the max separation found by the last call
+	uint16 count;		///< zero while the edges are unknown
+	uint8 edgeA;		///< the edge of max separation on polygon A
+	uint8 edgeB;		///< the edge of max separation on polygon B
+};
+
 /// Compute the collision manifold between two polygons.
+/// @param cache optional. A cached edge that still separates the polygons ends the
+/// test. Without SSE the cached edges of touching polygons are also kept while no
+/// neighbor edge beats them. Otherwise the full search runs and refreshes the cache.
 void b2CollidePolygons(b2Manifold* manifold,
 					   const b2PolygonShape* polygon1, const b2XForm& xf1,
-					   const b2PolygonShape* polygon2, const b2XForm& xf2);
+					   const b2PolygonShape* polygon2, const b2XForm& xf2,
+					   b2SeparationCache* cache = NULL);
 
 /// Compute the collision manifold between an edge and a circle.
 void b2CollideEdgeAndCircle(b2Manifold* manifold,
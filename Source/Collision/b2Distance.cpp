@@ -98,6 +98,38 @@ struct b2Simplex
 		}
 	}
 
+	// The direction from the simplex toward the origin. For a segment this is
+	// the edge normal, which keeps its sign when the origin is almost on the
+	// segment, unlike the closest point.
+	b2Vec2 GetSearchDirection() const
+	{
+		switch (m_count)
+		{
+		case 1:
+			return -m_v1.w;
+
+		case 2:
+			{
+				b2Vec2 e12 = m_v2.w - m_v1.w;
+				float32 sgn = b2Cross(e12, -m_v1.w);
+				if (sgn > 0.0f)
+				{
+					// Origin is left of e12.
+					return b2Cross(1.0f, e12);
+				}
+				else
+				{
+					// Origin is right of e12.
+					return b2Cross(e12, 1.0f);
+				}
+			}
+
+		default:
+			b2Assert(false);
+			return b2Vec2_zero;
+		}
+	}
+
 	b2Vec2 GetClosestPoint() const
 	{
 		switch (m_count)
@@ -410,12 +442,10 @@ void b2Distance(b2DistanceOutput* output,
 			break;
 		}
 
-		// Compute closest point.
-		b2Vec2 p = simplex.GetClosestPoint();
-		float32 distanceSqr = p.LengthSquared();
+		b2Vec2 d = simplex.GetSearchDirection();
 
 		// Ensure the search direction is numerically fit.
-		if (distanceSqr < B2_FLT_EPSILON * B2_FLT_EPSILON)
+		if (d.LengthSquared() < B2_FLT_EPSILON * B2_FLT_EPSILON)
 		{
 			// The origin is probably contained by a line segment
 			// or triangle. Thus the shapes are overlapped.
@@ -428,27 +458,17 @@ void b2Distance(b2DistanceOutput* output,
 
 		// Compute a tentative new simplex vertex using support points.
 		b2SimplexVertex* vertex = vertices + simplex.m_count;
-		vertex->indexA = shapeA->GetSupport(b2MulT(transformA.R, p));
+		vertex->indexA = shapeA->GetSupport(b2MulT(transformA.R, -d));
 		vertex->wA = b2Mul(transformA, shapeA->GetVertex(vertex->indexA));
-		b2Vec2 wBLocal;
-		vertex->indexB = shapeB->GetSupport(b2MulT(transformB.R, -p));
+		vertex->indexB = shapeB->GetSupport(b2MulT(transformB.R, d));
 		vertex->wB = b2Mul(transformB, shapeB->GetVertex(vertex->indexB));
 		vertex->w = vertex->wB - vertex->wA;
 
 		// Iteration count is equated to the number of support point calls.
 		++iter;
 
-		// Check for convergence.
-		float32 lowerBound = b2Dot(p, vertex->w);
-		float32 upperBound = distanceSqr;
-		const float32 k_relativeTolSqr = 0.01f * 0.01f;	// 1:100
-		if (upperBound - lowerBound <= k_relativeTolSqr * upperBound)
-		{
-			// Converged!
-			break;
-		}
-
-		// Check for duplicate support points.
+		// Check for duplicate support points. This is the main termination
+		// criterion, since the search direction gives no distance bound.
 		bool duplicate = false;
 		for (int32 i = 0; i < lastCount; ++i)
 		{
@@ -20,90 +20,112 @@
 
 #include <string.h>
 #include <float.h>
+#include <algorithm>
 
-b2DynamicTree::b2DynamicTree()
+b2DynamicTree::b2DynamicTree(int32 nodeCapacity)
 {
 	m_root = b2_nullNode;
-	m_nodeCount = b2Max(b2_nodePoolSize, 1);
-	m_nodes = (b2DynamicTreeNode*)b2Alloc(m_nodeCount * sizeof(b2DynamicTreeNode));
-	memset(m_nodes, 0, m_nodeCount * sizeof(b2DynamicTreeNode));
+	m_nodeCount = 0;
+	m_nodeCapacity = b2Max(nodeCapacity, 1);
+	m_nodes = (b2DynamicTreeNode*)b2Alloc(m_nodeCapacity * sizeof(b2DynamicTreeNode));
+	memset(m_nodes, 0, m_nodeCapacity * sizeof(b2DynamicTreeNode));
 
 	// Build a linked list for the free list. The parent
 	// pointer becomes the "next" pointer.
-	for (int32 i = 0; i < m_nodeCount - 1; ++i)
+	for (int32 i = 0; i < m_nodeCapacity - 1; ++i)
 	{
-		m_nodes[i].parent = uint16(i + 1);
+		m_nodes[i].parent = uint32(i + 1);
+		m_nodes[i].height = -1;
 	}
-	m_nodes[m_nodeCount-1].parent = b2_nullNode;
+	m_nodes[m_nodeCapacity-1].parent = b2_nullNode;
+	m_nodes[m_nodeCapacity-1].height = -1;
 	m_freeList = 0;
 
 	m_path = 0;
+
+	m_wideNodes = NULL;
+	m_wideNodeCount = 0;
+	m_wideNodeCapacity = 0;
+	m_wideEnabled = false;
 }
 
 b2DynamicTree::~b2DynamicTree()
 {
 	// This frees the entire tree in one shot.
 	b2Free(m_nodes);
+	b2Free(m_wideNodes);
 }
 
 // Allocate a node from the pool. Grow the pool if necessary.
-uint16 b2DynamicTree::AllocateNode()
+uint32 b2DynamicTree::AllocateNode()
 {
 	// Peel a node off the free list.
 	if (m_freeList != b2_nullNode)
 	{
-		uint16 node = m_freeList;
+		uint32 node = m_freeList;
 		m_freeList = m_nodes[node].parent;
 		m_nodes[node].parent = b2_nullNode;
 		m_nodes[node].child1 = b2_nullNode;
 		m_nodes[node].child2 = b2_nullNode;
+		m_nodes[node].height = 0;
+		++m_nodeCount;
 		return node;
 	}
 
 	// The free list is empty. Rebuild a bigger pool.
-	int32 newPoolCount = b2Min(2 * m_nodeCount, USHRT_MAX - 1);
-	b2Assert(newPoolCount > m_nodeCount);
+	b2Assert(m_nodeCapacity <= INT_MAX / 2);
+	int32 newPoolCount = 2 * m_nodeCapacity;
 	b2DynamicTreeNode* newPool = (b2DynamicTreeNode*)b2Alloc(newPoolCount * sizeof(b2DynamicTreeNode));
-	memcpy(newPool, m_nodes, m_nodeCount * sizeof(b2DynamicTreeNode));
-	memset(newPool + m_nodeCount, 0, (newPoolCount - m_nodeCount) * sizeof(b2DynamicTreeNode));
+	memcpy(newPool, m_nodes, m_nodeCapacity * sizeof(b2DynamicTreeNode));
+	memset(newPool + m_nodeCapacity, 0, (newPoolCount - m_nodeCapacity) * sizeof(b2DynamicTreeNode));
 
 	// Build a linked list for the free list. The parent
 	// pointer becomes the "next" pointer.
-	for (int32 i = m_nodeCount; i < newPoolCount - 1; ++i)
+	for (int32 i = m_nodeCapacity; i < newPoolCount - 1; ++i)
 	{
-		newPool[i].parent = uint16(i + 1);
+		newPool[i].parent = uint32(i + 1);
+		newPool[i].height = -1;
 	}
 	newPool[newPoolCount-1].parent = b2_nullNode;
-	m_freeList = uint16(m_nodeCount);
+	newPool[newPoolCount-1].height = -1;
+	m_freeList = uint32(m_nodeCapacity);
 
 	b2Free(m_nodes);
 	m_nodes = newPool;
-	m_nodeCount = newPoolCount;
+	m_nodeCapacity = newPoolCount;
 
 	// Finally peel a node off the new free list.
-	uint16 node = m_freeList;
+	uint32 node = m_freeList;
 	m_freeList = m_nodes[node].parent;
+	m_nodes[node].parent = b2_nullNode;
+	m_nodes[node].child1 = b2_nullNode;
+	m_nodes[node].child2 = b2_nullNode;
+	m_nodes[node].height = 0;
+	++m_nodeCount;
 	return node;
 }
 
 // Return a node to the pool.
-void b2DynamicTree::FreeNode(uint16 node)
+void b2DynamicTree::FreeNode(uint32 node)
 {
-	b2Assert(node < USHRT_MAX);
+	b2Assert(node < uint32(m_nodeCapacity));
 	m_nodes[node].parent = m_freeList;
+	m_nodes[node].userData = NULL;
+	m_nodes[node].height = -1;
 	m_freeList = node;
+	--m_nodeCount;
 }
 
 // Create a proxy in the tree as a leaf node. We return the index
 // of the node instead of a pointer so that we can grow
 // the node pool.
-uint16 b2DynamicTree::CreateProxy(const b2AABB& aabb, void* userData)
+uint32 b2DynamicTree::CreateProxy(const b2AABB& aabb, void* userData)
 {
-	uint16 node = AllocateNode();
+	uint32 node = AllocateNode();
 
 	// Fatten the aabb.
 	b2Vec2 center = aabb.GetCenter();
-	b2Vec2 extents = b2_fatAABBFactor * aabb.GetExtents();
+	b2Vec2 extents = aabb.GetExtents() + b2Vec2(b2_aabbExtension, b2_aabbExtension);
 	m_nodes[node].aabb.lowerBound = center - extents;
 	m_nodes[node].aabb.upperBound = center + extents;
 	m_nodes[node].userData = userData;
@@ -113,187 +135,714 @@ uint16 b2DynamicTree::CreateProxy(const b2AABB& aabb, void* userData)
 	return node;
 }
 
-void b2DynamicTree::DestroyProxy(uint16 proxyId)
+void b2DynamicTree::CreateProxies(const b2AABB* aabbs, void** userData, int32 count, uint32* proxyIds)
 {
-	b2Assert(proxyId < m_nodeCount);
-	b2Assert(m_nodes[proxyId].IsLeaf());
+	if (count <= 0)
+	{
+		return;
+	}
 
-	RemoveLeaf(proxyId);
-	FreeNode(proxyId);
-}
+	int32 oldProxyCount = GetProxyCount();
 
-void b2DynamicTree::MoveProxy(uint16 proxyId, const b2AABB& aabb)
-{
-	b2Assert(proxyId < m_nodeCount);
+	for (int32 i = 0; i < count; ++i)
+	{
+		uint32 node = AllocateNode();
 
-	b2Assert(m_nodes[proxyId].IsLeaf());
+		// Fatten the aabb.
+		b2Vec2 center = aabbs[i].GetCenter();
+		b2Vec2 extents = aabbs[i].GetExtents() + b2Vec2(b2_aabbExtension, b2_aabbExtension);
+		m_nodes[node].aabb.lowerBound = center - extents;
+		m_nodes[node].aabb.upperBound = center + extents;
+		m_nodes[node].userData = userData[i];
 
-	if (m_nodes[proxyId].aabb.Contains(aabb))
+		proxyIds[i] = node;
+	}
+
+	if (count >= oldProxyCount)
+	{
+		// The batch dominates the tree, so build the whole tree from scratch.
+		RebuildTopDown();
+	}
+	else
+	{
+		// Small batches go through the incremental path.
+		for (int32 i = 0; i < count; ++i)
+		{
+			InsertLeaf(proxyIds[i]);
+		}
+	}
+}
+
+void b2DynamicTree::RebuildTopDown()
+{
+	if (m_nodeCount == 0)
 	{
 		return;
 	}
 
-	RemoveLeaf(proxyId);
+	// Gather the leafs and free the internal nodes.
+	uint32* leaves = (uint32*)b2Alloc(m_nodeCount * sizeof(uint32));
+	int32 leafCount = 0;
+	for (int32 i = 0; i < m_nodeCapacity; ++i)
+	{
+		if (m_nodes[i].height < 0)
+		{
+			// Free node in pool
+			continue;
+		}
 
-	b2Vec2 center = aabb.GetCenter();
-	b2Vec2 extents = b2_fatAABBFactor * aabb.GetExtents();
+		if (m_nodes[i].IsLeaf())
+		{
+			m_nodes[i].parent = b2_nullNode;
+			leaves[leafCount++] = uint32(i);
+		}
+		else
+		{
+			FreeNode(uint32(i));
+		}
+	}
 
-	m_nodes[proxyId].aabb.lowerBound = center - extents;
-	m_nodes[proxyId].aabb.upperBound = center + extents;
+	m_root = BuildTopDown(leaves, leafCount, 0);
+	m_nodes[m_root].parent = b2_nullNode;
 
-	InsertLeaf(proxyId);
+	b2Free(leaves);
+
+	m_wideNodeCount = 0;
+	Collapse();
 }
 
-void* b2DynamicTree::GetProxy(uint16 proxyId)
+void b2DynamicTree::SetWideNodes(bool flag)
 {
-	if (proxyId < m_nodeCount)
-	{
-		return m_nodes[proxyId].userData;
-	}
-	else
+	m_wideEnabled = flag;
+
+	if (flag == false)
 	{
-		return NULL;
+		b2Free(m_wideNodes);
+		m_wideNodes = NULL;
+		m_wideNodeCount = 0;
+		m_wideNodeCapacity = 0;
 	}
 }
 
-void b2DynamicTree::InsertLeaf(uint16 leaf)
+void b2DynamicTree::Collapse()
 {
-	if (m_root == b2_nullNode)
+	if (m_wideEnabled == false || m_wideNodeCount > 0 || m_root == b2_nullNode)
 	{
-		m_root = leaf;
-		m_nodes[m_root].parent = b2_nullNode;
 		return;
 	}
 
-	// Find the best sibling for this node.
-	b2Vec2 center = m_nodes[leaf].aabb.GetCenter();
-	uint16 sibling = m_root;
-	if (m_nodes[sibling].IsLeaf() == false)
+	if (m_nodes[m_root].IsLeaf() == false)
+	{
+		CollapseNode(m_root);
+		return;
+	}
+
+	// A single leaf still needs a wide root.
+	uint32 wideIndex = AllocateWideNode();
+	b2WideNode* wideNode = m_wideNodes + wideIndex;
+	const b2AABB& aabb = m_nodes[m_root].aabb;
+	wideNode->lowerX[0] = aabb.lowerBound.x;
+	wideNode->lowerY[0] = aabb.lowerBound.y;
+	wideNode->upperX[0] = aabb.upperBound.x;
+	wideNode->upperY[0] = aabb.upperBound.y;
+	wideNode->children[0] = m_root | b2_wideLeafFlag;
+}
+
+// Allocate a wide node with all slots empty. This may move the wide nodes.
+uint32 b2DynamicTree::AllocateWideNode()
+{
+	if (m_wideNodeCount == m_wideNodeCapacity)
 	{
-		do 
+		b2WideNode* oldNodes = m_wideNodes;
+		m_wideNodeCapacity = b2Max(2 * m_wideNodeCapacity, 16);
+		m_wideNodes = (b2WideNode*)b2Alloc(m_wideNodeCapacity * sizeof(b2WideNode));
+		if (oldNodes)
 		{
-			uint16 child1 = m_nodes[sibling].child1;
-			uint16 child2 = m_nodes[sibling].child2;
+			memcpy(m_wideNodes, oldNodes, m_wideNodeCount * sizeof(b2WideNode));
+			b2Free(oldNodes);
+		}
+	}
+
+	uint32 index = uint32(m_wideNodeCount);
+	++m_wideNodeCount;
+
+	b2WideNode* node = m_wideNodes + index;
+	for (int32 i = 0; i < 4; ++i)
+	{
+		node->lowerX[i] = B2_FLT_MAX;
+		node->lowerY[i] = B2_FLT_MAX;
+		node->upperX[i] = -B2_FLT_MAX;
+		node->upperY[i] = -B2_FLT_MAX;
+		node->children[i] = b2_nullNode;
+	}
+
+	return index;
+}
 
-			b2Vec2 delta1 = b2Abs(m_nodes[child1].aabb.GetCenter() - center);
-			b2Vec2 delta2 = b2Abs(m_nodes[child2].aabb.GetCenter() - center);
+// Collapse the binary subtree at index into wide nodes. The binary nodes closest
+// to the top are opened until four children are gathered, biggest first.
+uint32 b2DynamicTree::CollapseNode(uint32 index)
+{
+	b2Assert(m_nodes[index].IsLeaf() == false);
+
+	uint32 wideIndex = AllocateWideNode();
 
-			float32 norm1 = delta1.x + delta1.y;
-			float32 norm2 = delta2.x + delta2.y;
+	uint32 slots[4];
+	slots[0] = m_nodes[index].child1;
+	slots[1] = m_nodes[index].child2;
+	int32 count = 2;
 
-			if (norm1 < norm2)
+	while (count < 4)
+	{
+		int32 best = -1;
+		float32 bestArea = 0.0f;
+		for (int32 i = 0; i < count; ++i)
+		{
+			if (m_nodes[slots[i]].IsLeaf())
 			{
-				sibling = child1;
+				continue;
 			}
-			else
+
+			float32 area = m_nodes[slots[i]].aabb.GetPerimeter();
+			if (best == -1 || area > bestArea)
 			{
-				sibling = child2;
+				best = i;
+				bestArea = area;
 			}
+		}
+
+		if (best == -1)
+		{
+			break;
+		}
 
+		uint32 node = slots[best];
+		slots[best] = m_nodes[node].child1;
+		slots[count] = m_nodes[node].child2;
+		++count;
+	}
+
+	for (int32 i = 0; i < count; ++i)
+	{
+		uint32 child = slots[i] | b2_wideLeafFlag;
+		if (m_nodes[slots[i]].IsLeaf() == false)
+		{
+			child = CollapseNode(slots[i]);
 		}
-		while(m_nodes[sibling].IsLeaf() == false);
+
+		// Collapsing the child may have moved the wide nodes.
+		b2WideNode* wideNode = m_wideNodes + wideIndex;
+		const b2AABB& aabb = m_nodes[slots[i]].aabb;
+		wideNode->lowerX[i] = aabb.lowerBound.x;
+		wideNode->lowerY[i] = aabb.lowerBound.y;
+		wideNode->upperX[i] = aabb.upperBound.x;
+		wideNode->upperY[i] = aabb.upperBound.y;
+		wideNode->children[i] = child;
 	}
 
-	// Create a parent for the siblings.
-	uint16 node1 = m_nodes[sibling].parent;
-	uint16 node2 = AllocateNode();
-	m_nodes[node2].parent = node1;
-	m_nodes[node2].userData = NULL;
-	m_nodes[node2].aabb.Combine(m_nodes[leaf].aabb, m_nodes[sibling].aabb);
+	return wideIndex;
+}
 
-	if (node1 != b2_nullNode)
+// Sorts leafs by the center of their AABB along an axis.
+struct b2TreeCenterLess
+{
+	bool operator()(uint32 a, uint32 b) const
 	{
-		if (m_nodes[m_nodes[sibling].parent].child1 == sibling)
+		b2Vec2 ca = nodes[a].aabb.GetCenter();
+		b2Vec2 cb = nodes[b].aabb.GetCenter();
+		if (axis == 0)
 		{
-			m_nodes[node1].child1 = node2;
+			return ca.x < cb.x;
 		}
-		else
+
+		return ca.y < cb.y;
+	}
+
+	const b2DynamicTreeNode* nodes;
+	int32 axis;
+};
+
+// Build a subtree over the leafs using a binned surface area heuristic.
+// Returns the root of the subtree. The leaf array is reordered.
+uint32 b2DynamicTree::BuildTopDown(uint32* leaves, int32 count, int32 depth)
+{
+	b2Assert(count > 0);
+
+	if (count == 1)
+	{
+		return leaves[0];
+	}
+
+	// Bound the leaf centers and split along the longest axis.
+	b2Vec2 lower = m_nodes[leaves[0]].aabb.GetCenter();
+	b2Vec2 upper = lower;
+	for (int32 i = 1; i < count; ++i)
+	{
+		b2Vec2 c = m_nodes[leaves[i]].aabb.GetCenter();
+		lower = b2Min(lower, c);
+		upper = b2Max(upper, c);
+	}
+
+	b2Vec2 d = upper - lower;
+	int32 axis = 0;
+	float32 axisLower = lower.x;
+	float32 axisExtent = d.x;
+	if (d.y > d.x)
+	{
+		axis = 1;
+		axisLower = lower.y;
+		axisExtent = d.y;
+	}
+
+	// Fall back to a median split when the centers coincide or the
+	// heuristic keeps peeling off a few leafs at a time.
+	const int32 k_maxDepth = 64;
+	int32 split = count / 2;
+
+	if (axisExtent > 0.0f && depth < k_maxDepth)
+	{
+		const int32 k_binCount = 16;
+		b2AABB binAABBs[k_binCount];
+		int32 binCounts[k_binCount];
+		for (int32 i = 0; i < k_binCount; ++i)
+		{
+			binCounts[i] = 0;
+		}
+
+		float32 binScale = float32(k_binCount) / axisExtent;
+
+		for (int32 i = 0; i < count; ++i)
+		{
+			const b2AABB& aabb = m_nodes[leaves[i]].aabb;
+			int32 bin = ComputeBin(aabb, axis, axisLower, binScale, k_binCount);
+			if (binCounts[bin] == 0)
+			{
+				binAABBs[bin] = aabb;
+			}
+			else
+			{
+				binAABBs[bin].Combine(binAABBs[bin], aabb);
+			}
+			++binCounts[bin];
+		}
+
+		// Sweep from the left to get the cost of the leafs left of each split plane.
+		float32 leftCosts[k_binCount - 1];
+		int32 leftCounts[k_binCount - 1];
+		b2AABB leftAABB;
+		int32 leftCount = 0;
+		for (int32 i = 0; i < k_binCount - 1; ++i)
 		{
-			m_nodes[node1].child2 = node2;
+			if (binCounts[i] > 0)
+			{
+				if (leftCount == 0)
+				{
+					leftAABB = binAABBs[i];
+				}
+				else
+				{
+					leftAABB.Combine(leftAABB, binAABBs[i]);
+				}
+				leftCount += binCounts[i];
+			}
+
+			leftCounts[i] = leftCount;
+			leftCosts[i] = 0.0f;
+			if (leftCount > 0)
+			{
+				leftCosts[i] = leftAABB.GetPerimeter() * leftCount;
+			}
 		}
 
-		m_nodes[node2].child1 = sibling;
-		m_nodes[node2].child2 = leaf;
-		m_nodes[sibling].parent = node2;
-		m_nodes[leaf].parent = node2;
+		// Sweep from the right and keep the cheapest split plane.
+		int32 bestBin = -1;
+		float32 bestCost = 0.0f;
+		b2AABB rightAABB;
+		int32 rightCount = 0;
+		for (int32 i = k_binCount - 1; i > 0; --i)
+		{
+			if (binCounts[i] > 0)
+			{
+				if (rightCount == 0)
+				{
+					rightAABB = binAABBs[i];
+				}
+				else
+				{
+					rightAABB.Combine(rightAABB, binAABBs[i]);
+				}
+				rightCount += binCounts[i];
+			}
+
+			if (rightCount == 0 || leftCounts[i-1] == 0)
+			{
+				continue;
+			}
+
+			float32 cost = leftCosts[i-1] + rightAABB.GetPerimeter() * rightCount;
+			if (bestBin == -1 || cost < bestCost)
+			{
+				bestBin = i - 1;
+				bestCost = cost;
+			}
+		}
 
-		do 
+		if (bestBin != -1)
 		{
-			if (m_nodes[node1].aabb.Contains(m_nodes[node2].aabb))
+			// Partition the leafs about the split plane.
+			int32 i = 0;
+			int32 j = count - 1;
+			while (i <= j)
 			{
-				break;
+				int32 bin = ComputeBin(m_nodes[leaves[i]].aabb, axis, axisLower, binScale, k_binCount);
+				if (bin <= bestBin)
+				{
+					++i;
+				}
+				else
+				{
+					b2Swap(leaves[i], leaves[j]);
+					--j;
+				}
 			}
 
-			m_nodes[node1].aabb.Combine(m_nodes[m_nodes[node1].child1].aabb, m_nodes[m_nodes[node1].child2].aabb);
-			node2 = node1;
-			node1 = m_nodes[node1].parent;
+			split = i;
+			b2Assert(0 < split && split < count);
+		}
+	}
+	else
+	{
+		b2TreeCenterLess less;
+		less.nodes = m_nodes;
+		less.axis = axis;
+		std::nth_element(leaves, leaves + split, leaves + count, less);
+	}
+
+	uint32 child1 = BuildTopDown(leaves, split, depth + 1);
+	uint32 child2 = BuildTopDown(leaves + split, count - split, depth + 1);
+
+	uint32 parent = AllocateNode();
+	m_nodes[parent].userData = NULL;
+	m_nodes[parent].child1 = child1;
+	m_nodes[parent].child2 = child2;
+	m_nodes[parent].aabb.Combine(m_nodes[child1].aabb, m_nodes[child2].aabb);
+	m_nodes[parent].height = 1 + b2Max(m_nodes[child1].height, m_nodes[child2].height);
+	m_nodes[child1].parent = parent;
+	m_nodes[child2].parent = parent;
+
+	return parent;
+}
+
+// Get the bin of an AABB center along an axis.
+int32 b2DynamicTree::ComputeBin(const b2AABB& aabb, int32 axis, float32 axisLower, float32 binScale, int32 binCount)
+{
+	b2Vec2 c = aabb.GetCenter();
+	float32 x = c.x;
+	if (axis == 1)
+	{
+		x = c.y;
+	}
+
+	int32 bin = int32(binScale * (x - axisLower));
+	return b2Clamp(bin, 0, binCount - 1);
+}
+
+void b2DynamicTree::DestroyProxy(uint32 proxyId)
+{
+	b2Assert(proxyId < uint32(m_nodeCapacity));
+	b2Assert(m_nodes[proxyId].IsLeaf());
+
+	RemoveLeaf(proxyId);
+	FreeNode(proxyId);
+}
+
+bool b2DynamicTree::MoveProxy(uint32 proxyId, const b2AABB& aabb)
+{
+	b2Assert(proxyId < uint32(m_nodeCapacity));
+
+	b2Assert(m_nodes[proxyId].IsLeaf());
+
+	if (m_nodes[proxyId].aabb.Contains(aabb))
+	{
+		return false;
+	}
+
+	RemoveLeaf(proxyId);
+
+	b2Vec2 center = aabb.GetCenter();
+	b2Vec2 extents = aabb.GetExtents() + b2Vec2(b2_aabbExtension, b2_aabbExtension);
+
+	m_nodes[proxyId].aabb.lowerBound = center - extents;
+	m_nodes[proxyId].aabb.upperBound = center + extents;
+
+	InsertLeaf(proxyId);
+	return true;
+}
+
+void b2DynamicTree::InsertLeaf(uint32 leaf)
+{
+	// The wide layout is stale until the next collapse.
+	m_wideNodeCount = 0;
+
+	if (m_root == b2_nullNode)
+	{
+		m_root = leaf;
+		m_nodes[m_root].parent = b2_nullNode;
+		return;
+	}
+
+	// Find the best sibling for this node using the surface area heuristic.
+	// In 2D the perimeter takes the place of the surface area.
+	b2AABB leafAABB = m_nodes[leaf].aabb;
+	uint32 index = m_root;
+	while (m_nodes[index].IsLeaf() == false)
+	{
+		uint32 child1 = m_nodes[index].child1;
+		uint32 child2 = m_nodes[index].child2;
+
+		float32 area = m_nodes[index].aabb.GetPerimeter();
+
+		b2AABB combinedAABB;
+		combinedAABB.Combine(m_nodes[index].aabb, leafAABB);
+		float32 combinedArea = combinedAABB.GetPerimeter();
+
+		// Cost of creating a new parent for this node and the new leaf.
+		float32 cost = 2.0f * combinedArea;
+
+		// Minimum cost of pushing the leaf further down the tree.
+		float32 inheritanceCost = 2.0f * (combinedArea - area);
+
+		// Cost of descending into each child.
+		float32 cost1 = ComputeDescentCost(child1, leafAABB) + inheritanceCost;
+		float32 cost2 = ComputeDescentCost(child2, leafAABB) + inheritanceCost;
+
+		if (cost < cost1 && cost < cost2)
+		{
+			break;
+		}
+
+		// Descend according to the minimum cost.
+		if (cost1 < cost2)
+		{
+			index = child1;
+		}
+		else
+		{
+			index = child2;
+		}
+	}
+
+	uint32 sibling = index;
+
+	// Create a new parent for the siblings.
+	uint32 oldParent = m_nodes[sibling].parent;
+	uint32 newParent = AllocateNode();
+	m_nodes[newParent].parent = oldParent;
+	m_nodes[newParent].userData = NULL;
+	m_nodes[newParent].aabb.Combine(leafAABB, m_nodes[sibling].aabb);
+	m_nodes[newParent].height = 1 + b2Max(m_nodes[sibling].height, m_nodes[leaf].height);
+	m_nodes[newParent].child1 = sibling;
+	m_nodes[newParent].child2 = leaf;
+	m_nodes[sibling].parent = newParent;
+	m_nodes[leaf].parent = newParent;
+
+	if (oldParent != b2_nullNode)
+	{
+		if (m_nodes[oldParent].child1 == sibling)
+		{
+			m_nodes[oldParent].child1 = newParent;
+		}
+		else
+		{
+			m_nodes[oldParent].child2 = newParent;
 		}
-		while(node1 != b2_nullNode);
 	}
 	else
 	{
-		m_nodes[node2].child1 = sibling;
-		m_nodes[node2].child2 = leaf;
-		m_nodes[sibling].parent = node2;
-		m_nodes[leaf].parent = node2;
-		m_root = node2;
+		m_root = newParent;
 	}
+
+	// Walk back up the tree fixing heights and AABBs.
+	AdjustAncestors(newParent);
 }
 
-void b2DynamicTree::RemoveLeaf(uint16 leaf)
+void b2DynamicTree::RemoveLeaf(uint32 leaf)
 {
+	// The wide layout is stale until the next collapse.
+	m_wideNodeCount = 0;
+
 	if (leaf == m_root)
 	{
 		m_root = b2_nullNode;
 		return;
 	}
 
-	uint16 node2 = m_nodes[leaf].parent;
-	uint16 node1 = m_nodes[node2].parent;
-	uint16 sibling;
-	if (m_nodes[node2].child1 == leaf)
+	uint32 parent = m_nodes[leaf].parent;
+	uint32 grandParent = m_nodes[parent].parent;
+	uint32 sibling;
+	if (m_nodes[parent].child1 == leaf)
 	{
-		sibling = m_nodes[node2].child2;
+		sibling = m_nodes[parent].child2;
 	}
 	else
 	{
-		sibling = m_nodes[node2].child1;
+		sibling = m_nodes[parent].child1;
 	}
 
-	if (node1 != b2_nullNode)
+	if (grandParent != b2_nullNode)
 	{
-		// Destroy node2 and connect node1 to sibling.
-		if (m_nodes[node1].child1 == node2)
+		// Destroy the parent and connect the sibling to the grand parent.
+		if (m_nodes[grandParent].child1 == parent)
 		{
-			m_nodes[node1].child1 = sibling;
+			m_nodes[grandParent].child1 = sibling;
 		}
 		else
 		{
-			m_nodes[node1].child2 = sibling;
+			m_nodes[grandParent].child2 = sibling;
 		}
-		m_nodes[sibling].parent = node1;
-		FreeNode(node2);
+		m_nodes[sibling].parent = grandParent;
+		FreeNode(parent);
 
-		// Adjust ancestor bounds.
-		while (node1 != b2_nullNode)
-		{
-			b2AABB oldAABB = m_nodes[node1].aabb;
-			m_nodes[node1].aabb.Combine(m_nodes[m_nodes[node1].child1].aabb, m_nodes[m_nodes[node1].child2].aabb);
+		AdjustAncestors(grandParent);
+	}
+	else
+	{
+		m_root = sibling;
+		m_nodes[sibling].parent = b2_nullNode;
+		FreeNode(parent);
+	}
+}
 
-			if (oldAABB.Contains(m_nodes[node1].aabb))
-			{
-				break;
-			}
+// Get the perimeter growth caused by pushing the leaf into the subtree at index.
+// A leaf has to be split, so it pays for the whole new parent.
+float32 b2DynamicTree::ComputeDescentCost(uint32 index, const b2AABB& leafAABB) const
+{
+	b2AABB aabb;
+	aabb.Combine(leafAABB, m_nodes[index].aabb);
+
+	if (m_nodes[index].IsLeaf())
+	{
+		return aabb.GetPerimeter();
+	}
+
+	return aabb.GetPerimeter() - m_nodes[index].aabb.GetPerimeter();
+}
+
+// Walk from a node to the root, balancing each node and refitting its height and AABB.
+void b2DynamicTree::AdjustAncestors(uint32 index)
+{
+	while (index != b2_nullNode)
+	{
+		index = Balance(index);
+
+		uint32 child1 = m_nodes[index].child1;
+		uint32 child2 = m_nodes[index].child2;
+
+		b2Assert(child1 != b2_nullNode);
+		b2Assert(child2 != b2_nullNode);
+
+		m_nodes[index].height = 1 + b2Max(m_nodes[child1].height, m_nodes[child2].height);
+		m_nodes[index].aabb.Combine(m_nodes[child1].aabb, m_nodes[child2].aabb);
+
+		index = m_nodes[index].parent;
+	}
+}
+
+// Perform a rotation if node A is imbalanced. Returns the new root of the subtree.
+uint32 b2DynamicTree::Balance(uint32 iA)
+{
+	b2Assert(iA != b2_nullNode);
+
+	b2DynamicTreeNode* A = m_nodes + iA;
+	if (A->IsLeaf() || A->height < 2)
+	{
+		return iA;
+	}
+
+	uint32 iB = A->child1;
+	uint32 iC = A->child2;
+	b2Assert(iB < uint32(m_nodeCapacity));
+	b2Assert(iC < uint32(m_nodeCapacity));
+
+	int32 balance = m_nodes[iC].height - m_nodes[iB].height;
+
+	// Rotate C up
+	if (balance > 1)
+	{
+		return Rotate(iA, iC);
+	}
+
+	// Rotate B up
+	if (balance < -1)
+	{
+		return Rotate(iA, iB);
+	}
+
+	return iA;
+}
+
+// Rotate the tall child U of A above A. The taller child of U stays with U
+// and the shorter child of U takes the place of U under A.
+//
+//       A              U
+//     +-+-+          +-+-+
+//     S   U    =>    A   T
+//       +-+-+      +-+-+
+//       T   R      S   R
+uint32 b2DynamicTree::Rotate(uint32 iA, uint32 iU)
+{
+	b2DynamicTreeNode* A = m_nodes + iA;
+	b2DynamicTreeNode* U = m_nodes + iU;
+	b2Assert(U->IsLeaf() == false);
+
+	uint32 iS = A->child1 == iU ? A->child2 : A->child1;
+	uint32 iT = U->child1;
+	uint32 iR = U->child2;
+	if (m_nodes[iT].height < m_nodes[iR].height)
+	{
+		iT = U->child2;
+		iR = U->child1;
+	}
+
+	b2DynamicTreeNode* S = m_nodes + iS;
+	b2DynamicTreeNode* T = m_nodes + iT;
+	b2DynamicTreeNode* R = m_nodes + iR;
 
-			node1 = m_nodes[node1].parent;
+	// Swap A and U.
+	U->parent = A->parent;
+	A->parent = iU;
+
+	if (U->parent != b2_nullNode)
+	{
+		if (m_nodes[U->parent].child1 == iA)
+		{
+			m_nodes[U->parent].child1 = iU;
+		}
+		else
+		{
+			b2Assert(m_nodes[U->parent].child2 == iA);
+			m_nodes[U->parent].child2 = iU;
 		}
 	}
 	else
 	{
-		m_root = sibling;
-		m_nodes[sibling].parent = b2_nullNode;
-		FreeNode(node2);
+		m_root = iU;
 	}
+
+	// A keeps S and adopts R.
+	A->child1 = iS;
+	A->child2 = iR;
+	R->parent = iA;
+	A->aabb.Combine(S->aabb, R->aabb);
+	A->height = 1 + b2Max(S->height, R->height);
+
+	// U keeps T and adopts A.
+	U->child1 = iA;
+	U->child2 = iT;
+	U->aabb.Combine(A->aabb, T->aabb);
+	U->height = 1 + b2Max(A->height, T->height);
+
+	return iU;
 }
 
 void b2DynamicTree::Rebalance(int32 iterations)
@@ -305,12 +854,12 @@ void b2DynamicTree::Rebalance(int32 iterations)
 
 	for (int32 i = 0; i < iterations; ++i)
 	{
-		uint16 node = m_root;
+		uint32 node = m_root;
 
 		uint32 bit = 0;
 		while (m_nodes[node].IsLeaf() == false)
 		{
-			uint16* children = &m_nodes[node].child1;
+			uint32* children = &m_nodes[node].child1;
 			node = children[(m_path >> bit) & 1];
 			bit = (bit + 1) & (8* sizeof(uint32) - 1);
 		}
@@ -320,3 +869,144 @@ void b2DynamicTree::Rebalance(int32 iterations)
 		InsertLeaf(node);
 	}
 }
+
+int32 b2DynamicTree::GetHeight() const
+{
+	if (m_root == b2_nullNode)
+	{
+		return 0;
+	}
+
+	return m_nodes[m_root].height;
+}
+
+int32 b2DynamicTree::GetMaxBalance() const
+{
+	int32 maxBalance = 0;
+	for (int32 i = 0; i < m_nodeCapacity; ++i)
+	{
+		const b2DynamicTreeNode* node = m_nodes + i;
+		if (node->height <= 1)
+		{
+			continue;
+		}
+
+		b2Assert(node->IsLeaf() == false);
+
+		int32 balance = m_nodes[node->child2].height - m_nodes[node->child1].height;
+		maxBalance = b2Max(maxBalance, b2Max(balance, -balance));
+	}
+
+	return maxBalance;
+}
+
+float32 b2DynamicTree::GetAreaRatio() const
+{
+	if (m_root == b2_nullNode)
+	{
+		return 0.0f;
+	}
+
+	float32 rootArea = m_nodes[m_root].aabb.GetPerimeter();
+
+	float32 totalArea = 0.0f;
+	for (int32 i = 0; i < m_nodeCapacity; ++i)
+	{
+		const b2DynamicTreeNode* node = m_nodes + i;
+		if (node->height < 0)
+		{
+			// Free node in pool
+			continue;
+		}
+
+		totalArea += node->aabb.GetPerimeter();
+	}
+
+	if (rootArea <= 0.0f)
+	{
+		return 0.0f;
+	}
+
+	return totalArea / rootArea;
+}
+
+int32 b2DynamicTree::ValidateStructure(uint32 index) const
+{
+	if (index == b2_nullNode)
+	{
+		return 0;
+	}
+
+	if (index == m_root)
+	{
+		b2Assert(m_nodes[index].parent == b2_nullNode);
+	}
+
+	const b2DynamicTreeNode* node = m_nodes + index;
+	if (node->IsLeaf())
+	{
+		b2Assert(node->child2 == b2_nullNode);
+		b2Assert(node->height == 0);
+		return 1;
+	}
+
+	uint32 child1 = node->child1;
+	uint32 child2 = node->child2;
+
+	b2Assert(child1 < uint32(m_nodeCapacity));
+	b2Assert(child2 < uint32(m_nodeCapacity));
+	b2Assert(m_nodes[child1].parent == index);
+	b2Assert(m_nodes[child2].parent == index);
+
+	b2Assert(node->height == 1 + b2Max(m_nodes[child1].height, m_nodes[child2].height));
+	b2Assert(node->aabb.Contains(m_nodes[child1].aabb));
+	b2Assert(node->aabb.Contains(m_nodes[child2].aabb));
+
+	return 1 + ValidateStructure(child1) + ValidateStructure(child2);
+}
+
+void b2DynamicTree::Validate() const
+{
+	int32 nodeCount = ValidateStructure(m_root);
+
+	int32 freeCount = 0;
+	uint32 freeIndex = m_freeList;
+	while (freeIndex != b2_nullNode)
+	{
+		b2Assert(freeIndex < uint32(m_nodeCapacity));
+		b2Assert(m_nodes[freeIndex].height == -1);
+		freeIndex = m_nodes[freeIndex].parent;
+		++freeCount;
+	}
+
+	b2Assert(nodeCount == m_nodeCount);
+	b2Assert(nodeCount + freeCount == m_nodeCapacity);
+
+	// Every proxy must appear once in the wide layout.
+	int32 wideLeafCount = 0;
+	for (int32 i = 0; i < m_wideNodeCount; ++i)
+	{
+		for (int32 j = 0; j < 4; ++j)
+		{
+			uint32 child = m_wideNodes[i].children[j];
+			if (child == b2_nullNode)
+			{
+				continue;
+			}
+
+			if (child & b2_wideLeafFlag)
+			{
+				b2Assert(m_nodes[child & ~b2_wideLeafFlag].IsLeaf());
+				++wideLeafCount;
+			}
+			else
+			{
+				b2Assert(child < uint32(m_wideNodeCount));
+			}
+		}
+	}
+	b2Assert(m_wideNodeCount == 0 || wideLeafCount == GetProxyCount());
+	B2_NOT_USED(wideLeafCount);
+	B2_NOT_USED(nodeCount);
+	B2_NOT_USED(freeCount);
+}
@@ -20,11 +20,19 @@
 #define B2_DYNAMIC_TREE_H
 
 #include "b2Collision.h"
+#include "../Common/b2GrowableStack.h"
 
-#define b2_nullNode USHRT_MAX
+#ifdef B2_USE_SSE
+#include <xmmintrin.h>
+#endif
+
+#define b2_nullNode UINT_MAX
+
+/// Tags the leaf children of a wide node. The rest of the value is the proxy id.
+#define b2_wideLeafFlag 0x80000000
 
 /// A node in the dynamic tree. The client does not interact with this directly.
-/// 4 + 8 + 6 = 18 bytes on a 32bit machine.
+/// 4 + 16 + 12 + 4 = 36 bytes on a 32bit machine.
 struct b2DynamicTreeNode
 {
 	bool IsLeaf() const
@@ -34,75 +42,147 @@ struct b2DynamicTreeNode
 
 	void* userData;
 	b2AABB aabb;
-	uint16 parent;
-	uint16 child1;
-	uint16 child2;
+	uint32 parent;
+	uint32 child1;
+	uint32 child2;
+
+	/// Leaf = 0, free node = -1
+	int32 height;
 };
 
-/// A callback for AABB queries.
-class b2QueryCallback
+/// A node of the 4-wide tree layout. The child AABBs are stored as a structure
+/// of arrays so that all four can be tested with one SIMD compare. Unused slots
+/// have inverted AABBs that never overlap anything.
+/// 64 + 16 = 80 bytes.
+struct b2WideNode
 {
-public:
-	~b2QueryCallback() {}
+	float32 lowerX[4];
+	float32 lowerY[4];
+	float32 upperX[4];
+	float32 upperY[4];
 
-	/// This function is called for each overlapping AABB.
-	/// @return true if the query should continue.
-	virtual bool Process(void* userData) = 0;
+	/// A wide node index, a proxy id tagged with b2_wideLeafFlag, or b2_nullNode.
+	uint32 children[4];
 };
 
-/// A callback for ray casts.
-class b2RayCastCallback
+/// A node waiting in a best-first traversal, ordered by the distance of its AABB.
+struct b2TreeDistanceNode
 {
-public:
-	~b2RayCastCallback() {}
-
-	/// Process a ray-cast. This allows the client to perform an exact ray-cast
-	/// against their object (found from the proxyUserData pointer).
-	/// @param input the original ray-cast segment with an adjusted maxFraction.
-	/// @param maxFraction the clipping parameter, the ray extends from p1 to p1 + maxFraction * (p2 - p1).
-	/// @param userData user data associated with the current proxy.
-	/// @return the new max fraction. Return 0 to end the ray-cast. Return the input maxFraction to
-	/// continue the ray cast. Return a value less than maxFraction to clip the ray-cast.
-	virtual float32 Process(const b2RayCastInput& input, void* userData) = 0;
+	bool operator<(const b2TreeDistanceNode& other) const
+	{
+		return distance < other.distance;
+	}
+
+	float32 distance;
+	uint32 nodeId;
+};
+
+/// The number of rays traversed together by b2DynamicTree::RayCastPacket.
+#define b2_rayPacketSize 4
+
+/// A packet of rays in structure of arrays form, so that one SIMD slab test
+/// checks all rays against a node. Inactive rays have a negative max fraction.
+struct b2RayPacket
+{
+	float32 p1x[b2_rayPacketSize];
+	float32 p1y[b2_rayPacketSize];
+	float32 invDx[b2_rayPacketSize];
+	float32 invDy[b2_rayPacketSize];
+	float32 maxFraction[b2_rayPacketSize];
 };
 
 /// A dynamic tree arranges data in a binary tree to accelerate
 /// queries such as volume queries and ray casts. Leafs are proxies
-/// with an AABB. In the tree we expand the proxy AABB by b2_fatAABBFactor
+/// with an AABB. In the tree we expand the proxy AABB by b2_aabbExtension
 /// so that the proxy AABB is bigger than the client object. This allows the client
 /// object to move by small amounts without triggering a tree update.
 ///
+/// Leafs are inserted next to the sibling that minimizes the perimeter growth
+/// of the tree (the 2D surface area heuristic). Nodes whose subtree heights
+/// differ by more than one are rotated on the way back up, so the height
+/// stays logarithmic no matter how the proxies churn.
+///
+/// The tree can also keep a 4-wide copy of itself for faster queries and ray
+/// casts, see SetWideNodes. The copy is rebuilt by Collapse and goes stale when
+/// the tree structure changes. Queries fall back to the binary nodes while
+/// the copy is stale.
+///
 /// Nodes are pooled and relocatable, so we use node indices rather than pointers.
 class b2DynamicTree
 {
 public:
 
 	/// Constructing the tree initializes the node pool.
-	b2DynamicTree();
+	b2DynamicTree(int32 nodeCapacity = b2_nodePoolSize);
 
 	/// Destroy the tree, freeing the node pool.
 	~b2DynamicTree();
 
 	/// Create a proxy. Provide a tight fitting AABB and a userData pointer.
-	uint16 CreateProxy(const b2AABB& aabb, void* userData);
+	uint32 CreateProxy(const b2AABB& aabb, void* userData);
+
+	/// Create many proxies at once. When the batch is at least as big as the rest
+	/// of the tree, the whole tree is rebuilt top-down with a binned surface area
+	/// heuristic. This gives a much better tree than calling CreateProxy in a loop,
+	/// so use it to load level geometry. Smaller batches are inserted one by one.
+	/// @param proxyIds receives the ids of the new proxies.
+	void CreateProxies(const b2AABB* aabbs, void** userData, int32 count, uint32* proxyIds);
 
 	/// Destroy a proxy. This asserts if the id is invalid.
-	void DestroyProxy(uint16 proxyId);
+	void DestroyProxy(uint32 proxyId);
 
 	/// Move a proxy. If the proxy has moved outside of its fattened AABB,
 	/// then the proxy is removed from the tree and re-inserted. Otherwise
 	/// the function returns immediately.
-	void MoveProxy(uint16 proxyId, const b2AABB& aabb);
+	/// @return true if the proxy was re-inserted.
+	bool MoveProxy(uint32 proxyId, const b2AABB& aabb);
+
+	/// Build an optimal tree over the current proxies using a binned surface area
+	/// heuristic. This is O(n log n), so only use it after large changes.
+	void RebuildTopDown();
+
+	/// Enable or disable the 4-wide node layout. The layout is built by the next
+	/// Collapse. It pays off when the tree is queried much more often than it changes.
+	void SetWideNodes(bool flag);
+
+	/// Rebuild the 4-wide layout from the binary tree. This is O(n) and does nothing
+	/// when the layout is disabled or still up to date. RebuildTopDown calls this.
+	void Collapse();
 
-	/// Perform some iterations to re-balance the tree.
+	/// Perform some iterations to re-balance the tree. Each iteration re-inserts
+	/// one leaf, which can improve the fit of leafs inserted long ago.
 	void Rebalance(int32 iterations);
 
 	/// Get proxy user data.
-	/// @return the proxy user data or NULL if the id is invalid.
-	void* GetProxy(uint16 proxyId);
+	/// @return the proxy user data or NULL if the proxy was destroyed.
+	void* GetUserData(uint32 proxyId) const;
+
+	/// Get the fat AABB for a proxy.
+	const b2AABB& GetFatAABB(uint32 proxyId) const;
+
+	/// Get the number of nodes the pool holds before it must grow.
+	int32 GetNodeCapacity() const;
+
+	/// Get the number of proxies in the tree.
+	int32 GetProxyCount() const;
+
+	/// Get the height of the tree. This is the maximum depth of a leaf.
+	int32 GetHeight() const;
+
+	/// Get the maximum height difference between the two children of a node.
+	int32 GetMaxBalance() const;
+
+	/// Get the sum of the node perimeters divided by the root perimeter.
+	/// Query cost grows with this ratio, so it is a good measure of tree quality.
+	float32 GetAreaRatio() const;
+
+	/// Validate the tree structure, heights and AABBs. This asserts on failure.
+	void Validate() const;
 
 	/// Query an AABB for overlapping proxies. The callback class
 	/// is called for each proxy that overlaps the supplied AABB.
+	/// The callback must provide bool QueryCallback(uint32 proxyId)
+	/// and return false to terminate the query.
 	template <typename T>
 	void Query(T* callback, const b2AABB& aabb) const;
 
@@ -111,59 +191,257 @@ public:
 	/// The callback also performs the any collision filtering. This has performance
 	/// roughly equal to k * log(n), where k is the number of collisions and n is the
 	/// number of proxies in the tree.
+	/// The callback must provide float32 RayCastCallback(const b2RayCastInput& input, uint32 proxyId).
+	/// It returns 0 to terminate the ray-cast, a value less than input.maxFraction to clip the ray,
+	/// input.maxFraction to continue, or a negative value to ignore the proxy.
 	/// @param input the ray-cast input data. The ray extends from p1 to p1 + maxFraction * (p2 - p1).
 	/// @param callback a callback class that is called for each proxy that is hit by the ray.
 	template <typename T>
 	void RayCast(T* callback, const b2RayCastInput& input) const;
 
+	/// Sweep a box with the given half-extents from p1 toward p2. This works like RayCast
+	/// with every node grown by the extents, so the callback gets the ray of the box center
+	/// and has the same return values. A zero translation makes this an AABB query.
+	template <typename T>
+	void BoxCast(T* callback, const b2RayCastInput& input, const b2Vec2& extents) const;
+
+	/// Ray-cast up to b2_rayPacketSize rays in one traversal. Each node is tested
+	/// against all rays at once, so rays that start close together and point the
+	/// same way share most of the work.
+	/// The callback must provide float32 RayCastCallback(const b2RayCastInput& input, uint32 proxyId, int32 rayIndex),
+	/// with the same return values as for RayCast. Rays with a max fraction of zero are skipped.
+	template <typename T>
+	void RayCastPacket(T* callback, const b2RayCastInput* inputs, int32 count) const;
+
+	/// Visit the proxies within maxDistance of a point, nearest AABB first. The callback
+	/// must provide float32 NearestCallback(uint32 proxyId, float32 maxDistance). It returns
+	/// the new search distance, so nodes that cannot beat the current best are never
+	/// visited. Return a negative value to terminate the query. This uses the binary
+	/// nodes, even when the wide layout is enabled.
+	template <typename T>
+	void QueryNearest(T* callback, const b2Vec2& point, float32 maxDistance) const;
+
 private:
 
-	uint16 AllocateNode();
-	void FreeNode(uint16 node);
+	template <typename T>
+	void QueryWide(T* callback, const b2AABB& aabb) const;
+
+	template <typename T>
+	void BoxCastWide(T* callback, const b2RayCastInput& input, const b2Vec2& extents) const;
+
+	uint32 AllocateWideNode();
+	uint32 CollapseNode(uint32 index);
+
+	uint32 AllocateNode();
+	void FreeNode(uint32 node);
+
+	// Insert a leaf or a whole subtree.
+	void InsertLeaf(uint32 node);
+	void RemoveLeaf(uint32 node);
 
-	void InsertLeaf(uint16 node);
-	void RemoveLeaf(uint16 node);
+	float32 ComputeDescentCost(uint32 index, const b2AABB& leafAABB) const;
+	void AdjustAncestors(uint32 index);
+	uint32 Balance(uint32 index);
+	uint32 Rotate(uint32 iA, uint32 iU);
 
-	uint16 m_root;
+	uint32 BuildTopDown(uint32* leaves, int32 count, int32 depth);
+	static int32 ComputeBin(const b2AABB& aabb, int32 axis, float32 axisLower, float32 binScale, int32 binCount);
+
+	int32 ValidateStructure(uint32 index) const;
+
+	uint32 m_root;
 
 	b2DynamicTreeNode* m_nodes;
 	int32 m_nodeCount;
+	int32 m_nodeCapacity;
 
-	uint16 m_freeList;
+	uint32 m_freeList;
 
 	/// This is used incrementally traverse the tree for re-balancing.
 	uint32 m_path;
+
+	/// The wide layout. This is empty when disabled or stale.
+	b2WideNode* m_wideNodes;
+	int32 m_wideNodeCount;
+	int32 m_wideNodeCapacity;
+	bool m_wideEnabled;
 };
 
+/// Get a bit mask of the wide node children that overlap an AABB.
+inline int32 b2WideOverlapMask(const b2WideNode* node, const b2AABB& aabb)
+{
+#ifdef B2_USE_SSE
+	__m128 lx = _mm_loadu_ps(node->lowerX);
+	__m128 ly = _mm_loadu_ps(node->lowerY);
+	__m128 ux = _mm_loadu_ps(node->upperX);
+	__m128 uy = _mm_loadu_ps(node->upperY);
+
+	__m128 mx = _mm_and_ps(_mm_cmple_ps(lx, _mm_set1_ps(aabb.upperBound.x)), _mm_cmple_ps(_mm_set1_ps(aabb.lowerBound.x), ux));
+	__m128 my = _mm_and_ps(_mm_cmple_ps(ly, _mm_set1_ps(aabb.upperBound.y)), _mm_cmple_ps(_mm_set1_ps(aabb.lowerBound.y), uy));
+	return _mm_movemask_ps(_mm_and_ps(mx, my));
+#else
+	int32 mask = 0;
+	for (int32 i = 0; i < 4; ++i)
+	{
+		if (node->lowerX[i] <= aabb.upperBound.x && aabb.lowerBound.x <= node->upperX[i] &&
+			node->lowerY[i] <= aabb.upperBound.y && aabb.lowerBound.y <= node->upperY[i])
+		{
+			mask |= 1 << i;
+		}
+	}
+	return mask;
+#endif
+}
+
+/// Get a bit mask of the wide node children that the line through p1 with
+/// normal v may cross. This is the separating axis test used by RayCast. The children
+/// are grown by radius along v.
+inline int32 b2WideSegmentMask(const b2WideNode* node, const b2Vec2& p1, const b2Vec2& v, const b2Vec2& abs_v, float32 radius)
+{
+#ifdef B2_USE_SSE
+	__m128 lx = _mm_loadu_ps(node->lowerX);
+	__m128 ly = _mm_loadu_ps(node->lowerY);
+	__m128 ux = _mm_loadu_ps(node->upperX);
+	__m128 uy = _mm_loadu_ps(node->upperY);
+
+	__m128 half = _mm_set1_ps(0.5f);
+	__m128 cx = _mm_mul_ps(half, _mm_add_ps(lx, ux));
+	__m128 cy = _mm_mul_ps(half, _mm_add_ps(ly, uy));
+	__m128 hx = _mm_mul_ps(half, _mm_sub_ps(ux, lx));
+	__m128 hy = _mm_mul_ps(half, _mm_sub_ps(uy, ly));
+
+	// |dot(v, p1 - c)| - dot(|v|, h) - radius
+	__m128 d = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(v.x), _mm_sub_ps(_mm_set1_ps(p1.x), cx)),
+		_mm_mul_ps(_mm_set1_ps(v.y), _mm_sub_ps(_mm_set1_ps(p1.y), cy)));
+	d = _mm_andnot_ps(_mm_set1_ps(-0.0f), d);
+	__m128 r = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(abs_v.x), hx), _mm_mul_ps(_mm_set1_ps(abs_v.y), hy));
+	r = _mm_add_ps(r, _mm_set1_ps(radius));
+	return _mm_movemask_ps(_mm_cmple_ps(d, r));
+#else
+	int32 mask = 0;
+	for (int32 i = 0; i < 4; ++i)
+	{
+		b2Vec2 lower(node->lowerX[i], node->lowerY[i]);
+		b2Vec2 upper(node->upperX[i], node->upperY[i]);
+		b2Vec2 c = 0.5f * (lower + upper);
+		b2Vec2 h = 0.5f * (upper - lower);
+		float32 separation = b2Abs(b2Dot(v, p1 - c)) - b2Dot(abs_v, h) - radius;
+		if (separation <= 0.0f)
+		{
+			mask |= 1 << i;
+		}
+	}
+	return mask;
+#endif
+}
+
+/// Get a bit mask of the packet rays that cross an AABB within their max fraction.
+inline int32 b2RayPacketMask(const b2RayPacket* packet, const b2AABB& aabb)
+{
+#ifdef B2_USE_SSE
+	__m128 px = _mm_loadu_ps(packet->p1x);
+	__m128 py = _mm_loadu_ps(packet->p1y);
+	__m128 ix = _mm_loadu_ps(packet->invDx);
+	__m128 iy = _mm_loadu_ps(packet->invDy);
+
+	// Slab test. The fractions at which each ray crosses the AABB planes.
+	__m128 tx1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(aabb.lowerBound.x), px), ix);
+	__m128 tx2 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(aabb.upperBound.x), px), ix);
+	__m128 ty1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(aabb.lowerBound.y), py), iy);
+	__m128 ty2 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(aabb.upperBound.y), py), iy);
+
+	__m128 tmin = _mm_max_ps(_mm_min_ps(tx1, tx2), _mm_min_ps(ty1, ty2));
+	__m128 tmax = _mm_min_ps(_mm_max_ps(tx1, tx2), _mm_max_ps(ty1, ty2));
+	tmin = _mm_max_ps(tmin, _mm_setzero_ps());
+	tmax = _mm_min_ps(tmax, _mm_loadu_ps(packet->maxFraction));
+	return _mm_movemask_ps(_mm_cmple_ps(tmin, tmax));
+#else
+	int32 mask = 0;
+	for (int32 i = 0; i < b2_rayPacketSize; ++i)
+	{
+		float32 tx1 = (aabb.lowerBound.x - packet->p1x[i]) * packet->invDx[i];
+		float32 tx2 = (aabb.upperBound.x - packet->p1x[i]) * packet->invDx[i];
+		float32 ty1 = (aabb.lowerBound.y - packet->p1y[i]) * packet->invDy[i];
+		float32 ty2 = (aabb.upperBound.y - packet->p1y[i]) * packet->invDy[i];
+
+		float32 tmin = b2Max(b2Max(b2Min(tx1, tx2), b2Min(ty1, ty2)), 0.0f);
+		float32 tmax = b2Min(b2Min(b2Max(tx1, tx2), b2Max(ty1, ty2)), packet->maxFraction[i]);
+		if (tmin <= tmax)
+		{
+			mask |= 1 << i;
+		}
+	}
+	return mask;
+#endif
+}
+
+/// Get the distance from a point to an AABB. This is zero for points inside the AABB.
+inline float32 b2DistanceToAABB(const b2Vec2& point, const b2AABB& aabb)
+{
+	b2Vec2 d = b2Max(aabb.lowerBound - point, point - aabb.upperBound);
+	d = b2Max(d, b2Vec2_zero);
+	return d.Length();
+}
+
+inline void* b2DynamicTree::GetUserData(uint32 proxyId) const
+{
+	b2Assert(proxyId < uint32(m_nodeCapacity));
+	return m_nodes[proxyId].userData;
+}
+
+inline const b2AABB& b2DynamicTree::GetFatAABB(uint32 proxyId) const
+{
+	b2Assert(proxyId < uint32(m_nodeCapacity));
+	return m_nodes[proxyId].aabb;
+}
+
+inline int32 b2DynamicTree::GetNodeCapacity() const
+{
+	return m_nodeCapacity;
+}
+
+inline int32 b2DynamicTree::GetProxyCount() const
+{
+	// A binary tree with n leafs has n - 1 internal nodes.
+	return (m_nodeCount + 1) / 2;
+}
+
 template <typename T>
 inline void b2DynamicTree::Query(T* callback, const b2AABB& aabb) const
 {
-	if (m_root == NULL)
+	if (m_wideNodeCount > 0)
 	{
+		QueryWide(callback, aabb);
 		return;
 	}
 
-	const int32 k_stackSize = 32;
-	uint16 stack[k_stackSize];
+	if (m_root == b2_nullNode)
+	{
+		return;
+	}
 
-	int32 count = 0;
-	stack[count++] = m_root;
+	b2GrowableStack<uint32, 64> stack;
+	stack.Push(m_root);
 
-	while (count > 0)
+	while (stack.GetCount() > 0)
 	{
-		const b2DynamicTreeNode* node = m_nodes + stack[--count];
+		uint32 nodeId = stack.Pop();
+		const b2DynamicTreeNode* node = m_nodes + nodeId;
 
 		if (b2TestOverlap(node->aabb, aabb))
 		{
 			if (node->IsLeaf())
 			{
-				callback->QueryCallback(aabb, node->userData);
+				bool proceed = callback->QueryCallback(nodeId);
+				if (proceed == false)
+				{
+					return;
+				}
 			}
 			else
 			{
-				b2Assert(count + 1 < k_stackSize);
-				stack[count++] = node->child1;
-				stack[count++] = node->child2;
+				stack.Push(node->child1);
+				stack.Push(node->child2);
 			}
 		}
 	}
@@ -172,7 +450,20 @@ inline void b2DynamicTree::Query(T* callback, const b2AABB& aabb) const
 template <typename T>
 inline void b2DynamicTree::RayCast(T* callback, const b2RayCastInput& input) const
 {
-	if (m_root == NULL)
+	b2Assert((input.p2 - input.p1).LengthSquared() > 0.0f);
+	BoxCast(callback, input, b2Vec2_zero);
+}
+
+template <typename T>
+inline void b2DynamicTree::BoxCast(T* callback, const b2RayCastInput& input, const b2Vec2& extents) const
+{
+	if (m_wideNodeCount > 0)
+	{
+		BoxCastWide(callback, input, extents);
+		return;
+	}
+
+	if (m_root == b2_nullNode)
 	{
 		return;
 	}
@@ -180,35 +471,34 @@ inline void b2DynamicTree::RayCast(T* callback, const b2RayCastInput& input) con
 	b2Vec2 p1 = input.p1;
 	b2Vec2 p2 = input.p2;
 	b2Vec2 r = p2 - p1;
-	b2Assert(r.LengthSquared() > 0.0f);
 	r.Normalize();
 
-	// v is perpendicular to the segment.
+	// v is perpendicular to the segment. It is zero for a zero translation,
+	// which leaves only the bounding box test.
 	b2Vec2 v = b2Cross(1.0f, r);
 	b2Vec2 abs_v = b2Abs(v);
 
-	// Separating axis for segment (Gino, p80).
-	// |dot(v, p1 - c)| > dot(|v|, h)
+	// Separating axis for segment (Gino, p80), with the node grown by the extents.
+	// |dot(v, p1 - c)| > dot(|v|, h + extents)
+	float32 radius = b2Dot(abs_v, extents);
 
 	float32 maxFraction = input.maxFraction;
 
-	// Build a bounding box for the segment.
+	// Build a bounding box for the swept box.
 	b2AABB segmentAABB;
 	{
 		b2Vec2 t = p1 + maxFraction * (p2 - p1);
-		segmentAABB.lowerBound = b2Min(p1, t);
-		segmentAABB.upperBound = b2Max(p1, t);
+		segmentAABB.lowerBound = b2Min(p1, t) - extents;
+		segmentAABB.upperBound = b2Max(p1, t) + extents;
 	}
 
-	const int32 k_stackSize = 32;
-	uint16 stack[k_stackSize];
-
-	int32 count = 0;
-	stack[count++] = m_root;
+	b2GrowableStack<uint32, 64> stack;
+	stack.Push(m_root);
 
-	while (count > 0)
+	while (stack.GetCount() > 0)
 	{
-		const b2DynamicTreeNode* node = m_nodes + stack[--count];
+		uint32 nodeId = stack.Pop();
+		const b2DynamicTreeNode* node = m_nodes + nodeId;
 
 		if (b2TestOverlap(node->aabb, segmentAABB) == false)
 		{
@@ -216,10 +506,10 @@ inline void b2DynamicTree::RayCast(T* callback, const b2RayCastInput& input) con
 		}
 
 		// Separating axis for segment (Gino, p80).
-		// |dot(v, p1 - c)| > dot(|v|, h)
+		// |dot(v, p1 - c)| > dot(|v|, h + extents)
 		b2Vec2 c = node->aabb.GetCenter();
 		b2Vec2 h = node->aabb.GetExtents();
-		float32 separation = b2Abs(b2Dot(v, p1 - c)) - b2Dot(abs_v, h);
+		float32 separation = b2Abs(b2Dot(v, p1 - c)) - b2Dot(abs_v, h) - radius;
 		if (separation > 0.0f)
 		{
 			continue;
@@ -232,33 +522,281 @@ inline void b2DynamicTree::RayCast(T* callback, const b2RayCastInput& input) con
 			subInput.p2 = input.p2;
 			subInput.maxFraction = maxFraction;
 
-			b2RayCastOutput output;
+			float32 value = callback->RayCastCallback(subInput, nodeId);
 
-			callback->RayCastCallback(&output, subInput, node->userData);
+			if (value == 0.0f)
+			{
+				// The client has terminated the ray cast.
+				return;
+			}
 
-			if (output.hit)
+			if (0.0f < value && value < maxFraction)
 			{
-				// Early exit.
-				if (output.fraction == 0.0f)
+				// Update segment bounding box.
+				maxFraction = value;
+				b2Vec2 t = p1 + maxFraction * (p2 - p1);
+				segmentAABB.lowerBound = b2Min(p1, t) - extents;
+				segmentAABB.upperBound = b2Max(p1, t) + extents;
+			}
+		}
+		else
+		{
+			stack.Push(node->child1);
+			stack.Push(node->child2);
+		}
+	}
+}
+
+template <typename T>
+inline void b2DynamicTree::QueryNearest(T* callback, const b2Vec2& point, float32 maxDistance) const
+{
+	if (m_root == b2_nullNode)
+	{
+		return;
+	}
+
+	b2GrowableHeap<b2TreeDistanceNode, 64> heap;
+
+	b2TreeDistanceNode rootNode;
+	rootNode.distance = b2DistanceToAABB(point, m_nodes[m_root].aabb);
+	rootNode.nodeId = m_root;
+	heap.Push(rootNode);
+
+	while (heap.GetCount() > 0)
+	{
+		b2TreeDistanceNode entry = heap.Pop();
+
+		// The nodes left in the heap are all farther away.
+		if (entry.distance > maxDistance)
+		{
+			return;
+		}
+
+		const b2DynamicTreeNode* node = m_nodes + entry.nodeId;
+		if (node->IsLeaf())
+		{
+			maxDistance = callback->NearestCallback(entry.nodeId, maxDistance);
+			continue;
+		}
+
+		b2TreeDistanceNode child;
+		child.nodeId = node->child1;
+		child.distance = b2DistanceToAABB(point, m_nodes[child.nodeId].aabb);
+		if (child.distance <= maxDistance)
+		{
+			heap.Push(child);
+		}
+
+		child.nodeId = node->child2;
+		child.distance = b2DistanceToAABB(point, m_nodes[child.nodeId].aabb);
+		if (child.distance <= maxDistance)
+		{
+			heap.Push(child);
+		}
+	}
+}
+
+template <typename T>
+inline void b2DynamicTree::QueryWide(T* callback, const b2AABB& aabb) const
+{
+	b2GrowableStack<uint32, 128> stack;
+	stack.Push(0);
+
+	while (stack.GetCount() > 0)
+	{
+		const b2WideNode* node = m_wideNodes + stack.Pop();
+
+		int32 mask = b2WideOverlapMask(node, aabb);
+		for (int32 i = 0; i < 4; ++i)
+		{
+			if ((mask & (1 << i)) == 0)
+			{
+				continue;
+			}
+
+			uint32 child = node->children[i];
+			if (child & b2_wideLeafFlag)
+			{
+				bool proceed = callback->QueryCallback(child & ~b2_wideLeafFlag);
+				if (proceed == false)
 				{
 					return;
 				}
+			}
+			else
+			{
+				stack.Push(child);
+			}
+		}
+	}
+}
+
+template <typename T>
+inline void b2DynamicTree::BoxCastWide(T* callback, const b2RayCastInput& input, const b2Vec2& extents) const
+{
+	b2Vec2 p1 = input.p1;
+	b2Vec2 p2 = input.p2;
+	b2Vec2 r = p2 - p1;
+	r.Normalize();
+
+	// v is perpendicular to the segment.
+	b2Vec2 v = b2Cross(1.0f, r);
+	b2Vec2 abs_v = b2Abs(v);
+	float32 radius = b2Dot(abs_v, extents);
+
+	float32 maxFraction = input.maxFraction;
+
+	// Build a bounding box for the swept box.
+	b2AABB segmentAABB;
+	{
+		b2Vec2 t = p1 + maxFraction * (p2 - p1);
+		segmentAABB.lowerBound = b2Min(p1, t) - extents;
+		segmentAABB.upperBound = b2Max(p1, t) + extents;
+	}
+
+	b2GrowableStack<uint32, 128> stack;
+	stack.Push(0);
+
+	while (stack.GetCount() > 0)
+	{
+		const b2WideNode* node = m_wideNodes + stack.Pop();
+
+		int32 mask = b2WideOverlapMask(node, segmentAABB) & b2WideSegmentMask(node, p1, v, abs_v, radius);
+		for (int32 i = 0; i < 4; ++i)
+		{
+			if ((mask & (1 << i)) == 0)
+			{
+				continue;
+			}
+
+			uint32 child = node->children[i];
+			if ((child & b2_wideLeafFlag) == 0)
+			{
+				stack.Push(child);
+				continue;
+			}
 
-				maxFraction = output.fraction;
+			uint32 proxyId = child & ~b2_wideLeafFlag;
 
+			// An earlier sibling may have clipped the segment.
+			if (b2TestOverlap(m_nodes[proxyId].aabb, segmentAABB) == false)
+			{
+				continue;
+			}
+
+			b2RayCastInput subInput;
+			subInput.p1 = input.p1;
+			subInput.p2 = input.p2;
+			subInput.maxFraction = maxFraction;
+
+			float32 value = callback->RayCastCallback(subInput, proxyId);
+
+			if (value == 0.0f)
+			{
+				// The client has terminated the ray cast.
+				return;
+			}
+
+			if (0.0f < value && value < maxFraction)
+			{
 				// Update segment bounding box.
-				{
-					b2Vec2 t = p1 + maxFraction * (p2 - p1);
-					segmentAABB.lowerBound = b2Min(p1, t);
-					segmentAABB.upperBound = b2Max(p1, t);
-				}
+				maxFraction = value;
+				b2Vec2 t = p1 + maxFraction * (p2 - p1);
+				segmentAABB.lowerBound = b2Min(p1, t) - extents;
+				segmentAABB.upperBound = b2Max(p1, t) + extents;
 			}
 		}
-		else
+	}
+}
+
+template <typename T>
+inline void b2DynamicTree::RayCastPacket(T* callback, const b2RayCastInput* inputs, int32 count) const
+{
+	b2Assert(0 < count && count <= b2_rayPacketSize);
+
+	if (m_root == b2_nullNode)
+	{
+		return;
+	}
+
+	b2RayPacket packet;
+	int32 activeMask = 0;
+	for (int32 i = 0; i < b2_rayPacketSize; ++i)
+	{
+		packet.p1x[i] = 0.0f;
+		packet.p1y[i] = 0.0f;
+		packet.invDx[i] = 0.0f;
+		packet.invDy[i] = 0.0f;
+		packet.maxFraction[i] = -1.0f;
+
+		if (i >= count || inputs[i].maxFraction <= 0.0f)
 		{
-			b2Assert(count + 1 < k_stackSize);
-			stack[count++] = node->child1;
-			stack[count++] = node->child2;
+			continue;
+		}
+
+		// A huge inverse keeps the slab test free of 0 * infinity.
+		b2Vec2 d = inputs[i].p2 - inputs[i].p1;
+		packet.p1x[i] = inputs[i].p1.x;
+		packet.p1y[i] = inputs[i].p1.y;
+		packet.invDx[i] = B2_FLT_MAX;
+		packet.invDy[i] = B2_FLT_MAX;
+		if (d.x != 0.0f)
+		{
+			packet.invDx[i] = 1.0f / d.x;
+		}
+		if (d.y != 0.0f)
+		{
+			packet.invDy[i] = 1.0f / d.y;
+		}
+		packet.maxFraction[i] = inputs[i].maxFraction;
+		activeMask |= 1 << i;
+	}
+
+	b2GrowableStack<uint32, 64> stack;
+	stack.Push(m_root);
+
+	while (stack.GetCount() > 0 && activeMask != 0)
+	{
+		uint32 nodeId = stack.Pop();
+		const b2DynamicTreeNode* node = m_nodes + nodeId;
+
+		int32 mask = b2RayPacketMask(&packet, node->aabb) & activeMask;
+		if (mask == 0)
+		{
+			continue;
+		}
+
+		if (node->IsLeaf() == false)
+		{
+			stack.Push(node->child1);
+			stack.Push(node->child2);
+			continue;
+		}
+
+		for (int32 i = 0; i < count; ++i)
+		{
+			if ((mask & (1 << i)) == 0)
+			{
+				continue;
+			}
+
+			b2RayCastInput subInput;
+			subInput.p1 = inputs[i].p1;
+			subInput.p2 = inputs[i].p2;
+			subInput.maxFraction = packet.maxFraction[i];
+
+			float32 value = callback->RayCastCallback(subInput, nodeId, i);
+
+			if (value == 0.0f)
+			{
+				// The client has terminated this ray.
+				activeMask &= ~(1 << i);
+				packet.maxFraction[i] = -1.0f;
+			}
+			else if (0.0f < value && value < packet.maxFraction[i])
+			{
+				packet.maxFraction[i] = value;
+			}
 		}
 	}
 }
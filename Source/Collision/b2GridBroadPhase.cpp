@@ -0,0 +1,737 @@
+/*
+* Copyright (c) 2009 Erin Catto http://www.gphysics.com
+*
+* This software is provided 'as-is', without any express or implied
+* warranty.  In no event will the authors be held liable for any damages
+* arising from the use of this software.
+* Permission is granted to anyone to use this software for any purpose,
+* including commercial applications, and to alter it and redistribute it
+* freely, subject to the following restrictions:
+* 1. The origin of this software must not be misrepresented; you must not
+* claim that you wrote the original software. If you use this software
+* in a product, an acknowledgment in the product documentation would be
+* appreciated but is not required.
+* 2. Altered source versions must be plainly marked as such, and must not be
+* misrepresented as being the original software.
+* 3. This notice may not be removed or altered from any source distribution.
+*/
+
+#include "b2GridBroadPhase.h"
+
+#include <string.h>
+
+// Buffers a pair for every proxy overlapping a moved proxy.
+struct b2GridPairQuery
+{
+	bool QueryCallback(uint32 proxyId)
+	{
+		if (proxyId == queryProxyId)
+		{
+			return true;
+		}
+
+		const b2GridProxy* proxy = broadPhase->m_proxies + proxyId;
+		if (isStatic && proxy->isStatic)
+		{
+			return true;
+		}
+
+		if (b2TestOverlap(*fatAABB, proxy->aabb))
+		{
+			broadPhase->m_pairManager.AddBufferedPair(queryProxyId, proxyId);
+		}
+
+		return true;
+	}
+
+	b2GridBroadPhase* broadPhase;
+	uint32 queryProxyId;
+	const b2AABB* fatAABB;
+	bool isStatic;
+};
+
+// Buffers the removal of pairs that no longer overlap the fat AABB of the
+// query proxy. Every pair is removed if there is no fat AABB.
+struct b2GridRemoveQuery
+{
+	bool QueryCallback(uint32 proxyId)
+	{
+		if (proxyId == queryProxyId)
+		{
+			return true;
+		}
+
+		if (fatAABB == NULL || b2TestOverlap(*fatAABB, broadPhase->m_proxies[proxyId].aabb) == false)
+		{
+			broadPhase->m_pairManager.RemoveBufferedPair(queryProxyId, proxyId);
+		}
+
+		return true;
+	}
+
+	b2GridBroadPhase* broadPhase;
+	uint32 queryProxyId;
+	const b2AABB* fatAABB;
+};
+
+// Collects user data up to a maximum count.
+struct b2GridUserQuery
+{
+	bool QueryCallback(uint32 proxyId)
+	{
+		if (b2TestOverlap(*aabb, broadPhase->GetFatAABB(proxyId)))
+		{
+			userData[count++] = broadPhase->GetUserData(proxyId);
+		}
+
+		return count < maxCount;
+	}
+
+	const b2GridBroadPhase* broadPhase;
+	const b2AABB* aabb;
+	void** userData;
+	int32 maxCount;
+	int32 count;
+};
+
+// Forwards the proxies found in the cells to a broad-phase callback.
+struct b2GridCallbackQuery
+{
+	bool QueryCallback(uint32 proxyId)
+	{
+		if (b2TestOverlap(*aabb, broadPhase->GetFatAABB(proxyId)) == false)
+		{
+			return true;
+		}
+
+		return callback->QueryCallback(broadPhase->GetUserData(proxyId));
+	}
+
+	const b2GridBroadPhase* broadPhase;
+	const b2AABB* aabb;
+	b2BroadPhaseQueryCallback* callback;
+};
+
+// Collects user data along a segment, one cell at a time. With a sort key the
+// results are kept sorted and the segment is clipped once maxCount results are found.
+struct b2GridSegmentQuery
+{
+	bool QueryCallback(uint32 proxyId)
+	{
+		b2AABB aabb = broadPhase->GetFatAABB(proxyId);
+
+		// Build a bounding box for the clipped segment.
+		b2AABB segmentAABB;
+		b2Vec2 t = p1 + maxFraction * (p2 - p1);
+		segmentAABB.lowerBound = b2Min(p1, t);
+		segmentAABB.upperBound = b2Max(p1, t);
+
+		if (b2TestOverlap(aabb, segmentAABB) == false)
+		{
+			return true;
+		}
+
+		// Separating axis for segment (Gino, p80).
+		// |dot(v, p1 - c)| > dot(|v|, h)
+		b2Vec2 c = aabb.GetCenter();
+		b2Vec2 h = aabb.GetExtents();
+		float32 separation = b2Abs(b2Dot(v, p1 - c)) - b2Dot(abs_v, h);
+		if (separation > 0.0f)
+		{
+			return true;
+		}
+
+		void* proxyUserData = broadPhase->GetUserData(proxyId);
+
+		if (sortKey == NULL)
+		{
+			userData[count++] = proxyUserData;
+			return count < maxCount;
+		}
+
+		float32 key = sortKey(proxyUserData);
+		if (key < 0.0f)
+		{
+			return true;
+		}
+
+		if (count == maxCount && key >= keys[count-1])
+		{
+			return true;
+		}
+
+		// Insertion sort. The last result drops off when full.
+		int32 i = count < maxCount ? count++ : count - 1;
+		while (i > 0 && keys[i-1] > key)
+		{
+			keys[i] = keys[i-1];
+			userData[i] = userData[i-1];
+			--i;
+		}
+		keys[i] = key;
+		userData[i] = proxyUserData;
+
+		if (count == maxCount && keys[count-1] < maxFraction)
+		{
+			maxFraction = keys[count-1];
+		}
+
+		return true;
+	}
+
+	const b2GridBroadPhase* broadPhase;
+	b2Vec2 p1, p2;
+	b2Vec2 v, abs_v;
+	float32 maxFraction;
+	void** userData;
+	float32* keys;
+	int32 maxCount;
+	int32 count;
+	SortKeyFunc sortKey;
+};
+
+b2GridBroadPhase::b2GridBroadPhase(const b2AABB& worldAABB, b2PairCallback* callback, int32 proxyCapacity, float32 cellSize)
+: b2BroadPhase(worldAABB, callback, proxyCapacity)
+{
+	b2Assert(cellSize > 0.0f);
+
+	m_type = e_hashGridBroadPhase;
+	m_cellSize = cellSize;
+	m_invCellSize = 1.0f / cellSize;
+
+	m_proxyCapacity = 0;
+	m_proxies = NULL;
+	m_freeProxy = b2_nullProxy;
+	ReserveProxies(b2Max(proxyCapacity, 1));
+
+	// Most proxies cover a few cells.
+	m_entryCapacity = 4 * m_proxyCapacity;
+	m_entryCount = 0;
+	m_entries = (b2GridEntry*)b2Alloc(m_entryCapacity * sizeof(b2GridEntry));
+	for (int32 i = 0; i < m_entryCapacity - 1; ++i)
+	{
+		m_entries[i].proxyId = b2_nullProxy;
+		m_entries[i].next = uint32(i + 1);
+	}
+	m_entries[m_entryCapacity - 1].proxyId = b2_nullProxy;
+	m_entries[m_entryCapacity - 1].next = b2_nullEntry;
+	m_freeEntry = 0;
+
+	m_bucketCount = 0;
+	m_buckets = NULL;
+	Rehash(b2NextPowerOfTwo(uint32(m_entryCapacity)));
+
+	m_moveCapacity = 16;
+	m_moveCount = 0;
+	m_moveBuffer = (uint32*)b2Alloc(m_moveCapacity * sizeof(uint32));
+}
+
+b2GridBroadPhase::~b2GridBroadPhase()
+{
+	b2Free(m_moveBuffer);
+	b2Free(m_buckets);
+	b2Free(m_entries);
+	b2Free(m_proxies);
+}
+
+void b2GridBroadPhase::ReserveProxies(int32 capacity)
+{
+	b2Assert(capacity > m_proxyCapacity);
+
+	b2GridProxy* oldProxies = m_proxies;
+	m_proxies = (b2GridProxy*)b2Alloc(capacity * sizeof(b2GridProxy));
+	if (oldProxies)
+	{
+		memcpy(m_proxies, oldProxies, m_proxyCapacity * sizeof(b2GridProxy));
+		b2Free(oldProxies);
+	}
+
+	// Thread the new proxies onto the free list.
+	for (int32 i = m_proxyCapacity; i < capacity; ++i)
+	{
+		m_proxies[i].userData = NULL;
+		m_proxies[i].next = uint32(i + 1);
+		m_proxies[i].isStatic = false;
+	}
+	m_proxies[capacity - 1].next = m_freeProxy;
+
+	m_freeProxy = uint32(m_proxyCapacity);
+	m_proxyCapacity = capacity;
+}
+
+void b2GridBroadPhase::ComputeRange(b2GridProxy* proxy) const
+{
+	proxy->lowerX = ComputeCell(proxy->aabb.lowerBound.x);
+	proxy->lowerY = ComputeCell(proxy->aabb.lowerBound.y);
+	proxy->upperX = ComputeCell(proxy->aabb.upperBound.x);
+	proxy->upperY = ComputeCell(proxy->aabb.upperBound.y);
+}
+
+void b2GridBroadPhase::AddEntry(int32 x, int32 y, uint32 proxyId)
+{
+	if (m_freeEntry == b2_nullEntry)
+	{
+		b2GridEntry* oldEntries = m_entries;
+		int32 oldCapacity = m_entryCapacity;
+		m_entryCapacity *= 2;
+		m_entries = (b2GridEntry*)b2Alloc(m_entryCapacity * sizeof(b2GridEntry));
+		memcpy(m_entries, oldEntries, oldCapacity * sizeof(b2GridEntry));
+		b2Free(oldEntries);
+
+		for (int32 i = oldCapacity; i < m_entryCapacity - 1; ++i)
+		{
+			m_entries[i].proxyId = b2_nullProxy;
+			m_entries[i].next = uint32(i + 1);
+		}
+		m_entries[m_entryCapacity - 1].proxyId = b2_nullProxy;
+		m_entries[m_entryCapacity - 1].next = b2_nullEntry;
+		m_freeEntry = uint32(oldCapacity);
+	}
+
+	// Keep the chains short.
+	if (m_entryCount >= 2 * m_bucketCount)
+	{
+		Rehash(2 * m_bucketCount);
+	}
+
+	uint32 e = m_freeEntry;
+	b2GridEntry* entry = m_entries + e;
+	m_freeEntry = entry->next;
+
+	uint32 bucket = Hash(x, y);
+	entry->x = x;
+	entry->y = y;
+	entry->proxyId = proxyId;
+	entry->next = m_buckets[bucket];
+	m_buckets[bucket] = e;
+	++m_entryCount;
+}
+
+void b2GridBroadPhase::RemoveEntry(int32 x, int32 y, uint32 proxyId)
+{
+	uint32* link = m_buckets + Hash(x, y);
+	while (*link != b2_nullEntry)
+	{
+		b2GridEntry* entry = m_entries + *link;
+		if (entry->proxyId == proxyId && entry->x == x && entry->y == y)
+		{
+			uint32 e = *link;
+			*link = entry->next;
+
+			entry->proxyId = b2_nullProxy;
+			entry->next = m_freeEntry;
+			m_freeEntry = e;
+			--m_entryCount;
+			return;
+		}
+
+		link = &entry->next;
+	}
+
+	b2Assert(false);
+}
+
+void b2GridBroadPhase::Rehash(int32 bucketCount)
+{
+	b2Assert(bucketCount > 0 && (bucketCount & (bucketCount - 1)) == 0);
+
+	b2Free(m_buckets);
+	m_bucketCount = bucketCount;
+	m_buckets = (uint32*)b2Alloc(m_bucketCount * sizeof(uint32));
+	for (int32 i = 0; i < m_bucketCount; ++i)
+	{
+		m_buckets[i] = b2_nullEntry;
+	}
+
+	for (int32 i = 0; i < m_entryCapacity; ++i)
+	{
+		b2GridEntry* entry = m_entries + i;
+		if (entry->proxyId == b2_nullProxy)
+		{
+			continue;
+		}
+
+		uint32 bucket = Hash(entry->x, entry->y);
+		entry->next = m_buckets[bucket];
+		m_buckets[bucket] = uint32(i);
+	}
+}
+
+uint32 b2GridBroadPhase::CreateProxy(const b2AABB& aabb, void* userData, bool isStatic)
+{
+	if (m_freeProxy == b2_nullProxy)
+	{
+		ReserveProxies(2 * m_proxyCapacity);
+	}
+
+	uint32 proxyId = m_freeProxy;
+	b2GridProxy* proxy = m_proxies + proxyId;
+	m_freeProxy = proxy->next;
+
+	b2Vec2 r(b2_aabbExtension, b2_aabbExtension);
+	proxy->aabb.lowerBound = aabb.lowerBound - r;
+	proxy->aabb.upperBound = aabb.upperBound + r;
+	proxy->userData = userData;
+	proxy->next = b2_nullProxy;
+	proxy->isStatic = isStatic;
+	ComputeRange(proxy);
+
+	for (int32 y = proxy->lowerY; y <= proxy->upperY; ++y)
+	{
+		for (int32 x = proxy->lowerX; x <= proxy->upperX; ++x)
+		{
+			AddEntry(x, y, proxyId);
+		}
+	}
+
+	++m_proxyCount;
+
+	// Pairs are found in the next Commit.
+	BufferMove(proxyId);
+	return proxyId;
+}
+
+void b2GridBroadPhase::DestroyProxy(uint32 proxyId)
+{
+	b2Assert(m_proxyCount > 0);
+	b2Assert(proxyId < uint32(m_proxyCapacity));
+	b2GridProxy* proxy = m_proxies + proxyId;
+
+	// Every live pair of this proxy shares a cell with it.
+	b2GridRemoveQuery removeQuery;
+	removeQuery.broadPhase = this;
+	removeQuery.queryProxyId = proxyId;
+	removeQuery.fatAABB = NULL;
+	QueryCells(&removeQuery, proxy->lowerX, proxy->lowerY, proxy->upperX, proxy->upperY);
+
+	m_pairManager.Commit();
+
+	UnBufferMove(proxyId);
+
+	for (int32 y = proxy->lowerY; y <= proxy->upperY; ++y)
+	{
+		for (int32 x = proxy->lowerX; x <= proxy->upperX; ++x)
+		{
+			RemoveEntry(x, y, proxyId);
+		}
+	}
+
+	proxy->userData = NULL;
+	proxy->next = m_freeProxy;
+	proxy->isStatic = false;
+	m_freeProxy = proxyId;
+	--m_proxyCount;
+}
+
+void b2GridBroadPhase::MoveProxy(uint32 proxyId, const b2AABB& aabb)
+{
+	if (aabb.IsValid() == false)
+	{
+		b2Assert(false);
+		return;
+	}
+
+	b2Assert(proxyId < uint32(m_proxyCapacity));
+	b2GridProxy* proxy = m_proxies + proxyId;
+
+	if (proxy->aabb.Contains(aabb))
+	{
+		return;
+	}
+
+	int32 oldLowerX = proxy->lowerX;
+	int32 oldLowerY = proxy->lowerY;
+	int32 oldUpperX = proxy->upperX;
+	int32 oldUpperY = proxy->upperY;
+
+	b2Vec2 r(b2_aabbExtension, b2_aabbExtension);
+	proxy->aabb.lowerBound = aabb.lowerBound - r;
+	proxy->aabb.upperBound = aabb.upperBound + r;
+	ComputeRange(proxy);
+
+	// Drop the pairs that the new fat AABB left behind.
+	b2GridRemoveQuery removeQuery;
+	removeQuery.broadPhase = this;
+	removeQuery.queryProxyId = proxyId;
+	removeQuery.fatAABB = &proxy->aabb;
+	QueryCells(&removeQuery, oldLowerX, oldLowerY, oldUpperX, oldUpperY);
+
+	// Only touch the cells that were left or entered.
+	for (int32 y = oldLowerY; y <= oldUpperY; ++y)
+	{
+		for (int32 x = oldLowerX; x <= oldUpperX; ++x)
+		{
+			if (x < proxy->lowerX || proxy->upperX < x || y < proxy->lowerY || proxy->upperY < y)
+			{
+				RemoveEntry(x, y, proxyId);
+			}
+		}
+	}
+
+	for (int32 y = proxy->lowerY; y <= proxy->upperY; ++y)
+	{
+		for (int32 x = proxy->lowerX; x <= proxy->upperX; ++x)
+		{
+			if (x < oldLowerX || oldUpperX < x || y < oldLowerY || oldUpperY < y)
+			{
+				AddEntry(x, y, proxyId);
+			}
+		}
+	}
+
+	BufferMove(proxyId);
+}
+
+void b2GridBroadPhase::SetProxyStatic(uint32 proxyId, bool isStatic)
+{
+	b2Assert(proxyId < uint32(m_proxyCapacity));
+	b2GridProxy* proxy = m_proxies + proxyId;
+	if (proxy->isStatic == isStatic)
+	{
+		return;
+	}
+
+	proxy->isStatic = isStatic;
+
+	if (isStatic == false)
+	{
+		// Pick up the static proxies that were skipped while this one was static.
+		BufferMove(proxyId);
+	}
+}
+
+void b2GridBroadPhase::Commit()
+{
+	// Find the pairs of the moved proxies.
+	b2GridPairQuery pairQuery;
+	pairQuery.broadPhase = this;
+
+	for (int32 i = 0; i < m_moveCount; ++i)
+	{
+		uint32 proxyId = m_moveBuffer[i];
+		if (proxyId == b2_nullProxy)
+		{
+			continue;
+		}
+
+		const b2GridProxy* proxy = m_proxies + proxyId;
+		pairQuery.queryProxyId = proxyId;
+		pairQuery.fatAABB = &proxy->aabb;
+		pairQuery.isStatic = proxy->isStatic;
+		QueryCells(&pairQuery, proxy->lowerX, proxy->lowerY, proxy->upperX, proxy->upperY);
+	}
+
+	m_moveCount = 0;
+
+	m_pairManager.Commit();
+
+	if (s_validate)
+	{
+		Validate();
+	}
+}
+
+int32 b2GridBroadPhase::Query(const b2AABB& aabb, void** userData, int32 maxCount)
+{
+	if (maxCount <= 0)
+	{
+		return 0;
+	}
+
+	b2GridUserQuery userQuery;
+	userQuery.broadPhase = this;
+	userQuery.aabb = &aabb;
+	userQuery.userData = userData;
+	userQuery.maxCount = maxCount;
+	userQuery.count = 0;
+
+	QueryCells(&userQuery, ComputeCell(aabb.lowerBound.x), ComputeCell(aabb.lowerBound.y),
+		ComputeCell(aabb.upperBound.x), ComputeCell(aabb.upperBound.y));
+
+	return userQuery.count;
+}
+
+void b2GridBroadPhase::Query(b2BroadPhaseQueryCallback* callback, const b2AABB& aabb)
+{
+	b2GridCallbackQuery callbackQuery;
+	callbackQuery.broadPhase = this;
+	callbackQuery.aabb = &aabb;
+	callbackQuery.callback = callback;
+
+	QueryCells(&callbackQuery, ComputeCell(aabb.lowerBound.x), ComputeCell(aabb.lowerBound.y),
+		ComputeCell(aabb.upperBound.x), ComputeCell(aabb.upperBound.y));
+}
+
+int32 b2GridBroadPhase::QuerySegment(const b2Segment& segment, void** userData, int32 maxCount, SortKeyFunc sortKey)
+{
+	if (maxCount <= 0)
+	{
+		return 0;
+	}
+
+	b2Vec2 p1 = segment.p1;
+	b2Vec2 p2 = segment.p2;
+	b2Vec2 d = p2 - p1;
+	b2Vec2 r = d;
+	b2Assert(r.LengthSquared() > 0.0f);
+	r.Normalize();
+
+	b2GridSegmentQuery segmentQuery;
+	segmentQuery.broadPhase = this;
+	segmentQuery.p1 = p1;
+	segmentQuery.p2 = p2;
+	segmentQuery.v = b2Cross(1.0f, r);
+	segmentQuery.abs_v = b2Abs(segmentQuery.v);
+	segmentQuery.maxFraction = 1.0f;
+	segmentQuery.userData = userData;
+	segmentQuery.keys = NULL;
+	segmentQuery.maxCount = maxCount;
+	segmentQuery.count = 0;
+	segmentQuery.sortKey = sortKey;
+
+	if (sortKey)
+	{
+		segmentQuery.keys = (float32*)b2Alloc(maxCount * sizeof(float32));
+	}
+
+	// Walk the cells along the segment (Amanatides and Woo). tMax is the fraction
+	// where the segment crosses the next cell boundary and tDelta is the fraction
+	// covered by one cell.
+	int32 x = ComputeCell(p1.x);
+	int32 y = ComputeCell(p1.y);
+	int32 endX = ComputeCell(p2.x);
+	int32 endY = ComputeCell(p2.y);
+
+	int32 stepX = 0, stepY = 0;
+	float32 tMaxX = B2_FLT_MAX, tMaxY = B2_FLT_MAX;
+	float32 tDeltaX = B2_FLT_MAX, tDeltaY = B2_FLT_MAX;
+
+	if (d.x > 0.0f)
+	{
+		stepX = 1;
+		tDeltaX = m_cellSize / d.x;
+		tMaxX = (m_cellSize * (x + 1) - p1.x) / d.x;
+	}
+	else if (d.x < 0.0f)
+	{
+		stepX = -1;
+		tDeltaX = -m_cellSize / d.x;
+		tMaxX = (m_cellSize * x - p1.x) / d.x;
+	}
+
+	if (d.y > 0.0f)
+	{
+		stepY = 1;
+		tDeltaY = m_cellSize / d.y;
+		tMaxY = (m_cellSize * (y + 1) - p1.y) / d.y;
+	}
+	else if (d.y < 0.0f)
+	{
+		stepY = -1;
+		tDeltaY = -m_cellSize / d.y;
+		tMaxY = (m_cellSize * y - p1.y) / d.y;
+	}
+
+	// Every proxy crossing the segment covers a cell along the way. The walk is
+	// monotone, so the cells a proxy shares with it are contiguous and a proxy is
+	// reported in the first of them.
+	int32 prevX = x, prevY = y;
+	for (;;)
+	{
+		bool proceed = QueryCell(&segmentQuery, x, y, prevX, prevY);
+		if (proceed == false)
+		{
+			break;
+		}
+
+		if (x == endX && y == endY)
+		{
+			break;
+		}
+
+		prevX = x;
+		prevY = y;
+
+		float32 t;
+		if (tMaxX < tMaxY)
+		{
+			t = tMaxX;
+			tMaxX += tDeltaX;
+			x += stepX;
+		}
+		else
+		{
+			t = tMaxY;
+			tMaxY += tDeltaY;
+			y += stepY;
+		}
+
+		// The sort keys clip the segment.
+		if (t > segmentQuery.maxFraction)
+		{
+			break;
+		}
+	}
+
+	b2Free(segmentQuery.keys);
+
+	return segmentQuery.count;
+}
+
+void b2GridBroadPhase::Validate()
+{
+	int32 entryCount = 0;
+	for (int32 i = 0; i < m_entryCapacity; ++i)
+	{
+		const b2GridEntry* entry = m_entries + i;
+		if (entry->proxyId == b2_nullProxy)
+		{
+			continue;
+		}
+
+		const b2GridProxy* proxy = m_proxies + entry->proxyId;
+		b2Assert(proxy->lowerX <= entry->x && entry->x <= proxy->upperX);
+		b2Assert(proxy->lowerY <= entry->y && entry->y <= proxy->upperY);
+		++entryCount;
+	}
+
+	b2Assert(entryCount == m_entryCount);
+
+	int32 chainCount = 0;
+	for (int32 i = 0; i < m_bucketCount; ++i)
+	{
+		for (uint32 e = m_buckets[i]; e != b2_nullEntry; e = m_entries[e].next)
+		{
+			b2Assert(Hash(m_entries[e].x, m_entries[e].y) == uint32(i));
+			++chainCount;
+		}
+	}
+
+	b2Assert(chainCount == m_entryCount);
+}
+
+void b2GridBroadPhase::BufferMove(uint32 proxyId)
+{
+	if (m_moveCount == m_moveCapacity)
+	{
+		uint32* oldBuffer = m_moveBuffer;
+		m_moveCapacity *= 2;
+		m_moveBuffer = (uint32*)b2Alloc(m_moveCapacity * sizeof(uint32));
+		memcpy(m_moveBuffer, oldBuffer, m_moveCount * sizeof(uint32));
+		b2Free(oldBuffer);
+	}
+
+	m_moveBuffer[m_moveCount] = proxyId;
+	++m_moveCount;
+}
+
+void b2GridBroadPhase::UnBufferMove(uint32 proxyId)
+{
+	for (int32 i = 0; i < m_moveCount; ++i)
+	{
+		if (m_moveBuffer[i] == proxyId)
+		{
+			m_moveBuffer[i] = b2_nullProxy;
+		}
+	}
+}
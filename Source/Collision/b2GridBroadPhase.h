@@ -0,0 +1,235 @@
+/*
+* Copyright (c) 2009 Erin Catto http://www.gphysics.com
+*
+* This software is provided 'as-is', without any express or implied
+* warranty.  In no event will the authors be held liable for any damages
+* arising from the use of this software.
+* Permission is granted to anyone to use this software for any purpose,
+* including commercial applications, and to alter it and redistribute it
+* freely, subject to the following restrictions:
+* 1. The origin of this software must not be misrepresented; you must not
+* claim that you wrote the original software. If you use this software
+* in a product, an acknowledgment in the product documentation would be
+* appreciated but is not required.
+* 2. Altered source versions must be plainly marked as such, and must not be
+* misrepresented as being the original software.
+* 3. This notice may not be removed or altered from any source distribution.
+*/
+
+#ifndef B2_GRID_BROAD_PHASE_H
+#define B2_GRID_BROAD_PHASE_H
+
+#include "b2BroadPhase.h"
+
+const uint32 b2_nullEntry = UINT_MAX;
+
+struct b2GridProxy
+{
+	b2AABB aabb;			///< fat AABB
+	void* userData;
+	int32 lowerX, lowerY;	///< cell range covered by the fat AABB
+	int32 upperX, upperY;
+	uint32 next;			///< next free proxy
+	bool isStatic;
+};
+
+/// A proxy registered in one grid cell. Entries of cells with the same hash
+/// are chained in a bucket.
+struct b2GridEntry
+{
+	int32 x, y;
+	uint32 proxyId;			///< b2_nullProxy for a free entry
+	uint32 next;			///< next entry in the bucket, or next free entry
+};
+
+/// Broad-phase backed by a hashed uniform grid. Each proxy is registered in every
+/// cell its fat AABB covers, and the cells are stored in a hash table, so the grid
+/// is unbounded. Proxies that leave their fat AABB only touch the cells they
+/// enter or leave, which makes updates O(1) when the proxies are about the size
+/// of a cell. Use this for dense scenes of similar-sized objects. Large proxies
+/// cover many cells and should be rare.
+///
+/// Like the tree broad-phase, moved proxies are buffered and Commit finds their
+/// new pairs. Static proxies never pair with each other.
+class b2GridBroadPhase : public b2BroadPhase
+{
+public:
+	/// @param cellSize the size of a grid cell. This should be about the size
+	/// of a typical proxy.
+	b2GridBroadPhase(const b2AABB& worldAABB, b2PairCallback* callback, int32 proxyCapacity = b2_proxyPoolSize, float32 cellSize = 2.0f);
+	~b2GridBroadPhase();
+
+	uint32 CreateProxy(const b2AABB& aabb, void* userData, bool isStatic);
+	void DestroyProxy(uint32 proxyId);
+	void MoveProxy(uint32 proxyId, const b2AABB& aabb);
+	void Commit();
+	void SetProxyStatic(uint32 proxyId, bool isStatic);
+
+	void* GetUserData(uint32 proxyId) const;
+	b2AABB GetFatAABB(uint32 proxyId) const;
+	bool TestOverlap(uint32 proxyId1, uint32 proxyId2) const;
+
+	int32 Query(const b2AABB& aabb, void** userData, int32 maxCount);
+	void Query(b2BroadPhaseQueryCallback* callback, const b2AABB& aabb);
+	int32 QuerySegment(const b2Segment& segment, void** userData, int32 maxCount, SortKeyFunc sortKey);
+
+	int32 GetProxyCapacity() const;
+
+	void Validate();
+
+	/// Get the size of a grid cell.
+	float32 GetCellSize() const;
+
+	/// Get the number of cell entries. Each proxy has one entry per covered cell.
+	int32 GetEntryCount() const;
+
+	/// Query the cells in a range and call callback->QueryCallback(proxyId) once for
+	/// every proxy registered in them. Stop when the callback returns false.
+	/// This does not write to the broad-phase, so queries may run concurrently.
+	template <typename T>
+	void QueryCells(T* callback, int32 lowerX, int32 lowerY, int32 upperX, int32 upperY) const;
+
+private:
+	friend struct b2GridPairQuery;
+	friend struct b2GridRemoveQuery;
+
+	int32 ComputeCell(float32 x) const;
+	uint32 Hash(int32 x, int32 y) const;
+	void ComputeRange(b2GridProxy* proxy) const;
+
+	template <typename T>
+	bool QueryCell(T* callback, int32 x, int32 y, int32 prevX, int32 prevY) const;
+
+	void ReserveProxies(int32 capacity);
+	void AddEntry(int32 x, int32 y, uint32 proxyId);
+	void RemoveEntry(int32 x, int32 y, uint32 proxyId);
+	void Rehash(int32 bucketCount);
+
+	void BufferMove(uint32 proxyId);
+	void UnBufferMove(uint32 proxyId);
+
+	float32 m_cellSize;
+	float32 m_invCellSize;
+
+	b2GridProxy* m_proxies;
+	int32 m_proxyCapacity;
+	uint32 m_freeProxy;
+
+	b2GridEntry* m_entries;
+	int32 m_entryCapacity;
+	int32 m_entryCount;
+	uint32 m_freeEntry;
+
+	uint32* m_buckets;
+	int32 m_bucketCount;
+
+	uint32* m_moveBuffer;
+	int32 m_moveCapacity;
+	int32 m_moveCount;
+};
+
+inline void* b2GridBroadPhase::GetUserData(uint32 proxyId) const
+{
+	b2Assert(proxyId < uint32(m_proxyCapacity));
+	return m_proxies[proxyId].userData;
+}
+
+inline b2AABB b2GridBroadPhase::GetFatAABB(uint32 proxyId) const
+{
+	b2Assert(proxyId < uint32(m_proxyCapacity));
+	return m_proxies[proxyId].aabb;
+}
+
+inline bool b2GridBroadPhase::TestOverlap(uint32 proxyId1, uint32 proxyId2) const
+{
+	return b2TestOverlap(m_proxies[proxyId1].aabb, m_proxies[proxyId2].aabb);
+}
+
+inline int32 b2GridBroadPhase::GetProxyCapacity() const
+{
+	return m_proxyCapacity;
+}
+
+inline float32 b2GridBroadPhase::GetCellSize() const
+{
+	return m_cellSize;
+}
+
+inline int32 b2GridBroadPhase::GetEntryCount() const
+{
+	return m_entryCount;
+}
+
+inline int32 b2GridBroadPhase::ComputeCell(float32 x) const
+{
+	// Round toward negative infinity.
+	float32 t = x * m_invCellSize;
+	int32 i = int32(t);
+	if (t < float32(i))
+	{
+		--i;
+	}
+	return i;
+}
+
+inline uint32 b2GridBroadPhase::Hash(int32 x, int32 y) const
+{
+	uint32 h = (uint32(x) * 73856093) ^ (uint32(y) * 19349663);
+	return h & uint32(m_bucketCount - 1);
+}
+
+// A proxy covering several cells is reported once, in the first visited cell it
+// covers. The walks visit cells in x and y order, so a proxy that also covers the
+// previous column (prevX, y) or the previous row (x, prevY) was already reported.
+// Pass prevX == x or prevY == y when there is no previous column or row.
+template <typename T>
+inline bool b2GridBroadPhase::QueryCell(T* callback, int32 x, int32 y, int32 prevX, int32 prevY) const
+{
+	for (uint32 e = m_buckets[Hash(x, y)]; e != b2_nullEntry; e = m_entries[e].next)
+	{
+		const b2GridEntry* entry = m_entries + e;
+		if (entry->x != x || entry->y != y)
+		{
+			continue;
+		}
+
+		const b2GridProxy* proxy = m_proxies + entry->proxyId;
+		if (prevX != x && proxy->lowerX <= prevX && prevX <= proxy->upperX)
+		{
+			continue;
+		}
+
+		if (prevY != y && proxy->lowerY <= prevY && prevY <= proxy->upperY)
+		{
+			continue;
+		}
+
+		bool proceed = callback->QueryCallback(entry->proxyId);
+		if (proceed == false)
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+template <typename T>
+inline void b2GridBroadPhase::QueryCells(T* callback, int32 lowerX, int32 lowerY, int32 upperX, int32 upperY) const
+{
+	for (int32 y = lowerY; y <= upperY; ++y)
+	{
+		int32 prevY = y > lowerY ? y - 1 : y;
+		for (int32 x = lowerX; x <= upperX; ++x)
+		{
+			int32 prevX = x > lowerX ? x - 1 : x;
+			bool proceed = QueryCell(callback, x, y, prevX, prevY);
+			if (proceed == false)
+			{
+				return;
+			}
+		}
+	}
+}
+
+#endif
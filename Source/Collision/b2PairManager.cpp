@@ -20,12 +20,13 @@
 #include "b2BroadPhase.h"
 
 #include <algorithm>
+#include <cstring>
 
 // Thomas Wang's hash, see: http://www.concentric.net/~Ttwang/tech/inthash.htm
-// This assumes proxyId1 and proxyId2 are 16-bit.
+// The second id is rotated by 16 bits so that ids below 2^16 pack without collisions.
 inline uint32 Hash(uint32 proxyId1, uint32 proxyId2)
 {
-	uint32 key = (proxyId2 << 16) | proxyId1;
+	uint32 key = ((proxyId2 << 16) | (proxyId2 >> 16)) ^ proxyId1;
 	key = ~key + (key << 15);
 	key = key ^ (key >> 12);
 	key = key + (key << 2);
@@ -35,7 +36,7 @@ inline uint32 Hash(uint32 proxyId1, uint32 proxyId2)
 	return key;
 }
 
-inline bool Equals(const b2Pair& pair, int32 proxyId1, int32 proxyId2)
+inline bool Equals(const b2Pair& pair, uint32 proxyId1, uint32 proxyId2)
 {
 	return pair.proxyId1 == proxyId1 && pair.proxyId2 == proxyId2;
 }
@@ -64,131 +65,270 @@ inline bool operator < (const b2BufferedPair& pair1, const b2BufferedPair& pair2
 
 b2PairManager::b2PairManager()
 {
-	b2Assert(b2IsPowerOfTwo(b2_tableCapacity) == true);
-	b2Assert(b2_tableCapacity >= b2_maxPairs);
-	for (int32 i = 0; i < b2_tableCapacity; ++i)
+	m_broadPhase = NULL;
+	m_callback = NULL;
+	m_pairs = NULL;
+	m_pairCapacity = 0;
+	m_freePair = b2_nullPair;
+	m_pairCount = 0;
+	m_peakPairCount = 0;
+	m_pairBuffer = NULL;
+	m_pairBufferCount = 0;
+	m_table = NULL;
+	m_tableCapacity = 0;
+	m_tableMask = 0;
+}
+
+b2PairManager::~b2PairManager()
+{
+	b2Free(m_pairs);
+	b2Free(m_pairBuffer);
+	b2Free(m_table);
+}
+
+void b2PairManager::Initialize(b2BroadPhase* broadPhase, b2PairCallback* callback, int32 pairCapacity)
+{
+	b2Assert(pairCapacity > 0);
+
+	m_broadPhase = broadPhase;
+	m_callback = callback;
+
+	uint32 capacity = uint32(pairCapacity);
+	if (b2IsPowerOfTwo(capacity) == false)
+	{
+		capacity = b2NextPowerOfTwo(capacity);
+	}
+
+	ReservePairs(int32(capacity));
+	Rehash(2 * int32(capacity));
+}
+
+// Grow the pair storage. Pair indices remain valid, so the table, the buffered
+// pairs, and the free list carry over.
+void b2PairManager::ReservePairs(int32 newCapacity)
+{
+	b2Assert(b2IsPowerOfTwo(newCapacity) == true);
+	b2Assert(m_pairCapacity < newCapacity && newCapacity <= INT_MAX / 2);
+
+	int32 oldCapacity = m_pairCapacity;
+
+	b2Pair* oldPairs = m_pairs;
+	m_pairs = (b2Pair*)b2Alloc(newCapacity * sizeof(b2Pair));
+	if (oldPairs != NULL)
+	{
+		memcpy(m_pairs, oldPairs, oldCapacity * sizeof(b2Pair));
+		b2Free(oldPairs);
+	}
+
+	b2BufferedPair* oldBuffer = m_pairBuffer;
+	m_pairBuffer = (b2BufferedPair*)b2Alloc(newCapacity * sizeof(b2BufferedPair));
+	if (oldBuffer != NULL)
 	{
-		m_hashTable[i] = b2_nullPair;
+		memcpy(m_pairBuffer, oldBuffer, m_pairBufferCount * sizeof(b2BufferedPair));
+		b2Free(oldBuffer);
 	}
-	m_freePair = 0;
-	for (int32 i = 0; i < b2_maxPairs; ++i)
+
+	// Chain the new pairs in front of the free list.
+	for (int32 i = oldCapacity; i < newCapacity - 1; ++i)
 	{
 		m_pairs[i].proxyId1 = b2_nullProxy;
 		m_pairs[i].proxyId2 = b2_nullProxy;
 		m_pairs[i].userData = NULL;
 		m_pairs[i].status = 0;
-		m_pairs[i].next = uint16(i + 1);
+		m_pairs[i].next = uint32(i + 1);
 	}
-	m_pairs[b2_maxPairs-1].next = b2_nullPair;
-	m_pairCount = 0;
-	m_pairBufferCount = 0;
+	m_pairs[newCapacity-1].proxyId1 = b2_nullProxy;
+	m_pairs[newCapacity-1].proxyId2 = b2_nullProxy;
+	m_pairs[newCapacity-1].userData = NULL;
+	m_pairs[newCapacity-1].status = 0;
+	m_pairs[newCapacity-1].next = m_freePair;
+	m_freePair = uint32(oldCapacity);
+
+	m_pairCapacity = newCapacity;
 }
 
-void b2PairManager::Initialize(b2BroadPhase* broadPhase, b2PairCallback* callback)
+// Rebuild the table with a new capacity. The stored hashes avoid rehashing the keys.
+void b2PairManager::Rehash(int32 tableCapacity)
 {
-	m_broadPhase = broadPhase;
-	m_callback = callback;
-}
+	b2Assert(b2IsPowerOfTwo(tableCapacity) == true);
+	b2Assert(2 * m_pairCount <= tableCapacity);
 
-b2Pair* b2PairManager::Find(int32 proxyId1, int32 proxyId2, uint32 hash)
-{
-	int32 index = m_hashTable[hash];
+	b2PairSlot* oldTable = m_table;
+	int32 oldCapacity = m_tableCapacity;
 
-	while (index != b2_nullPair && Equals(m_pairs[index], proxyId1, proxyId2) == false)
+	m_tableCapacity = tableCapacity;
+	m_tableMask = uint32(tableCapacity - 1);
+	m_table = (b2PairSlot*)b2Alloc(m_tableCapacity * sizeof(b2PairSlot));
+	for (int32 i = 0; i < m_tableCapacity; ++i)
 	{
-		index = m_pairs[index].next;
+		m_table[i].pairIndex = b2_nullPair;
 	}
 
-	if (index == b2_nullPair)
+	for (int32 i = 0; i < oldCapacity; ++i)
 	{
-		return NULL;
+		const b2PairSlot& oldSlot = oldTable[i];
+		if (oldSlot.pairIndex == b2_nullPair)
+		{
+			continue;
+		}
+
+		uint32 slot = oldSlot.hash & m_tableMask;
+		while (m_table[slot].pairIndex != b2_nullPair)
+		{
+			slot = (slot + 1) & m_tableMask;
+		}
+		m_table[slot] = oldSlot;
 	}
 
-	b2Assert(index < b2_maxPairs);
+	b2Free(oldTable);
+}
 
-	return m_pairs + index;
+// Returns the slot holding the pair, or the empty slot that ends its probe sequence.
+// The table is never more than half full, so the probe always ends.
+inline uint32 b2PairManager::FindSlot(uint32 proxyId1, uint32 proxyId2, uint32 hash) const
+{
+	uint32 slot = hash & m_tableMask;
+	for (;;)
+	{
+		const b2PairSlot& s = m_table[slot];
+		if (s.pairIndex == b2_nullPair)
+		{
+			return slot;
+		}
+
+		if (s.hash == hash && Equals(m_pairs[s.pairIndex], proxyId1, proxyId2))
+		{
+			return slot;
+		}
+
+		slot = (slot + 1) & m_tableMask;
+	}
 }
 
-b2Pair* b2PairManager::Find(int32 proxyId1, int32 proxyId2)
+b2Pair* b2PairManager::Find(uint32 proxyId1, uint32 proxyId2)
 {
 	if (proxyId1 > proxyId2) b2Swap(proxyId1, proxyId2);
 
-	int32 hash = Hash(proxyId1, proxyId2) & b2_tableMask;
+	uint32 slot = FindSlot(proxyId1, proxyId2, Hash(proxyId1, proxyId2));
+	uint32 index = m_table[slot].pairIndex;
 
-	return Find(proxyId1, proxyId2, hash);
+	if (index == b2_nullPair)
+	{
+		return NULL;
+	}
+
+	b2Assert(index < uint32(m_pairCapacity));
+
+	return m_pairs + index;
 }
 
 // Returns existing pair or creates a new one.
-b2Pair* b2PairManager::AddPair(int32 proxyId1, int32 proxyId2)
+b2Pair* b2PairManager::AddPair(uint32 proxyId1, uint32 proxyId2)
 {
 	if (proxyId1 > proxyId2) b2Swap(proxyId1, proxyId2);
 
-	int32 hash = Hash(proxyId1, proxyId2) & b2_tableMask;
+	uint32 hash = Hash(proxyId1, proxyId2);
+	uint32 slot = FindSlot(proxyId1, proxyId2, hash);
 
-	b2Pair* pair = Find(proxyId1, proxyId2, hash);
-	if (pair != NULL)
+	if (m_table[slot].pairIndex != b2_nullPair)
 	{
-		return pair;
+		return m_pairs + m_table[slot].pairIndex;
 	}
 
-	b2Assert(m_pairCount < b2_maxPairs && m_freePair != b2_nullPair);
+	if (m_freePair == b2_nullPair)
+	{
+		ReservePairs(2 * m_pairCapacity);
+	}
+
+	// Keep the load factor at or below one half, so the probes stay short.
+	if (2 * (m_pairCount + 1) > m_tableCapacity)
+	{
+		Rehash(2 * m_tableCapacity);
+		slot = FindSlot(proxyId1, proxyId2, hash);
+	}
+
+	b2Assert(m_pairCount < m_pairCapacity && m_freePair != b2_nullPair);
 
-	uint16 pairIndex = m_freePair;
-	pair = m_pairs + pairIndex;
+	uint32 pairIndex = m_freePair;
+	b2Pair* pair = m_pairs + pairIndex;
 	m_freePair = pair->next;
 
-	pair->proxyId1 = (uint16)proxyId1;
-	pair->proxyId2 = (uint16)proxyId2;
+	pair->proxyId1 = proxyId1;
+	pair->proxyId2 = proxyId2;
 	pair->status = 0;
 	pair->userData = NULL;
-	pair->next = m_hashTable[hash];
+	pair->next = b2_nullPair;
 
-	m_hashTable[hash] = pairIndex;
+	m_table[slot].hash = hash;
+	m_table[slot].pairIndex = pairIndex;
 
 	++m_pairCount;
+	m_peakPairCount = b2Max(m_peakPairCount, m_pairCount);
 
 	return pair;
 }
 
 // Removes a pair. The pair must exist.
-void* b2PairManager::RemovePair(int32 proxyId1, int32 proxyId2)
+void* b2PairManager::RemovePair(uint32 proxyId1, uint32 proxyId2)
 {
 	b2Assert(m_pairCount > 0);
 
 	if (proxyId1 > proxyId2) b2Swap(proxyId1, proxyId2);
 
-	int32 hash = Hash(proxyId1, proxyId2) & b2_tableMask;
+	uint32 hole = FindSlot(proxyId1, proxyId2, Hash(proxyId1, proxyId2));
+	uint32 index = m_table[hole].pairIndex;
+	b2Assert(index != b2_nullPair);
+
+	b2Pair* pair = m_pairs + index;
+	void* userData = pair->userData;
+
+	// Scrub
+	pair->next = m_freePair;
+	pair->proxyId1 = b2_nullProxy;
+	pair->proxyId2 = b2_nullProxy;
+	pair->userData = NULL;
+	pair->status = 0;
+
+	m_freePair = index;
+	--m_pairCount;
 
-	uint16* node = &m_hashTable[hash];
-	while (*node != b2_nullPair)
+	// Backward shift deletion. Pull later slots of the cluster into the hole
+	// unless that would move them in front of their home slot. This keeps every
+	// probe sequence unbroken without tombstones.
+	uint32 slot = (hole + 1) & m_tableMask;
+	while (m_table[slot].pairIndex != b2_nullPair)
 	{
-		if (Equals(m_pairs[*node], proxyId1, proxyId2))
+		uint32 home = m_table[slot].hash & m_tableMask;
+		if (((slot - home) & m_tableMask) >= ((slot - hole) & m_tableMask))
 		{
-			uint16 index = *node;
-			*node = m_pairs[*node].next;
-			
-			b2Pair* pair = m_pairs + index;
-			void* userData = pair->userData;
-
-			// Scrub
-			pair->next = m_freePair;
-			pair->proxyId1 = b2_nullProxy;
-			pair->proxyId2 = b2_nullProxy;
-			pair->userData = NULL;
-			pair->status = 0;
-
-			m_freePair = index;
-			--m_pairCount;
-			return userData;
+			m_table[hole] = m_table[slot];
+			hole = slot;
 		}
-		else
+		slot = (slot + 1) & m_tableMask;
+	}
+	m_table[hole].pairIndex = b2_nullPair;
+
+	return userData;
+}
+
+float32 b2PairManager::ComputeAverageProbeLength() const
+{
+	if (m_pairCount == 0)
+	{
+		return 0.0f;
+	}
+
+	int32 probeCount = 0;
+	for (int32 i = 0; i < m_tableCapacity; ++i)
+	{
+		const b2PairSlot& s = m_table[i];
+		if (s.pairIndex != b2_nullPair)
 		{
-			node = &m_pairs[*node].next;
+			probeCount += int32((uint32(i) - s.hash) & m_tableMask) + 1;
 		}
 	}
 
-	b2Assert(false);
-	return NULL;
+	return float32(probeCount) / float32(m_pairCount);
 }
 
 /*
@@ -205,20 +345,25 @@ may be harmed if pairs are added and removed within the same time step.
 Buffer a pair for addition.
 We may add a pair that is not in the pair manager or pair buffer.
 We may add a pair that is already in the pair manager and pair buffer.
-If the added pair is not a new pair, then it must be in the pair buffer (because RemovePair was called).
+If the added pair is not a new pair, then it must be in the pair buffer (because RemovePair was called)
+or it must be a final pair that is still overlapping. Broad-phases that re-query
+moved proxies may report a final pair again.
 */
-void b2PairManager::AddBufferedPair(int32 id1, int32 id2)
+void b2PairManager::AddBufferedPair(uint32 id1, uint32 id2)
 {
 	b2Assert(id1 != b2_nullProxy && id2 != b2_nullProxy);
-	b2Assert(m_pairBufferCount < b2_maxPairs);
 
+	// This may grow the pair storage, which also grows the pair buffer.
 	b2Pair* pair = AddPair(id1, id2);
 
 	// If this pair is not in the pair buffer ...
 	if (pair->IsBuffered() == false)
 	{
-		// This must be a newly added pair.
-		b2Assert(pair->IsFinal() == false);
+		// An existing pair that is still overlapping needs no work.
+		if (pair->IsFinal() == true)
+		{
+			return;
+		}
 
 		// Add it to the pair buffer.
 		pair->SetBuffered();
@@ -239,10 +384,9 @@ void b2PairManager::AddBufferedPair(int32 id1, int32 id2)
 }
 
 // Buffer a pair for removal.
-void b2PairManager::RemoveBufferedPair(int32 id1, int32 id2)
+void b2PairManager::RemoveBufferedPair(uint32 id1, uint32 id2)
 {
 	b2Assert(id1 != b2_nullProxy && id2 != b2_nullProxy);
-	b2Assert(m_pairBufferCount < b2_maxPairs);
 
 	b2Pair* pair = Find(id1, id2);
 
@@ -257,6 +401,7 @@ void b2PairManager::RemoveBufferedPair(int32 id1, int32 id2)
 	{
 		// This must be an old pair.
 		b2Assert(pair->IsFinal() == true);
+		b2Assert(m_pairBufferCount < m_pairCapacity);
 
 		pair->SetBuffered();
 		m_pairBuffer[m_pairBufferCount].proxyId1 = pair->proxyId1;
@@ -278,21 +423,14 @@ void b2PairManager::Commit()
 {
 	int32 removeCount = 0;
 
-	b2Proxy* proxies = m_broadPhase->m_proxyPool;
-
 	for (int32 i = 0; i < m_pairBufferCount; ++i)
 	{
 		b2Pair* pair = Find(m_pairBuffer[i].proxyId1, m_pairBuffer[i].proxyId2);
 		b2Assert(pair->IsBuffered());
 		pair->ClearBuffered();
 
-		b2Assert(pair->proxyId1 < b2_maxProxies && pair->proxyId2 < b2_maxProxies);
-
-		b2Proxy* proxy1 = proxies + pair->proxyId1;
-		b2Proxy* proxy2 = proxies + pair->proxyId2;
-
-		b2Assert(proxy1->IsValid());
-		b2Assert(proxy2->IsValid());
+		void* userData1 = m_broadPhase->GetUserData(pair->proxyId1);
+		void* userData2 = m_broadPhase->GetUserData(pair->proxyId2);
 
 		if (pair->IsRemoved())
 		{
@@ -301,7 +439,7 @@ void b2PairManager::Commit()
 			// the user didn't receive a matching add.
 			if (pair->IsFinal() == true)
 			{
-				m_callback->PairRemoved(proxy1->userData, proxy2->userData, pair->userData);
+				m_callback->PairRemoved(userData1, userData2, pair->userData);
 			}
 
 			// Store the ids so we can actually remove the pair below.
@@ -311,11 +449,11 @@ void b2PairManager::Commit()
 		}
 		else
 		{
-			b2Assert(m_broadPhase->TestOverlap(proxy1, proxy2) == true);
+			b2Assert(m_broadPhase->TestOverlap(pair->proxyId1, pair->proxyId2) == true);
 
 			if (pair->IsFinal() == false)
 			{
-				pair->userData = m_callback->PairAdded(proxy1->userData, proxy2->userData);
+				pair->userData = m_callback->PairAdded(userData1, userData2);
 				pair->SetFinal();
 			}
 		}
@@ -352,14 +490,8 @@ void b2PairManager::ValidateBuffer()
 		b2Assert(pair->IsBuffered());
 
 		b2Assert(pair->proxyId1 != pair->proxyId2);
-		b2Assert(pair->proxyId1 < b2_maxProxies);
-		b2Assert(pair->proxyId2 < b2_maxProxies);
-
-		b2Proxy* proxy1 = m_broadPhase->m_proxyPool + pair->proxyId1;
-		b2Proxy* proxy2 = m_broadPhase->m_proxyPool + pair->proxyId2;
-
-		b2Assert(proxy1->IsValid() == true);
-		b2Assert(proxy2->IsValid() == true);
+		b2Assert(pair->proxyId1 != b2_nullProxy);
+		b2Assert(pair->proxyId2 != b2_nullProxy);
 	}
 #endif
 }
@@ -367,30 +499,29 @@ void b2PairManager::ValidateBuffer()
 void b2PairManager::ValidateTable()
 {
 #ifdef _DEBUG
-	for (int32 i = 0; i < b2_tableCapacity; ++i)
+	int32 pairCount = 0;
+	for (int32 i = 0; i < m_tableCapacity; ++i)
 	{
-		uint16 index = m_hashTable[i];
-		while (index != b2_nullPair)
+		const b2PairSlot& s = m_table[i];
+		if (s.pairIndex == b2_nullPair)
 		{
-			b2Pair* pair = m_pairs + index;
-			b2Assert(pair->IsBuffered() == false);
-			b2Assert(pair->IsFinal() == true);
-			b2Assert(pair->IsRemoved() == false);
-
-			b2Assert(pair->proxyId1 != pair->proxyId2);
-			b2Assert(pair->proxyId1 < b2_maxProxies);
-			b2Assert(pair->proxyId2 < b2_maxProxies);
+			continue;
+		}
 
-			b2Proxy* proxy1 = m_broadPhase->m_proxyPool + pair->proxyId1;
-			b2Proxy* proxy2 = m_broadPhase->m_proxyPool + pair->proxyId2;
+		b2Pair* pair = m_pairs + s.pairIndex;
+		b2Assert(pair->IsBuffered() == false);
+		b2Assert(pair->IsFinal() == true);
+		b2Assert(pair->IsRemoved() == false);
 
-			b2Assert(proxy1->IsValid() == true);
-			b2Assert(proxy2->IsValid() == true);
+		b2Assert(pair->proxyId1 < pair->proxyId2);
+		b2Assert(pair->proxyId2 != b2_nullProxy);
+		b2Assert(s.hash == Hash(pair->proxyId1, pair->proxyId2));
+		b2Assert(FindSlot(pair->proxyId1, pair->proxyId2, s.hash) == uint32(i));
 
-			b2Assert(m_broadPhase->TestOverlap(proxy1, proxy2) == true);
+		b2Assert(m_broadPhase->TestOverlap(pair->proxyId1, pair->proxyId2) == true);
 
-			index = pair->next;
-		}
+		++pairCount;
 	}
+	b2Assert(pairCount == m_pairCount);
 #endif
 }
@@ -29,12 +29,9 @@
 #include <climits>
 
 class b2BroadPhase;
-struct b2Proxy;
 
-const uint16 b2_nullPair = USHRT_MAX;
-const uint16 b2_nullProxy = USHRT_MAX;
-const int32 b2_tableCapacity = b2_maxPairs;	// must be a power of two
-const int32 b2_tableMask = b2_tableCapacity - 1;
+const uint32 b2_nullPair = UINT_MAX;
+const uint32 b2_nullProxy = UINT_MAX;
 
 struct b2Pair
 {
@@ -57,16 +54,24 @@ struct b2Pair
 	bool IsFinal()		{ return (status & e_pairFinal) == e_pairFinal; }
 
 	void* userData;
-	uint16 proxyId1;
-	uint16 proxyId2;
-	uint16 next;
-	uint16 status;
+	uint32 proxyId1;
+	uint32 proxyId2;
+	uint32 next;		///< next free pair
+	uint32 status;
 };
 
 struct b2BufferedPair
 {
-	uint16 proxyId1;
-	uint16 proxyId2;
+	uint32 proxyId1;
+	uint32 proxyId2;
+};
+
+/// A slot of the open addressing pair table. The full hash is kept so that
+/// probing rarely touches the pairs.
+struct b2PairSlot
+{
+	uint32 hash;
+	uint32 pairIndex;	///< b2_nullPair for an empty slot
 };
 
 class b2PairCallback
@@ -87,20 +92,42 @@ class b2PairManager
 {
 public:
 	b2PairManager();
+	~b2PairManager();
 
-	void Initialize(b2BroadPhase* broadPhase, b2PairCallback* callback);
+	/// The pair capacity is rounded up to a power of two. The pair storage
+	/// doubles when it fills up, and the table doubles when it is half full.
+	void Initialize(b2BroadPhase* broadPhase, b2PairCallback* callback, int32 pairCapacity);
 
-	void AddBufferedPair(int32 proxyId1, int32 proxyId2);
-	void RemoveBufferedPair(int32 proxyId1, int32 proxyId2);
+	void AddBufferedPair(uint32 proxyId1, uint32 proxyId2);
+	void RemoveBufferedPair(uint32 proxyId1, uint32 proxyId2);
 
 	void Commit();
 
+	/// Get the number of live pairs.
+	int32 GetPairCount() const { return m_pairCount; }
+
+	/// Get the number of pairs that fit before the storage must grow.
+	int32 GetPairCapacity() const { return m_pairCapacity; }
+
+	/// Get the highest number of live pairs so far.
+	int32 GetPeakPairCount() const { return m_peakPairCount; }
+
+	/// Get the number of slots in the pair table.
+	int32 GetTableCapacity() const { return m_tableCapacity; }
+
+	/// Compute the average number of slots probed to find a live pair. This walks
+	/// the whole table, so only use it for profiling.
+	float32 ComputeAverageProbeLength() const;
+
 private:
-	b2Pair* Find(int32 proxyId1, int32 proxyId2);
-	b2Pair* Find(int32 proxyId1, int32 proxyId2, uint32 hashValue);
+	b2Pair* Find(uint32 proxyId1, uint32 proxyId2);
+	uint32 FindSlot(uint32 proxyId1, uint32 proxyId2, uint32 hash) const;
+
+	b2Pair* AddPair(uint32 proxyId1, uint32 proxyId2);
+	void* RemovePair(uint32 proxyId1, uint32 proxyId2);
 
-	b2Pair* AddPair(int32 proxyId1, int32 proxyId2);
-	void* RemovePair(int32 proxyId1, int32 proxyId2);
+	void ReservePairs(int32 capacity);
+	void Rehash(int32 tableCapacity);
 
 	void ValidateBuffer();
 	void ValidateTable();
@@ -108,14 +135,20 @@ private:
 public:
 	b2BroadPhase *m_broadPhase;
 	b2PairCallback *m_callback;
-	b2Pair m_pairs[b2_maxPairs];
-	uint16 m_freePair;
+	b2Pair* m_pairs;
+	int32 m_pairCapacity;
+	uint32 m_freePair;
 	int32 m_pairCount;
+	int32 m_peakPairCount;
 
-	b2BufferedPair m_pairBuffer[b2_maxPairs];
+	b2BufferedPair* m_pairBuffer;
 	int32 m_pairBufferCount;
 
-	uint16 m_hashTable[b2_tableCapacity];
+	// Open addressing with linear probing. The capacity is a power of two
+	// and at most half of the slots are used.
+	b2PairSlot* m_table;
+	int32 m_tableCapacity;
+	uint32 m_tableMask;
 };
 
 #endif
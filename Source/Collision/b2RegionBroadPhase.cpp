@@ -0,0 +1,795 @@
+/*
+* Copyright (c) 2009 Erin Catto http://www.gphysics.com
+*
+* This software is provided 'as-is', without any express or implied
+* warranty.  In no event will the authors be held liable for any damages
+* arising from the use of this software.
+* Permission is granted to anyone to use this software for any purpose,
+* including commercial applications, and to alter it and redistribute it
+* freely, subject to the following restrictions:
+* 1. The origin of this software must not be misrepresented; you must not
+* claim that you wrote the original software. If you use this software
+* in a product, an acknowledgment in the product documentation would be
+* appreciated but is not required.
+* 2. Altered source versions must be plainly marked as such, and must not be
+* misrepresented as being the original software.
+* 3. This notice may not be removed or altered from any source distribution.
+*/
+
+#include "b2RegionBroadPhase.h"
+
+#include <new>
+#include <string.h>
+
+// The region proxies store the proxy id of this broad-phase as their user data.
+inline void* b2RegionUserData(uint32 proxyId)
+{
+	return (void*)(size_t)proxyId;
+}
+
+inline uint32 b2RegionProxyId(void* userData)
+{
+	return uint32((size_t)userData);
+}
+
+// Clip the segment p + t * d to the slab [lower, upper] along one axis.
+static bool b2ClipSegment(float32* t0, float32* t1, float32 p, float32 d, float32 lower, float32 upper)
+{
+	if (b2Abs(d) < B2_FLT_EPSILON)
+	{
+		return lower <= p && p <= upper;
+	}
+
+	float32 ta = (lower - p) / d;
+	float32 tb = (upper - p) / d;
+	if (ta > tb)
+	{
+		b2Swap(ta, tb);
+	}
+
+	*t0 = b2Max(*t0, ta);
+	*t1 = b2Min(*t1, tb);
+	return *t0 <= *t1;
+}
+
+// Forwards the proxies found in one region to a broad-phase callback. A proxy
+// overlapping the query is reported in the region that holds the lower corner of
+// the overlap, which is the first of its regions visited by the query. The proxy
+// is skipped in the other regions.
+class b2RegionQueryCallback : public b2BroadPhaseQueryCallback
+{
+public:
+	bool QueryCallback(void* userData)
+	{
+		const b2RegionProxy* proxy = m_proxies + b2RegionProxyId(userData);
+		if (b2Max(proxy->lowerX, m_lowerX) != m_x || b2Max(proxy->lowerY, m_lowerY) != m_y)
+		{
+			return true;
+		}
+
+		// The region bounds are quantized, so check the exact AABB.
+		if (b2TestOverlap(*m_aabb, proxy->aabb) == false)
+		{
+			return true;
+		}
+
+		m_proceed = m_callback->QueryCallback(proxy->userData);
+		return m_proceed;
+	}
+
+	b2BroadPhaseQueryCallback* m_callback;
+	const b2RegionProxy* m_proxies;
+	const b2AABB* m_aabb;
+	int32 m_lowerX, m_lowerY;	///< the first region of the query
+	int32 m_x, m_y;				///< the region being queried
+	bool m_proceed;
+};
+
+// Collects user data up to a maximum count.
+class b2RegionUserQuery : public b2BroadPhaseQueryCallback
+{
+public:
+	bool QueryCallback(void* userData)
+	{
+		m_userData[m_count++] = userData;
+		return m_count < m_maxCount;
+	}
+
+	void** m_userData;
+	int32 m_maxCount;
+	int32 m_count;
+};
+
+// Region pairs are added right away. A region pair may be removed while the
+// proxies still overlap in another region, so removals are checked in Commit.
+void* b2RegionPairCallback::PairAdded(void* proxyUserData1, void* proxyUserData2)
+{
+	m_broadPhase->m_pairManager.AddBufferedPair(b2RegionProxyId(proxyUserData1), b2RegionProxyId(proxyUserData2));
+
+	// Any non-null value marks a pair that was reported.
+	return this;
+}
+
+void b2RegionPairCallback::PairRemoved(void* proxyUserData1, void* proxyUserData2, void* pairUserData)
+{
+	if (pairUserData == NULL)
+	{
+		return;
+	}
+
+	m_broadPhase->BufferRemove(b2RegionProxyId(proxyUserData1), b2RegionProxyId(proxyUserData2));
+}
+
+b2RegionBroadPhase::b2RegionBroadPhase(const b2AABB& worldAABB, b2PairCallback* callback, int32 proxyCapacity,
+										float32 regionSize, bool batchMoves)
+: b2BroadPhase(worldAABB, callback, proxyCapacity)
+{
+	b2Assert(regionSize > 0.0f);
+
+	m_type = e_regionBroadPhase;
+	m_regionCallback.m_broadPhase = this;
+	m_regionSize = regionSize;
+	m_invRegionSize = 1.0f / regionSize;
+	m_batchMoves = batchMoves;
+
+	m_regionCapacity = 16;
+	m_regionCount = 0;
+	m_regions = (b2Region*)b2Alloc(m_regionCapacity * sizeof(b2Region));
+	for (int32 i = 0; i < m_regionCapacity - 1; ++i)
+	{
+		m_regions[i].broadPhase = NULL;
+		m_regions[i].next = uint32(i + 1);
+	}
+	m_regions[m_regionCapacity - 1].broadPhase = NULL;
+	m_regions[m_regionCapacity - 1].next = b2_nullRegion;
+	m_freeRegion = 0;
+
+	m_bucketCount = 0;
+	m_buckets = NULL;
+	Rehash(m_regionCapacity);
+
+	m_proxyCapacity = 0;
+	m_proxies = NULL;
+	m_freeProxy = b2_nullProxy;
+	ReserveProxies(b2Max(proxyCapacity, 1));
+
+	// Most proxies sit inside a single region.
+	m_entryCapacity = m_proxyCapacity;
+	m_entries = (b2RegionEntry*)b2Alloc(m_entryCapacity * sizeof(b2RegionEntry));
+	for (int32 i = 0; i < m_entryCapacity - 1; ++i)
+	{
+		m_entries[i].next = uint32(i + 1);
+	}
+	m_entries[m_entryCapacity - 1].next = b2_nullRegion;
+	m_freeEntry = 0;
+
+	m_removeCapacity = 16;
+	m_removeCount = 0;
+	m_removeBuffer = (b2BufferedPair*)b2Alloc(m_removeCapacity * sizeof(b2BufferedPair));
+}
+
+b2RegionBroadPhase::~b2RegionBroadPhase()
+{
+	for (int32 i = 0; i < m_regionCapacity; ++i)
+	{
+		if (m_regions[i].broadPhase)
+		{
+			m_regions[i].broadPhase->~b2SAPBroadPhase();
+			b2Free(m_regions[i].broadPhase);
+		}
+	}
+
+	b2Free(m_removeBuffer);
+	b2Free(m_entries);
+	b2Free(m_proxies);
+	b2Free(m_buckets);
+	b2Free(m_regions);
+}
+
+bool b2RegionBroadPhase::InRange(const b2AABB& aabb) const
+{
+	// Regions are created wherever they are needed.
+	B2_NOT_USED(aabb);
+	return true;
+}
+
+void b2RegionBroadPhase::ReserveProxies(int32 capacity)
+{
+	b2Assert(capacity > m_proxyCapacity);
+
+	b2RegionProxy* oldProxies = m_proxies;
+	m_proxies = (b2RegionProxy*)b2Alloc(capacity * sizeof(b2RegionProxy));
+	if (oldProxies)
+	{
+		memcpy(m_proxies, oldProxies, m_proxyCapacity * sizeof(b2RegionProxy));
+		b2Free(oldProxies);
+	}
+
+	// Thread the new proxies onto the free list.
+	for (int32 i = m_proxyCapacity; i < capacity; ++i)
+	{
+		m_proxies[i].userData = NULL;
+		m_proxies[i].firstEntry = b2_nullRegion;
+		m_proxies[i].next = uint32(i + 1);
+	}
+	m_proxies[capacity - 1].next = m_freeProxy;
+
+	m_freeProxy = uint32(m_proxyCapacity);
+	m_proxyCapacity = capacity;
+}
+
+void b2RegionBroadPhase::ComputeRange(b2RegionProxy* proxy) const
+{
+	proxy->lowerX = ComputeRegion(proxy->aabb.lowerBound.x);
+	proxy->lowerY = ComputeRegion(proxy->aabb.lowerBound.y);
+	proxy->upperX = ComputeRegion(proxy->aabb.upperBound.x);
+	proxy->upperY = ComputeRegion(proxy->aabb.upperBound.y);
+}
+
+uint32 b2RegionBroadPhase::FindRegion(int32 x, int32 y) const
+{
+	for (uint32 r = m_buckets[Hash(x, y)]; r != b2_nullRegion; r = m_regions[r].next)
+	{
+		if (m_regions[r].x == x && m_regions[r].y == y)
+		{
+			return r;
+		}
+	}
+
+	return b2_nullRegion;
+}
+
+uint32 b2RegionBroadPhase::CreateRegion(int32 x, int32 y)
+{
+	if (m_freeRegion == b2_nullRegion)
+	{
+		b2Region* oldRegions = m_regions;
+		int32 oldCapacity = m_regionCapacity;
+		m_regionCapacity *= 2;
+		m_regions = (b2Region*)b2Alloc(m_regionCapacity * sizeof(b2Region));
+		memcpy(m_regions, oldRegions, oldCapacity * sizeof(b2Region));
+		b2Free(oldRegions);
+
+		for (int32 i = oldCapacity; i < m_regionCapacity - 1; ++i)
+		{
+			m_regions[i].broadPhase = NULL;
+			m_regions[i].next = uint32(i + 1);
+		}
+		m_regions[m_regionCapacity - 1].broadPhase = NULL;
+		m_regions[m_regionCapacity - 1].next = b2_nullRegion;
+		m_freeRegion = uint32(oldCapacity);
+	}
+
+	if (m_regionCount >= m_bucketCount)
+	{
+		Rehash(2 * m_bucketCount);
+	}
+
+	uint32 r = m_freeRegion;
+	b2Region* region = m_regions + r;
+	m_freeRegion = region->next;
+
+	// The region broad-phase is quantized to the bounds of the region.
+	b2AABB bounds;
+	bounds.lowerBound.Set(m_regionSize * x, m_regionSize * y);
+	bounds.upperBound.Set(m_regionSize * (x + 1), m_regionSize * (y + 1));
+
+	void* mem = b2Alloc(sizeof(b2SAPBroadPhase));
+	region->broadPhase = new (mem) b2SAPBroadPhase(bounds, &m_regionCallback, 16, m_batchMoves);
+	region->x = x;
+	region->y = y;
+
+	uint32 bucket = Hash(x, y);
+	region->next = m_buckets[bucket];
+	m_buckets[bucket] = r;
+	++m_regionCount;
+
+	return r;
+}
+
+void b2RegionBroadPhase::DestroyRegion(uint32 r)
+{
+	b2Region* region = m_regions + r;
+	b2Assert(region->broadPhase->GetProxyCount() == 0);
+
+	uint32* link = m_buckets + Hash(region->x, region->y);
+	while (*link != r)
+	{
+		b2Assert(*link != b2_nullRegion);
+		link = &m_regions[*link].next;
+	}
+	*link = region->next;
+
+	region->broadPhase->~b2SAPBroadPhase();
+	b2Free(region->broadPhase);
+	region->broadPhase = NULL;
+
+	region->next = m_freeRegion;
+	m_freeRegion = r;
+	--m_regionCount;
+}
+
+void b2RegionBroadPhase::Rehash(int32 bucketCount)
+{
+	b2Assert(bucketCount > 0 && (bucketCount & (bucketCount - 1)) == 0);
+
+	b2Free(m_buckets);
+	m_bucketCount = bucketCount;
+	m_buckets = (uint32*)b2Alloc(m_bucketCount * sizeof(uint32));
+	for (int32 i = 0; i < m_bucketCount; ++i)
+	{
+		m_buckets[i] = b2_nullRegion;
+	}
+
+	for (int32 i = 0; i < m_regionCapacity; ++i)
+	{
+		b2Region* region = m_regions + i;
+		if (region->broadPhase == NULL)
+		{
+			continue;
+		}
+
+		uint32 bucket = Hash(region->x, region->y);
+		region->next = m_buckets[bucket];
+		m_buckets[bucket] = uint32(i);
+	}
+}
+
+void b2RegionBroadPhase::AddEntry(uint32 proxyId, int32 x, int32 y)
+{
+	if (m_freeEntry == b2_nullRegion)
+	{
+		b2RegionEntry* oldEntries = m_entries;
+		int32 oldCapacity = m_entryCapacity;
+		m_entryCapacity *= 2;
+		m_entries = (b2RegionEntry*)b2Alloc(m_entryCapacity * sizeof(b2RegionEntry));
+		memcpy(m_entries, oldEntries, oldCapacity * sizeof(b2RegionEntry));
+		b2Free(oldEntries);
+
+		for (int32 i = oldCapacity; i < m_entryCapacity - 1; ++i)
+		{
+			m_entries[i].next = uint32(i + 1);
+		}
+		m_entries[m_entryCapacity - 1].next = b2_nullRegion;
+		m_freeEntry = uint32(oldCapacity);
+	}
+
+	uint32 r = FindRegion(x, y);
+	if (r == b2_nullRegion)
+	{
+		r = CreateRegion(x, y);
+	}
+
+	uint32 e = m_freeEntry;
+	b2RegionEntry* entry = m_entries + e;
+	m_freeEntry = entry->next;
+
+	b2RegionProxy* proxy = m_proxies + proxyId;
+	entry->region = r;
+	entry->proxyId = m_regions[r].broadPhase->CreateProxy(proxy->aabb, b2RegionUserData(proxyId), false);
+	entry->next = proxy->firstEntry;
+	proxy->firstEntry = e;
+}
+
+void b2RegionBroadPhase::RemoveEntry(uint32* link)
+{
+	uint32 e = *link;
+	b2RegionEntry* entry = m_entries + e;
+	*link = entry->next;
+
+	b2SAPBroadPhase* broadPhase = m_regions[entry->region].broadPhase;
+	broadPhase->DestroyProxy(entry->proxyId);
+
+	// Free regions as they empty, so a wandering proxy does not leave a trail.
+	if (broadPhase->GetProxyCount() == 0)
+	{
+		DestroyRegion(entry->region);
+	}
+
+	entry->next = m_freeEntry;
+	m_freeEntry = e;
+}
+
+uint32 b2RegionBroadPhase::FindEntry(uint32 proxyId, uint32 region) const
+{
+	for (uint32 e = m_proxies[proxyId].firstEntry; e != b2_nullRegion; e = m_entries[e].next)
+	{
+		if (m_entries[e].region == region)
+		{
+			return e;
+		}
+	}
+
+	return b2_nullRegion;
+}
+
+void b2RegionBroadPhase::BufferRemove(uint32 proxyId1, uint32 proxyId2)
+{
+	if (m_removeCount == m_removeCapacity)
+	{
+		b2BufferedPair* oldBuffer = m_removeBuffer;
+		m_removeCapacity *= 2;
+		m_removeBuffer = (b2BufferedPair*)b2Alloc(m_removeCapacity * sizeof(b2BufferedPair));
+		memcpy(m_removeBuffer, oldBuffer, m_removeCount * sizeof(b2BufferedPair));
+		b2Free(oldBuffer);
+	}
+
+	m_removeBuffer[m_removeCount].proxyId1 = proxyId1;
+	m_removeBuffer[m_removeCount].proxyId2 = proxyId2;
+	++m_removeCount;
+}
+
+uint32 b2RegionBroadPhase::CreateProxy(const b2AABB& aabb, void* userData, bool isStatic)
+{
+	B2_NOT_USED(isStatic);
+
+	if (m_freeProxy == b2_nullProxy)
+	{
+		ReserveProxies(2 * m_proxyCapacity);
+	}
+
+	uint32 proxyId = m_freeProxy;
+	b2RegionProxy* proxy = m_proxies + proxyId;
+	m_freeProxy = proxy->next;
+
+	proxy->aabb = aabb;
+	proxy->userData = userData;
+	proxy->firstEntry = b2_nullRegion;
+	proxy->next = b2_nullProxy;
+	ComputeRange(proxy);
+
+	// The regions report the new pairs right away.
+	for (int32 y = proxy->lowerY; y <= proxy->upperY; ++y)
+	{
+		for (int32 x = proxy->lowerX; x <= proxy->upperX; ++x)
+		{
+			AddEntry(proxyId, x, y);
+		}
+	}
+
+	++m_proxyCount;
+	return proxyId;
+}
+
+void b2RegionBroadPhase::DestroyProxy(uint32 proxyId)
+{
+	b2Assert(m_proxyCount > 0);
+	b2Assert(proxyId < uint32(m_proxyCapacity));
+	b2RegionProxy* proxy = m_proxies + proxyId;
+
+	while (proxy->firstEntry != b2_nullRegion)
+	{
+		RemoveEntry(&proxy->firstEntry);
+	}
+
+	// The proxy is in no region now, so Commit removes all of its pairs.
+	Commit();
+
+	proxy->userData = NULL;
+	proxy->next = m_freeProxy;
+	m_freeProxy = proxyId;
+
+	--m_proxyCount;
+
+	if (s_validate)
+	{
+		Validate();
+	}
+}
+
+void b2RegionBroadPhase::MoveProxy(uint32 proxyId, const b2AABB& aabb)
+{
+	b2Assert(proxyId < uint32(m_proxyCapacity));
+	b2Assert(aabb.IsValid());
+
+	b2RegionProxy* proxy = m_proxies + proxyId;
+	b2Assert(proxy->firstEntry != b2_nullRegion);
+
+	int32 oldLowerX = proxy->lowerX;
+	int32 oldLowerY = proxy->lowerY;
+	int32 oldUpperX = proxy->upperX;
+	int32 oldUpperY = proxy->upperY;
+
+	proxy->aabb = aabb;
+	ComputeRange(proxy);
+
+	// Leave the regions outside the new range and move within the others.
+	uint32* link = &proxy->firstEntry;
+	while (*link != b2_nullRegion)
+	{
+		b2RegionEntry* entry = m_entries + *link;
+		const b2Region* region = m_regions + entry->region;
+		if (region->x < proxy->lowerX || proxy->upperX < region->x ||
+			region->y < proxy->lowerY || proxy->upperY < region->y)
+		{
+			RemoveEntry(link);
+			continue;
+		}
+
+		region->broadPhase->MoveProxy(entry->proxyId, aabb);
+		link = &entry->next;
+	}
+
+	// Enter the new regions.
+	for (int32 y = proxy->lowerY; y <= proxy->upperY; ++y)
+	{
+		for (int32 x = proxy->lowerX; x <= proxy->upperX; ++x)
+		{
+			if (oldLowerX <= x && x <= oldUpperX && oldLowerY <= y && y <= oldUpperY)
+			{
+				continue;
+			}
+
+			AddEntry(proxyId, x, y);
+		}
+	}
+}
+
+void b2RegionBroadPhase::Commit()
+{
+	for (int32 i = 0; i < m_regionCapacity; ++i)
+	{
+		if (m_regions[i].broadPhase)
+		{
+			m_regions[i].broadPhase->Commit();
+		}
+	}
+
+	// All regions are up to date, so a pair that no region reports can go.
+	for (int32 i = 0; i < m_removeCount; ++i)
+	{
+		uint32 proxyId1 = m_removeBuffer[i].proxyId1;
+		uint32 proxyId2 = m_removeBuffer[i].proxyId2;
+		if (TestOverlap(proxyId1, proxyId2) == false)
+		{
+			m_pairManager.RemoveBufferedPair(proxyId1, proxyId2);
+		}
+	}
+	m_removeCount = 0;
+
+	m_pairManager.Commit();
+}
+
+bool b2RegionBroadPhase::TestOverlap(uint32 proxyId1, uint32 proxyId2) const
+{
+	b2Assert(proxyId1 < uint32(m_proxyCapacity) && proxyId2 < uint32(m_proxyCapacity));
+
+	for (uint32 e1 = m_proxies[proxyId1].firstEntry; e1 != b2_nullRegion; e1 = m_entries[e1].next)
+	{
+		const b2RegionEntry* entry1 = m_entries + e1;
+		uint32 e2 = FindEntry(proxyId2, entry1->region);
+		if (e2 == b2_nullRegion)
+		{
+			continue;
+		}
+
+		if (m_regions[entry1->region].broadPhase->TestOverlap(entry1->proxyId, m_entries[e2].proxyId))
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+int32 b2RegionBroadPhase::Query(const b2AABB& aabb, void** userData, int32 maxCount)
+{
+	if (maxCount <= 0)
+	{
+		return 0;
+	}
+
+	b2RegionUserQuery userQuery;
+	userQuery.m_userData = userData;
+	userQuery.m_maxCount = maxCount;
+	userQuery.m_count = 0;
+
+	Query(&userQuery, aabb);
+
+	return userQuery.m_count;
+}
+
+void b2RegionBroadPhase::Query(b2BroadPhaseQueryCallback* callback, const b2AABB& aabb)
+{
+	int32 lowerX = ComputeRegion(aabb.lowerBound.x);
+	int32 lowerY = ComputeRegion(aabb.lowerBound.y);
+	int32 upperX = ComputeRegion(aabb.upperBound.x);
+	int32 upperY = ComputeRegion(aabb.upperBound.y);
+
+	b2RegionQueryCallback regionCallback;
+	regionCallback.m_callback = callback;
+	regionCallback.m_proxies = m_proxies;
+	regionCallback.m_aabb = &aabb;
+	regionCallback.m_lowerX = lowerX;
+	regionCallback.m_lowerY = lowerY;
+	regionCallback.m_proceed = true;
+
+	for (int32 y = lowerY; y <= upperY; ++y)
+	{
+		for (int32 x = lowerX; x <= upperX; ++x)
+		{
+			uint32 r = FindRegion(x, y);
+			if (r == b2_nullRegion)
+			{
+				continue;
+			}
+
+			regionCallback.m_x = x;
+			regionCallback.m_y = y;
+			m_regions[r].broadPhase->Query(&regionCallback, aabb);
+			if (regionCallback.m_proceed == false)
+			{
+				return;
+			}
+		}
+	}
+}
+
+int32 b2RegionBroadPhase::QuerySegment(const b2Segment& segment, void** userData, int32 maxCount, SortKeyFunc sortKey)
+{
+	b2Vec2 lower = b2Min(segment.p1, segment.p2);
+	b2Vec2 upper = b2Max(segment.p1, segment.p2);
+	int32 lowerX = ComputeRegion(lower.x);
+	int32 lowerY = ComputeRegion(lower.y);
+	int32 upperX = ComputeRegion(upper.x);
+	int32 upperY = ComputeRegion(upper.y);
+
+	b2Vec2 d = segment.p2 - segment.p1;
+	float32 quantizationFactor = float32(B2BROADPHASE_MAX) * m_invRegionSize;
+
+	if (maxCount <= 0 || m_proxyCount == 0)
+	{
+		return 0;
+	}
+
+	float32* keys = NULL;
+	if (sortKey)
+	{
+		keys = (float32*)b2Alloc(maxCount * sizeof(float32));
+	}
+
+	// Per call scratch memory. A region never holds more proxies than this
+	// broad-phase. The segment may find a proxy in several regions, so the
+	// reported proxies are marked in a bit set.
+	void** results = (void**)b2Alloc(m_proxyCount * sizeof(void*));
+	int32 wordCount = (m_proxyCapacity + 31) >> 5;
+	uint32* visited = (uint32*)b2Alloc(wordCount * sizeof(uint32));
+	memset(visited, 0, wordCount * sizeof(uint32));
+
+	int32 count = 0;
+
+	for (int32 y = lowerY; y <= upperY; ++y)
+	{
+		for (int32 x = lowerX; x <= upperX; ++x)
+		{
+			uint32 r = FindRegion(x, y);
+			if (r == b2_nullRegion)
+			{
+				continue;
+			}
+
+			// The region broad-phase only handles segments inside its bounds.
+			b2SAPBroadPhase* broadPhase = m_regions[r].broadPhase;
+			const b2AABB& bounds = broadPhase->GetWorldAABB();
+
+			float32 t0 = 0.0f;
+			float32 t1 = 1.0f;
+			if (b2ClipSegment(&t0, &t1, segment.p1.x, d.x, bounds.lowerBound.x, bounds.upperBound.x) == false ||
+				b2ClipSegment(&t0, &t1, segment.p1.y, d.y, bounds.lowerBound.y, bounds.upperBound.y) == false)
+			{
+				continue;
+			}
+
+			b2Segment clipped;
+			clipped.p1 = b2Clamp(segment.p1 + t0 * d, bounds.lowerBound, bounds.upperBound);
+			clipped.p2 = b2Clamp(segment.p1 + t1 * d, bounds.lowerBound, bounds.upperBound);
+
+			// Skip segments that only graze the region.
+			b2Vec2 cd = clipped.p2 - clipped.p1;
+			if (b2Max(b2Abs(cd.x), b2Abs(cd.y)) * quantizationFactor <= B2_FLT_EPSILON)
+			{
+				continue;
+			}
+
+			// The sort keys are relative to the whole segment, so sort here.
+			int32 resultCount = broadPhase->QuerySegment(clipped, results, broadPhase->GetProxyCount(), NULL);
+
+			for (int32 i = 0; i < resultCount; ++i)
+			{
+				uint32 proxyId = b2RegionProxyId(results[i]);
+				uint32 bit = 1u << (proxyId & 31);
+				if (visited[proxyId >> 5] & bit)
+				{
+					continue;
+				}
+				visited[proxyId >> 5] |= bit;
+
+				const b2RegionProxy* proxy = m_proxies + proxyId;
+				if (sortKey == NULL)
+				{
+					userData[count++] = proxy->userData;
+					if (count == maxCount)
+					{
+						b2Free(visited);
+						b2Free(results);
+						return count;
+					}
+					continue;
+				}
+
+				float32 key = sortKey(proxy->userData);
+				if (key < 0.0f)
+				{
+					continue;
+				}
+
+				if (count == maxCount && key >= keys[count-1])
+				{
+					continue;
+				}
+
+				// Insertion sort. The last result drops off when full.
+				int32 j = count < maxCount ? count++ : count - 1;
+				while (j > 0 && keys[j-1] > key)
+				{
+					keys[j] = keys[j-1];
+					userData[j] = userData[j-1];
+					--j;
+				}
+				keys[j] = key;
+				userData[j] = proxy->userData;
+			}
+		}
+	}
+
+	b2Free(visited);
+	b2Free(results);
+	b2Free(keys);
+
+	return count;
+}
+
+void b2RegionBroadPhase::Validate()
+{
+	int32 regionCount = 0;
+	for (int32 i = 0; i < m_regionCapacity; ++i)
+	{
+		const b2Region* region = m_regions + i;
+		if (region->broadPhase == NULL)
+		{
+			continue;
+		}
+
+		b2Assert(FindRegion(region->x, region->y) == uint32(i));
+		b2Assert(region->broadPhase->GetProxyCount() > 0);
+		region->broadPhase->Validate();
+		++regionCount;
+	}
+	b2Assert(regionCount == m_regionCount);
+
+	int32 proxyCount = 0;
+	for (int32 i = 0; i < m_proxyCapacity; ++i)
+	{
+		const b2RegionProxy* proxy = m_proxies + i;
+		if (proxy->firstEntry == b2_nullRegion)
+		{
+			continue;
+		}
+
+		// The proxy has one entry per region in its range.
+		int32 entryCount = 0;
+		for (uint32 e = proxy->firstEntry; e != b2_nullRegion; e = m_entries[e].next)
+		{
+			const b2RegionEntry* entry = m_entries + e;
+			const b2Region* region = m_regions + entry->region;
+			b2Assert(region->broadPhase != NULL);
+			b2Assert(proxy->lowerX <= region->x && region->x <= proxy->upperX);
+			b2Assert(proxy->lowerY <= region->y && region->y <= proxy->upperY);
+			b2Assert(b2RegionProxyId(region->broadPhase->GetUserData(entry->proxyId)) == uint32(i));
+			++entryCount;
+		}
+		b2Assert(entryCount == (proxy->upperX - proxy->lowerX + 1) * (proxy->upperY - proxy->lowerY + 1));
+		++proxyCount;
+	}
+	b2Assert(proxyCount == m_proxyCount);
+}
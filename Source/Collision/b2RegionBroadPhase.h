@@ -0,0 +1,208 @@
+/*
+* Copyright (c) 2009 Erin Catto http://www.gphysics.com
+*
+* This software is provided 'as-is', without any express or implied
+* warranty.  In no event will the authors be held liable for any damages
+* arising from the use of this software.
+* Permission is granted to anyone to use this software for any purpose,
+* including commercial applications, and to alter it and redistribute it
+* freely, subject to the following restrictions:
+* 1. The origin of this software must not be misrepresented; you must not
+* claim that you wrote the original software. If you use this software
+* in a product, an acknowledgment in the product documentation would be
+* appreciated but is not required.
+* 2. Altered source versions must be plainly marked as such, and must not be
+* misrepresented as being the original software.
+* 3. This notice may not be removed or altered from any source distribution.
+*/
+
+#ifndef B2_REGION_BROAD_PHASE_H
+#define B2_REGION_BROAD_PHASE_H
+
+#include "b2BroadPhase.h"
+#include "b2SAPBroadPhase.h"
+
+const uint32 b2_nullRegion = UINT_MAX;
+
+class b2RegionBroadPhase;
+
+/// A square of the region grid with its own sweep and prune broad-phase.
+struct b2Region
+{
+	int32 x, y;
+	b2SAPBroadPhase* broadPhase;	///< NULL for a free region
+	uint32 next;					///< next region in the bucket, or next free region
+};
+
+/// A proxy registered in one region.
+struct b2RegionEntry
+{
+	uint32 region;
+	uint32 proxyId;		///< the proxy in the region broad-phase
+	uint32 next;		///< next entry of the same proxy, or next free entry
+};
+
+struct b2RegionProxy
+{
+	b2AABB aabb;
+	void* userData;
+	int32 lowerX, lowerY;	///< region range covered by the AABB
+	int32 upperX, upperY;
+	uint32 firstEntry;		///< b2_nullRegion for a free proxy
+	uint32 next;			///< next free proxy
+};
+
+/// Receives the pair events of the region broad-phases.
+class b2RegionPairCallback : public b2PairCallback
+{
+public:
+	void* PairAdded(void* proxyUserData1, void* proxyUserData2);
+	void PairRemoved(void* proxyUserData1, void* proxyUserData2, void* pairUserData);
+
+	b2RegionBroadPhase* m_broadPhase;
+};
+
+/// Multi box pruning broad-phase. Space is cut into square regions and each region
+/// runs its own sweep and prune broad-phase, quantized to the bounds of the region.
+/// Regions are kept in a hash table and created when the first proxy enters them,
+/// so the world has no bounds and InRange is always true. Bodies never freeze.
+///
+/// A proxy that crosses region borders has a proxy in every region it covers. Two
+/// proxies form a pair while they overlap in at least one region. Region pairs are
+/// added right away, while a removed region pair is checked against the other
+/// regions in Commit, once all regions are up to date.
+///
+/// Queries report a proxy found in several regions once without marking it, so
+/// they only read the broad-phase and may run concurrently.
+class b2RegionBroadPhase : public b2BroadPhase
+{
+public:
+	/// @param regionSize the size of a region. Each region is quantized to 16 bits,
+	/// so smaller regions give tighter bounds.
+	b2RegionBroadPhase(const b2AABB& worldAABB, b2PairCallback* callback, int32 proxyCapacity = b2_proxyPoolSize,
+						float32 regionSize = 100.0f, bool batchMoves = false);
+	~b2RegionBroadPhase();
+
+	bool InRange(const b2AABB& aabb) const;
+
+	uint32 CreateProxy(const b2AABB& aabb, void* userData, bool isStatic);
+	void DestroyProxy(uint32 proxyId);
+	void MoveProxy(uint32 proxyId, const b2AABB& aabb);
+	void Commit();
+
+	void* GetUserData(uint32 proxyId) const;
+	b2AABB GetFatAABB(uint32 proxyId) const;
+	bool TestOverlap(uint32 proxyId1, uint32 proxyId2) const;
+
+	int32 Query(const b2AABB& aabb, void** userData, int32 maxCount);
+	void Query(b2BroadPhaseQueryCallback* callback, const b2AABB& aabb);
+	int32 QuerySegment(const b2Segment& segment, void** userData, int32 maxCount, SortKeyFunc sortKey);
+
+	int32 GetProxyCapacity() const;
+
+	void Validate();
+
+	/// Get the size of a region.
+	float32 GetRegionSize() const;
+
+	/// Get the number of regions that hold proxies.
+	int32 GetRegionCount() const;
+
+private:
+	friend class b2RegionPairCallback;
+
+	int32 ComputeRegion(float32 x) const;
+	uint32 Hash(int32 x, int32 y) const;
+	void ComputeRange(b2RegionProxy* proxy) const;
+
+	uint32 FindRegion(int32 x, int32 y) const;
+	uint32 CreateRegion(int32 x, int32 y);
+	void DestroyRegion(uint32 region);
+	void Rehash(int32 bucketCount);
+
+	void ReserveProxies(int32 capacity);
+	void AddEntry(uint32 proxyId, int32 x, int32 y);
+	void RemoveEntry(uint32* link);
+	uint32 FindEntry(uint32 proxyId, uint32 region) const;
+
+	void BufferRemove(uint32 proxyId1, uint32 proxyId2);
+
+	b2RegionPairCallback m_regionCallback;
+
+	float32 m_regionSize;
+	float32 m_invRegionSize;
+	bool m_batchMoves;
+
+	b2Region* m_regions;
+	int32 m_regionCapacity;
+	int32 m_regionCount;
+	uint32 m_freeRegion;
+
+	uint32* m_buckets;
+	int32 m_bucketCount;
+
+	b2RegionProxy* m_proxies;
+	int32 m_proxyCapacity;
+	uint32 m_freeProxy;
+
+	b2RegionEntry* m_entries;
+	int32 m_entryCapacity;
+	uint32 m_freeEntry;
+
+	// Region pairs removed since the last Commit.
+	b2BufferedPair* m_removeBuffer;
+	int32 m_removeCapacity;
+	int32 m_removeCount;
+};
+
+inline void* b2RegionBroadPhase::GetUserData(uint32 proxyId) const
+{
+	b2Assert(proxyId < uint32(m_proxyCapacity));
+	return m_proxies[proxyId].userData;
+}
+
+inline b2AABB b2RegionBroadPhase::GetFatAABB(uint32 proxyId) const
+{
+	b2Assert(proxyId < uint32(m_proxyCapacity));
+	return m_proxies[proxyId].aabb;
+}
+
+inline int32 b2RegionBroadPhase::GetProxyCapacity() const
+{
+	return m_proxyCapacity;
+}
+
+inline float32 b2RegionBroadPhase::GetRegionSize() const
+{
+	return m_regionSize;
+}
+
+inline int32 b2RegionBroadPhase::GetRegionCount() const
+{
+	return m_regionCount;
+}
+
+inline int32 b2RegionBroadPhase::ComputeRegion(float32 x) const
+{
+	float32 t = x * m_invRegionSize;
+#ifndef TARGET_FLOAT32_IS_FIXED
+	// Clamp far away values so the region coordinates cannot overflow.
+	t = b2Clamp(t, -1000000.0f, 1000000.0f);
+#endif
+
+	// Round toward negative infinity.
+	int32 i = int32(t);
+	if (t < float32(i))
+	{
+		--i;
+	}
+	return i;
+}
+
+inline uint32 b2RegionBroadPhase::Hash(int32 x, int32 y) const
+{
+	uint32 h = (uint32(x) * 73856093) ^ (uint32(y) * 19349663);
+	return h & uint32(m_bucketCount - 1);
+}
+
+#endif
@@ -0,0 +1,1405 @@
+/*
+* Copyright (c) 2006-2009 Erin Catto http://www.gphysics.com
+*
+* This software is provided 'as-is', without any express or implied
+* warranty.  In no event will the authors be held liable for any damages
+* arising from the use of this software.
+* Permission is granted to anyone to use this software for any purpose,
+* including commercial applications, and to alter it and redistribute it
+* freely, subject to the following restrictions:
+* 1. The origin of this software must not be misrepresented; you must not
+* claim that you wrote the original software. If you use this software
+* in a product, an acknowledgment in the product documentation would be
+* appreciated but is not required.
+* 2. Altered source versions must be plainly marked as such, and must not be
+* misrepresented as being the original software.
+* 3. This notice may not be removed or altered from any source distribution.
+*/
+
+#include "b2SAPBroadPhase.h"
+#include <algorithm>
+
+#include <cstring>
+
+// Notes:
+// - we use bound arrays instead of linked lists for cache coherence.
+// - we use quantized integral values for fast compares.
+// - we use 32-bit indices rather than pointers so the storage can grow.
+// - we use a stabbing count for fast overlap queries (less than order N).
+// - we also use a time stamp on each proxy to speed up the registration of
+//   overlap query results.
+// - where possible, we compare bound indices instead of values to reduce
+//   cache misses (TODO_ERIN).
+// - no broadphase is perfect and neither is this one: it is not great for huge
+//   worlds (use a multi-SAP instead), it is not great for large objects.
+
+struct b2BoundValues
+{
+	uint16 lowerValues[2];
+	uint16 upperValues[2];
+};
+
+static int32 BinarySearch(const b2Bound* bounds, int32 count, uint16 value)
+{
+	int32 low = 0;
+	int32 high = count - 1;
+	while (low <= high)
+	{
+		int32 mid = (low + high) >> 1;
+		if (bounds[mid].value > value)
+		{
+			high = mid - 1;
+		}
+		else if (bounds[mid].value < value)
+		{
+			low = mid + 1;
+		}
+		else
+		{
+			return (uint16)mid;
+		}
+	}
+	
+	return low;
+}
+
+b2SAPBroadPhase::b2SAPBroadPhase(const b2AABB& worldAABB, b2PairCallback* callback, int32 proxyCapacity, bool batchMoves)
+: b2BroadPhase(worldAABB, callback, proxyCapacity)
+{
+	m_type = e_sweepAndPruneBroadPhase;
+
+	b2Vec2 d = worldAABB.upperBound - worldAABB.lowerBound;
+	m_quantizationFactor.x = float32(B2BROADPHASE_MAX) / d.x;
+	m_quantizationFactor.y = float32(B2BROADPHASE_MAX) / d.y;
+
+	m_proxyCapacity = 0;
+	m_proxyPool = NULL;
+	m_bounds[0] = NULL;
+	m_bounds[1] = NULL;
+	m_queryResults = NULL;
+	m_freeProxy = b2_nullProxy;
+
+	m_timeStamp = 1;
+	m_queryResultCount = 0;
+
+	m_batchMoves = batchMoves;
+	m_moveBuffer = NULL;
+	m_moveCount = 0;
+	m_sortBuffer = NULL;
+	m_activeProxies = NULL;
+	m_activeMoved = NULL;
+
+	ReserveProxies(proxyCapacity);
+}
+
+b2SAPBroadPhase::~b2SAPBroadPhase()
+{
+	b2Free(m_proxyPool);
+	b2Free(m_bounds[0]);
+	b2Free(m_bounds[1]);
+	b2Free(m_queryResults);
+	b2Free(m_moveBuffer);
+	b2Free(m_sortBuffer);
+	b2Free(m_activeProxies);
+	b2Free(m_activeMoved);
+}
+
+// Grow the proxy storage. The free list must be empty. Existing proxy ids
+// and bound indices remain valid.
+void b2SAPBroadPhase::ReserveProxies(int32 newCapacity)
+{
+	b2Assert(m_freeProxy == b2_nullProxy);
+
+	int32 oldCapacity = m_proxyCapacity;
+	b2Assert(oldCapacity < newCapacity && newCapacity <= INT_MAX / 2);
+
+	b2Proxy* oldPool = m_proxyPool;
+	m_proxyPool = (b2Proxy*)b2Alloc(newCapacity * sizeof(b2Proxy));
+	if (oldPool != NULL)
+	{
+		memcpy(m_proxyPool, oldPool, oldCapacity * sizeof(b2Proxy));
+		b2Free(oldPool);
+	}
+
+	for (int32 axis = 0; axis < 2; ++axis)
+	{
+		b2Bound* oldBounds = m_bounds[axis];
+		m_bounds[axis] = (b2Bound*)b2Alloc(2 * newCapacity * sizeof(b2Bound));
+		if (oldBounds != NULL)
+		{
+			memcpy(m_bounds[axis], oldBounds, 2 * m_proxyCount * sizeof(b2Bound));
+			b2Free(oldBounds);
+		}
+	}
+
+	// Query results never outlive a query, so they need not be copied.
+	b2Assert(m_queryResultCount == 0);
+	b2Free(m_queryResults);
+	m_queryResults = (uint32*)b2Alloc(newCapacity * sizeof(uint32));
+
+	// The batched update is flushed before new proxies are created.
+	b2Assert(m_moveCount == 0);
+	b2Free(m_moveBuffer);
+	b2Free(m_sortBuffer);
+	b2Free(m_activeProxies);
+	b2Free(m_activeMoved);
+	m_moveBuffer = NULL;
+	m_sortBuffer = NULL;
+	m_activeProxies = NULL;
+	m_activeMoved = NULL;
+	if (m_batchMoves)
+	{
+		m_moveBuffer = (uint32*)b2Alloc(newCapacity * sizeof(uint32));
+		m_sortBuffer = (b2Bound*)b2Alloc(2 * newCapacity * sizeof(b2Bound));
+		m_activeProxies = (uint32*)b2Alloc(newCapacity * sizeof(uint32));
+		m_activeMoved = (uint32*)b2Alloc(newCapacity * sizeof(uint32));
+	}
+
+	// Build a linked list for the free list.
+	for (int32 i = oldCapacity; i < newCapacity - 1; ++i)
+	{
+		m_proxyPool[i].SetNext(i + 1);
+		m_proxyPool[i].timeStamp = 0;
+		m_proxyPool[i].moved = false;
+		m_proxyPool[i].overlapCount = b2_invalid;
+		m_proxyPool[i].userData = NULL;
+	}
+	m_proxyPool[newCapacity-1].SetNext(b2_nullProxy);
+	m_proxyPool[newCapacity-1].timeStamp = 0;
+	m_proxyPool[newCapacity-1].moved = false;
+	m_proxyPool[newCapacity-1].overlapCount = b2_invalid;
+	m_proxyPool[newCapacity-1].userData = NULL;
+	m_freeProxy = oldCapacity;
+
+	m_proxyCapacity = newCapacity;
+}
+
+// This one is only used for validation.
+bool b2SAPBroadPhase::TestOverlap(const b2Proxy* p1, const b2Proxy* p2) const
+{
+	for (int32 axis = 0; axis < 2; ++axis)
+	{
+		const b2Bound* bounds = m_bounds[axis];
+
+		b2Assert(p1->lowerBounds[axis] < 2 * m_proxyCount);
+		b2Assert(p1->upperBounds[axis] < 2 * m_proxyCount);
+		b2Assert(p2->lowerBounds[axis] < 2 * m_proxyCount);
+		b2Assert(p2->upperBounds[axis] < 2 * m_proxyCount);
+
+		if (bounds[p1->lowerBounds[axis]].value > bounds[p2->upperBounds[axis]].value)
+			return false;
+
+		if (bounds[p1->upperBounds[axis]].value < bounds[p2->lowerBounds[axis]].value)
+			return false;
+	}
+
+	return true;
+}
+
+bool b2SAPBroadPhase::TestOverlap(const b2BoundValues& b, b2Proxy* p)
+{
+	for (int32 axis = 0; axis < 2; ++axis)
+	{
+		b2Bound* bounds = m_bounds[axis];
+
+		b2Assert(p->lowerBounds[axis] < 2 * m_proxyCount);
+		b2Assert(p->upperBounds[axis] < 2 * m_proxyCount);
+
+		if (b.lowerValues[axis] > bounds[p->upperBounds[axis]].value)
+			return false;
+
+		if (b.upperValues[axis] < bounds[p->lowerBounds[axis]].value)
+			return false;
+	}
+
+	return true;
+}
+
+b2AABB b2SAPBroadPhase::GetFatAABB(uint32 proxyId) const
+{
+	b2Assert(proxyId < uint32(m_proxyCapacity));
+	const b2Proxy* proxy = m_proxyPool + proxyId;
+	b2Assert(proxy->IsValid());
+
+	b2Vec2 invQ;
+	invQ.Set(1.0f / m_quantizationFactor.x, 1.0f / m_quantizationFactor.y);
+
+	b2AABB aabb;
+	aabb.lowerBound.x = m_worldAABB.lowerBound.x + invQ.x * m_bounds[0][proxy->lowerBounds[0]].value;
+	aabb.lowerBound.y = m_worldAABB.lowerBound.y + invQ.y * m_bounds[1][proxy->lowerBounds[1]].value;
+	aabb.upperBound.x = m_worldAABB.lowerBound.x + invQ.x * m_bounds[0][proxy->upperBounds[0]].value;
+	aabb.upperBound.y = m_worldAABB.lowerBound.y + invQ.y * m_bounds[1][proxy->upperBounds[1]].value;
+	return aabb;
+}
+
+void b2SAPBroadPhase::ComputeBounds(uint16* lowerValues, uint16* upperValues, const b2AABB& aabb)
+{
+	b2Assert(aabb.upperBound.x >= aabb.lowerBound.x);
+	b2Assert(aabb.upperBound.y >= aabb.lowerBound.y);
+
+	b2Vec2 minVertex = b2Clamp(aabb.lowerBound, m_worldAABB.lowerBound, m_worldAABB.upperBound);
+	b2Vec2 maxVertex = b2Clamp(aabb.upperBound, m_worldAABB.lowerBound, m_worldAABB.upperBound);
+
+	// Bump lower bounds downs and upper bounds up. This ensures correct sorting of
+	// lower/upper bounds that would have equal values.
+	// TODO_ERIN implement fast float to uint16 conversion.
+	lowerValues[0] = (uint16)(m_quantizationFactor.x * (minVertex.x - m_worldAABB.lowerBound.x)) & (B2BROADPHASE_MAX - 1);
+	upperValues[0] = (uint16)(m_quantizationFactor.x * (maxVertex.x - m_worldAABB.lowerBound.x)) | 1;
+
+	lowerValues[1] = (uint16)(m_quantizationFactor.y * (minVertex.y - m_worldAABB.lowerBound.y)) & (B2BROADPHASE_MAX - 1);
+	upperValues[1] = (uint16)(m_quantizationFactor.y * (maxVertex.y - m_worldAABB.lowerBound.y)) | 1;
+}
+
+void b2SAPBroadPhase::IncrementTimeStamp()
+{
+	if (m_timeStamp == B2BROADPHASE_MAX)
+	{
+		for (int32 i = 0; i < m_proxyCapacity; ++i)
+		{
+			m_proxyPool[i].timeStamp = 0;
+		}
+		m_timeStamp = 1;
+	}
+	else
+	{
+		++m_timeStamp;
+	}
+}
+
+void b2SAPBroadPhase::IncrementOverlapCount(uint32 proxyId)
+{
+	b2Proxy* proxy = m_proxyPool + proxyId;
+	if (proxy->timeStamp < m_timeStamp)
+	{
+		proxy->timeStamp = m_timeStamp;
+		proxy->overlapCount = 1;
+	}
+	else
+	{
+		proxy->overlapCount = 2;
+		b2Assert(m_queryResultCount < m_proxyCapacity);
+		m_queryResults[m_queryResultCount] = proxyId;
+		++m_queryResultCount;
+	}
+}
+
+void b2SAPBroadPhase::Query(int32* lowerQueryOut, int32* upperQueryOut,
+					   uint16 lowerValue, uint16 upperValue,
+					   b2Bound* bounds, int32 boundCount, int32 axis)
+{
+	int32 lowerQuery = BinarySearch(bounds, boundCount, lowerValue);
+	int32 upperQuery = BinarySearch(bounds, boundCount, upperValue);
+
+	// Easy case: lowerQuery <= lowerIndex(i) < upperQuery
+	// Solution: search query range for min bounds.
+	for (int32 i = lowerQuery; i < upperQuery; ++i)
+	{
+		if (bounds[i].IsLower())
+		{
+			IncrementOverlapCount(bounds[i].proxyId);
+		}
+	}
+
+	// Hard case: lowerIndex(i) < lowerQuery < upperIndex(i)
+	// Solution: use the stabbing count to search down the bound array.
+	if (lowerQuery > 0)
+	{
+		int32 i = lowerQuery - 1;
+		int32 s = bounds[i].stabbingCount;
+
+		// Find the s overlaps.
+		while (s)
+		{
+			b2Assert(i >= 0);
+
+			if (bounds[i].IsLower())
+			{
+				b2Proxy* proxy = m_proxyPool + bounds[i].proxyId;
+				if (lowerQuery <= proxy->upperBounds[axis])
+				{
+					IncrementOverlapCount(bounds[i].proxyId);
+					--s;
+				}
+			}
+			--i;
+		}
+	}
+
+	*lowerQueryOut = lowerQuery;
+	*upperQueryOut = upperQuery;
+}
+
+// Check the bound indices of a proxy against a query range on one axis.
+inline bool b2OverlapsQuery(const b2Proxy* proxy, int32 axis, int32 lowerQuery, int32 upperQuery)
+{
+	int32 lowerIndex = int32(proxy->lowerBounds[axis]);
+	int32 upperIndex = int32(proxy->upperBounds[axis]);
+	return (lowerQuery <= lowerIndex && lowerIndex < upperQuery) || (lowerIndex < lowerQuery && lowerQuery <= upperIndex);
+}
+
+// This finds the same proxies as the overlap counting query, but it checks
+// the second axis with the bound indices instead of marking the proxies.
+template <typename T>
+void b2SAPBroadPhase::QueryBounds(T* callback, const uint16* lowerValues, const uint16* upperValues) const
+{
+	int32 boundCount = 2 * m_proxyCount;
+	const b2Bound* bounds = m_bounds[0];
+
+	int32 lowerQuery = BinarySearch(bounds, boundCount, lowerValues[0]);
+	int32 upperQuery = BinarySearch(bounds, boundCount, upperValues[0]);
+	int32 lowerQueryY = BinarySearch(m_bounds[1], boundCount, lowerValues[1]);
+	int32 upperQueryY = BinarySearch(m_bounds[1], boundCount, upperValues[1]);
+
+	// Proxies that start inside the query range.
+	for (int32 i = lowerQuery; i < upperQuery; ++i)
+	{
+		if (bounds[i].IsLower() == false)
+		{
+			continue;
+		}
+
+		uint32 proxyId = bounds[i].proxyId;
+		if (b2OverlapsQuery(m_proxyPool + proxyId, 1, lowerQueryY, upperQueryY) == false)
+		{
+			continue;
+		}
+
+		if (callback->QueryCallback(proxyId) == false)
+		{
+			return;
+		}
+	}
+
+	// Proxies that straddle the lower end of the query range.
+	if (lowerQuery > 0)
+	{
+		int32 i = lowerQuery - 1;
+		uint32 s = bounds[i].stabbingCount;
+
+		while (s)
+		{
+			b2Assert(i >= 0);
+
+			if (bounds[i].IsLower())
+			{
+				uint32 proxyId = bounds[i].proxyId;
+				const b2Proxy* proxy = m_proxyPool + proxyId;
+				if (lowerQuery <= int32(proxy->upperBounds[0]))
+				{
+					--s;
+
+					if (b2OverlapsQuery(proxy, 1, lowerQueryY, upperQueryY) &&
+						callback->QueryCallback(proxyId) == false)
+					{
+						return;
+					}
+				}
+			}
+			--i;
+		}
+	}
+}
+
+// Collects user data up to a maximum count.
+struct b2SAPUserQuery
+{
+	bool QueryCallback(uint32 proxyId)
+	{
+		userData[count++] = broadPhase->GetUserData(proxyId);
+		return count < maxCount;
+	}
+
+	const b2SAPBroadPhase* broadPhase;
+	void** userData;
+	int32 maxCount;
+	int32 count;
+};
+
+// Forwards the proxies to a broad-phase callback.
+struct b2SAPCallbackQuery
+{
+	bool QueryCallback(uint32 proxyId)
+	{
+		return callback->QueryCallback(broadPhase->GetUserData(proxyId));
+	}
+
+	const b2SAPBroadPhase* broadPhase;
+	b2BroadPhaseQueryCallback* callback;
+};
+
+// Collects proxy ids.
+struct b2SAPResultQuery
+{
+	bool QueryCallback(uint32 proxyId)
+	{
+		results[count++] = proxyId;
+		return true;
+	}
+
+	uint32* results;
+	int32 count;
+};
+
+uint32 b2SAPBroadPhase::CreateProxy(const b2AABB& aabb, void* userData, bool isStatic)
+{
+	B2_NOT_USED(isStatic);
+
+	Flush();
+
+	if (m_freeProxy == b2_nullProxy)
+	{
+		ReserveProxies(2 * m_proxyCapacity);
+	}
+
+	b2Assert(m_proxyCount < m_proxyCapacity);
+
+	uint32 proxyId = m_freeProxy;
+	b2Proxy* proxy = m_proxyPool + proxyId;
+	m_freeProxy = proxy->GetNext();
+
+	proxy->overlapCount = 0;
+	proxy->userData = userData;
+
+	int32 boundCount = 2 * m_proxyCount;
+
+	uint16 lowerValues[2], upperValues[2];
+	ComputeBounds(lowerValues, upperValues, aabb);
+
+	for (int32 axis = 0; axis < 2; ++axis)
+	{
+		b2Bound* bounds = m_bounds[axis];
+		int32 lowerIndex, upperIndex;
+		Query(&lowerIndex, &upperIndex, lowerValues[axis], upperValues[axis], bounds, boundCount, axis);
+
+		memmove(bounds + upperIndex + 2, bounds + upperIndex, (boundCount - upperIndex) * sizeof(b2Bound));
+		memmove(bounds + lowerIndex + 1, bounds + lowerIndex, (upperIndex - lowerIndex) * sizeof(b2Bound));
+
+		// The upper index has increased because of the lower bound insertion.
+		++upperIndex;
+
+		// Copy in the new bounds.
+		bounds[lowerIndex].value = lowerValues[axis];
+		bounds[lowerIndex].proxyId = proxyId;
+		bounds[upperIndex].value = upperValues[axis];
+		bounds[upperIndex].proxyId = proxyId;
+
+		bounds[lowerIndex].stabbingCount = lowerIndex == 0 ? 0 : bounds[lowerIndex-1].stabbingCount;
+		bounds[upperIndex].stabbingCount = bounds[upperIndex-1].stabbingCount;
+
+		// Adjust the stabbing count between the new bounds.
+		for (int32 index = lowerIndex; index < upperIndex; ++index)
+		{
+			++bounds[index].stabbingCount;
+		}
+
+		// Adjust the all the affected bound indices.
+		for (int32 index = lowerIndex; index < boundCount + 2; ++index)
+		{
+			b2Proxy* proxy = m_proxyPool + bounds[index].proxyId;
+			if (bounds[index].IsLower())
+			{
+				proxy->lowerBounds[axis] = index;
+			}
+			else
+			{
+				proxy->upperBounds[axis] = index;
+			}
+		}
+	}
+
+	++m_proxyCount;
+
+	b2Assert(m_queryResultCount < m_proxyCapacity);
+
+	// Create pairs if the AABB is in range.
+	for (int32 i = 0; i < m_queryResultCount; ++i)
+	{
+		b2Assert(m_queryResults[i] < uint32(m_proxyCapacity));
+		b2Assert(m_proxyPool[m_queryResults[i]].IsValid());
+
+		m_pairManager.AddBufferedPair(proxyId, m_queryResults[i]);
+	}
+
+	m_pairManager.Commit();
+
+	if (s_validate)
+	{
+		Validate();
+	}
+
+	// Prepare for next query.
+	m_queryResultCount = 0;
+	IncrementTimeStamp();
+
+	return proxyId;
+}
+
+void b2SAPBroadPhase::DestroyProxy(uint32 proxyId)
+{
+	Flush();
+
+	b2Assert(0 < m_proxyCount && m_proxyCount <= m_proxyCapacity);
+	b2Proxy* proxy = m_proxyPool + proxyId;
+	b2Assert(proxy->IsValid());
+
+	int32 boundCount = 2 * m_proxyCount;
+
+	for (int32 axis = 0; axis < 2; ++axis)
+	{
+		b2Bound* bounds = m_bounds[axis];
+
+		int32 lowerIndex = proxy->lowerBounds[axis];
+		int32 upperIndex = proxy->upperBounds[axis];
+		uint16 lowerValue = bounds[lowerIndex].value;
+		uint16 upperValue = bounds[upperIndex].value;
+
+		memmove(bounds + lowerIndex, bounds + lowerIndex + 1, (upperIndex - lowerIndex - 1) * sizeof(b2Bound));
+		memmove(bounds + upperIndex-1, bounds + upperIndex + 1, (boundCount - upperIndex - 1) * sizeof(b2Bound));
+
+		// Fix bound indices.
+		for (int32 index = lowerIndex; index < boundCount - 2; ++index)
+		{
+			b2Proxy* proxy = m_proxyPool + bounds[index].proxyId;
+			if (bounds[index].IsLower())
+			{
+				proxy->lowerBounds[axis] = index;
+			}
+			else
+			{
+				proxy->upperBounds[axis] = index;
+			}
+		}
+
+		// Fix stabbing count.
+		for (int32 index = lowerIndex; index < upperIndex - 1; ++index)
+		{
+			--bounds[index].stabbingCount;
+		}
+
+		// Query for pairs to be removed. lowerIndex and upperIndex are not needed.
+		Query(&lowerIndex, &upperIndex, lowerValue, upperValue, bounds, boundCount - 2, axis);
+	}
+
+	b2Assert(m_queryResultCount < m_proxyCapacity);
+
+	for (int32 i = 0; i < m_queryResultCount; ++i)
+	{
+		b2Assert(m_proxyPool[m_queryResults[i]].IsValid());
+		m_pairManager.RemoveBufferedPair(proxyId, m_queryResults[i]);
+	}
+
+	m_pairManager.Commit();
+
+	// Prepare for next query.
+	m_queryResultCount = 0;
+	IncrementTimeStamp();
+
+	// Return the proxy to the pool.
+	proxy->userData = NULL;
+	proxy->overlapCount = b2_invalid;
+	proxy->lowerBounds[0] = b2_invalid;
+	proxy->lowerBounds[1] = b2_invalid;
+	proxy->upperBounds[0] = b2_invalid;
+	proxy->upperBounds[1] = b2_invalid;
+
+	proxy->SetNext(m_freeProxy);
+	m_freeProxy = proxyId;
+	--m_proxyCount;
+
+	if (s_validate)
+	{
+		Validate();
+	}
+}
+
+void b2SAPBroadPhase::MoveProxy(uint32 proxyId, const b2AABB& aabb)
+{
+	if (proxyId == b2_nullProxy || uint32(m_proxyCapacity) <= proxyId)
+	{
+		b2Assert(false);
+		return;
+	}
+
+	if (aabb.IsValid() == false)
+	{
+		b2Assert(false);
+		return;
+	}
+
+	int32 boundCount = 2 * m_proxyCount;
+
+	b2Proxy* proxy = m_proxyPool + proxyId;
+
+	// Get new bound values
+	b2BoundValues newValues;
+	ComputeBounds(newValues.lowerValues, newValues.upperValues, aabb);
+
+	if (m_batchMoves)
+	{
+		// Only record the new bounds. Flush sorts them into place.
+		for (int32 axis = 0; axis < 2; ++axis)
+		{
+			m_bounds[axis][proxy->lowerBounds[axis]].value = newValues.lowerValues[axis];
+			m_bounds[axis][proxy->upperBounds[axis]].value = newValues.upperValues[axis];
+		}
+
+		if (proxy->moved == false)
+		{
+			proxy->moved = true;
+			m_moveBuffer[m_moveCount] = proxyId;
+			++m_moveCount;
+		}
+
+		return;
+	}
+
+	// Get old bound values
+	b2BoundValues oldValues;
+	for (int32 axis = 0; axis < 2; ++axis)
+	{
+		oldValues.lowerValues[axis] = m_bounds[axis][proxy->lowerBounds[axis]].value;
+		oldValues.upperValues[axis] = m_bounds[axis][proxy->upperBounds[axis]].value;
+	}
+
+	for (int32 axis = 0; axis < 2; ++axis)
+	{
+		b2Bound* bounds = m_bounds[axis];
+
+		int32 lowerIndex = proxy->lowerBounds[axis];
+		int32 upperIndex = proxy->upperBounds[axis];
+
+		uint16 lowerValue = newValues.lowerValues[axis];
+		uint16 upperValue = newValues.upperValues[axis];
+
+		int32 deltaLower = lowerValue - bounds[lowerIndex].value;
+		int32 deltaUpper = upperValue - bounds[upperIndex].value;
+
+		bounds[lowerIndex].value = lowerValue;
+		bounds[upperIndex].value = upperValue;
+
+		//
+		// Expanding adds overlaps
+		//
+
+		// Should we move the lower bound down?
+		if (deltaLower < 0)
+		{
+			int32 index = lowerIndex;
+			while (index > 0 && lowerValue < bounds[index-1].value)
+			{
+				b2Bound* bound = bounds + index;
+				b2Bound* prevBound = bound - 1;
+
+				int32 prevProxyId = prevBound->proxyId;
+				b2Proxy* prevProxy = m_proxyPool + prevBound->proxyId;
+
+				++prevBound->stabbingCount;
+
+				if (prevBound->IsUpper() == true)
+				{
+					if (TestOverlap(newValues, prevProxy))
+					{
+						m_pairManager.AddBufferedPair(proxyId, prevProxyId);
+					}
+
+					++prevProxy->upperBounds[axis];
+					++bound->stabbingCount;
+				}
+				else
+				{
+					++prevProxy->lowerBounds[axis];
+					--bound->stabbingCount;
+				}
+
+				--proxy->lowerBounds[axis];
+				b2Swap(*bound, *prevBound);
+				--index;
+			}
+		}
+
+		// Should we move the upper bound up?
+		if (deltaUpper > 0)
+		{
+			int32 index = upperIndex;
+			while (index < boundCount-1 && bounds[index+1].value <= upperValue)
+			{
+				b2Bound* bound = bounds + index;
+				b2Bound* nextBound = bound + 1;
+				int32 nextProxyId = nextBound->proxyId;
+				b2Proxy* nextProxy = m_proxyPool + nextProxyId;
+
+				++nextBound->stabbingCount;
+
+				if (nextBound->IsLower() == true)
+				{
+					if (TestOverlap(newValues, nextProxy))
+					{
+						m_pairManager.AddBufferedPair(proxyId, nextProxyId);
+					}
+
+					--nextProxy->lowerBounds[axis];
+					++bound->stabbingCount;
+				}
+				else
+				{
+					--nextProxy->upperBounds[axis];
+					--bound->stabbingCount;
+				}
+
+				++proxy->upperBounds[axis];
+				b2Swap(*bound, *nextBound);
+				++index;
+			}
+		}
+
+		//
+		// Shrinking removes overlaps
+		//
+
+		// Should we move the lower bound up?
+		if (deltaLower > 0)
+		{
+			int32 index = lowerIndex;
+			while (index < boundCount-1 && bounds[index+1].value <= lowerValue)
+			{
+				b2Bound* bound = bounds + index;
+				b2Bound* nextBound = bound + 1;
+
+				int32 nextProxyId = nextBound->proxyId;
+				b2Proxy* nextProxy = m_proxyPool + nextProxyId;
+
+				--nextBound->stabbingCount;
+
+				if (nextBound->IsUpper())
+				{
+					if (TestOverlap(oldValues, nextProxy))
+					{
+						m_pairManager.RemoveBufferedPair(proxyId, nextProxyId);
+					}
+
+					--nextProxy->upperBounds[axis];
+					--bound->stabbingCount;
+				}
+				else
+				{
+					--nextProxy->lowerBounds[axis];
+					++bound->stabbingCount;
+				}
+
+				++proxy->lowerBounds[axis];
+				b2Swap(*bound, *nextBound);
+				++index;
+			}
+		}
+
+		// Should we move the upper bound down?
+		if (deltaUpper < 0)
+		{
+			int32 index = upperIndex;
+			while (index > 0 && upperValue < bounds[index-1].value)
+			{
+				b2Bound* bound = bounds + index;
+				b2Bound* prevBound = bound - 1;
+
+				int32 prevProxyId = prevBound->proxyId;
+				b2Proxy* prevProxy = m_proxyPool + prevProxyId;
+
+				--prevBound->stabbingCount;
+
+				if (prevBound->IsLower() == true)
+				{
+					if (TestOverlap(oldValues, prevProxy))
+					{
+						m_pairManager.RemoveBufferedPair(proxyId, prevProxyId);
+					}
+
+					++prevProxy->lowerBounds[axis];
+					--bound->stabbingCount;
+				}
+				else
+				{
+					++prevProxy->upperBounds[axis];
+					++bound->stabbingCount;
+				}
+
+				--proxy->upperBounds[axis];
+				b2Swap(*bound, *prevBound);
+				--index;
+			}
+		}
+	}
+
+	if (s_validate)
+	{
+		Validate();
+	}
+}
+
+void b2SAPBroadPhase::Commit()
+{
+	Flush();
+
+	m_pairManager.Commit();
+}
+
+// Sort the bounds of an axis by value (LSD radix sort, one byte per pass),
+// then rebuild the bound indices and stabbing counts.
+void b2SAPBroadPhase::SortBounds(int32 axis)
+{
+	int32 boundCount = 2 * m_proxyCount;
+	b2Bound* bounds = m_bounds[axis];
+	b2Bound* buffer = m_sortBuffer;
+
+	for (int32 shift = 0; shift < 16; shift += 8)
+	{
+		int32 offsets[256];
+		memset(offsets, 0, sizeof(offsets));
+
+		for (int32 i = 0; i < boundCount; ++i)
+		{
+			++offsets[(bounds[i].value >> shift) & 0xff];
+		}
+
+		int32 sum = 0;
+		for (int32 i = 0; i < 256; ++i)
+		{
+			int32 count = offsets[i];
+			offsets[i] = sum;
+			sum += count;
+		}
+
+		for (int32 i = 0; i < boundCount; ++i)
+		{
+			buffer[offsets[(bounds[i].value >> shift) & 0xff]++] = bounds[i];
+		}
+
+		b2Swap(bounds, buffer);
+	}
+
+	// An even number of passes leaves the result in the bound array.
+	b2Assert(bounds == m_bounds[axis]);
+
+	uint32 stabbingCount = 0;
+	for (int32 i = 0; i < boundCount; ++i)
+	{
+		b2Bound* bound = bounds + i;
+		b2Proxy* proxy = m_proxyPool + bound->proxyId;
+		if (bound->IsLower())
+		{
+			proxy->lowerBounds[axis] = i;
+			++stabbingCount;
+		}
+		else
+		{
+			proxy->upperBounds[axis] = i;
+			--stabbingCount;
+		}
+
+		bound->stabbingCount = stabbingCount;
+	}
+}
+
+// Find the proxies that overlapped a moved proxy before the move. The bound
+// indices still hold the last sorted order, so this is the overlap query run
+// on indices: proxies starting inside the old x range, then proxies still open
+// at the old lower bound, found with the stabbing count. This also finds pairs
+// that were added since the last commit.
+void b2SAPBroadPhase::RemoveStalePairs(uint32 proxyId)
+{
+	const b2Proxy* proxy = m_proxyPool + proxyId;
+	const b2Bound* bounds = m_bounds[0];
+	int32 lowerIndex = int32(proxy->lowerBounds[0]);
+	int32 upperIndex = int32(proxy->upperBounds[0]);
+
+	for (int32 i = lowerIndex + 1; i < upperIndex; ++i)
+	{
+		if (bounds[i].IsLower())
+		{
+			RemoveStalePair(proxyId, bounds[i].proxyId);
+		}
+	}
+
+	if (lowerIndex > 0)
+	{
+		int32 i = lowerIndex - 1;
+		int32 s = bounds[i].stabbingCount;
+
+		while (s)
+		{
+			b2Assert(i >= 0);
+
+			if (bounds[i].IsLower())
+			{
+				const b2Proxy* other = m_proxyPool + bounds[i].proxyId;
+				if (lowerIndex < int32(other->upperBounds[0]))
+				{
+					RemoveStalePair(proxyId, bounds[i].proxyId);
+					--s;
+				}
+			}
+			--i;
+		}
+	}
+}
+
+// The bound values already hold the new bounds, so the value test tells if
+// a pair that overlapped on the old indices still overlaps.
+void b2SAPBroadPhase::RemoveStalePair(uint32 proxyId, uint32 otherId)
+{
+	const b2Proxy* proxy = m_proxyPool + proxyId;
+	const b2Proxy* other = m_proxyPool + otherId;
+
+	if (other->upperBounds[1] < proxy->lowerBounds[1] || proxy->upperBounds[1] < other->lowerBounds[1])
+	{
+		return;
+	}
+
+	if (TestOverlap(proxy, other) == false)
+	{
+		m_pairManager.RemoveBufferedPair(proxyId, otherId);
+	}
+}
+
+void b2SAPBroadPhase::Flush()
+{
+	if (m_moveCount == 0)
+	{
+		return;
+	}
+
+	// Remove the pairs of moved proxies that stopped overlapping. Do this
+	// before sorting, while the bound indices still give the old order, and
+	// before adding pairs, which may grow the pair storage.
+	for (int32 i = 0; i < m_moveCount; ++i)
+	{
+		RemoveStalePairs(m_moveBuffer[i]);
+	}
+
+	SortBounds(0);
+	SortBounds(1);
+
+	// Sweep along x. Every proxy that is open when a lower bound is reached
+	// overlaps the new proxy on x. Pairs of two unmoved proxies did not change,
+	// so unmoved proxies only check the open moved proxies.
+	const b2Bound* bounds = m_bounds[0];
+	int32 boundCount = 2 * m_proxyCount;
+	int32 activeCount = 0;
+	int32 activeMovedCount = 0;
+
+	for (int32 i = 0; i < boundCount; ++i)
+	{
+		uint32 proxyId = bounds[i].proxyId;
+		const b2Proxy* proxy = m_proxyPool + proxyId;
+
+		if (bounds[i].IsUpper())
+		{
+			uint32* active = proxy->moved ? m_activeMoved : m_activeProxies;
+			int32* count = proxy->moved ? &activeMovedCount : &activeCount;
+			for (int32 j = *count - 1; j >= 0; --j)
+			{
+				if (active[j] == proxyId)
+				{
+					active[j] = active[*count - 1];
+					--(*count);
+					break;
+				}
+			}
+			continue;
+		}
+
+		// Bound indices are sorted, so compare them instead of values.
+		for (int32 j = 0; j < activeMovedCount; ++j)
+		{
+			const b2Proxy* other = m_proxyPool + m_activeMoved[j];
+			if (proxy->lowerBounds[1] < other->upperBounds[1] && other->lowerBounds[1] < proxy->upperBounds[1])
+			{
+				m_pairManager.AddBufferedPair(proxyId, m_activeMoved[j]);
+			}
+		}
+
+		if (proxy->moved)
+		{
+			for (int32 j = 0; j < activeCount; ++j)
+			{
+				const b2Proxy* other = m_proxyPool + m_activeProxies[j];
+				if (proxy->lowerBounds[1] < other->upperBounds[1] && other->lowerBounds[1] < proxy->upperBounds[1])
+				{
+					m_pairManager.AddBufferedPair(proxyId, m_activeProxies[j]);
+				}
+			}
+
+			m_activeMoved[activeMovedCount++] = proxyId;
+		}
+		else
+		{
+			m_activeProxies[activeCount++] = proxyId;
+		}
+	}
+
+	for (int32 i = 0; i < m_moveCount; ++i)
+	{
+		m_proxyPool[m_moveBuffer[i]].moved = false;
+	}
+	m_moveCount = 0;
+
+	if (s_validate)
+	{
+		Validate();
+	}
+}
+
+int32 b2SAPBroadPhase::Query(const b2AABB& aabb, void** userData, int32 maxCount)
+{
+	Flush();
+
+	if (maxCount <= 0)
+	{
+		return 0;
+	}
+
+	uint16 lowerValues[2];
+	uint16 upperValues[2];
+	ComputeBounds(lowerValues, upperValues, aabb);
+
+	b2SAPUserQuery userQuery;
+	userQuery.broadPhase = this;
+	userQuery.userData = userData;
+	userQuery.maxCount = maxCount;
+	userQuery.count = 0;
+
+	QueryBounds(&userQuery, lowerValues, upperValues);
+
+	return userQuery.count;
+}
+
+void b2SAPBroadPhase::Validate()
+{
+	for (int32 axis = 0; axis < 2; ++axis)
+	{
+		b2Bound* bounds = m_bounds[axis];
+
+		int32 boundCount = 2 * m_proxyCount;
+		uint32 stabbingCount = 0;
+
+		for (int32 i = 0; i < boundCount; ++i)
+		{
+			b2Bound* bound = bounds + i;
+			b2Assert(i == 0 || bounds[i-1].value <= bound->value);
+			b2Assert(bound->proxyId != b2_nullProxy);
+			b2Assert(m_proxyPool[bound->proxyId].IsValid());
+
+			if (bound->IsLower() == true)
+			{
+				b2Assert(m_proxyPool[bound->proxyId].lowerBounds[axis] == i);
+				++stabbingCount;
+			}
+			else
+			{
+				b2Assert(m_proxyPool[bound->proxyId].upperBounds[axis] == i);
+				--stabbingCount;
+			}
+
+			b2Assert(bound->stabbingCount == stabbingCount);
+		}
+	}
+}
+
+
+void b2SAPBroadPhase::Query(b2BroadPhaseQueryCallback* callback, const b2AABB& aabb)
+{
+	Flush();
+
+	uint16 lowerValues[2];
+	uint16 upperValues[2];
+	ComputeBounds(lowerValues, upperValues, aabb);
+
+	b2SAPCallbackQuery callbackQuery;
+	callbackQuery.broadPhase = this;
+	callbackQuery.callback = callback;
+
+	QueryBounds(&callbackQuery, lowerValues, upperValues);
+}
+
+int32 b2SAPBroadPhase::QuerySegment(const b2Segment& segment, void** userData, int32 maxCount, SortKeyFunc sortKey)
+{
+	Flush();
+
+	if (m_proxyCount == 0)
+	{
+		return 0;
+	}
+
+	float32 maxLambda = 1;
+
+	float32 dx = (segment.p2.x-segment.p1.x)*m_quantizationFactor.x;
+	float32 dy = (segment.p2.y-segment.p1.y)*m_quantizationFactor.y;
+
+	int32 sx = dx<-B2_FLT_EPSILON ? -1 : (dx>B2_FLT_EPSILON ? 1 : 0);
+	int32 sy = dy<-B2_FLT_EPSILON ? -1 : (dy>B2_FLT_EPSILON ? 1 : 0);
+
+	b2Assert(sx!=0||sy!=0);
+
+	float32 p1x = (segment.p1.x-m_worldAABB.lowerBound.x)*m_quantizationFactor.x;
+	float32 p1y = (segment.p1.y-m_worldAABB.lowerBound.y)*m_quantizationFactor.y;
+
+	uint16 startValues[2];
+	uint16 startValues2[2];
+
+	int32 xIndex;
+	int32 yIndex;
+
+	uint32 proxyId;
+	b2Proxy* proxy;
+	
+	// TODO_ERIN implement fast float to uint16 conversion.
+	startValues[0] = (uint16)(p1x) & (B2BROADPHASE_MAX - 1);
+	startValues2[0] = (uint16)(p1x) | 1;
+
+	startValues[1] = (uint16)(p1y) & (B2BROADPHASE_MAX - 1);
+	startValues2[1] = (uint16)(p1y) | 1;
+
+	// The results live on the heap for the duration of this call, so concurrent
+	// queries do not share state.
+	uint32* results = (uint32*)b2Alloc(m_proxyCapacity * sizeof(uint32));
+	float32* keys = (float32*)b2Alloc(m_proxyCapacity * sizeof(float32));
+	int32 resultCount;
+
+	//First deal with all the proxies that contain segment.p1
+	b2SAPResultQuery startQuery;
+	startQuery.results = results;
+	startQuery.count = 0;
+	QueryBounds(&startQuery, startValues, startValues2);
+	resultCount = startQuery.count;
+
+	int32 boundCount = 2*m_proxyCount;
+	if(sx>=0)	xIndex = BinarySearch(m_bounds[0],boundCount,startValues2[0])-1;
+	else		xIndex = BinarySearch(m_bounds[0],boundCount,startValues[0]);
+	if(sy>=0)	yIndex = BinarySearch(m_bounds[1],boundCount,startValues2[1])-1;
+	else		yIndex = BinarySearch(m_bounds[1],boundCount,startValues[1]);
+
+	//If we are using sortKey, then sort what we have so far, filtering negative keys
+	if(sortKey)
+	{
+		//Fill keys
+		for(int32 i=0;i<resultCount;i++)
+		{
+			keys[i] = sortKey(m_proxyPool[results[i]].userData);
+		}
+		//Bubble sort keys
+		//Sorting negative values to the top, so we can easily remove them
+		int32 i = 0;
+		while(i<resultCount-1)
+		{
+			float32 a = keys[i];
+			float32 b = keys[i+1];
+			if((a<0)?(b>=0):(a>b&&b>=0))
+			{
+				keys[i+1] = a;
+				keys[i]   = b;
+				uint32 tempValue = results[i+1];
+				results[i+1] = results[i];
+				results[i] = tempValue;
+				i--;
+				if(i==-1) i=1;
+			}
+			else
+			{
+				i++;
+			}
+		}
+		//Skim off negative values
+		while(resultCount>0 && keys[resultCount-1]<0)
+			resultCount--;
+	}
+
+	//Now work through the rest of the segment
+	for (;;)
+	{
+		float32 xProgress = 0;
+		float32 yProgress = 0;
+		//Move on to the next bound
+		xIndex += sx>=0?1:-1;
+		if(xIndex<0||xIndex>=m_proxyCount*2)
+			break;
+		if(sx!=0)
+			xProgress = ((float32)m_bounds[0][xIndex].value-p1x)/dx;
+		//Move on to the next bound
+		yIndex += sy>=0?1:-1;
+		if(yIndex<0||yIndex>=m_proxyCount*2)
+			break;
+		if(sy!=0)
+			yProgress = ((float32)m_bounds[1][yIndex].value-p1y)/dy;
+		for(;;)
+		{
+			if(sy==0||(sx!=0&&xProgress<yProgress))
+			{
+				if(xProgress>maxLambda)
+					break;
+
+				//Check that we are entering a proxy, not leaving
+				if(sx>0?m_bounds[0][xIndex].IsLower():m_bounds[0][xIndex].IsUpper()){
+					//Check the other axis of the proxy
+					proxyId = m_bounds[0][xIndex].proxyId;
+					proxy = m_proxyPool+proxyId;
+					if(sy>=0)
+					{
+						if(proxy->lowerBounds[1]<=yIndex-1&&proxy->upperBounds[1]>=yIndex)
+						{
+							//Add the proxy
+							if(sortKey)
+							{
+								AddProxyResult(results,keys,&resultCount,proxyId,proxy,maxCount,sortKey);
+							}
+							else
+							{
+								results[resultCount] = proxyId;
+								++resultCount;
+							}
+						}
+					}
+					else
+					{
+						if(proxy->lowerBounds[1]<=yIndex&&proxy->upperBounds[1]>=yIndex+1)
+						{
+							//Add the proxy
+							if(sortKey)
+							{
+								AddProxyResult(results,keys,&resultCount,proxyId,proxy,maxCount,sortKey);
+							}
+							else
+							{
+								results[resultCount] = proxyId;
+								++resultCount;
+							}
+						}
+					}
+				}
+
+				//Early out
+				if(sortKey && resultCount==maxCount && resultCount>0 && xProgress>keys[resultCount-1])
+					break;
+
+				//Move on to the next bound
+				if(sx>0)
+				{
+					xIndex++;
+					if(xIndex==m_proxyCount*2)
+						break;
+				}
+				else
+				{
+					xIndex--;
+					if(xIndex<0)
+						break;
+				}
+				xProgress = ((float32)m_bounds[0][xIndex].value - p1x) / dx;
+			}
+			else
+			{
+				if(yProgress>maxLambda)
+					break;
+
+				//Check that we are entering a proxy, not leaving
+				if(sy>0?m_bounds[1][yIndex].IsLower():m_bounds[1][yIndex].IsUpper()){
+					//Check the other axis of the proxy
+					proxyId = m_bounds[1][yIndex].proxyId;
+					proxy = m_proxyPool+proxyId;
+					if(sx>=0)
+					{
+						if(proxy->lowerBounds[0]<=xIndex-1&&proxy->upperBounds[0]>=xIndex)
+						{
+							//Add the proxy
+							if(sortKey)
+							{
+								AddProxyResult(results,keys,&resultCount,proxyId,proxy,maxCount,sortKey);
+							}
+							else
+							{
+								results[resultCount] = proxyId;
+								++resultCount;
+							}
+						}
+					}
+					else
+					{
+						if(proxy->lowerBounds[0]<=xIndex&&proxy->upperBounds[0]>=xIndex+1)
+						{
+							//Add the proxy
+							if(sortKey)
+							{
+								AddProxyResult(results,keys,&resultCount,proxyId,proxy,maxCount,sortKey);
+							}
+							else
+							{
+								results[resultCount] = proxyId;
+								++resultCount;
+							}
+						}
+					}
+				}
+
+				//Early out
+				if(sortKey && resultCount==maxCount && resultCount>0 && yProgress>keys[resultCount-1])
+					break;
+
+				//Move on to the next bound
+				if(sy>0)
+				{
+					yIndex++;
+					if(yIndex==m_proxyCount*2)
+						break;
+				}
+				else
+				{
+					yIndex--;
+					if(yIndex<0)
+						break;
+				}
+				yProgress = ((float32)m_bounds[1][yIndex].value - p1y) / dy;
+			}
+		}
+
+		break;
+	}
+
+	int32 count = 0;
+	for(int32 i=0;i < resultCount && count<maxCount; ++i, ++count)
+	{
+		b2Assert(results[i] < uint32(m_proxyCapacity));
+		b2Proxy* proxy = m_proxyPool + results[i];
+		b2Assert(proxy->IsValid());
+		userData[i] = proxy->userData;
+	}
+
+	b2Free(keys);
+	b2Free(results);
+
+	return count;
+
+}
+void b2SAPBroadPhase::AddProxyResult(uint32* results, float32* keys, int32* resultCount, uint32 proxyId,
+									 const b2Proxy* proxy, int32 maxCount, SortKeyFunc sortKey) const
+{
+	float32 key = sortKey(proxy->userData);
+	//Filter proxies on positive keys
+	if(key<0)
+		return;
+	//Merge the new key into the sorted list.
+	//float32* p = std::lower_bound(keys,keys+*resultCount,key);
+	float32* p = keys;
+	while(p<keys+*resultCount&&*p<key)
+		p++;
+	int32 i = (int32)(p-keys);
+	if(maxCount==*resultCount&&i==*resultCount)
+		return;
+	if(maxCount==*resultCount)
+		--*resultCount;
+	//std::copy_backward
+	for(int32 j=*resultCount;j>i;--j){
+		keys[j] = keys[j-1];
+		results[j]  = results[j-1];
+	}
+	keys[i] = key;
+	results[i] = proxyId;
+	++*resultCount;
+}
\ No newline at end of file
@@ -0,0 +1,192 @@
+/*
+* Copyright (c) 2006-2009 Erin Catto http://www.gphysics.com
+*
+* This software is provided 'as-is', without any express or implied
+* warranty.  In no event will the authors be held liable for any damages
+* arising from the use of this software.
+* Permission is granted to anyone to use this software for any purpose,
+* including commercial applications, and to alter it and redistribute it
+* freely, subject to the following restrictions:
+* 1. The origin of this software must not be misrepresented; you must not
+* claim that you wrote the original software. If you use this software
+* in a product, an acknowledgment in the product documentation would be
+* appreciated but is not required.
+* 2. Altered source versions must be plainly marked as such, and must not be
+* misrepresented as being the original software.
+* 3. This notice may not be removed or altered from any source distribution.
+*/
+
+#ifndef B2_SAP_BROAD_PHASE_H
+#define B2_SAP_BROAD_PHASE_H
+
+/*
+This broad phase uses the Sweep and Prune algorithm as described in:
+Collision Detection in Interactive 3D Environments by Gino van den Bergen
+Also, some ideas, such as using integral values for fast compares comes from
+Bullet (http:/www.bulletphysics.com).
+*/
+
+#include "b2BroadPhase.h"
+
+#ifdef TARGET_FLOAT32_IS_FIXED
+#define	B2BROADPHASE_MAX	(USHRT_MAX/2)
+#else
+#define	B2BROADPHASE_MAX	USHRT_MAX
+
+#endif
+
+const uint32 b2_invalid = UINT_MAX;
+const uint32 b2_nullEdge = UINT_MAX;
+struct b2BoundValues;
+
+struct b2Bound
+{
+	bool IsLower() const { return (value & 1) == 0; }
+	bool IsUpper() const { return (value & 1) == 1; }
+
+	uint16 value;
+	uint32 proxyId;
+	uint32 stabbingCount;
+};
+
+struct b2Proxy
+{
+	uint32 GetNext() const { return lowerBounds[0]; }
+	void SetNext(uint32 next) { lowerBounds[0] = next; }
+	bool IsValid() const { return overlapCount != b2_invalid; }
+
+	uint32 lowerBounds[2], upperBounds[2];
+	uint32 overlapCount;
+	uint16 timeStamp;
+	bool moved;
+	void* userData;
+};
+
+/// Sweep and prune broad-phase. Good for worlds with a known extent and
+/// objects spread evenly along both axes.
+///
+/// By default MoveProxy shifts the bounds into place and reports every crossing
+/// right away. In batched mode MoveProxy only records the new bounds. Flush then
+/// radix sorts both axes and finds the pair changes of all moved proxies in a
+/// single sweep. This is O(n + changes) per step, which wins when many proxies
+/// move far, and loses when few proxies move.
+class b2SAPBroadPhase : public b2BroadPhase
+{
+public:
+	/// The proxy capacity is only a hint. The proxy, bound, and pair storage
+	/// grows as needed.
+	b2SAPBroadPhase(const b2AABB& worldAABB, b2PairCallback* callback, int32 proxyCapacity = b2_proxyPoolSize, bool batchMoves = false);
+	~b2SAPBroadPhase();
+
+	// Create and destroy proxies. These call Flush first.
+	uint32 CreateProxy(const b2AABB& aabb, void* userData, bool isStatic);
+	void DestroyProxy(uint32 proxyId);
+
+	// Call MoveProxy as many times as you like, then when you are done
+	// call Commit to finalized the proxy pairs (for your time step).
+	void MoveProxy(uint32 proxyId, const b2AABB& aabb);
+	void Commit();
+
+	// Apply the moves recorded in batched mode. Queries and proxy creation
+	// call this first, so it is only needed for direct access to the bounds.
+	// Once flushed, queries only read the broad-phase and may run concurrently.
+	void Flush();
+
+	// Get a single proxy. Returns NULL if the id is invalid.
+	b2Proxy* GetProxy(uint32 proxyId);
+
+	void* GetUserData(uint32 proxyId) const;
+	b2AABB GetFatAABB(uint32 proxyId) const;
+	bool TestOverlap(uint32 proxyId1, uint32 proxyId2) const;
+	int32 GetProxyCapacity() const;
+
+	// Query an AABB for overlapping proxies, returns the user data and
+	// the count, up to the supplied maximum count.
+	int32 Query(const b2AABB& aabb, void** userData, int32 maxCount);
+	void Query(b2BroadPhaseQueryCallback* callback, const b2AABB& aabb);
+
+	// Query a segment for overlapping proxies, returns the user data and
+	// the count, up to the supplied maximum count.
+	// If sortKey is provided, then it is a function mapping from proxy userDatas to distances along the segment (between 0 & 1)
+	// Then the returned proxies are sorted on that, before being truncated to maxCount
+	// The sortKey of a proxy is assumed to be larger than the closest point inside the proxy along the segment, this allows for early exits
+	// Proxies with a negative sortKey are discarded
+	int32 QuerySegment(const b2Segment& segment, void** userData, int32 maxCount, SortKeyFunc sortKey);
+
+	void Validate();
+	void ValidatePairs();
+
+private:
+	void ComputeBounds(uint16* lowerValues, uint16* upperValues, const b2AABB& aabb);
+
+	bool TestOverlap(const b2Proxy* p1, const b2Proxy* p2) const;
+	bool TestOverlap(const b2BoundValues& b, b2Proxy* p);
+
+	void Query(int32* lowerIndex, int32* upperIndex, uint16 lowerValue, uint16 upperValue,
+				b2Bound* bounds, int32 boundCount, int32 axis);
+	void IncrementOverlapCount(uint32 proxyId);
+	void IncrementTimeStamp();
+
+	// Read only query used by the public queries. Calls callback->QueryCallback(proxyId)
+	// for every proxy overlapping the bounds, until the callback returns false.
+	template <typename T>
+	void QueryBounds(T* callback, const uint16* lowerValues, const uint16* upperValues) const;
+	void AddProxyResult(uint32* results, float32* keys, int32* resultCount, uint32 proxyId,
+						const b2Proxy* proxy, int32 maxCount, SortKeyFunc sortKey) const;
+	void ReserveProxies(int32 capacity);
+	void SortBounds(int32 axis);
+	void RemoveStalePairs(uint32 proxyId);
+	void RemoveStalePair(uint32 proxyId, uint32 otherId);
+
+public:
+	b2Proxy* m_proxyPool;
+	int32 m_proxyCapacity;
+	uint32 m_freeProxy;
+
+	b2Bound* m_bounds[2];
+
+	// Results of the proxy creation and destruction queries.
+	uint32* m_queryResults;
+	int32 m_queryResultCount;
+
+	b2Vec2 m_quantizationFactor;
+	uint16 m_timeStamp;
+
+	bool m_batchMoves;
+	uint32* m_moveBuffer;
+	int32 m_moveCount;
+
+	// Scratch space for the batched update.
+	b2Bound* m_sortBuffer;
+	uint32* m_activeProxies;
+	uint32* m_activeMoved;
+};
+
+inline b2Proxy* b2SAPBroadPhase::GetProxy(uint32 proxyId)
+{
+	if (proxyId >= uint32(m_proxyCapacity) || m_proxyPool[proxyId].IsValid() == false)
+	{
+		return NULL;
+	}
+
+	return m_proxyPool + proxyId;
+}
+
+inline void* b2SAPBroadPhase::GetUserData(uint32 proxyId) const
+{
+	b2Assert(proxyId < uint32(m_proxyCapacity));
+	return m_proxyPool[proxyId].userData;
+}
+
+inline bool b2SAPBroadPhase::TestOverlap(uint32 proxyId1, uint32 proxyId2) const
+{
+	b2Assert(proxyId1 < uint32(m_proxyCapacity) && proxyId2 < uint32(m_proxyCapacity));
+	return TestOverlap(m_proxyPool + proxyId1, m_proxyPool + proxyId2);
+}
+
+inline int32 b2SAPBroadPhase::GetProxyCapacity() const
+{
+	return m_proxyCapacity;
+}
+
+#endif
@@ -0,0 +1,680 @@
+/*
+* Copyright (c) 2009 Erin Catto http://www.gphysics.com
+*
+* This software is provided 'as-is', without any express or implied
+* warranty.  In no event will the authors be held liable for any damages
+* arising from the use of this software.
+* Permission is granted to anyone to use this software for any purpose,
+* including commercial applications, and to alter it and redistribute it
+* freely, subject to the following restrictions:
+* 1. The origin of this software must not be misrepresented; you must not
+* claim that you wrote the original software. If you use this software
+* in a product, an acknowledgment in the product documentation would be
+* appreciated but is not required.
+* 2. Altered source versions must be plainly marked as such, and must not be
+* misrepresented as being the original software.
+* 3. This notice may not be removed or altered from any source distribution.
+*/
+
+#include "b2TreeBroadPhase.h"
+
+#include <string.h>
+
+// The tree leaves store the broad-phase proxy id as their user data.
+inline void* b2TreeLeafData(uint32 proxyId)
+{
+	return (void*)(size_t)proxyId;
+}
+
+inline uint32 b2TreeLeafProxyId(const b2DynamicTree* tree, uint32 treeProxyId)
+{
+	return uint32((size_t)tree->GetUserData(treeProxyId));
+}
+
+// Buffers a pair for every proxy overlapping a moved proxy.
+struct b2TreePairQuery
+{
+	bool QueryCallback(uint32 treeProxyId)
+	{
+		uint32 proxyId = b2TreeLeafProxyId(tree, treeProxyId);
+		if (proxyId != queryProxyId)
+		{
+			broadPhase->m_pairManager.AddBufferedPair(queryProxyId, proxyId);
+		}
+
+		return true;
+	}
+
+	b2TreeBroadPhase* broadPhase;
+	const b2DynamicTree* tree;
+	uint32 queryProxyId;
+};
+
+// Buffers the removal of pairs that no longer overlap the fat AABB of the
+// query proxy. Every pair is removed if there is no fat AABB.
+struct b2TreeRemoveQuery
+{
+	bool QueryCallback(uint32 treeProxyId)
+	{
+		uint32 proxyId = b2TreeLeafProxyId(tree, treeProxyId);
+		if (proxyId == queryProxyId)
+		{
+			return true;
+		}
+
+		if (fatAABB == NULL || b2TestOverlap(*fatAABB, tree->GetFatAABB(treeProxyId)) == false)
+		{
+			broadPhase->m_pairManager.RemoveBufferedPair(queryProxyId, proxyId);
+		}
+
+		return true;
+	}
+
+	b2TreeBroadPhase* broadPhase;
+	const b2DynamicTree* tree;
+	uint32 queryProxyId;
+	const b2AABB* fatAABB;
+};
+
+// Collects user data up to a maximum count.
+struct b2TreeUserQuery
+{
+	bool QueryCallback(uint32 treeProxyId)
+	{
+		userData[count++] = broadPhase->GetUserData(b2TreeLeafProxyId(tree, treeProxyId));
+		return count < maxCount;
+	}
+
+	const b2TreeBroadPhase* broadPhase;
+	const b2DynamicTree* tree;
+	void** userData;
+	int32 maxCount;
+	int32 count;
+};
+
+// Collects user data along a segment. With a sort key the results are kept sorted
+// and the segment is clipped once maxCount results are found.
+struct b2TreeSegmentQuery
+{
+	float32 RayCastCallback(const b2RayCastInput& input, uint32 treeProxyId)
+	{
+		void* proxyUserData = broadPhase->GetUserData(b2TreeLeafProxyId(tree, treeProxyId));
+
+		if (sortKey == NULL)
+		{
+			userData[count++] = proxyUserData;
+			if (count == maxCount)
+			{
+				return 0.0f;
+			}
+
+			return input.maxFraction;
+		}
+
+		float32 key = sortKey(proxyUserData);
+		if (key < 0.0f)
+		{
+			return -1.0f;
+		}
+
+		if (count == maxCount && key >= keys[count-1])
+		{
+			return -1.0f;
+		}
+
+		// Insertion sort. The last result drops off when full.
+		int32 i = count < maxCount ? count++ : count - 1;
+		while (i > 0 && keys[i-1] > key)
+		{
+			keys[i] = keys[i-1];
+			userData[i] = userData[i-1];
+			--i;
+		}
+		keys[i] = key;
+		userData[i] = proxyUserData;
+
+		if (count == maxCount)
+		{
+			return keys[count-1];
+		}
+
+		return input.maxFraction;
+	}
+
+	const b2TreeBroadPhase* broadPhase;
+	const b2DynamicTree* tree;
+	void** userData;
+	float32* keys;
+	int32 maxCount;
+	int32 count;
+	SortKeyFunc sortKey;
+};
+
+// Forwards the leaves found by a tree query to a broad-phase callback.
+struct b2TreeCallbackQuery
+{
+	bool QueryCallback(uint32 treeProxyId)
+	{
+		void* proxyUserData = broadPhase->GetUserData(b2TreeLeafProxyId(tree, treeProxyId));
+		proceed = callback->QueryCallback(proxyUserData);
+		return proceed;
+	}
+
+	const b2TreeBroadPhase* broadPhase;
+	const b2DynamicTree* tree;
+	b2BroadPhaseQueryCallback* callback;
+	bool proceed;
+};
+
+// Forwards the leaves found by a nearest query to a broad-phase callback.
+struct b2TreeNearestQuery
+{
+	float32 NearestCallback(uint32 treeProxyId, float32 maxDistance)
+	{
+		void* proxyUserData = broadPhase->GetUserData(b2TreeLeafProxyId(tree, treeProxyId));
+		distance = callback->NearestCallback(proxyUserData, maxDistance);
+		return distance;
+	}
+
+	const b2TreeBroadPhase* broadPhase;
+	const b2DynamicTree* tree;
+	b2BroadPhaseNearestCallback* callback;
+	float32 distance;
+};
+
+// Forwards the leaves hit by a tree ray-cast to a broad-phase callback.
+struct b2TreeRayCastQuery
+{
+	float32 RayCastCallback(const b2RayCastInput& input, uint32 treeProxyId)
+	{
+		void* proxyUserData = broadPhase->GetUserData(b2TreeLeafProxyId(tree, treeProxyId));
+		float32 value = callback->RayCastCallback(input, proxyUserData);
+
+		if (value == 0.0f)
+		{
+			terminated = true;
+		}
+		else if (0.0f < value && value < maxFraction)
+		{
+			maxFraction = value;
+		}
+
+		return value;
+	}
+
+	const b2TreeBroadPhase* broadPhase;
+	const b2DynamicTree* tree;
+	b2BroadPhaseRayCastCallback* callback;
+	float32 maxFraction;
+	bool terminated;
+};
+
+// Forwards the leaves hit by a packet of rays to a batch callback.
+struct b2TreeRayPacketQuery
+{
+	float32 RayCastCallback(const b2RayCastInput& input, uint32 treeProxyId, int32 rayIndex)
+	{
+		void* proxyUserData = broadPhase->GetUserData(b2TreeLeafProxyId(tree, treeProxyId));
+		float32 value = callback->RayCastCallback(input, proxyUserData, baseIndex + rayIndex);
+
+		// Carry the clipping over to the static tree. A terminated ray is skipped there.
+		if (value == 0.0f || (0.0f < value && value < maxFractions[rayIndex]))
+		{
+			maxFractions[rayIndex] = value;
+		}
+
+		return value;
+	}
+
+	const b2TreeBroadPhase* broadPhase;
+	const b2DynamicTree* tree;
+	b2BroadPhaseRayBatchCallback* callback;
+	int32 baseIndex;
+	float32 maxFractions[b2_rayPacketSize];
+};
+
+b2TreeBroadPhase::b2TreeBroadPhase(const b2AABB& worldAABB, b2PairCallback* callback, int32 proxyCapacity, bool wideNodes)
+: b2BroadPhase(worldAABB, callback, proxyCapacity), m_tree(2 * proxyCapacity - 1)
+{
+	m_type = e_dynamicTreeBroadPhase;
+	m_tree.SetWideNodes(wideNodes);
+	m_staticTree.SetWideNodes(wideNodes);
+
+	m_proxyCapacity = 0;
+	m_proxies = NULL;
+	m_freeProxy = b2_nullProxy;
+	ReserveProxies(b2Max(proxyCapacity, 1));
+
+	m_moveCapacity = 16;
+	m_moveCount = 0;
+	m_moveBuffer = (uint32*)b2Alloc(m_moveCapacity * sizeof(uint32));
+}
+
+b2TreeBroadPhase::~b2TreeBroadPhase()
+{
+	b2Free(m_moveBuffer);
+	b2Free(m_proxies);
+}
+
+void b2TreeBroadPhase::ReserveProxies(int32 capacity)
+{
+	b2Assert(capacity > m_proxyCapacity);
+
+	b2TreeProxy* oldProxies = m_proxies;
+	m_proxies = (b2TreeProxy*)b2Alloc(capacity * sizeof(b2TreeProxy));
+	if (oldProxies)
+	{
+		memcpy(m_proxies, oldProxies, m_proxyCapacity * sizeof(b2TreeProxy));
+		b2Free(oldProxies);
+	}
+
+	// Thread the new proxies onto the free list.
+	for (int32 i = m_proxyCapacity; i < capacity - 1; ++i)
+	{
+		m_proxies[i].userData = NULL;
+		m_proxies[i].treeProxyId = uint32(i + 1);
+		m_proxies[i].isStatic = false;
+	}
+	m_proxies[capacity - 1].userData = NULL;
+	m_proxies[capacity - 1].treeProxyId = m_freeProxy;
+	m_proxies[capacity - 1].isStatic = false;
+
+	m_freeProxy = uint32(m_proxyCapacity);
+	m_proxyCapacity = capacity;
+}
+
+uint32 b2TreeBroadPhase::AllocateProxy(void* userData, bool isStatic)
+{
+	if (m_freeProxy == b2_nullProxy)
+	{
+		ReserveProxies(2 * m_proxyCapacity);
+	}
+
+	uint32 proxyId = m_freeProxy;
+	b2TreeProxy* proxy = m_proxies + proxyId;
+	m_freeProxy = proxy->treeProxyId;
+
+	proxy->userData = userData;
+	proxy->treeProxyId = b2_nullProxy;
+	proxy->isStatic = isStatic;
+	++m_proxyCount;
+	return proxyId;
+}
+
+void b2TreeBroadPhase::FreeProxy(uint32 proxyId)
+{
+	b2Assert(m_proxyCount > 0);
+
+	b2TreeProxy* proxy = m_proxies + proxyId;
+	proxy->userData = NULL;
+	proxy->treeProxyId = m_freeProxy;
+	proxy->isStatic = false;
+	m_freeProxy = proxyId;
+	--m_proxyCount;
+}
+
+uint32 b2TreeBroadPhase::CreateProxy(const b2AABB& aabb, void* userData, bool isStatic)
+{
+	uint32 proxyId = AllocateProxy(userData, isStatic);
+	m_proxies[proxyId].treeProxyId = GetOwnerTree(proxyId).CreateProxy(aabb, b2TreeLeafData(proxyId));
+
+	// Pairs are found in the next Commit.
+	BufferMove(proxyId);
+	return proxyId;
+}
+
+void b2TreeBroadPhase::CreateProxies(const b2AABB* aabbs, void** userData, int32 count, uint32* proxyIds, bool isStatic)
+{
+	if (count <= 0)
+	{
+		return;
+	}
+
+	void** leafData = (void**)b2Alloc(count * sizeof(void*));
+	uint32* treeProxyIds = (uint32*)b2Alloc(count * sizeof(uint32));
+
+	for (int32 i = 0; i < count; ++i)
+	{
+		proxyIds[i] = AllocateProxy(userData[i], isStatic);
+		leafData[i] = b2TreeLeafData(proxyIds[i]);
+	}
+
+	b2DynamicTree& tree = isStatic ? m_staticTree : m_tree;
+	tree.CreateProxies(aabbs, leafData, count, treeProxyIds);
+
+	for (int32 i = 0; i < count; ++i)
+	{
+		m_proxies[proxyIds[i]].treeProxyId = treeProxyIds[i];
+		BufferMove(proxyIds[i]);
+	}
+
+	b2Free(treeProxyIds);
+	b2Free(leafData);
+}
+
+void b2TreeBroadPhase::DestroyProxy(uint32 proxyId)
+{
+	b2DynamicTree& tree = GetOwnerTree(proxyId);
+	uint32 treeProxyId = m_proxies[proxyId].treeProxyId;
+
+	// Every live pair of this proxy overlaps its fat AABB.
+	RemovePairs(proxyId, tree.GetFatAABB(treeProxyId), NULL);
+
+	m_pairManager.Commit();
+
+	UnBufferMove(proxyId);
+	tree.DestroyProxy(treeProxyId);
+	FreeProxy(proxyId);
+}
+
+void b2TreeBroadPhase::MoveProxy(uint32 proxyId, const b2AABB& aabb)
+{
+	if (aabb.IsValid() == false)
+	{
+		b2Assert(false);
+		return;
+	}
+
+	b2DynamicTree& tree = GetOwnerTree(proxyId);
+	uint32 treeProxyId = m_proxies[proxyId].treeProxyId;
+
+	b2AABB oldAABB = tree.GetFatAABB(treeProxyId);
+	bool moved = tree.MoveProxy(treeProxyId, aabb);
+	if (moved == false)
+	{
+		return;
+	}
+
+	// Drop the pairs that the new fat AABB left behind.
+	RemovePairs(proxyId, oldAABB, &tree.GetFatAABB(treeProxyId));
+
+	BufferMove(proxyId);
+}
+
+void b2TreeBroadPhase::SetProxyStatic(uint32 proxyId, bool isStatic)
+{
+	b2TreeProxy* proxy = m_proxies + proxyId;
+	if (proxy->isStatic == isStatic)
+	{
+		return;
+	}
+
+	b2DynamicTree& oldTree = GetOwnerTree(proxyId);
+
+	// Shrink the fat AABB back so the new leaf gets the same fat AABB
+	// and the existing pairs stay valid.
+	b2Vec2 r(b2_aabbExtension, b2_aabbExtension);
+	b2AABB aabb = oldTree.GetFatAABB(proxy->treeProxyId);
+	aabb.lowerBound += r;
+	aabb.upperBound -= r;
+
+	oldTree.DestroyProxy(proxy->treeProxyId);
+	proxy->isStatic = isStatic;
+	proxy->treeProxyId = GetOwnerTree(proxyId).CreateProxy(aabb, b2TreeLeafData(proxyId));
+
+	if (isStatic == false)
+	{
+		// Pick up the static proxies that were skipped while this one was static.
+		BufferMove(proxyId);
+	}
+}
+
+void b2TreeBroadPhase::Commit()
+{
+	// Proxies do not move again until the next step, so this
+	// is the place to rebuild the wide layout. The static tree
+	// rarely changes, so its layout is usually kept.
+	m_tree.Collapse();
+	m_staticTree.Collapse();
+
+	// Find the pairs of the moved proxies. Static proxies only look for
+	// moving proxies, so static-vs-static pairs are never generated.
+	b2TreePairQuery pairQuery;
+	pairQuery.broadPhase = this;
+
+	for (int32 i = 0; i < m_moveCount; ++i)
+	{
+		pairQuery.queryProxyId = m_moveBuffer[i];
+		if (pairQuery.queryProxyId == b2_nullProxy)
+		{
+			continue;
+		}
+
+		const b2AABB& fatAABB = GetOwnerTree(pairQuery.queryProxyId).GetFatAABB(m_proxies[pairQuery.queryProxyId].treeProxyId);
+
+		pairQuery.tree = &m_tree;
+		m_tree.Query(&pairQuery, fatAABB);
+
+		if (m_proxies[pairQuery.queryProxyId].isStatic == false)
+		{
+			pairQuery.tree = &m_staticTree;
+			m_staticTree.Query(&pairQuery, fatAABB);
+		}
+	}
+
+	m_moveCount = 0;
+
+	m_pairManager.Commit();
+
+	if (s_validate)
+	{
+		Validate();
+	}
+}
+
+int32 b2TreeBroadPhase::Query(const b2AABB& aabb, void** userData, int32 maxCount)
+{
+	if (maxCount <= 0)
+	{
+		return 0;
+	}
+
+	b2TreeUserQuery userQuery;
+	userQuery.broadPhase = this;
+	userQuery.userData = userData;
+	userQuery.maxCount = maxCount;
+	userQuery.count = 0;
+
+	userQuery.tree = &m_tree;
+	m_tree.Query(&userQuery, aabb);
+
+	if (userQuery.count < maxCount)
+	{
+		userQuery.tree = &m_staticTree;
+		m_staticTree.Query(&userQuery, aabb);
+	}
+
+	return userQuery.count;
+}
+
+void b2TreeBroadPhase::Query(b2BroadPhaseQueryCallback* callback, const b2AABB& aabb)
+{
+	b2TreeCallbackQuery callbackQuery;
+	callbackQuery.broadPhase = this;
+	callbackQuery.callback = callback;
+	callbackQuery.proceed = true;
+
+	callbackQuery.tree = &m_tree;
+	m_tree.Query(&callbackQuery, aabb);
+
+	if (callbackQuery.proceed)
+	{
+		callbackQuery.tree = &m_staticTree;
+		m_staticTree.Query(&callbackQuery, aabb);
+	}
+}
+
+void b2TreeBroadPhase::QueryNearest(b2BroadPhaseNearestCallback* callback, const b2Vec2& point, float32 maxDistance)
+{
+	b2TreeNearestQuery nearestQuery;
+	nearestQuery.broadPhase = this;
+	nearestQuery.callback = callback;
+	nearestQuery.distance = maxDistance;
+
+	nearestQuery.tree = &m_tree;
+	m_tree.QueryNearest(&nearestQuery, point, maxDistance);
+
+	// Keep the search distance from the first tree.
+	if (nearestQuery.distance >= 0.0f)
+	{
+		nearestQuery.tree = &m_staticTree;
+		m_staticTree.QueryNearest(&nearestQuery, point, nearestQuery.distance);
+	}
+}
+
+int32 b2TreeBroadPhase::QuerySegment(const b2Segment& segment, void** userData, int32 maxCount, SortKeyFunc sortKey)
+{
+	if (maxCount <= 0)
+	{
+		return 0;
+	}
+
+	b2TreeSegmentQuery segmentQuery;
+	segmentQuery.broadPhase = this;
+	segmentQuery.userData = userData;
+	segmentQuery.keys = NULL;
+	segmentQuery.maxCount = maxCount;
+	segmentQuery.count = 0;
+	segmentQuery.sortKey = sortKey;
+
+	if (sortKey)
+	{
+		segmentQuery.keys = (float32*)b2Alloc(maxCount * sizeof(float32));
+	}
+
+	b2RayCastInput input;
+	input.p1 = segment.p1;
+	input.p2 = segment.p2;
+	input.maxFraction = 1.0f;
+
+	segmentQuery.tree = &m_tree;
+	m_tree.RayCast(&segmentQuery, input);
+
+	if (segmentQuery.count == maxCount)
+	{
+		// Keep the clipping from the first tree.
+		if (sortKey == NULL)
+		{
+			b2Free(segmentQuery.keys);
+			return segmentQuery.count;
+		}
+
+		input.maxFraction = segmentQuery.keys[maxCount - 1];
+	}
+
+	segmentQuery.tree = &m_staticTree;
+	m_staticTree.RayCast(&segmentQuery, input);
+
+	b2Free(segmentQuery.keys);
+
+	return segmentQuery.count;
+}
+
+void b2TreeBroadPhase::RayCast(b2BroadPhaseRayCastCallback* callback, const b2RayCastInput& input)
+{
+	b2Assert((input.p2 - input.p1).LengthSquared() > 0.0f);
+	BoxCast(callback, input, b2Vec2_zero);
+}
+
+void b2TreeBroadPhase::BoxCast(b2BroadPhaseRayCastCallback* callback, const b2RayCastInput& input, const b2Vec2& extents)
+{
+	b2TreeRayCastQuery rayCastQuery;
+	rayCastQuery.broadPhase = this;
+	rayCastQuery.callback = callback;
+	rayCastQuery.maxFraction = input.maxFraction;
+	rayCastQuery.terminated = false;
+
+	rayCastQuery.tree = &m_tree;
+	m_tree.BoxCast(&rayCastQuery, input, extents);
+
+	if (rayCastQuery.terminated)
+	{
+		return;
+	}
+
+	// Keep the clipping from the first tree.
+	b2RayCastInput staticInput = input;
+	staticInput.maxFraction = rayCastQuery.maxFraction;
+
+	rayCastQuery.tree = &m_staticTree;
+	m_staticTree.BoxCast(&rayCastQuery, staticInput, extents);
+}
+
+void b2TreeBroadPhase::RayCastBatch(b2BroadPhaseRayBatchCallback* callback, const b2RayCastInput* inputs, int32 count)
+{
+	b2TreeRayPacketQuery packetQuery;
+	packetQuery.broadPhase = this;
+	packetQuery.callback = callback;
+
+	for (int32 base = 0; base < count; base += b2_rayPacketSize)
+	{
+		int32 packetCount = b2Min(count - base, b2_rayPacketSize);
+
+		b2RayCastInput packet[b2_rayPacketSize];
+		for (int32 i = 0; i < packetCount; ++i)
+		{
+			packet[i] = inputs[base + i];
+			packetQuery.maxFractions[i] = inputs[base + i].maxFraction;
+		}
+		packetQuery.baseIndex = base;
+
+		packetQuery.tree = &m_tree;
+		m_tree.RayCastPacket(&packetQuery, packet, packetCount);
+
+		for (int32 i = 0; i < packetCount; ++i)
+		{
+			packet[i].maxFraction = packetQuery.maxFractions[i];
+		}
+
+		packetQuery.tree = &m_staticTree;
+		m_staticTree.RayCastPacket(&packetQuery, packet, packetCount);
+	}
+}
+
+void b2TreeBroadPhase::RemovePairs(uint32 proxyId, const b2AABB& aabb, const b2AABB* fatAABB)
+{
+	b2TreeRemoveQuery removeQuery;
+	removeQuery.broadPhase = this;
+	removeQuery.queryProxyId = proxyId;
+	removeQuery.fatAABB = fatAABB;
+
+	removeQuery.tree = &m_tree;
+	m_tree.Query(&removeQuery, aabb);
+
+	removeQuery.tree = &m_staticTree;
+	m_staticTree.Query(&removeQuery, aabb);
+}
+
+void b2TreeBroadPhase::Validate()
+{
+	m_tree.Validate();
+	m_staticTree.Validate();
+
+	b2Assert(m_tree.GetProxyCount() + m_staticTree.GetProxyCount() == m_proxyCount);
+}
+
+void b2TreeBroadPhase::BufferMove(uint32 proxyId)
+{
+	if (m_moveCount == m_moveCapacity)
+	{
+		uint32* oldBuffer = m_moveBuffer;
+		m_moveCapacity *= 2;
+		m_moveBuffer = (uint32*)b2Alloc(m_moveCapacity * sizeof(uint32));
+		memcpy(m_moveBuffer, oldBuffer, m_moveCount * sizeof(uint32));
+		b2Free(oldBuffer);
+	}
+
+	m_moveBuffer[m_moveCount] = proxyId;
+	++m_moveCount;
+}
+
+void b2TreeBroadPhase::UnBufferMove(uint32 proxyId)
+{
+	for (int32 i = 0; i < m_moveCount; ++i)
+	{
+		if (m_moveBuffer[i] == proxyId)
+		{
+			m_moveBuffer[i] = b2_nullProxy;
+		}
+	}
+}
@@ -0,0 +1,148 @@
+/*
+* Copyright (c) 2009 Erin Catto http://www.gphysics.com
+*
+* This software is provided 'as-is', without any express or implied
+* warranty.  In no event will the authors be held liable for any damages
+* arising from the use of this software.
+* Permission is granted to anyone to use this software for any purpose,
+* including commercial applications, and to alter it and redistribute it
+* freely, subject to the following restrictions:
+* 1. The origin of this software must not be misrepresented; you must not
+* claim that you wrote the original software. If you use this software
+* in a product, an acknowledgment in the product documentation would be
+* appreciated but is not required.
+* 2. Altered source versions must be plainly marked as such, and must not be
+* misrepresented as being the original software.
+* 3. This notice may not be removed or altered from any source distribution.
+*/
+
+#ifndef B2_TREE_BROAD_PHASE_H
+#define B2_TREE_BROAD_PHASE_H
+
+#include "b2BroadPhase.h"
+#include "b2DynamicTree.h"
+
+/// A proxy of the tree broad-phase. The proxy id stays the same while the proxy
+/// moves between the static and the dynamic tree.
+struct b2TreeProxy
+{
+	void* userData;
+	uint32 treeProxyId;		///< the leaf in the owning tree, or the next free proxy
+	bool isStatic;
+};
+
+/// Broad-phase backed by dynamic AABB trees. Proxies are stored with fat AABBs,
+/// so small motions do not touch the trees. Proxies that leave their fat AABB are
+/// buffered as moved and Commit finds their new pairs by querying the trees.
+/// Pairs are removed as soon as the fat AABBs stop overlapping, which keeps every
+/// live pair reachable from a query of either fat AABB.
+///
+/// Static proxies live in their own tree. Moved static proxies only query the
+/// dynamic tree, so static-vs-static pairs are never generated, and the static
+/// tree is left alone while the dynamic proxies churn.
+class b2TreeBroadPhase : public b2BroadPhase
+{
+public:
+	b2TreeBroadPhase(const b2AABB& worldAABB, b2PairCallback* callback, int32 proxyCapacity = b2_proxyPoolSize, bool wideNodes = false);
+	~b2TreeBroadPhase();
+
+	uint32 CreateProxy(const b2AABB& aabb, void* userData, bool isStatic);
+	void CreateProxies(const b2AABB* aabbs, void** userData, int32 count, uint32* proxyIds, bool isStatic);
+	void DestroyProxy(uint32 proxyId);
+	void MoveProxy(uint32 proxyId, const b2AABB& aabb);
+	void Commit();
+	void SetProxyStatic(uint32 proxyId, bool isStatic);
+
+	void* GetUserData(uint32 proxyId) const;
+	b2AABB GetFatAABB(uint32 proxyId) const;
+	bool TestOverlap(uint32 proxyId1, uint32 proxyId2) const;
+
+	int32 Query(const b2AABB& aabb, void** userData, int32 maxCount);
+	void Query(b2BroadPhaseQueryCallback* callback, const b2AABB& aabb);
+	void QueryNearest(b2BroadPhaseNearestCallback* callback, const b2Vec2& point, float32 maxDistance);
+	int32 QuerySegment(const b2Segment& segment, void** userData, int32 maxCount, SortKeyFunc sortKey);
+	void RayCast(b2BroadPhaseRayCastCallback* callback, const b2RayCastInput& input);
+	void BoxCast(b2BroadPhaseRayCastCallback* callback, const b2RayCastInput& input, const b2Vec2& extents);
+	void RayCastBatch(b2BroadPhaseRayBatchCallback* callback, const b2RayCastInput* inputs, int32 count);
+
+	int32 GetProxyCapacity() const;
+
+	void Validate();
+
+	/// Get the tree of moving proxies. Use this for custom queries. The leaf
+	/// user data is the broad-phase proxy id.
+	const b2DynamicTree& GetTree() const;
+
+	/// Get the tree of static proxies.
+	const b2DynamicTree& GetStaticTree() const;
+
+private:
+	friend struct b2TreePairQuery;
+	friend struct b2TreeRemoveQuery;
+
+	void ReserveProxies(int32 capacity);
+	uint32 AllocateProxy(void* userData, bool isStatic);
+	void FreeProxy(uint32 proxyId);
+	void RemovePairs(uint32 proxyId, const b2AABB& aabb, const b2AABB* fatAABB);
+	b2DynamicTree& GetOwnerTree(uint32 proxyId);
+	const b2DynamicTree& GetOwnerTree(uint32 proxyId) const;
+
+	void BufferMove(uint32 proxyId);
+	void UnBufferMove(uint32 proxyId);
+
+	b2DynamicTree m_tree;
+	b2DynamicTree m_staticTree;
+
+	b2TreeProxy* m_proxies;
+	int32 m_proxyCapacity;
+	uint32 m_freeProxy;
+
+	uint32* m_moveBuffer;
+	int32 m_moveCapacity;
+	int32 m_moveCount;
+};
+
+inline b2DynamicTree& b2TreeBroadPhase::GetOwnerTree(uint32 proxyId)
+{
+	b2Assert(proxyId < uint32(m_proxyCapacity));
+	return m_proxies[proxyId].isStatic ? m_staticTree : m_tree;
+}
+
+inline const b2DynamicTree& b2TreeBroadPhase::GetOwnerTree(uint32 proxyId) const
+{
+	b2Assert(proxyId < uint32(m_proxyCapacity));
+	return m_proxies[proxyId].isStatic ? m_staticTree : m_tree;
+}
+
+inline void* b2TreeBroadPhase::GetUserData(uint32 proxyId) const
+{
+	b2Assert(proxyId < uint32(m_proxyCapacity));
+	return m_proxies[proxyId].userData;
+}
+
+inline b2AABB b2TreeBroadPhase::GetFatAABB(uint32 proxyId) const
+{
+	return GetOwnerTree(proxyId).GetFatAABB(m_proxies[proxyId].treeProxyId);
+}
+
+inline bool b2TreeBroadPhase::TestOverlap(uint32 proxyId1, uint32 proxyId2) const
+{
+	return b2TestOverlap(GetFatAABB(proxyId1), GetFatAABB(proxyId2));
+}
+
+inline int32 b2TreeBroadPhase::GetProxyCapacity() const
+{
+	return m_proxyCapacity;
+}
+
+inline const b2DynamicTree& b2TreeBroadPhase::GetTree() const
+{
+	return m_tree;
+}
+
+inline const b2DynamicTree& b2TreeBroadPhase::GetStaticTree() const
+{
+	return m_staticTree;
+}
+
+#endif
@@ -0,0 +1,187 @@
+/*
+* Copyright (c) 2009 Erin Catto http://www.gphysics.com
+*
+* This software is provided 'as-is', without any express or implied
+* warranty.  In no event will the authors be held liable for any damages
+* arising from the use of this software.
+* Permission is granted to anyone to use this software for any purpose,
+* including commercial applications, and to alter it and redistribute it
+* freely, subject to the following restrictions:
+* 1. The origin of this software must not be misrepresented; you must not
+* claim that you wrote the original software. If you use this software
+* in a product, an acknowledgment in the product documentation would be
+* appreciated but is not required.
+* 2. Altered source versions must be plainly marked as such, and must not be
+* misrepresented as being the original software.
+* 3. This notice may not be removed or altered from any source distribution.
+*/
+
+#ifndef B2_GROWABLE_STACK_H
+#define B2_GROWABLE_STACK_H
+
+#include "b2Settings.h"
+#include <string.h>
+
+/// This is a growable LIFO stack with an initial capacity of N.
+/// If the stack size exceeds the initial capacity, the heap is used
+/// to increase the size of the stack.
+template <typename T, int32 N>
+class b2GrowableStack
+{
+public:
+	b2GrowableStack()
+	{
+		m_stack = m_array;
+		m_count = 0;
+		m_capacity = N;
+	}
+
+	~b2GrowableStack()
+	{
+		if (m_stack != m_array)
+		{
+			b2Free(m_stack);
+			m_stack = NULL;
+		}
+	}
+
+	void Push(const T& element)
+	{
+		if (m_count == m_capacity)
+		{
+			T* old = m_stack;
+			m_capacity *= 2;
+			m_stack = (T*)b2Alloc(m_capacity * sizeof(T));
+			memcpy(m_stack, old, m_count * sizeof(T));
+			if (old != m_array)
+			{
+				b2Free(old);
+			}
+		}
+
+		m_stack[m_count] = element;
+		++m_count;
+	}
+
+	T Pop()
+	{
+		b2Assert(m_count > 0);
+		--m_count;
+		return m_stack[m_count];
+	}
+
+	int32 GetCount() const
+	{
+		return m_count;
+	}
+
+private:
+	T* m_stack;
+	T m_array[N];
+	int32 m_count;
+	int32 m_capacity;
+};
+
+/// This is a growable min-heap with an initial capacity of N. T must provide
+/// operator<. Pop returns the smallest element. The heap memory is only used
+/// once the initial capacity is exceeded.
+template <typename T, int32 N>
+class b2GrowableHeap
+{
+public:
+	b2GrowableHeap()
+	{
+		m_heap = m_array;
+		m_count = 0;
+		m_capacity = N;
+	}
+
+	~b2GrowableHeap()
+	{
+		if (m_heap != m_array)
+		{
+			b2Free(m_heap);
+			m_heap = NULL;
+		}
+	}
+
+	void Push(const T& element)
+	{
+		if (m_count == m_capacity)
+		{
+			T* old = m_heap;
+			m_capacity *= 2;
+			m_heap = (T*)b2Alloc(m_capacity * sizeof(T));
+			memcpy(m_heap, old, m_count * sizeof(T));
+			if (old != m_array)
+			{
+				b2Free(old);
+			}
+		}
+
+		// Sift up.
+		int32 index = m_count;
+		++m_count;
+		while (index > 0)
+		{
+			int32 parent = (index - 1) >> 1;
+			if ((element < m_heap[parent]) == false)
+			{
+				break;
+			}
+
+			m_heap[index] = m_heap[parent];
+			index = parent;
+		}
+
+		m_heap[index] = element;
+	}
+
+	T Pop()
+	{
+		b2Assert(m_count > 0);
+		T top = m_heap[0];
+		--m_count;
+
+		// Sift the last element down from the root.
+		T last = m_heap[m_count];
+		int32 index = 0;
+		for (;;)
+		{
+			int32 child = 2 * index + 1;
+			if (child >= m_count)
+			{
+				break;
+			}
+
+			if (child + 1 < m_count && m_heap[child + 1] < m_heap[child])
+			{
+				++child;
+			}
+
+			if ((m_heap[child] < last) == false)
+			{
+				break;
+			}
+
+			m_heap[index] = m_heap[child];
+			index = child;
+		}
+
+		m_heap[index] = last;
+		return top;
+	}
+
+	int32 GetCount() const
+	{
+		return m_count;
+	}
+
+private:
+	T* m_heap;
+	T m_array[N];
+	int32 m_count;
+	int32 m_capacity;
+};
+
+#endif
@@ -61,6 +61,12 @@ typedef float float32;
 #define	B2FORCE_SCALE(x)	(x)
 #define	B2FORCE_INV_SCALE(x)	(x)
 
+// Use SSE to traverse the wide dynamic tree nodes. Define B2_NO_SSE to
+// force the scalar code.
+#if !defined(B2_NO_SSE) && (defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1))
+#define B2_USE_SSE
+#endif
+
 #endif
 
 #define b2_pi						3.14159265359f
@@ -77,18 +83,17 @@ typedef float float32;
 /// The maximum number of vertices on a convex polygon.
 #define b2_maxPolygonVertices		8
 
-/// Factor used to fatten AABBs in b2DynamicTree. This allows client
+/// This is used to fatten AABBs in b2DynamicTree. This allows client
 /// objects to move a small amount without needing to adjust the tree.
-#define b2_fatAABBFactor			1.5f
+/// This is in meters.
+#define b2_aabbExtension			0.1f
 
 /// The initial pool size for the dynamic tree.
 #define b2_nodePoolSize				50
 
-/// This must be a power of two
-#define b2_maxProxies				512
-
-/// This must be a power of two
-#define b2_maxPairs					(8 * b2_maxProxies)
+/// The initial proxy capacity of the broad-phase. The proxy, bound, and pair
+/// storage grows as needed, so this is only a hint.
+#define b2_proxyPoolSize			64
 
 /// A small length used as a collision and constraint tolerance. Usually it is
 /// chosen to be numerically significant, but visually insignificant.
@@ -103,6 +108,18 @@ typedef float float32;
 /// Making it larger may create artifacts for vertex collision.
 #define b2_polygonRadius			(2.0f * b2_linearSlop)
 
+/// A contact reuses its manifold while the relative transform of its bodies stays
+/// within these tolerances of the transform the manifold was computed at.
+#define b2_coherenceLinearTolerance		(0.1f * b2_linearSlop)
+#define b2_coherenceAngularTolerance	(0.1f * b2_angularSlop)
+
+/// The smallest number of contacts the narrow-phase hands to a worker thread.
+#define b2_collideGrainSize				64
+
+/// The approach speed, in meters per second, above which a new touch records a
+/// hit event.
+#define b2_hitEventThreshold			1.0f
+
 
 // Dynamics
 
@@ -45,14 +45,18 @@ b2CircleContact::b2CircleContact(b2Fixture* fixtureA, b2Fixture* fixtureB)
 	b2Assert(m_fixtureB->GetType() == b2_circleShape);
 }
 
-void b2CircleContact::Evaluate()
+void b2CircleContact::Evaluate(b2Contact** contacts, b2Manifold* manifolds, int32 count)
 {
-	b2Body* bodyA = m_fixtureA->GetBody();
-	b2Body* bodyB = m_fixtureB->GetBody();
+	for (int32 i = 0; i < count; ++i)
+	{
+		b2CircleContact* contact = (b2CircleContact*)contacts[i];
+		b2Fixture* fixtureA = contact->m_fixtureA;
+		b2Fixture* fixtureB = contact->m_fixtureB;
 
-	b2CollideCircles(	&m_manifold,
-						(b2CircleShape*)m_fixtureA->GetShape(), bodyA->GetXForm(),
-						(b2CircleShape*)m_fixtureB->GetShape(), bodyB->GetXForm());
+		b2CollideCircles(	manifolds + i,
+							(b2CircleShape*)fixtureA->GetShape(), fixtureA->GetBody()->GetXForm(),
+							(b2CircleShape*)fixtureB->GetShape(), fixtureB->GetBody()->GetXForm());
+	}
 }
 
 float32 b2CircleContact::ComputeTOI(const b2Sweep& sweepA, const b2Sweep& sweepB) const
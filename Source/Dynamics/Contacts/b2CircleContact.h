@@ -34,7 +34,7 @@ public:
 	b2CircleContact(b2Fixture* fixtureA, b2Fixture* fixtureB);
 	~b2CircleContact() {}
 
-	void Evaluate();
+	static void Evaluate(b2Contact** contacts, b2Manifold* manifolds, int32 count);
 
 	float32 ComputeTOI(const b2Sweep& sweepA, const b2Sweep& sweepB) const;
 };
@@ -35,32 +35,45 @@ bool b2Contact::s_initialized = false;
 
 void b2Contact::InitializeRegisters()
 {
-	AddType(b2CircleContact::Create, b2CircleContact::Destroy, b2_circleShape, b2_circleShape);
-	AddType(b2PolyAndCircleContact::Create, b2PolyAndCircleContact::Destroy, b2_polygonShape, b2_circleShape);
-	AddType(b2PolygonContact::Create, b2PolygonContact::Destroy, b2_polygonShape, b2_polygonShape);
+	AddType(b2CircleContact::Create, b2CircleContact::Destroy, b2CircleContact::Evaluate, b2_circleShape, b2_circleShape);
+	AddType(b2PolyAndCircleContact::Create, b2PolyAndCircleContact::Destroy, b2PolyAndCircleContact::Evaluate, b2_polygonShape, b2_circleShape);
+	AddType(b2PolygonContact::Create, b2PolygonContact::Destroy, b2PolygonContact::Evaluate, b2_polygonShape, b2_polygonShape);
 	
-	AddType(b2EdgeAndCircleContact::Create, b2EdgeAndCircleContact::Destroy, b2_edgeShape, b2_circleShape);
-	AddType(b2PolyAndEdgeContact::Create, b2PolyAndEdgeContact::Destroy, b2_polygonShape, b2_edgeShape);
+	AddType(b2EdgeAndCircleContact::Create, b2EdgeAndCircleContact::Destroy, b2EdgeAndCircleContact::Evaluate, b2_edgeShape, b2_circleShape);
+	AddType(b2PolyAndEdgeContact::Create, b2PolyAndEdgeContact::Destroy, b2PolyAndEdgeContact::Evaluate, b2_polygonShape, b2_edgeShape);
 }
 
 void b2Contact::AddType(b2ContactCreateFcn* createFcn, b2ContactDestroyFcn* destoryFcn,
-					  b2ShapeType type1, b2ShapeType type2)
+					  b2ContactEvaluateFcn* evaluateFcn, b2ShapeType type1, b2ShapeType type2)
 {
 	b2Assert(b2_unknownShape < type1 && type1 < b2_shapeTypeCount);
 	b2Assert(b2_unknownShape < type2 && type2 < b2_shapeTypeCount);
 	
 	s_registers[type1][type2].createFcn = createFcn;
 	s_registers[type1][type2].destroyFcn = destoryFcn;
+	s_registers[type1][type2].evaluateFcn = evaluateFcn;
 	s_registers[type1][type2].primary = true;
 
 	if (type1 != type2)
 	{
 		s_registers[type2][type1].createFcn = createFcn;
 		s_registers[type2][type1].destroyFcn = destoryFcn;
+		s_registers[type2][type1].evaluateFcn = evaluateFcn;
 		s_registers[type2][type1].primary = false;
 	}
 }
 
+bool b2Contact::IsRegistered(b2ShapeType typeA, b2ShapeType typeB)
+{
+	if (s_initialized == false)
+	{
+		InitializeRegisters();
+		s_initialized = true;
+	}
+
+	return s_registers[typeA][typeB].createFcn != NULL;
+}
+
 b2Contact* b2Contact::Create(b2Fixture* fixtureA, b2Fixture* fixtureB, b2BlockAllocator* allocator)
 {
 	if (s_initialized == false)
@@ -127,9 +140,12 @@ b2Contact::b2Contact(b2Fixture* fA, b2Fixture* fB)
 	m_fixtureB = fB;
 
 	m_manifold.m_pointCount = 0;
+	m_collideIndex = b2_nullCollideIndex;
 
-	m_prev = NULL;
-	m_next = NULL;
+	m_index = 0;
+	m_handle.index = 0;
+	m_handle.generation = 0;
+	m_pair = NULL;
 
 	m_nodeA.contact = NULL;
 	m_nodeA.prev = NULL;
@@ -140,4 +156,69 @@ b2Contact::b2Contact(b2Fixture* fA, b2Fixture* fB)
 	m_nodeB.prev = NULL;
 	m_nodeB.next = NULL;
 	m_nodeB.other = NULL;
-}
\ No newline at end of file
+}
+
+void b2Contact::Evaluate(b2Manifold* manifold)
+{
+	b2Contact* contact = this;
+	b2ContactEvaluateFcn* evaluateFcn = s_registers[m_fixtureA->GetType()][m_fixtureB->GetType()].evaluateFcn;
+	evaluateFcn(&contact, manifold, 1);
+}
+
+bool b2Contact::IsCoherent() const
+{
+	if ((m_flags & e_coherentFlag) == 0)
+	{
+		return false;
+	}
+
+	// The manifold is stored in the body frames, so it only depends on the relative
+	// transform. Keep it, and its warm starting impulses, while that barely moved.
+	const b2Body* bodyA = m_fixtureA->GetBody();
+	const b2Body* bodyB = m_fixtureB->GetBody();
+	b2Vec2 d = b2MulT(bodyA->GetXForm(), bodyB->GetPosition()) - m_relativePosition;
+	float32 a = bodyB->GetAngle() - bodyA->GetAngle() - m_relativeAngle;
+	return d.LengthSquared() < b2_coherenceLinearTolerance * b2_coherenceLinearTolerance &&
+		b2Abs(a) < b2_coherenceAngularTolerance;
+}
+
+void b2Contact::SetManifold(const b2Manifold& manifold)
+{
+	b2Manifold oldManifold = m_manifold;
+	m_manifold = manifold;
+
+	// Match old contact ids to new contact ids and copy the
+	// stored impulses to warm start the solver.
+	for (int32 i = 0; i < m_manifold.m_pointCount; ++i)
+	{
+		b2ManifoldPoint* mp2 = m_manifold.m_points + i;
+		mp2->m_normalImpulse = 0.0f;
+		mp2->m_tangentImpulse = 0.0f;
+		b2ContactID id2 = mp2->m_id;
+
+		for (int32 j = 0; j < oldManifold.m_pointCount; ++j)
+		{
+			b2ManifoldPoint* mp1 = oldManifold.m_points + j;
+
+			if (mp1->m_id.key == id2.key)
+			{
+				mp2->m_normalImpulse = mp1->m_normalImpulse;
+				mp2->m_tangentImpulse = mp1->m_tangentImpulse;
+				break;
+			}
+		}
+	}
+
+	const b2Body* bodyA = m_fixtureA->GetBody();
+	const b2Body* bodyB = m_fixtureB->GetBody();
+	m_relativePosition = b2MulT(bodyA->GetXForm(), bodyB->GetPosition());
+	m_relativeAngle = bodyB->GetAngle() - bodyA->GetAngle();
+	m_flags |= e_coherentFlag;
+}
+
+b2Contact* b2Contact::GetNext()
+{
+	const b2ContactManager& contactManager = m_fixtureA->GetBody()->GetWorld()->m_contactManager;
+	int32 arrayIndex = b2ContactManager::GetArrayIndex(m_fixtureA->GetType(), m_fixtureB->GetType());
+	return contactManager.FindContact(arrayIndex, m_index + 1);
+}
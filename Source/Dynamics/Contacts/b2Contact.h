@@ -31,17 +31,33 @@ class b2World;
 class b2BlockAllocator;
 class b2StackAllocator;
 class b2ContactListener;
+struct b2ContactPair;
+
+const int32 b2_nullCollideIndex = -1;
 
 typedef b2Contact* b2ContactCreateFcn(b2Fixture* fixtureA, b2Fixture* fixtureB, b2BlockAllocator* allocator);
 typedef void b2ContactDestroyFcn(b2Contact* contact, b2BlockAllocator* allocator);
 
+/// Computes manifolds[i] for contacts[i]. The contacts all have the shape types
+/// of the register.
+typedef void b2ContactEvaluateFcn(b2Contact** contacts, b2Manifold* manifolds, int32 count);
+
 struct b2ContactRegister
 {
 	b2ContactCreateFcn* createFcn;
 	b2ContactDestroyFcn* destroyFcn;
+	b2ContactEvaluateFcn* evaluateFcn;
 	bool primary;
 };
 
+/// A handle to a contact. Unlike a contact pointer it can be kept after the
+/// contact is destroyed, b2World::GetContact then returns NULL.
+struct b2ContactHandle
+{
+	uint32 index;
+	uint32 generation;
+};
+
 /// A contact edge is used to connect bodies and contacts together
 /// in a contact graph where each body is a node and each contact
 /// is an edge. A contact edge belongs to a doubly linked list
@@ -90,6 +106,9 @@ public:
 	/// Get the next contact in the world's contact list.
 	b2Contact* GetNext();
 
+	/// Get a handle to this contact.
+	b2ContactHandle GetHandle() const;
+
 	/// Get the first fixture in this contact.
 	b2Fixture* GetFixtureA();
 
@@ -109,6 +128,7 @@ protected:
 	friend class b2ContactManager;
 	friend class b2World;
 	friend class b2ContactSolver;
+	friend struct b2CollideTask;
 
 	// m_flags
 	enum
@@ -133,11 +153,16 @@ protected:
 		// Meaning it should be deferred instead of destroyed.
 		// This is essntially a poor mans recursive lock.
 		e_lockedFlag	= 0x0080,
+		// The manifold is valid for m_relativePosition and m_relativeAngle.
+		e_coherentFlag	= 0x0100,
+		// Gathered by Collide in this step.
+		e_collideFlag	= 0x0200,
 	};
 
 	static void AddType(b2ContactCreateFcn* createFcn, b2ContactDestroyFcn* destroyFcn,
-						b2ShapeType typeA, b2ShapeType typeB);
+						b2ContactEvaluateFcn* evaluateFcn, b2ShapeType typeA, b2ShapeType typeB);
 	static void InitializeRegisters();
+	static bool IsRegistered(b2ShapeType typeA, b2ShapeType typeB);
 	static b2Contact* Create(b2Fixture* fixtureA, b2Fixture* fixtureB, b2BlockAllocator* allocator);
     static void Destroy(b2Contact* contact, b2ShapeType typeA, b2ShapeType typeB, b2BlockAllocator* allocator);
 	static void Destroy(b2Contact* contact, b2BlockAllocator* allocator);
@@ -146,7 +171,15 @@ protected:
 	b2Contact(b2Fixture* fixtureA, b2Fixture* fixtureB);
 	virtual ~b2Contact() {}
 
-	virtual void Evaluate() = 0;
+	/// Compute the manifold for the current body transforms.
+	void Evaluate(b2Manifold* manifold);
+
+	/// Is the relative transform still close to the one of the manifold?
+	bool IsCoherent() const;
+
+	/// Replace the manifold by a newly evaluated one. This carries over the impulses
+	/// of matching points and records the relative transform.
+	void SetManifold(const b2Manifold& manifold);
 
 	virtual float32 ComputeTOI(const b2Sweep& sweepA, const b2Sweep& sweepB) const = 0;
 
@@ -155,9 +188,13 @@ protected:
 
 	uint32 m_flags;
 
-	// World pool and list pointers.
-	b2Contact* m_prev;
-	b2Contact* m_next;
+	// The place in the contact array of the shape types.
+	int32 m_index;
+
+	b2ContactHandle m_handle;
+
+	// The broad-phase pair of the contact.
+	b2ContactPair* m_pair;
 
 	// Nodes for connecting bodies.
 	b2ContactEdge m_nodeA;
@@ -168,6 +205,13 @@ protected:
 
 	b2Manifold m_manifold;
 
+	// Body B in the frame of body A when the manifold was computed.
+	b2Vec2 m_relativePosition;
+	float32 m_relativeAngle;
+
+	// The new manifold while Collide runs, or b2_nullCollideIndex to keep the manifold.
+	int32 m_collideIndex;
+
 	float32 m_toi;
     
     void* m_userData;
@@ -208,9 +252,9 @@ inline bool b2Contact::AreTouching() const
 	return (m_flags & e_touchFlag) == e_touchFlag;
 }
 
-inline b2Contact* b2Contact::GetNext()
+inline b2ContactHandle b2Contact::GetHandle() const
 {
-	return m_next;
+	return m_handle;
 }
 
 inline b2Fixture* b2Contact::GetFixtureA()
@@ -50,14 +50,18 @@ b2EdgeAndCircleContact::b2EdgeAndCircleContact(b2Fixture* fixtureA, b2Fixture* f
 	m_manifold.m_points[0].m_tangentImpulse = 0.0f;
 }
 
-void b2EdgeAndCircleContact::Evaluate()
+void b2EdgeAndCircleContact::Evaluate(b2Contact** contacts, b2Manifold* manifolds, int32 count)
 {
-	b2Body* bodyA = m_fixtureA->GetBody();
-	b2Body* bodyB = m_fixtureB->GetBody();
+	for (int32 i = 0; i < count; ++i)
+	{
+		b2EdgeAndCircleContact* contact = (b2EdgeAndCircleContact*)contacts[i];
+		b2Fixture* fixtureA = contact->m_fixtureA;
+		b2Fixture* fixtureB = contact->m_fixtureB;
 
-	b2CollideEdgeAndCircle(	&m_manifold,
-							(b2EdgeShape*)m_fixtureA->GetShape(), bodyA->GetXForm(),
-							(b2CircleShape*)m_fixtureB->GetShape(), bodyB->GetXForm());
+		b2CollideEdgeAndCircle(	manifolds + i,
+								(b2EdgeShape*)fixtureA->GetShape(), fixtureA->GetBody()->GetXForm(),
+								(b2CircleShape*)fixtureB->GetShape(), fixtureB->GetBody()->GetXForm());
+	}
 }
 
 float32 b2EdgeAndCircleContact::ComputeTOI(const b2Sweep& sweepA, const b2Sweep& sweepB) const
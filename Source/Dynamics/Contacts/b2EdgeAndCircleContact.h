@@ -35,7 +35,7 @@ public:
 	b2EdgeAndCircleContact(b2Fixture* fixtureA, b2Fixture* fixtureB);
 	~b2EdgeAndCircleContact() {}
 
-	void Evaluate();
+	static void Evaluate(b2Contact** contacts, b2Manifold* manifolds, int32 count);
 
 	float32 ComputeTOI(const b2Sweep& sweepA, const b2Sweep& sweepB) const;
 };
@@ -26,7 +26,6 @@ class b2NullContact : public b2Contact
 {
 public:
 	b2NullContact() {}
-	void Evaluate() {}
 	float32 ComputeTOI(const b2Sweep& sweepA, const b2Sweep& sweepB) const
 	{
 		B2_NOT_USED(sweepA);
@@ -45,14 +45,18 @@ b2PolyAndCircleContact::b2PolyAndCircleContact(b2Fixture* fixtureA, b2Fixture* f
 	b2Assert(m_fixtureB->GetType() == b2_circleShape);
 }
 
-void b2PolyAndCircleContact::Evaluate()
+void b2PolyAndCircleContact::Evaluate(b2Contact** contacts, b2Manifold* manifolds, int32 count)
 {
-	b2Body* bodyA = m_fixtureA->GetBody();
-	b2Body* bodyB = m_fixtureB->GetBody();
+	for (int32 i = 0; i < count; ++i)
+	{
+		b2PolyAndCircleContact* contact = (b2PolyAndCircleContact*)contacts[i];
+		b2Fixture* fixtureA = contact->m_fixtureA;
+		b2Fixture* fixtureB = contact->m_fixtureB;
 
-	b2CollidePolygonAndCircle(	&m_manifold,
-								(b2PolygonShape*)m_fixtureA->GetShape(), bodyA->GetXForm(),
-								(b2CircleShape*)m_fixtureB->GetShape(), bodyB->GetXForm());
+		b2CollidePolygonAndCircle(	manifolds + i,
+									(b2PolygonShape*)fixtureA->GetShape(), fixtureA->GetBody()->GetXForm(),
+									(b2CircleShape*)fixtureB->GetShape(), fixtureB->GetBody()->GetXForm());
+	}
 }
 
 float32 b2PolyAndCircleContact::ComputeTOI(const b2Sweep& sweepA, const b2Sweep& sweepB) const
@@ -47,14 +47,18 @@ b2PolyAndEdgeContact::b2PolyAndEdgeContact(b2Fixture* fixtureA, b2Fixture* fixtu
 	b2Assert(m_fixtureB->GetType() == b2_edgeShape);
 }
 
-void b2PolyAndEdgeContact::Evaluate()
+void b2PolyAndEdgeContact::Evaluate(b2Contact** contacts, b2Manifold* manifolds, int32 count)
 {
-	b2Body* bodyA = m_fixtureA->GetBody();
-	b2Body* bodyB = m_fixtureB->GetBody();
+	for (int32 i = 0; i < count; ++i)
+	{
+		b2PolyAndEdgeContact* contact = (b2PolyAndEdgeContact*)contacts[i];
+		b2Fixture* fixtureA = contact->m_fixtureA;
+		b2Fixture* fixtureB = contact->m_fixtureB;
 
-	b2CollidePolyAndEdge(	&m_manifold,
-							(b2PolygonShape*)m_fixtureA->GetShape(), bodyA->GetXForm(),
-							(b2EdgeShape*)m_fixtureB->GetShape(), bodyB->GetXForm());
+		b2CollidePolyAndEdge(	manifolds + i,
+								(b2PolygonShape*)fixtureA->GetShape(), fixtureA->GetBody()->GetXForm(),
+								(b2EdgeShape*)fixtureB->GetShape(), fixtureB->GetBody()->GetXForm());
+	}
 }
 
 float32 b2PolyAndEdgeContact::ComputeTOI(const b2Sweep& sweepA, const b2Sweep& sweepB) const
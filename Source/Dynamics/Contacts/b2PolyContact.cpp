@@ -43,16 +43,22 @@ b2PolygonContact::b2PolygonContact(b2Fixture* fixtureA, b2Fixture* fixtureB)
 {
 	b2Assert(m_fixtureA->GetType() == b2_polygonShape);
 	b2Assert(m_fixtureB->GetType() == b2_polygonShape);
+	m_cache.count = 0;
 }
 
-void b2PolygonContact::Evaluate()
+void b2PolygonContact::Evaluate(b2Contact** contacts, b2Manifold* manifolds, int32 count)
 {
-	b2Body* bodyA = m_fixtureA->GetBody();
-	b2Body* bodyB = m_fixtureB->GetBody();
+	for (int32 i = 0; i < count; ++i)
+	{
+		b2PolygonContact* contact = (b2PolygonContact*)contacts[i];
+		b2Fixture* fixtureA = contact->m_fixtureA;
+		b2Fixture* fixtureB = contact->m_fixtureB;
 
-	b2CollidePolygons(	&m_manifold,
-						(b2PolygonShape*)m_fixtureA->GetShape(), bodyA->GetXForm(),
-						(b2PolygonShape*)m_fixtureB->GetShape(), bodyB->GetXForm());
+		b2CollidePolygons(	manifolds + i,
+							(b2PolygonShape*)fixtureA->GetShape(), fixtureA->GetBody()->GetXForm(),
+							(b2PolygonShape*)fixtureB->GetShape(), fixtureB->GetBody()->GetXForm(),
+							&contact->m_cache);
+	}
 }
 
 float32 b2PolygonContact::ComputeTOI(const b2Sweep& sweepA, const b2Sweep& sweepB) const
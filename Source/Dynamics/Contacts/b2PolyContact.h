@@ -32,9 +32,12 @@ public:
 	b2PolygonContact(b2Fixture* fixtureA, b2Fixture* fixtureB);
 	~b2PolygonContact() {}
 
-	void Evaluate();
+	static void Evaluate(b2Contact** contacts, b2Manifold* manifolds, int32 count);
 
 	float32 ComputeTOI(const b2Sweep& sweepA, const b2Sweep& sweepB) const;
+
+	/// The edges of max separation from the last Evaluate.
+	b2SeparationCache m_cache;
 };
 
 #endif
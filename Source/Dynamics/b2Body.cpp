@@ -100,6 +100,11 @@ b2Body::b2Body(const b2BodyDef* bd, b2World* world)
 		m_type = e_dynamicType;
 	}
 
+	if (m_type == e_staticType || (m_flags & e_sleepFlag))
+	{
+		m_flags |= e_staticProxyFlag;
+	}
+
 	m_userData = bd->userData;
 
 	m_fixtureList = NULL;
@@ -118,7 +123,8 @@ b2Fixture* b2Body::CreateFixture(const b2FixtureDef* def)
 
 	void* mem = allocator->Allocate(sizeof(b2Fixture));
 	b2Fixture* fixture = new (mem) b2Fixture;
-	fixture->Create(allocator, broadPhase, this, m_xf, def);
+	fixture->Create(allocator, this, def);
+	fixture->CreateProxy(broadPhase, m_xf, HasStaticProxies());
 
 	fixture->m_next = m_fixtureList;
 	m_fixtureList = fixture;
@@ -129,6 +135,67 @@ b2Fixture* b2Body::CreateFixture(const b2FixtureDef* def)
 	return fixture;
 }
 
+void b2Body::CreateFixtures(const b2FixtureDef* const* defs, int32 count, b2Fixture** fixtures)
+{
+	if (count <= 0)
+	{
+		return;
+	}
+
+	b2BlockAllocator* allocator = &m_world->m_blockAllocator;
+	b2StackAllocator* stackAllocator = &m_world->m_stackAllocator;
+	b2BroadPhase* broadPhase = m_world->m_broadPhase;
+
+	b2AABB* aabbs = (b2AABB*)stackAllocator->Allocate(count * sizeof(b2AABB));
+	void** userData = (void**)stackAllocator->Allocate(count * sizeof(void*));
+	uint32* proxyIds = (uint32*)stackAllocator->Allocate(count * sizeof(uint32));
+	int32 proxyCount = 0;
+
+	for (int32 i = 0; i < count; ++i)
+	{
+		void* mem = allocator->Allocate(sizeof(b2Fixture));
+		b2Fixture* fixture = new (mem) b2Fixture;
+		fixture->Create(allocator, this, defs[i]);
+
+		fixture->m_next = m_fixtureList;
+		m_fixtureList = fixture;
+		++m_fixtureCount;
+
+		if (fixtures)
+		{
+			fixtures[i] = fixture;
+		}
+
+		b2AABB aabb;
+		fixture->m_shape->ComputeAABB(&aabb, m_xf);
+
+		bool inRange = broadPhase->InRange(aabb);
+
+		// You are creating a shape outside the world box.
+		b2Assert(inRange);
+
+		if (inRange)
+		{
+			aabbs[proxyCount] = aabb;
+			userData[proxyCount] = fixture;
+			++proxyCount;
+		}
+	}
+
+	// Add the whole batch to the broad-phase at once.
+	broadPhase->CreateProxies(aabbs, userData, proxyCount, proxyIds, HasStaticProxies());
+
+	for (int32 i = 0; i < proxyCount; ++i)
+	{
+		b2Fixture* fixture = (b2Fixture*)userData[i];
+		fixture->m_proxyId = proxyIds[i];
+	}
+
+	stackAllocator->Free(proxyIds);
+	stackAllocator->Free(userData);
+	stackAllocator->Free(aabbs);
+}
+
 void b2Body::DestroyFixture(b2Fixture* fixture)
 {
 	b2Assert(fixture->m_body == this);
@@ -156,6 +223,7 @@ void b2Body::DestroyFixture(b2Fixture* fixture)
 	b2BroadPhase* broadPhase = m_world->m_broadPhase;
 
 	fixture->Destroy(allocator, broadPhase);
+	m_world->m_contactManager.RemoveEvents(fixture);
 	fixture->m_body = NULL;
 	fixture->m_next = NULL;
 	fixture->~b2Fixture();
@@ -202,9 +270,11 @@ void b2Body::SetMassData(const b2MassData* massData)
 	// If the body type changed, we need to refilter the broad-phase proxies.
 	if (oldType != m_type)
 	{
+		SynchronizeProxySet();
+
 		for (b2Fixture* f = m_fixtureList; f; f = f->m_next)
 		{
-			f->RefilterProxy(m_world->m_broadPhase, m_xf);
+			f->RefilterProxy(m_world->m_broadPhase, m_xf, HasStaticProxies());
 		}
 	}
 }
@@ -265,9 +335,11 @@ void b2Body::SetMassFromShapes()
 	// If the body type changed, we need to refilter the broad-phase proxies.
 	if (oldType != m_type)
 	{
+		SynchronizeProxySet();
+
 		for (b2Fixture* f = m_fixtureList; f; f = f->m_next)
 		{
-			f->RefilterProxy(m_world->m_broadPhase, m_xf);
+			f->RefilterProxy(m_world->m_broadPhase, m_xf, HasStaticProxies());
 		}
 	}
 }
@@ -284,10 +356,12 @@ void b2Body::SetStatic()
 	m_I = 0.0f;
 	m_invI = 0.0f;
 	m_type = e_staticType;
+
+	SynchronizeProxySet();
 	
 	for (b2Fixture* f = m_fixtureList; f; f = f->m_next)
 	{
-		f->RefilterProxy(m_world->m_broadPhase, m_xf);
+		f->RefilterProxy(m_world->m_broadPhase, m_xf, HasStaticProxies());
 	}
 }
 
@@ -373,3 +447,30 @@ bool b2Body::SynchronizeFixtures()
 	// Success
 	return true;
 }
+
+void b2Body::SynchronizeProxySet()
+{
+	bool isStatic = m_type == e_staticType || (m_flags & e_sleepFlag) == e_sleepFlag;
+	if (isStatic == HasStaticProxies())
+	{
+		return;
+	}
+
+	if (isStatic)
+	{
+		m_flags |= e_staticProxyFlag;
+	}
+	else
+	{
+		m_flags &= ~e_staticProxyFlag;
+	}
+
+	b2BroadPhase* broadPhase = m_world->m_broadPhase;
+	for (b2Fixture* f = m_fixtureList; f; f = f->m_next)
+	{
+		if (f->m_proxyId != b2_nullProxy)
+		{
+			broadPhase->SetProxyStatic(f->m_proxyId, isStatic);
+		}
+	}
+}
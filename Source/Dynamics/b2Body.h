@@ -114,6 +114,15 @@ public:
 	/// @warning This function is locked during callbacks.
 	b2Fixture* CreateFixture(const b2FixtureDef* def);
 
+	/// Creates many fixtures and attaches them to this body. The fixtures are added
+	/// to the broad-phase in one batch, which is much faster than calling CreateFixture
+	/// in a loop. Use this to load static level geometry.
+	/// @param defs the fixture definitions.
+	/// @param count the number of fixture definitions.
+	/// @param fixtures optionally receives the new fixtures in the order of the definitions.
+	/// @warning This function is locked during callbacks.
+	void CreateFixtures(const b2FixtureDef* const* defs, int32 count, b2Fixture** fixtures);
+
 	/// Destroy a fixture. This removes the fixture from the broad-phase and
 	/// therefore destroys any contacts associated with this fixture. All fixtures
 	/// attached to a body are implicitly destroyed when the body is destroyed.
@@ -367,6 +376,7 @@ private:
 		e_allowSleepFlag	= 0x0010,
 		e_bulletFlag		= 0x0020,
 		e_fixedRotationFlag	= 0x0040,
+		e_staticProxyFlag	= 0x0080,
 	};
 
 	// m_type
@@ -384,6 +394,11 @@ private:
 
 	void SynchronizeTransform();
 
+	// Static and sleeping bodies keep their proxies in the static set of the
+	// broad-phase. This moves the proxies when the body changes sets.
+	void SynchronizeProxySet();
+	bool HasStaticProxies() const;
+
 	// This is used to prevent connected bodies from colliding.
 	// It may lie, depending on the collideConnected flag.
 	bool IsConnected(const b2Body* other) const;
@@ -619,6 +634,11 @@ inline bool b2Body::IsSleeping() const
 	return (m_flags & e_sleepFlag) == e_sleepFlag;
 }
 
+inline bool b2Body::HasStaticProxies() const
+{
+	return (m_flags & e_staticProxyFlag) == e_staticProxyFlag;
+}
+
 inline bool b2Body::IsAllowSleeping() const
 {
 	return (m_flags & e_allowSleepFlag) == e_allowSleepFlag;
@@ -20,9 +20,525 @@
 #include "b2World.h"
 #include "b2Body.h"
 #include "b2Fixture.h"
+#include "../Collision/Shapes/b2CircleShape.h"
+#include "../Collision/Shapes/b2PolygonShape.h"
+#include "../Collision/Shapes/b2EdgeShape.h"
+
+#include <string.h>
+
+b2ContactManager::b2ContactManager()
+{
+	m_world = NULL;
+
+	for (int32 i = 0; i < b2_contactArrayCount; ++i)
+	{
+		m_arrays[i].contacts = NULL;
+		m_arrays[i].count = 0;
+		m_arrays[i].capacity = 0;
+	}
+
+	m_deferRemove = false;
+	m_hasHoles = false;
+
+	m_pairs.pairs = NULL;
+	m_pairs.count = 0;
+	m_pairs.capacity = 0;
+
+	m_sensors.pairs = NULL;
+	m_sensors.count = 0;
+	m_sensors.capacity = 0;
+
+	memset(&m_sensorBegins, 0, sizeof(m_sensorBegins));
+	memset(&m_sensorEnds, 0, sizeof(m_sensorEnds));
+	memset(&m_reportedBegins, 0, sizeof(m_reportedBegins));
+	memset(&m_reportedEnds, 0, sizeof(m_reportedEnds));
+
+	m_recordEvents = false;
+	m_hitEventThreshold = b2_hitEventThreshold;
+	memset(&m_beginEvents, 0, sizeof(m_beginEvents));
+	memset(&m_endEvents, 0, sizeof(m_endEvents));
+	memset(&m_hitEvents, 0, sizeof(m_hitEvents));
+	memset(&m_impulseEvents, 0, sizeof(m_impulseEvents));
+
+	m_slots = NULL;
+	m_slotCapacity = 0;
+	m_freeSlot = b2_nullContactSlot;
+
+	m_destroyImmediate = false;
+}
+
+b2ContactManager::~b2ContactManager()
+{
+	for (int32 i = 0; i < b2_contactArrayCount; ++i)
+	{
+		b2Free(m_arrays[i].contacts);
+	}
+
+	b2Free(m_pairs.pairs);
+	b2Free(m_sensors.pairs);
+	b2Free(m_sensorBegins.events);
+	b2Free(m_sensorEnds.events);
+	b2Free(m_reportedBegins.events);
+	b2Free(m_reportedEnds.events);
+	b2Free(m_beginEvents.events);
+	b2Free(m_endEvents.events);
+	b2Free(m_hitEvents.events);
+	b2Free(m_impulseEvents.events);
+	b2Free(m_slots);
+}
+
+// Appends the contact to the array of its shape types and gives it a handle.
+void b2ContactManager::AddContact(b2Contact* c)
+{
+	b2ContactArray* array = m_arrays + GetArrayIndex(c->m_fixtureA->GetType(), c->m_fixtureB->GetType());
+	if (array->count == array->capacity)
+	{
+		b2Contact** oldContacts = array->contacts;
+		array->capacity = b2Max(2 * array->capacity, 16);
+		array->contacts = (b2Contact**)b2Alloc(array->capacity * sizeof(b2Contact*));
+		if (oldContacts)
+		{
+			memcpy(array->contacts, oldContacts, array->count * sizeof(b2Contact*));
+			b2Free(oldContacts);
+		}
+	}
+
+	c->m_index = array->count;
+	array->contacts[array->count] = c;
+	++array->count;
+
+	if (m_freeSlot == b2_nullContactSlot)
+	{
+		b2ContactSlot* oldSlots = m_slots;
+		int32 capacity = b2Max(2 * m_slotCapacity, 16);
+		m_slots = (b2ContactSlot*)b2Alloc(capacity * sizeof(b2ContactSlot));
+		if (oldSlots)
+		{
+			memcpy(m_slots, oldSlots, m_slotCapacity * sizeof(b2ContactSlot));
+			b2Free(oldSlots);
+		}
+
+		// Thread the new slots onto the free list. Generations start at one, so a
+		// zeroed handle never finds a contact.
+		for (int32 i = m_slotCapacity; i < capacity; ++i)
+		{
+			m_slots[i].contact = NULL;
+			m_slots[i].generation = 1;
+			m_slots[i].next = i < capacity - 1 ? uint32(i + 1) : b2_nullContactSlot;
+		}
+
+		m_freeSlot = uint32(m_slotCapacity);
+		m_slotCapacity = capacity;
+	}
+
+	b2ContactSlot* slot = m_slots + m_freeSlot;
+	c->m_handle.index = m_freeSlot;
+	c->m_handle.generation = slot->generation;
+	m_freeSlot = slot->next;
+	slot->contact = c;
+}
+
+// Swap-removes the contact from its array, or leaves a hole while Collide
+// reports contacts, and retires its handle.
+void b2ContactManager::RemoveContact(b2Contact* c)
+{
+	b2ContactArray* array = m_arrays + GetArrayIndex(c->m_fixtureA->GetType(), c->m_fixtureB->GetType());
+	b2Assert(0 <= c->m_index && c->m_index < array->count && array->contacts[c->m_index] == c);
+
+	if (m_deferRemove)
+	{
+		array->contacts[c->m_index] = NULL;
+		m_hasHoles = true;
+	}
+	else
+	{
+		--array->count;
+		b2Contact* last = array->contacts[array->count];
+		array->contacts[c->m_index] = last;
+		last->m_index = c->m_index;
+	}
+
+	b2ContactSlot* slot = m_slots + c->m_handle.index;
+	b2Assert(slot->contact == c);
+	slot->contact = NULL;
+	++slot->generation;
+	slot->next = m_freeSlot;
+	m_freeSlot = c->m_handle.index;
+}
+
+// Removes the holes left by contacts destroyed during the report, keeping
+// the order of the other contacts.
+void b2ContactManager::CompactContacts()
+{
+	for (int32 i = 0; i < b2_contactArrayCount; ++i)
+	{
+		b2ContactArray* array = m_arrays + i;
+		int32 count = 0;
+		for (int32 j = 0; j < array->count; ++j)
+		{
+			b2Contact* c = array->contacts[j];
+			if (c)
+			{
+				c->m_index = count;
+				array->contacts[count] = c;
+				++count;
+			}
+		}
+		array->count = count;
+	}
+
+	m_hasHoles = false;
+}
+
+void b2ContactManager::AddPair(b2PairArray* array, b2ContactPair* pair)
+{
+	if (array->count == array->capacity)
+	{
+		b2ContactPair** oldPairs = array->pairs;
+		array->capacity = b2Max(2 * array->capacity, 16);
+		array->pairs = (b2ContactPair**)b2Alloc(array->capacity * sizeof(b2ContactPair*));
+		if (oldPairs)
+		{
+			memcpy(array->pairs, oldPairs, array->count * sizeof(b2ContactPair*));
+			b2Free(oldPairs);
+		}
+	}
+
+	pair->index = array->count;
+	array->pairs[array->count] = pair;
+	++array->count;
+}
+
+void b2ContactManager::RemovePair(b2PairArray* array, b2ContactPair* pair)
+{
+	b2Assert(0 <= pair->index && pair->index < array->count && array->pairs[pair->index] == pair);
+
+	--array->count;
+	b2ContactPair* last = array->pairs[array->count];
+	array->pairs[pair->index] = last;
+	last->index = pair->index;
+}
+
+// Do the shape bounds, grown by the margin, overlap?
+static bool b2TestShapeBounds(b2Fixture* fixtureA, b2Fixture* fixtureB, float32 margin)
+{
+	b2AABB aabbA, aabbB;
+	fixtureA->GetShape()->ComputeAABB(&aabbA, fixtureA->GetBody()->GetXForm());
+	fixtureB->GetShape()->ComputeAABB(&aabbB, fixtureB->GetBody()->GetXForm());
+
+	b2Vec2 d = aabbB.lowerBound - aabbA.upperBound;
+	if (d.x > margin || d.y > margin)
+	{
+		return false;
+	}
+
+	d = aabbA.lowerBound - aabbB.upperBound;
+	if (d.x > margin || d.y > margin)
+	{
+		return false;
+	}
+
+	return true;
+}
+
+// Is a contact needed between the fixtures? The time of impact solver only
+// finds contacts, so pairs with a static body or a bullet always get one.
+// Otherwise the shape bounds, grown by the margin, must overlap.
+bool b2ContactManager::NeedsContact(b2Fixture* fixtureA, b2Fixture* fixtureB, float32 margin) const
+{
+	b2Body* bodyA = fixtureA->GetBody();
+	b2Body* bodyB = fixtureB->GetBody();
+	if (bodyA->IsStatic() || bodyA->IsBullet() || bodyB->IsStatic() || bodyB->IsBullet())
+	{
+		return true;
+	}
+
+	return b2TestShapeBounds(fixtureA, fixtureB, margin);
+}
+
+typedef bool b2SensorOverlapFcn(b2SimplexCache* cache, b2Fixture* fixtureA, b2Fixture* fixtureB);
+
+// Sensors only need to know if the shapes overlap, so the distance replaces
+// the manifold.
+template <typename TA, typename TB>
+static bool b2TestSensorOverlap(b2SimplexCache* cache, b2Fixture* fixtureA, b2Fixture* fixtureB)
+{
+	b2DistanceInput input;
+	input.transformA = fixtureA->GetBody()->GetXForm();
+	input.transformB = fixtureB->GetBody()->GetXForm();
+	input.useRadii = true;
+
+	b2DistanceOutput output;
+	b2Distance(&output, cache, &input, (const TA*)fixtureA->GetShape(), (const TB*)fixtureB->GetShape());
+
+	return output.distance <= 0.0f;
+}
+
+static b2SensorOverlapFcn* const s_sensorOverlapFcns[b2_shapeTypeCount][b2_shapeTypeCount] =
+{
+	{
+		b2TestSensorOverlap<b2CircleShape, b2CircleShape>,
+		b2TestSensorOverlap<b2CircleShape, b2PolygonShape>,
+		b2TestSensorOverlap<b2CircleShape, b2EdgeShape>,
+	},
+	{
+		b2TestSensorOverlap<b2PolygonShape, b2CircleShape>,
+		b2TestSensorOverlap<b2PolygonShape, b2PolygonShape>,
+		b2TestSensorOverlap<b2PolygonShape, b2EdgeShape>,
+	},
+	{
+		b2TestSensorOverlap<b2EdgeShape, b2CircleShape>,
+		b2TestSensorOverlap<b2EdgeShape, b2PolygonShape>,
+		b2TestSensorOverlap<b2EdgeShape, b2EdgeShape>,
+	},
+};
+
+void b2ContactManager::AddSensorEvent(b2EventArray<b2SensorEvent>* array, b2ContactPair* pair)
+{
+	b2SensorEvent* event = array->Add();
+	if (pair->fixtureA->IsSensor())
+	{
+		event->sensor = pair->fixtureA;
+		event->fixture = pair->fixtureB;
+	}
+	else
+	{
+		event->sensor = pair->fixtureB;
+		event->fixture = pair->fixtureA;
+	}
+}
+
+static void b2RemoveSensorEvents(b2EventArray<b2SensorEvent>* array, b2Fixture* fixture)
+{
+	int32 count = 0;
+	for (int32 i = 0; i < array->count; ++i)
+	{
+		b2SensorEvent* event = array->events + i;
+		if (event->sensor == fixture || event->fixture == fixture)
+		{
+			continue;
+		}
+
+		array->events[count++] = *event;
+	}
+	array->count = count;
+}
+
+// The user may be iterating over reported events, so they keep their place.
+static void b2ClearSensorEvents(b2EventArray<b2SensorEvent>* array, b2Fixture* fixture)
+{
+	for (int32 i = 0; i < array->count; ++i)
+	{
+		b2SensorEvent* event = array->events + i;
+		if (event->sensor == fixture || event->fixture == fixture)
+		{
+			event->sensor = NULL;
+			event->fixture = NULL;
+		}
+	}
+}
+
+template <typename T>
+static void b2RemoveContactEvents(b2EventArray<T>* array, b2Fixture* fixture)
+{
+	int32 count = 0;
+	for (int32 i = 0; i < array->count; ++i)
+	{
+		T* event = array->events + i;
+		if (event->fixtureA == fixture || event->fixtureB == fixture)
+		{
+			continue;
+		}
+
+		array->events[count++] = *event;
+	}
+	array->count = count;
+}
+
+void b2ContactManager::RemoveEvents(b2Fixture* fixture)
+{
+	b2RemoveSensorEvents(&m_sensorBegins, fixture);
+	b2RemoveSensorEvents(&m_sensorEnds, fixture);
+	b2ClearSensorEvents(&m_reportedBegins, fixture);
+	b2ClearSensorEvents(&m_reportedEnds, fixture);
+
+	// Outside of the step the contact events belong to the user, who may be
+	// reading them while destroying fixtures.
+	if (m_world->m_lock)
+	{
+		b2RemoveContactEvents(&m_beginEvents, fixture);
+		b2RemoveContactEvents(&m_endEvents, fixture);
+		b2RemoveContactEvents(&m_hitEvents, fixture);
+		b2RemoveContactEvents(&m_impulseEvents, fixture);
+	}
+}
+
+void b2ContactManager::ClearEvents()
+{
+	m_beginEvents.count = 0;
+	m_endEvents.count = 0;
+	m_hitEvents.count = 0;
+	m_impulseEvents.count = 0;
+}
+
+// Contact events are only recorded during the step, so the arrays the user
+// reads between steps do not change.
+bool b2ContactManager::IsRecording() const
+{
+	return m_recordEvents && m_world->m_lock;
+}
+
+void b2ContactManager::AddBeginEvents(b2Contact* c)
+{
+	b2Fixture* fixtureA = c->m_fixtureA;
+	b2Fixture* fixtureB = c->m_fixtureB;
+
+	b2ContactBeginEvent* event = m_beginEvents.Add();
+	event->fixtureA = fixtureA;
+	event->fixtureB = fixtureB;
+	event->contact = c->m_handle;
+
+	// Find the point that approaches fastest.
+	b2Body* bodyA = fixtureA->GetBody();
+	b2Body* bodyB = fixtureB->GetBody();
+
+	b2WorldManifold worldManifold;
+	worldManifold.Initialize(&c->m_manifold, bodyA->GetXForm(), fixtureA->GetShape()->m_radius,
+							 bodyB->GetXForm(), fixtureB->GetShape()->m_radius);
+
+	float32 approachSpeed = -B2_FLT_MAX;
+	int32 index = 0;
+	for (int32 i = 0; i < c->m_manifold.m_pointCount; ++i)
+	{
+		b2Vec2 point = worldManifold.m_points[i];
+		b2Vec2 dv = bodyB->GetLinearVelocityFromWorldPoint(point) - bodyA->GetLinearVelocityFromWorldPoint(point);
+		float32 speed = -b2Dot(dv, worldManifold.m_normal);
+		if (speed > approachSpeed)
+		{
+			approachSpeed = speed;
+			index = i;
+		}
+	}
+
+	if (approachSpeed > m_hitEventThreshold)
+	{
+		b2ContactHitEvent* hit = m_hitEvents.Add();
+		hit->fixtureA = fixtureA;
+		hit->fixtureB = fixtureB;
+		hit->contact = c->m_handle;
+		hit->point = worldManifold.m_points[index];
+		hit->normal = worldManifold.m_normal;
+		hit->approachSpeed = approachSpeed;
+	}
+}
+
+void b2ContactManager::AddEndEvent(b2Contact* c)
+{
+	b2ContactEndEvent* event = m_endEvents.Add();
+	event->fixtureA = c->m_fixtureA;
+	event->fixtureB = c->m_fixtureB;
+	event->contact = c->m_handle;
+}
+
+// Tests the awake sensor pairs for overlap and buffers the changes.
+void b2ContactManager::UpdateSensors()
+{
+	for (int32 i = 0; i < m_sensors.count; ++i)
+	{
+		b2ContactPair* pair = m_sensors.pairs[i];
+		b2Fixture* fixtureA = pair->fixtureA;
+		b2Fixture* fixtureB = pair->fixtureB;
+		if (fixtureA->GetBody()->IsSleeping() && fixtureB->GetBody()->IsSleeping())
+		{
+			continue;
+		}
+
+		bool touching = false;
+		if (b2TestShapeBounds(fixtureA, fixtureB, 0.0f))
+		{
+			b2SensorOverlapFcn* overlapFcn = s_sensorOverlapFcns[fixtureA->GetType()][fixtureB->GetType()];
+			touching = overlapFcn(&pair->cache, fixtureA, fixtureB);
+		}
+
+		bool wasTouching = (pair->flags & b2ContactPair::e_touchingFlag) != 0;
+		if (touching == wasTouching)
+		{
+			continue;
+		}
+
+		if (touching)
+		{
+			pair->flags |= b2ContactPair::e_touchingFlag;
+			AddSensorEvent(&m_sensorBegins, pair);
+		}
+		else
+		{
+			pair->flags &= ~b2ContactPair::e_touchingFlag;
+			AddSensorEvent(&m_sensorEnds, pair);
+		}
+	}
+}
+
+void b2ContactManager::ReportSensors()
+{
+	// The listener may change the world, which can add events. Those go to the
+	// other arrays and wait for the next report.
+	b2Swap(m_sensorBegins, m_reportedBegins);
+	b2Swap(m_sensorEnds, m_reportedEnds);
+	m_sensorBegins.count = 0;
+	m_sensorEnds.count = 0;
+
+	if (m_reportedBegins.count == 0 && m_reportedEnds.count == 0)
+	{
+		return;
+	}
+
+	m_world->m_contactListener->SensorEvents(m_reportedBegins.events, m_reportedBegins.count,
+											 m_reportedEnds.events, m_reportedEnds.count);
+}
+
+void b2ContactManager::Promote(b2ContactPair* pair)
+{
+	b2Assert(pair->contact == NULL);
+	RemovePair(&m_pairs, pair);
+
+	b2Contact* c = CreateContact(pair->fixtureA, pair->fixtureB);
+	c->m_pair = pair;
+	pair->contact = c;
+}
+
+// Turns a contact without points back into a bare pair. There are no points,
+// so there is no EndContact.
+void b2ContactManager::Demote(b2Contact* c)
+{
+	b2Assert(c->m_manifold.m_pointCount == 0);
+
+	b2ContactPair* pair = c->m_pair;
+	Destroy(c);
+	pair->contact = NULL;
+	AddPair(&m_pairs, pair);
+}
+
+b2Contact* b2ContactManager::FindContact(int32 arrayIndex, int32 index) const
+{
+	for (; arrayIndex < b2_contactArrayCount; ++arrayIndex, index = 0)
+	{
+		const b2ContactArray* array = m_arrays + arrayIndex;
+		for (; index < array->count; ++index)
+		{
+			if (array->contacts[index])
+			{
+				return array->contacts[index];
+			}
+		}
+	}
+
+	return NULL;
+}
 
 // This is a callback from the broad-phase when two AABB proxies begin
-// to overlap. We create a b2Contact to manage the narrow phase.
+// to overlap. We create a b2ContactPair, which gets a b2Contact to manage
+// the narrow phase once the shapes are close.
 void* b2ContactManager::PairAdded(void* proxyUserDataA, void* proxyUserDataB)
 {
 	b2Fixture* fixtureA = (b2Fixture*)proxyUserDataA;
@@ -51,28 +567,45 @@ void* b2ContactManager::PairAdded(void* proxyUserDataA, void* proxyUserDataB)
 		return &m_nullContact;
 	}
 
-	// Call the factory.
-	b2Contact* c = b2Contact::Create(fixtureA, fixtureB, &m_world->m_blockAllocator);
-
-	if (c == NULL)
+	if (b2Contact::IsRegistered(fixtureA->GetType(), fixtureB->GetType()) == false)
 	{
 		return &m_nullContact;
 	}
 
+	b2ContactPair* pair = (b2ContactPair*)m_world->m_blockAllocator.Allocate(sizeof(b2ContactPair));
+	pair->fixtureA = fixtureA;
+	pair->fixtureB = fixtureB;
+	pair->contact = NULL;
+	pair->flags = 0;
+	pair->cache.count = 0;
+
+	if (fixtureA->IsSensor() || fixtureB->IsSensor())
+	{
+		pair->flags |= b2ContactPair::e_sensorFlag;
+		AddPair(&m_sensors, pair);
+	}
+	else
+	{
+		AddPair(&m_pairs, pair);
+	}
+
+	return pair;
+}
+
+b2Contact* b2ContactManager::CreateContact(b2Fixture* fixtureA, b2Fixture* fixtureB)
+{
+	// Call the factory.
+	b2Contact* c = b2Contact::Create(fixtureA, fixtureB, &m_world->m_blockAllocator);
+	b2Assert(c != NULL);
+
 	// Contact creation may swap shapes.
 	fixtureA = c->GetFixtureA();
 	fixtureB = c->GetFixtureB();
-	bodyA = fixtureA->GetBody();
-	bodyB = fixtureB->GetBody();
+	b2Body* bodyA = fixtureA->GetBody();
+	b2Body* bodyB = fixtureB->GetBody();
 
 	// Insert into the world.
-	c->m_prev = NULL;
-	c->m_next = m_world->m_contactList;
-	if (m_world->m_contactList != NULL)
-	{
-		m_world->m_contactList->m_prev = c;
-	}
-	m_world->m_contactList = c;
+	AddContact(c);
 
 	// Connect to island graph.
 
@@ -105,7 +638,7 @@ void* b2ContactManager::PairAdded(void* proxyUserDataA, void* proxyUserDataB)
 }
 
 // This is a callback from the broad-phase when two AABB proxies cease
-// to overlap. We retire the b2Contact.
+// to overlap. We retire the b2ContactPair and its b2Contact.
 void b2ContactManager::PairRemoved(void* proxyUserDataA, void* proxyUserDataB, void* pairUserData)
 {
 	B2_NOT_USED(proxyUserDataA);
@@ -116,15 +649,34 @@ void b2ContactManager::PairRemoved(void* proxyUserDataA, void* proxyUserDataB, v
 		return;
 	}
 
-	b2Contact* c = (b2Contact*)pairUserData;
-	if (c == &m_nullContact)
+	if (pairUserData == &m_nullContact)
 	{
 		return;
 	}
 
 	// An attached body is being destroyed, we must destroy this contact
 	// immediately to avoid orphaned shape pointers.
-	Destroy(c);
+	b2ContactPair* pair = (b2ContactPair*)pairUserData;
+	if (pair->flags & b2ContactPair::e_sensorFlag)
+	{
+		RemovePair(&m_sensors, pair);
+
+		// The world drops this event if a fixture is being destroyed.
+		if (pair->flags & b2ContactPair::e_touchingFlag)
+		{
+			AddSensorEvent(&m_sensorEnds, pair);
+		}
+	}
+	else if (pair->contact)
+	{
+		Destroy(pair->contact);
+	}
+	else
+	{
+		RemovePair(&m_pairs, pair);
+	}
+
+	m_world->m_blockAllocator.Free(pair, sizeof(b2ContactPair));
 }
 
 void b2ContactManager::Destroy(b2Contact* c)
@@ -136,24 +688,16 @@ void b2ContactManager::Destroy(b2Contact* c)
 
 	if (c->m_manifold.m_pointCount > 0)
 	{
+		if (IsRecording())
+		{
+			AddEndEvent(c);
+		}
+
 		m_world->m_contactListener->EndContact(c);
 	}
 
 	// Remove from the world.
-	if (c->m_prev)
-	{
-		c->m_prev->m_next = c->m_next;
-	}
-
-	if (c->m_next)
-	{
-		c->m_next->m_prev = c->m_prev;
-	}
-
-	if (c == m_world->m_contactList)
-	{
-		m_world->m_contactList = c->m_next;
-	}
+	RemoveContact(c);
 
 	// Remove from body 1
 	if (c->m_nodeA.prev)
@@ -187,10 +731,6 @@ void b2ContactManager::Destroy(b2Contact* c)
 		bodyB->m_contactList = c->m_nodeB.next;
 	}
 
-	if (m_nextContact == c)
-	{
-		m_nextContact = c->GetNext();
-	}
 	// Call the factory.
 	if( c->m_flags & b2Contact::e_lockedFlag)
 	{
@@ -203,69 +743,223 @@ void b2ContactManager::Destroy(b2Contact* c)
         // TODO: Is this necessary or wise?
 		//c->m_fixtureA = NULL;
 		//c->m_fixtureB = NULL;
-		c->m_next = NULL;
-		c->m_prev = NULL;
 	}else{
 		b2Contact::Destroy(c, &m_world->m_blockAllocator);
 	}
 	--m_world->m_contactCount;
 }
 
+// Evaluates a range of the contacts sorted by shape types and installs the new
+// manifolds. The old manifolds are left in the manifold array for the listener.
+// This only writes to the contacts of the range, so ranges may run concurrently.
+struct b2CollideTask : public b2Task
+{
+	void Execute(int32 begin, int32 end)
+	{
+		while (begin < end)
+		{
+			b2ShapeType typeA = contacts[begin]->GetFixtureA()->GetType();
+			b2ShapeType typeB = contacts[begin]->GetFixtureB()->GetType();
+			int32 last = begin + 1;
+			while (last < end && contacts[last]->GetFixtureA()->GetType() == typeA &&
+				contacts[last]->GetFixtureB()->GetType() == typeB)
+			{
+				++last;
+			}
+
+			b2ContactEvaluateFcn* evaluateFcn = b2Contact::s_registers[typeA][typeB].evaluateFcn;
+			evaluateFcn(contacts + begin, manifolds + begin, last - begin);
+
+			for (int32 i = begin; i < last; ++i)
+			{
+				b2Manifold oldManifold = contacts[i]->m_manifold;
+				contacts[i]->SetManifold(manifolds[i]);
+				manifolds[i] = oldManifold;
+			}
+
+			begin = last;
+		}
+	}
+
+	b2Contact** contacts;
+	b2Manifold* manifolds;
+};
+
 // This is the top level collision call for the time step. Here
 // all the narrow phase collision is processed for the world
 // contact list.
 void b2ContactManager::Collide()
 {
-	// Update awake contacts.
-	// Note the use of a accessible iterator, m_nextContact, this can be updated elsewhere
-	// should that contact get deleted inside the call to m_nextContact
-	m_nextContact = m_world->m_contactList;
-	while(m_nextContact)
-	{
-		b2Contact* c  = m_nextContact;
-		m_nextContact = c->GetNext();
-		b2Body* bodyA = c->GetFixtureA()->GetBody();
-		b2Body* bodyB = c->GetFixtureB()->GetBody();
-		if (bodyA->IsSleeping() && bodyB->IsSleeping())
+	b2StackAllocator* allocator = &m_world->m_stackAllocator;
+
+	UpdateSensors();
+
+	// Give contacts to the awake pairs whose shapes came close.
+	for (int32 i = 0; i < m_pairs.count;)
+	{
+		b2ContactPair* pair = m_pairs.pairs[i];
+		b2Body* bodyA = pair->fixtureA->GetBody();
+		b2Body* bodyB = pair->fixtureB->GetBody();
+		if ((bodyA->IsSleeping() && bodyB->IsSleeping()) || NeedsContact(pair->fixtureA, pair->fixtureB, 0.0f) == false)
 		{
+			++i;
 			continue;
 		}
 
-		Update(c);
+		// This moves another pair into slot i.
+		Promote(pair);
 	}
-    m_nextContact = NULL;
+
+	// Gather the awake contacts whose manifold must be computed again. The
+	// arrays are scanned in order, so the contacts come out sorted by shape types.
+	b2Contact** contacts = (b2Contact**)allocator->Allocate(m_world->m_contactCount * sizeof(b2Contact*));
+	int32 count = 0;
+	for (int32 i = 0; i < b2_contactArrayCount; ++i)
+	{
+		const b2ContactArray* array = m_arrays + i;
+		for (int32 j = 0; j < array->count; ++j)
+		{
+			b2Contact* c = array->contacts[j];
+			b2Body* bodyA = c->m_fixtureA->GetBody();
+			b2Body* bodyB = c->m_fixtureB->GetBody();
+			if (bodyA->IsSleeping() && bodyB->IsSleeping())
+			{
+				continue;
+			}
+
+			c->m_flags |= b2Contact::e_collideFlag;
+			c->m_collideIndex = b2_nullCollideIndex;
+			if (c->IsCoherent())
+			{
+				continue;
+			}
+
+			c->m_collideIndex = count;
+			contacts[count++] = c;
+		}
+	}
+
+	// Evaluate the batches. This does not call back into the user code, so it
+	// may run on the worker threads of the dispatcher.
+	b2CollideTask task;
+	task.contacts = contacts;
+	task.manifolds = (b2Manifold*)allocator->Allocate(count * sizeof(b2Manifold));
+	if (m_world->m_taskDispatcher)
+	{
+		m_world->m_taskDispatcher->ParallelFor(&task, count, b2_collideGrainSize);
+	}
+	else
+	{
+		task.Execute(0, count);
+	}
+
+	// Report the awake contacts in array order. The callbacks may destroy
+	// contacts, which only leaves holes in the arrays until the report is done.
+	m_deferRemove = true;
+	for (int32 i = 0; i < b2_contactArrayCount; ++i)
+	{
+		b2ContactArray* array = m_arrays + i;
+		for (int32 j = 0; j < array->count; ++j)
+		{
+			b2Contact* c = array->contacts[j];
+			if (c == NULL)
+			{
+				continue;
+			}
+
+			if (c->m_flags & b2Contact::e_collideFlag)
+			{
+				c->m_flags &= ~b2Contact::e_collideFlag;
+
+				bool destroyed;
+				if (c->m_collideIndex != b2_nullCollideIndex)
+				{
+					destroyed = Report(c, task.manifolds + c->m_collideIndex);
+				}
+				else
+				{
+					b2Manifold oldManifold = c->m_manifold;
+					destroyed = Report(c, &oldManifold);
+				}
+
+				// Drop the contact once the shapes are clearly apart.
+				if (destroyed == false && c->m_manifold.m_pointCount == 0 &&
+					NeedsContact(c->m_fixtureA, c->m_fixtureB, b2_linearSlop) == false)
+				{
+					Demote(c);
+				}
+				continue;
+			}
+
+			// The callbacks may wake up contacts that were not gathered.
+			b2Body* bodyA = c->m_fixtureA->GetBody();
+			b2Body* bodyB = c->m_fixtureB->GetBody();
+			if (bodyA->IsSleeping() && bodyB->IsSleeping())
+			{
+				continue;
+			}
+
+			Update(c);
+		}
+	}
+	m_deferRemove = false;
+
+	if (m_hasHoles)
+	{
+		CompactContacts();
+	}
+
+	allocator->Free(task.manifolds);
+	allocator->Free(contacts);
 }
 
 bool b2ContactManager::Update(b2Contact* contact)
 {
-	b2ContactListener* listener = m_world->m_contactListener;
-    
-	b2Body* bodyA = contact->m_fixtureA->GetBody();
-	b2Body* bodyB = contact->m_fixtureB->GetBody();
-    
 	b2ShapeType shapeAType = contact->m_fixtureA->GetType();
 	b2ShapeType shapeBType = contact->m_fixtureB->GetType();
     
     b2Manifold oldManifold = contact->m_manifold;
-    
-	uint32 oldLock = contact->m_flags & b2Contact::e_lockedFlag ;
 
-	contact->m_flags |= b2Contact::e_lockedFlag;
+	if (contact->IsCoherent() == false)
+	{
+		uint32 oldLock = contact->m_flags & b2Contact::e_lockedFlag ;
 
-	contact->Evaluate();
-	
-	contact->m_flags &= ~b2Contact::e_invalidFlag;
+		contact->m_flags |= b2Contact::e_lockedFlag;
 
-	if(contact->m_flags & b2Contact::e_destroyFlag)
-	{     
-		b2Contact::Destroy(contact, shapeAType, shapeBType, &m_world->m_blockAllocator);
-        return true;
+		b2Manifold manifold;
+		contact->Evaluate(&manifold);
+
+		if(contact->m_flags & b2Contact::e_destroyFlag)
+		{     
+			b2Contact::Destroy(contact, shapeAType, shapeBType, &m_world->m_blockAllocator);
+			return true;
+		}
+
+		if(!oldLock)
+			contact->m_flags &= ~b2Contact::e_lockedFlag;
+
+		contact->SetManifold(manifold);
 	}
 
-	if(!oldLock)
-		contact->m_flags &= ~b2Contact::e_lockedFlag;
+	return Report(contact, &oldManifold);
+}
+
+bool b2ContactManager::Report(b2Contact* contact, const b2Manifold* oldManifold)
+{
+	b2ContactListener* listener = m_world->m_contactListener;
+	b2ShapeType shapeAType = contact->m_fixtureA->GetType();
+	b2ShapeType shapeBType = contact->m_fixtureB->GetType();
+
+	// The callbacks may destroy the contact.
+	uint32 oldLock = contact->m_flags & b2Contact::e_lockedFlag;
+	contact->m_flags |= b2Contact::e_lockedFlag;
+    
+	b2Body* bodyA = contact->m_fixtureA->GetBody();
+	b2Body* bodyB = contact->m_fixtureB->GetBody();
+
+	contact->m_flags &= ~b2Contact::e_invalidFlag;
     
-	int32 oldCount = oldManifold.m_pointCount;
+	int32 oldCount = oldManifold->m_pointCount;
 	int32 newCount = contact->m_manifold.m_pointCount;
     
 	if (newCount == 0 && oldCount > 0)
@@ -283,51 +977,60 @@ bool b2ContactManager::Update(b2Contact* contact)
 	{
 		contact->m_flags |= b2Contact::e_slowFlag;
 	}
-    
-	// Match old contact ids to new contact ids and copy the
-	// stored impulses to warm start the solver.
-	for (int32 i = 0; i < contact->m_manifold.m_pointCount; ++i)
-	{
-		b2ManifoldPoint* mp2 = contact->m_manifold.m_points + i;
-		mp2->m_normalImpulse = 0.0f;
-		mp2->m_tangentImpulse = 0.0f;
-		b2ContactID id2 = mp2->m_id;
-
-		for (int32 j = 0; j < oldManifold.m_pointCount; ++j)
-		{
-			b2ManifoldPoint* mp1 = oldManifold.m_points + j;
-
-			if (mp1->m_id.key == id2.key)
-			{
-				mp2->m_normalImpulse = mp1->m_normalImpulse;
-				mp2->m_tangentImpulse = mp1->m_tangentImpulse;
-				break;
-			}
-		}
-	}
 
 	if (oldCount == 0 && newCount > 0)
 	{
 		contact->m_flags |= b2Contact::e_touchFlag;
+		if (IsRecording())
+		{
+			AddBeginEvents(contact);
+		}
+
 		listener->BeginContact(contact);
 	}
 
 	if (oldCount > 0 && newCount == 0)
 	{
 		contact->m_flags &= ~b2Contact::e_touchFlag;
+		if (IsRecording())
+		{
+			AddEndEvent(contact);
+		}
+
 		listener->EndContact(contact);
 	}
 
 	if ((contact->m_flags & b2Contact::e_nonSolidFlag) == 0)
 	{
-		listener->PreSolve(contact, &oldManifold);
+		listener->PreSolve(contact, oldManifold);
+
+		// The user may have disabled contact. The manifold must be
+		// computed again, since it no longer matches the shapes.
+		if (contact->m_manifold.m_pointCount != newCount)
+		{
+			contact->m_flags &= ~b2Contact::e_coherentFlag;
+		}
 
-		// The user may have disabled contact.
 		if (contact->m_manifold.m_pointCount == 0)
 		{
 			contact->m_flags &= ~b2Contact::e_touchFlag;
 		}
 	}
-	
+
+	if (oldLock)
+	{
+		return false;
+	}
+
+	contact->m_flags &= ~b2Contact::e_lockedFlag;
+
+	if (contact->m_flags & b2Contact::e_destroyFlag)
+	{
+		// The fixtures may be gone, so there is nothing to wake.
+		contact->m_manifold.m_pointCount = 0;
+		b2Contact::Destroy(contact, shapeAType, shapeBType, &m_world->m_blockAllocator);
+		return true;
+	}
+
 	return false;
 }
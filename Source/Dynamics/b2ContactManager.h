@@ -20,21 +20,100 @@
 #define B2_CONTACT_MANAGER_H
 
 #include "../Collision/b2BroadPhase.h"
+#include "../Collision/b2Distance.h"
 #include "../Dynamics/Contacts/b2NullContact.h"
+#include "b2WorldCallbacks.h"
+
+#include <string.h>
 
 class b2World;
 class b2Contact;
 struct b2TimeStep;
 
+const uint32 b2_nullContactSlot = UINT_MAX;
+
+/// The number of contact arrays, one per shape type pair.
+const int32 b2_contactArrayCount = b2_shapeTypeCount * b2_shapeTypeCount;
+
+/// A dense array of the contacts of one shape type pair.
+struct b2ContactArray
+{
+	b2Contact** contacts;	///< NULL for a contact destroyed while Collide reports
+	int32 count;
+	int32 capacity;
+};
+
+/// A broad-phase pair of fixtures. Most pairs never touch, so a pair only gets
+/// a contact, with a manifold and a place in the island graph, once the shapes
+/// are close. The pair is the broad-phase pair user data.
+///
+/// Pairs with a sensor never get a contact. They only track whether the shapes
+/// overlap, which is reported in bulk after the step.
+struct b2ContactPair
+{
+	enum
+	{
+		e_sensorFlag	= 0x0001,
+		e_touchingFlag	= 0x0002,
+	};
+
+	b2Fixture* fixtureA;
+	b2Fixture* fixtureB;
+	b2Contact* contact;		///< NULL while the shapes are apart
+	int32 index;			///< the place in the pair or sensor array while there is no contact
+	uint32 flags;
+	b2SimplexCache cache;	///< warm starts the overlap test of a sensor pair
+};
+
+/// A dense array of pairs.
+struct b2PairArray
+{
+	b2ContactPair** pairs;
+	int32 count;
+	int32 capacity;
+};
+
+/// A growable array of events. It keeps its memory from step to step.
+template <typename T>
+struct b2EventArray
+{
+	/// Add an event and return it for the caller to fill.
+	T* Add()
+	{
+		if (count == capacity)
+		{
+			T* oldEvents = events;
+			capacity = b2Max(2 * capacity, 16);
+			events = (T*)b2Alloc(capacity * sizeof(T));
+			if (oldEvents)
+			{
+				memcpy(events, oldEvents, count * sizeof(T));
+				b2Free(oldEvents);
+			}
+		}
+
+		return events + count++;
+	}
+
+	T* events;
+	int32 count;
+	int32 capacity;
+};
+
+/// Maps a contact handle to its contact.
+struct b2ContactSlot
+{
+	b2Contact* contact;		///< NULL for a free slot
+	uint32 generation;
+	uint32 next;			///< next free slot
+};
+
 // Delegate of b2World.
 class b2ContactManager : public b2PairCallback
 {
 public:
-	b2ContactManager() : 
-		m_world(NULL), 
-		m_destroyImmediate(false),
-		m_nextContact(NULL)
-		{}
+	b2ContactManager();
+	~b2ContactManager();
 
 	// Implements PairCallback
 	void* PairAdded(void* proxyUserDataA, void* proxyUserDataB);
@@ -51,17 +130,103 @@ public:
 	/// @return True if the contact has been destroyed during the callback.
 	bool Update(b2Contact* contact);
 
+	/// Get the first contact of the arrays at or after the given position.
+	b2Contact* FindContact(int32 arrayIndex, int32 index) const;
+
+	/// Get the contact of a handle, or NULL if it was destroyed.
+	b2Contact* GetContact(const b2ContactHandle& handle) const;
+
+	/// Get the array of a shape type pair.
+	static int32 GetArrayIndex(b2ShapeType typeA, b2ShapeType typeB);
+
+	/// Report the sensor events of the step to the listener.
+	void ReportSensors();
+
+	/// Drop the pending events of a fixture that is being destroyed, and clear
+	/// its reported sensor events.
+	void RemoveEvents(b2Fixture* fixture);
+
+	/// Start recording the contact events of a new step.
+	void ClearEvents();
+
 private:
 	friend class b2World;
+
+	// Reports the new manifold to the listener. Returns true if the listener
+	// destroyed the contact.
+	bool Report(b2Contact* contact, const b2Manifold* oldManifold);
+
+	void AddContact(b2Contact* c);
+	void RemoveContact(b2Contact* c);
+	void CompactContacts();
+
+	b2Contact* CreateContact(b2Fixture* fixtureA, b2Fixture* fixtureB);
+	bool NeedsContact(b2Fixture* fixtureA, b2Fixture* fixtureB, float32 margin) const;
+	void Promote(b2ContactPair* pair);
+	void Demote(b2Contact* c);
+
+	void AddPair(b2PairArray* array, b2ContactPair* pair);
+	void RemovePair(b2PairArray* array, b2ContactPair* pair);
+
+	void UpdateSensors();
+	void AddSensorEvent(b2EventArray<b2SensorEvent>* array, b2ContactPair* pair);
+
+	bool IsRecording() const;
+	void AddBeginEvents(b2Contact* c);
+	void AddEndEvent(b2Contact* c);
+
 	b2World* m_world;
 
 	// This lets us provide broadphase proxy pair user data for
 	// contacts that shouldn't exist.
 	b2NullContact m_nullContact;
-    
-    b2Contact* m_nextContact;
+
+	b2ContactArray m_arrays[b2_contactArrayCount];
+
+	// While Collide reports contacts, destroyed contacts leave a hole in their
+	// array, so the arrays do not move under the iteration.
+	bool m_deferRemove;
+	bool m_hasHoles;
+
+	// The pairs without a contact, and the sensor pairs.
+	b2PairArray m_pairs;
+	b2PairArray m_sensors;
+
+	// The sensor events waiting for the next report, and the events of the last
+	// report, which the user may still be reading.
+	b2EventArray<b2SensorEvent> m_sensorBegins;
+	b2EventArray<b2SensorEvent> m_sensorEnds;
+	b2EventArray<b2SensorEvent> m_reportedBegins;
+	b2EventArray<b2SensorEvent> m_reportedEnds;
+
+	// The contact events of the step, when the world records them.
+	bool m_recordEvents;
+	float32 m_hitEventThreshold;
+	b2EventArray<b2ContactBeginEvent> m_beginEvents;
+	b2EventArray<b2ContactEndEvent> m_endEvents;
+	b2EventArray<b2ContactHitEvent> m_hitEvents;
+	b2EventArray<b2ContactImpulseEvent> m_impulseEvents;
+
+	b2ContactSlot* m_slots;
+	int32 m_slotCapacity;
+	uint32 m_freeSlot;
 
 	bool m_destroyImmediate;
 };
 
+inline int32 b2ContactManager::GetArrayIndex(b2ShapeType typeA, b2ShapeType typeB)
+{
+	return typeA * b2_shapeTypeCount + typeB;
+}
+
+inline b2Contact* b2ContactManager::GetContact(const b2ContactHandle& handle) const
+{
+	if (handle.index < uint32(m_slotCapacity) && m_slots[handle.index].generation == handle.generation)
+	{
+		return m_slots[handle.index].contact;
+	}
+
+	return NULL;
+}
+
 #endif
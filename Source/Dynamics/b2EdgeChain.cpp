@@ -21,6 +21,8 @@
 #include "b2Fixture.h"
 #include "../Collision/Shapes/b2EdgeShape.h"
 
+#include <new>
+
 static void b2ConnectEdges(b2EdgeShape* edgeA, b2EdgeShape* edgeB)
 {
 	b2Vec2 cornerDir = edgeA->GetDirectionVector() + edgeB->GetDirectionVector();
@@ -32,7 +34,7 @@ static void b2ConnectEdges(b2EdgeShape* edgeA, b2EdgeShape* edgeB)
 
 b2Fixture* b2CreateEdgeChain(b2Body* body, const b2EdgeChainDef* def)
 {
-	b2Vec2 v1, v2;
+	b2Vec2 v1;
 	int32 i;
 
 	if (def->isLoop)
@@ -46,48 +48,54 @@ b2Fixture* b2CreateEdgeChain(b2Body* body, const b2EdgeChainDef* def)
 		i = 1;
 	}
 
-	b2EdgeDef edgeDef;
-	edgeDef.userData = def->userData;
-	edgeDef.friction = def->friction;
-	edgeDef.restitution = def->restitution;
-	edgeDef.density = 0.0f;
-	edgeDef.filter = def->filter;
-	edgeDef.isSensor = def->isSensor;
+	int32 edgeCount = def->vertexCount - i;
+	if (edgeCount <= 0)
+	{
+		return NULL;
+	}
 
-	b2Fixture* fixture0 = NULL;
-	b2Fixture* fixture1 = NULL;
-	b2Fixture* fixture2 = NULL;
+	b2EdgeDef* edgeDefs = (b2EdgeDef*)b2Alloc(edgeCount * sizeof(b2EdgeDef));
+	const b2FixtureDef** defs = (const b2FixtureDef**)b2Alloc(edgeCount * sizeof(b2FixtureDef*));
+	b2Fixture** fixtures = (b2Fixture**)b2Alloc(edgeCount * sizeof(b2Fixture*));
 
-	for (; i < def->vertexCount; ++i)
+	for (int32 j = 0; j < edgeCount; ++j, ++i)
 	{
-		v2 = def->vertices[i];
+		b2EdgeDef* edgeDef = new (edgeDefs + j) b2EdgeDef;
+		edgeDef->userData = def->userData;
+		edgeDef->friction = def->friction;
+		edgeDef->restitution = def->restitution;
+		edgeDef->density = 0.0f;
+		edgeDef->filter = def->filter;
+		edgeDef->isSensor = def->isSensor;
+		edgeDef->vertex1 = v1;
+		edgeDef->vertex2 = def->vertices[i];
+		defs[j] = edgeDef;
 
-		edgeDef.vertex1 = v1;
-		edgeDef.vertex2 = v2;
-
-		fixture2 = body->CreateFixture(&edgeDef);
+		v1 = def->vertices[i];
+	}
 
-		if (fixture1 == NULL)
-		{
-			fixture0 = fixture2;
-		}
-		else
-		{
-			b2EdgeShape* edge1 = (b2EdgeShape*)fixture1->GetShape();
-			b2EdgeShape* edge2 = (b2EdgeShape*)fixture2->GetShape();
-			b2ConnectEdges(edge1, edge2);
-		}
+	// Chains are usually level geometry, so add the edges as one batch.
+	body->CreateFixtures(defs, edgeCount, fixtures);
 
-		fixture1 = fixture2;
-		v1 = v2;
+	for (int32 j = 1; j < edgeCount; ++j)
+	{
+		b2EdgeShape* edge1 = (b2EdgeShape*)fixtures[j-1]->GetShape();
+		b2EdgeShape* edge2 = (b2EdgeShape*)fixtures[j]->GetShape();
+		b2ConnectEdges(edge1, edge2);
 	}
 
 	if (def->isLoop)
 	{
-		b2EdgeShape* edge1 = (b2EdgeShape*)fixture1->GetShape();
-		b2EdgeShape* edge0 = (b2EdgeShape*)fixture0->GetShape();
+		b2EdgeShape* edge1 = (b2EdgeShape*)fixtures[edgeCount-1]->GetShape();
+		b2EdgeShape* edge0 = (b2EdgeShape*)fixtures[0]->GetShape();
 		b2ConnectEdges(edge1, edge0);
 	}
-	
+
+	b2Fixture* fixture0 = fixtures[0];
+
+	b2Free(fixtures);
+	b2Free(defs);
+	b2Free(edgeDefs);
+
 	return fixture0;
 }
@@ -17,6 +17,8 @@
 */
 
 #include "b2Fixture.h"
+#include "b2Body.h"
+#include "b2World.h"
 #include "../Collision/Shapes/b2CircleShape.h"
 #include "../Collision/Shapes/b2PolygonShape.h"
 #include "../Collision/Shapes/b2EdgeShape.h"
@@ -68,7 +70,7 @@ b2Fixture::~b2Fixture()
 	b2Assert(m_proxyId == b2_nullProxy);
 }
 
-void b2Fixture::Create(b2BlockAllocator* allocator, b2BroadPhase* broadPhase, b2Body* body, const b2XForm& xf, const b2FixtureDef* def)
+void b2Fixture::Create(b2BlockAllocator* allocator, b2Body* body, const b2FixtureDef* def)
 {
 	m_userData = def->userData;
 	m_friction = def->friction;
@@ -122,6 +124,11 @@ void b2Fixture::Create(b2BlockAllocator* allocator, b2BroadPhase* broadPhase, b2
 		b2Assert(false);
 		break;
 	}
+}
+
+void b2Fixture::CreateProxy(b2BroadPhase* broadPhase, const b2XForm& xf, bool isStatic)
+{
+	b2Assert(m_proxyId == b2_nullProxy);
 
 	// Create proxy in the broad-phase.
 	b2AABB aabb;
@@ -134,7 +141,7 @@ void b2Fixture::Create(b2BlockAllocator* allocator, b2BroadPhase* broadPhase, b2
 
 	if (inRange)
 	{
-		m_proxyId = broadPhase->CreateProxy(aabb, this);
+		m_proxyId = broadPhase->CreateProxy(aabb, this, isStatic);
 	}
 	else
 	{
@@ -212,7 +219,7 @@ bool b2Fixture::Synchronize(b2BroadPhase* broadPhase, const b2XForm& transform1,
 	}
 }
 
-void b2Fixture::RefilterProxy(b2BroadPhase* broadPhase, const b2XForm& transform)
+void b2Fixture::RefilterProxy(b2BroadPhase* broadPhase, const b2XForm& transform, bool isStatic)
 {
 	if (m_proxyId == b2_nullProxy)
 	{	
@@ -228,10 +235,25 @@ void b2Fixture::RefilterProxy(b2BroadPhase* broadPhase, const b2XForm& transform
 
 	if (inRange)
 	{
-		m_proxyId = broadPhase->CreateProxy(aabb, this);
+		m_proxyId = broadPhase->CreateProxy(aabb, this, isStatic);
 	}
 	else
 	{
 		m_proxyId = b2_nullProxy;
 	}
 }
+
+void b2Fixture::SetSensor(bool sensor)
+{
+	if (m_isSensor == sensor)
+	{
+		return;
+	}
+
+	m_isSensor = sensor;
+
+	if (m_body != NULL)
+	{
+		m_body->GetWorld()->Refilter(this);
+	}
+}
@@ -167,8 +167,10 @@ public:
 	/// @return the true if the shape is a sensor.
 	bool IsSensor() const;
 
-	/// Set if this fixture is a sensor.
-	/// You must call b2World::Refilter to update existing contacts.
+	/// Set if this fixture is a sensor. A pair only becomes a sensor pair when it
+	/// is created, so this refilters the fixture: its contacts end and its pairs
+	/// are rebuilt.
+	/// @warning This function is locked during callbacks.
 	void SetSensor(bool sensor);
 
 	/// Set the contact filtering data. You must call b2World::Refilter to correct
@@ -252,11 +254,15 @@ protected:
 
 	// We need separation create/destroy functions from the constructor/destructor because
 	// the destructor cannot access the allocator or broad-phase (no destructor arguments allowed by C++).
-	void Create(b2BlockAllocator* allocator, b2BroadPhase* broadPhase, b2Body* body, const b2XForm& xf, const b2FixtureDef* def);
+	void Create(b2BlockAllocator* allocator, b2Body* body, const b2FixtureDef* def);
 	void Destroy(b2BlockAllocator* allocator, b2BroadPhase* broadPhase);
 
+	// Add the fixture to the broad-phase. b2Body::CreateFixtures skips this
+	// and adds a whole batch of fixtures at once.
+	void CreateProxy(b2BroadPhase* broadPhase, const b2XForm& xf, bool isStatic);
+
 	bool Synchronize(b2BroadPhase* broadPhase, const b2XForm& xf1, const b2XForm& xf2);
-	void RefilterProxy(b2BroadPhase* broadPhase, const b2XForm& xf);
+	void RefilterProxy(b2BroadPhase* broadPhase, const b2XForm& xf, bool isStatic);
 
 	b2ShapeType m_type;
 	b2Fixture* m_next;
@@ -268,7 +274,7 @@ protected:
 	float32 m_friction;
 	float32 m_restitution;
 
-	uint16 m_proxyId;
+	uint32 m_proxyId;
 	b2FilterData m_filter;
 
 	bool m_isSensor;
@@ -296,11 +302,6 @@ inline bool b2Fixture::IsSensor() const
 	return m_isSensor;
 }
 
-inline void b2Fixture::SetSensor(bool sensor)
-{
-	m_isSensor = sensor;
-}
-
 inline void b2Fixture::SetFilterData(const b2FilterData& filter)
 {
 	m_filter = filter;
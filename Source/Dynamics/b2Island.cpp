@@ -148,7 +148,8 @@ b2Island::b2Island(
 	int32 contactCapacity,
 	int32 jointCapacity,
 	b2StackAllocator* allocator,
-	b2ContactListener* listener)
+	b2ContactListener* listener,
+	b2EventArray<b2ContactImpulseEvent>* impulseEvents)
 {
 	m_bodyCapacity = bodyCapacity;
 	m_contactCapacity = contactCapacity;
@@ -159,6 +160,7 @@ b2Island::b2Island(
 
 	m_allocator = allocator;
 	m_listener = listener;
+	m_impulseEvents = impulseEvents;
 
 	m_bodies = (b2Body**)m_allocator->Allocate(bodyCapacity * sizeof(b2Body*));
 	m_contacts = (b2Contact**)m_allocator->Allocate(contactCapacity	 * sizeof(b2Contact*));
@@ -485,6 +487,16 @@ void b2Island::Report(const b2ContactConstraint* constraints)
 			impulse.tangentImpulses[j] = cc->points[j].tangentImpulse;
 		}
 
+		if (m_impulseEvents)
+		{
+			b2ContactImpulseEvent* event = m_impulseEvents->Add();
+			event->fixtureA = c->GetFixtureA();
+			event->fixtureB = c->GetFixtureB();
+			event->contact = c->GetHandle();
+			event->pointCount = cc->pointCount;
+			event->impulse = impulse;
+		}
+
 		m_listener->PostSolve(c, &impulse);
 	}
 }
@@ -27,7 +27,9 @@ class b2Joint;
 class b2StackAllocator;
 class b2ContactListener;
 struct b2ContactConstraint;
+struct b2ContactImpulseEvent;
 struct b2TimeStep;
+template <typename T> struct b2EventArray;
 
 struct b2Position
 {
@@ -45,7 +47,8 @@ class b2Island
 {
 public:
 	b2Island(int32 bodyCapacity, int32 contactCapacity, int32 jointCapacity,
-			b2StackAllocator* allocator, b2ContactListener* listener);
+			b2StackAllocator* allocator, b2ContactListener* listener,
+			b2EventArray<b2ContactImpulseEvent>* impulseEvents);
 	~b2Island();
 
 	void Clear()
@@ -82,6 +85,7 @@ public:
 
 	b2StackAllocator* m_allocator;
 	b2ContactListener* m_listener;
+	b2EventArray<b2ContactImpulseEvent>* m_impulseEvents;
 
 	b2Body** m_bodies;
 	b2Contact** m_contacts;
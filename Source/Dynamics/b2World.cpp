@@ -25,6 +25,9 @@
 #include "Contacts/b2ContactSolver.h"
 #include "Controllers/b2Controller.h"
 #include "../Collision/b2Collision.h"
+#include "../Collision/b2Distance.h"
+#include "../Collision/b2DynamicTree.h"
+#include "../Collision/b2TimeOfImpact.h"
 #include "../Collision/Shapes/b2CircleShape.h"
 #include "../Collision/Shapes/b2PolygonShape.h"
 #include "../Collision/Shapes/b2EdgeShape.h"
@@ -33,16 +36,29 @@
 b2ContactFilter b2_defaultFilter;
 b2ContactListener b2_defaultListener;
 
-b2World::b2World(const b2AABB& worldAABB, const b2Vec2& gravity, bool doSleep)
+b2World::b2World(const b2AABB& worldAABB, const b2Vec2& gravity, bool doSleep, int32 proxyCapacity)
+{
+	b2BroadPhaseDef broadPhaseDef;
+	broadPhaseDef.worldAABB = worldAABB;
+	broadPhaseDef.proxyCapacity = proxyCapacity;
+	Initialize(&broadPhaseDef, gravity, doSleep);
+}
+
+b2World::b2World(const b2BroadPhaseDef* broadPhaseDef, const b2Vec2& gravity, bool doSleep)
+{
+	Initialize(broadPhaseDef, gravity, doSleep);
+}
+
+void b2World::Initialize(const b2BroadPhaseDef* broadPhaseDef, const b2Vec2& gravity, bool doSleep)
 {
 	m_destructionListener = NULL;
 	m_boundaryListener = NULL;
 	m_contactFilter = &b2_defaultFilter;
 	m_contactListener = &b2_defaultListener;
 	m_debugDraw = NULL;
+	m_taskDispatcher = NULL;
 
 	m_bodyList = NULL;
-	m_contactList = NULL;
 	m_jointList = NULL;
 	m_controllerList = NULL;
 
@@ -62,8 +78,7 @@ b2World::b2World(const b2AABB& worldAABB, const b2Vec2& gravity, bool doSleep)
 	m_inv_dt0 = 0.0f;
 
 	m_contactManager.m_world = this;
-	void* mem = b2Alloc(sizeof(b2BroadPhase));
-	m_broadPhase = new (mem) b2BroadPhase(worldAABB, &m_contactManager);
+	m_broadPhase = b2BroadPhase::Create(broadPhaseDef, &m_contactManager);
 
 	b2BodyDef bd;
 	m_groundBody = CreateBody(&bd);
@@ -72,8 +87,7 @@ b2World::b2World(const b2AABB& worldAABB, const b2Vec2& gravity, bool doSleep)
 b2World::~b2World()
 {
 	DestroyBody(m_groundBody);
-	m_broadPhase->~b2BroadPhase();
-	b2Free(m_broadPhase);
+	b2BroadPhase::Destroy(m_broadPhase);
 }
 
 void b2World::SetDestructionListener(b2DestructionListener* listener)
@@ -101,6 +115,22 @@ void b2World::SetDebugDraw(b2DebugDraw* debugDraw)
 	m_debugDraw = debugDraw;
 }
 
+void b2World::SetTaskDispatcher(b2TaskDispatcher* dispatcher)
+{
+	m_taskDispatcher = dispatcher;
+}
+
+void b2World::SetContactEventsEnabled(bool flag)
+{
+	m_contactManager.m_recordEvents = flag;
+	m_contactManager.ClearEvents();
+}
+
+void b2World::SetHitEventThreshold(float32 speed)
+{
+	m_contactManager.m_hitEventThreshold = speed;
+}
+
 b2Body* b2World::CreateBody(const b2BodyDef* def)
 {
 	void* mem = m_blockAllocator.Allocate(sizeof(b2Body));
@@ -162,6 +192,7 @@ void b2World::DestroyBody(b2Body* b)
 		}
 
 		f0->Destroy(&m_blockAllocator, m_broadPhase);
+		m_contactManager.RemoveEvents(f0);
 		f0->~b2Fixture();
 		m_blockAllocator.Free(f0, sizeof(b2Fixture));
 	}
@@ -235,7 +266,7 @@ b2Joint* b2World::CreateJoint(const b2JointDef* def)
 
 		for (b2Fixture* f = b->m_fixtureList; f; f = f->m_next)
 		{
-			f->RefilterProxy(m_broadPhase, b->GetXForm());
+			f->RefilterProxy(m_broadPhase, b->GetXForm(), b->HasStaticProxies());
 		}
 	}
 
@@ -328,7 +359,7 @@ void b2World::DestroyJoint(b2Joint* j)
 		b2Body* b = body1->m_fixtureCount < body2->m_fixtureCount ? body1 : body2;
 		for (b2Fixture* f = b->m_fixtureList; f; f = f->m_next)
 		{
-			f->RefilterProxy(m_broadPhase, b->GetXForm());
+			f->RefilterProxy(m_broadPhase, b->GetXForm(), b->HasStaticProxies());
 		}
 	}
 }
@@ -379,7 +410,10 @@ void b2World::DestroyController(b2Controller* controller)
 
 void b2World::Refilter(b2Fixture* fixture)
 {
-	fixture->RefilterProxy(m_broadPhase, fixture->GetBody()->GetXForm());
+	b2Assert(m_lock == false);
+
+	b2Body* body = fixture->GetBody();
+	fixture->RefilterProxy(m_broadPhase, body->GetXForm(), body->HasStaticProxies());
 }
 
 // Find islands, integrate and solve constraints, solve position constraints
@@ -392,16 +426,21 @@ void b2World::Solve(const b2TimeStep& step)
 	}
 
 	// Size the island for the worst case.
-	b2Island island(m_bodyCount, m_contactCount, m_jointCount, &m_stackAllocator, m_contactListener);
+	b2EventArray<b2ContactImpulseEvent>* impulseEvents = m_contactManager.m_recordEvents ? &m_contactManager.m_impulseEvents : NULL;
+	b2Island island(m_bodyCount, m_contactCount, m_jointCount, &m_stackAllocator, m_contactListener, impulseEvents);
 
 	// Clear all the island flags.
 	for (b2Body* b = m_bodyList; b; b = b->m_next)
 	{
 		b->m_flags &= ~b2Body::e_islandFlag;
 	}
-	for (b2Contact* c = m_contactList; c; c = c->m_next)
+	for (int32 i = 0; i < b2_contactArrayCount; ++i)
 	{
-		c->m_flags &= ~b2Contact::e_islandFlag;
+		const b2ContactArray* array = m_contactManager.m_arrays + i;
+		for (int32 j = 0; j < array->count; ++j)
+		{
+			array->contacts[j]->m_flags &= ~b2Contact::e_islandFlag;
+		}
 	}
 	for (b2Joint* j = m_jointList; j; j = j->m_next)
 	{
@@ -526,6 +565,9 @@ void b2World::Solve(const b2TimeStep& step)
 	// Synchronize fixtures, check for out of range bodies.
 	for (b2Body* b = m_bodyList; b; b = b->GetNext())
 	{
+		// Bodies that fell asleep or woke up change broad-phase sets.
+		b->SynchronizeProxySet();
+
 		if (b->m_flags & (b2Body::e_sleepFlag | b2Body::e_frozenFlag))
 		{
 			continue;
@@ -557,7 +599,8 @@ void b2World::Solve(const b2TimeStep& step)
 void b2World::SolveTOI(const b2TimeStep& step)
 {
 	// Reserve an island and a queue for TOI island solution.
-	b2Island island(m_bodyCount, b2_maxTOIContactsPerIsland, b2_maxTOIJointsPerIsland, &m_stackAllocator, m_contactListener);
+	b2EventArray<b2ContactImpulseEvent>* impulseEvents = m_contactManager.m_recordEvents ? &m_contactManager.m_impulseEvents : NULL;
+	b2Island island(m_bodyCount, b2_maxTOIContactsPerIsland, b2_maxTOIJointsPerIsland, &m_stackAllocator, m_contactListener, impulseEvents);
 	
 	//Simple one pass queue
 	//Relies on the fact that we're only making one pass
@@ -576,10 +619,14 @@ void b2World::SolveTOI(const b2TimeStep& step)
 		b->m_sweep.t0 = 0.0f;
 	}
 
-	for (b2Contact* c = m_contactList; c; c = c->m_next)
+	for (int32 i = 0; i < b2_contactArrayCount; ++i)
 	{
-		// Invalidate TOI
-		c->m_flags &= ~(b2Contact::e_toiFlag | b2Contact::e_islandFlag);
+		const b2ContactArray* array = m_contactManager.m_arrays + i;
+		for (int32 j = 0; j < array->count; ++j)
+		{
+			// Invalidate TOI
+			array->contacts[j]->m_flags &= ~(b2Contact::e_toiFlag | b2Contact::e_islandFlag);
+		}
 	}
 
 	for (b2Joint* j = m_jointList; j; j = j->m_next)
@@ -594,73 +641,78 @@ void b2World::SolveTOI(const b2TimeStep& step)
 		b2Contact* minContact = NULL;
 		float32 minTOI = 1.0f;
 
-		for (b2Contact* c = m_contactList; c; c = c->m_next)
+		for (int32 i = 0; i < b2_contactArrayCount; ++i)
 		{
-			if (c->m_flags & (b2Contact::e_slowFlag | b2Contact::e_nonSolidFlag | b2Contact::e_invalidFlag | b2Contact::e_destroyFlag))
-			{
-				continue;
-			}
-
-			// TODO_ERIN keep a counter on the contact, only respond to M TOIs per contact.
-
-			float32 toi = 1.0f;
-			if (c->m_flags & b2Contact::e_toiFlag)
-			{
-				// This contact has a valid cached TOI.
-				toi = c->m_toi;
-			}
-			else
+			const b2ContactArray* array = m_contactManager.m_arrays + i;
+			for (int32 j = 0; j < array->count; ++j)
 			{
-				// Compute the TOI for this contact.
-				b2Fixture* s1 = c->GetFixtureA();
-				b2Fixture* s2 = c->GetFixtureB();
-				b2Body* b1 = s1->GetBody();
-				b2Body* b2 = s2->GetBody();
-
-				if ((b1->IsStatic() || b1->IsSleeping()) && (b2->IsStatic() || b2->IsSleeping()))
+				b2Contact* c = array->contacts[j];
+				if (c->m_flags & (b2Contact::e_slowFlag | b2Contact::e_nonSolidFlag | b2Contact::e_invalidFlag | b2Contact::e_destroyFlag))
 				{
 					continue;
 				}
 
-				// Put the sweeps onto the same time interval.
-				float32 t0 = b1->m_sweep.t0;
-				
-				if (b1->m_sweep.t0 < b2->m_sweep.t0)
+				// TODO_ERIN keep a counter on the contact, only respond to M TOIs per contact.
+
+				float32 toi = 1.0f;
+				if (c->m_flags & b2Contact::e_toiFlag)
 				{
-					t0 = b2->m_sweep.t0;
-					b1->m_sweep.Advance(t0);
+					// This contact has a valid cached TOI.
+					toi = c->m_toi;
 				}
-				else if (b2->m_sweep.t0 < b1->m_sweep.t0)
+				else
 				{
-					t0 = b1->m_sweep.t0;
-					b2->m_sweep.Advance(t0);
+					// Compute the TOI for this contact.
+					b2Fixture* s1 = c->GetFixtureA();
+					b2Fixture* s2 = c->GetFixtureB();
+					b2Body* b1 = s1->GetBody();
+					b2Body* b2 = s2->GetBody();
+
+					if ((b1->IsStatic() || b1->IsSleeping()) && (b2->IsStatic() || b2->IsSleeping()))
+					{
+						continue;
+					}
+
+					// Put the sweeps onto the same time interval.
+					float32 t0 = b1->m_sweep.t0;
+				
+					if (b1->m_sweep.t0 < b2->m_sweep.t0)
+					{
+						t0 = b2->m_sweep.t0;
+						b1->m_sweep.Advance(t0);
+					}
+					else if (b2->m_sweep.t0 < b1->m_sweep.t0)
+					{
+						t0 = b1->m_sweep.t0;
+						b2->m_sweep.Advance(t0);
+					}
+
+					b2Assert(t0 < 1.0f);
+
+					// Compute the time of impact.
+					toi = c->ComputeTOI(b1->m_sweep, b2->m_sweep);
+					//b2TimeOfImpact(c->m_fixtureA->GetShape(), b1->m_sweep, c->m_fixtureB->GetShape(), b2->m_sweep);
+
+					b2Assert(0.0f <= toi && toi <= 1.0f);
+
+					// If the TOI is in range ...
+					if (0.0f < toi && toi < 1.0f)
+					{
+						// Interpolate on the actual range.
+						toi = b2Min((1.0f - toi) * t0 + toi, 1.0f);
+					}
+
+
+					c->m_toi = toi;
+					c->m_flags |= b2Contact::e_toiFlag;
 				}
 
-				b2Assert(t0 < 1.0f);
-
-				// Compute the time of impact.
-				toi = c->ComputeTOI(b1->m_sweep, b2->m_sweep);
-				//b2TimeOfImpact(c->m_fixtureA->GetShape(), b1->m_sweep, c->m_fixtureB->GetShape(), b2->m_sweep);
-
-				b2Assert(0.0f <= toi && toi <= 1.0f);
-
-				// If the TOI is in range ...
-				if (0.0f < toi && toi < 1.0f)
+				if (B2_FLT_EPSILON < toi && toi < minTOI)
 				{
-					// Interpolate on the actual range.
-					toi = b2Min((1.0f - toi) * t0 + toi, 1.0f);
+					// This is the minimum TOI found so far.
+					minContact = c;
+					minTOI = toi;
 				}
-
-
-				c->m_toi = toi;
-				c->m_flags |= b2Contact::e_toiFlag;
-			}
-
-			if (B2_FLT_EPSILON < toi && toi < minTOI)
-			{
-				// This is the minimum TOI found so far.
-				minContact = c;
-				minTOI = toi;
 			}
 		}
 
@@ -836,6 +888,8 @@ void b2World::SolveTOI(const b2TimeStep& step)
 			b2Body* b = island.m_bodies[i];
 			b->m_flags &= ~b2Body::e_islandFlag;
 
+			b->SynchronizeProxySet();
+
 			if (b->m_flags & (b2Body::e_sleepFlag | b2Body::e_frozenFlag))
 			{
 				continue;
@@ -907,7 +961,12 @@ void b2World::Step(float32 dt, int32 velocityIterations, int32 positionIteration
 	step.dtRatio = m_inv_dt0 * dt;
 
 	step.warmStarting = m_warmStarting;
-	
+
+	m_contactManager.ClearEvents();
+
+	// Report the pairs of proxies created since the last step.
+	m_broadPhase->Commit();
+
 	// Update contacts.
 	m_contactManager.Collide();
 
@@ -932,58 +991,597 @@ void b2World::Step(float32 dt, int32 velocityIterations, int32 positionIteration
 	}
 
 	m_lock = false;
+
+	// The listener may change the world here.
+	m_contactManager.ReportSensors();
 }
 
+// Writes the broad-phase candidates straight into the fixture array.
+struct b2WorldQueryArray : public b2BroadPhaseQueryCallback
+{
+	bool QueryCallback(void* proxyUserData)
+	{
+		fixtures[count++] = (b2Fixture*)proxyUserData;
+		return count < maxCount;
+	}
+
+	b2Fixture** fixtures;
+	int32 maxCount;
+	int32 count;
+};
+
 int32 b2World::Query(const b2AABB& aabb, b2Fixture** fixtures, int32 maxCount)
 {
-	void** results = (void**)m_stackAllocator.Allocate(maxCount * sizeof(void*));
+	if (maxCount <= 0)
+	{
+		return 0;
+	}
+
+	b2WorldQueryArray query;
+	query.fixtures = fixtures;
+	query.maxCount = maxCount;
+	query.count = 0;
+	m_broadPhase->Query(&query, aabb);
+
+	return query.count;
+}
+
+// Test two shapes for overlap, including their radii.
+template <typename TA, typename TB>
+static bool b2TestShapeOverlap(const TA* shapeA, const b2XForm& xfA, const TB* shapeB, const b2XForm& xfB)
+{
+	b2DistanceInput input;
+	input.transformA = xfA;
+	input.transformB = xfB;
+	input.useRadii = false;
+
+	b2SimplexCache cache;
+	cache.count = 0;
+	b2DistanceOutput output;
+	b2Distance(&output, &cache, &input, shapeA, shapeB);
+
+	return output.distance < shapeA->m_radius + shapeB->m_radius;
+}
+
+// Runs the exact overlap test for each broad-phase candidate.
+template <typename TA>
+struct b2WorldQueryWrapper : public b2BroadPhaseQueryCallback
+{
+	bool QueryCallback(void* proxyUserData)
+	{
+		b2Fixture* fixture = (b2Fixture*)proxyUserData;
+		const b2Shape* shapeB = fixture->GetShape();
+		const b2XForm& xfB = fixture->GetBody()->GetXForm();
+
+		bool overlap = false;
+		switch (shapeB->GetType())
+		{
+		case b2_circleShape:
+			overlap = b2TestShapeOverlap(shape, *xf, (const b2CircleShape*)shapeB, xfB);
+			break;
+
+		case b2_polygonShape:
+			overlap = b2TestShapeOverlap(shape, *xf, (const b2PolygonShape*)shapeB, xfB);
+			break;
+
+		case b2_edgeShape:
+			overlap = b2TestShapeOverlap(shape, *xf, (const b2EdgeShape*)shapeB, xfB);
+			break;
+
+		default:
+			b2Assert(false);
+			break;
+		}
+
+		if (overlap == false)
+		{
+			return true;
+		}
+
+		return callback->ReportFixture(fixture);
+	}
+
+	b2QueryCallback* callback;
+	const TA* shape;
+	const b2XForm* xf;
+};
+
+template <typename TA>
+static void b2QueryShape(b2BroadPhase* broadPhase, b2QueryCallback* callback, const TA* shape, const b2XForm& xf)
+{
+	b2WorldQueryWrapper<TA> wrapper;
+	wrapper.callback = callback;
+	wrapper.shape = shape;
+	wrapper.xf = &xf;
+
+	b2AABB aabb;
+	shape->ComputeAABB(&aabb, xf);
+	broadPhase->Query(&wrapper, aabb);
+}
+
+void b2World::Query(b2QueryCallback* callback, const b2AABB& aabb)
+{
+	// Query with a box that has no radius, so only the fixture radii count.
+	b2PolygonShape box;
+	box.SetAsBox(0.5f * (aabb.upperBound.x - aabb.lowerBound.x), 0.5f * (aabb.upperBound.y - aabb.lowerBound.y));
+	box.m_radius = 0.0f;
 
-	int32 count = m_broadPhase->Query(aabb, results, maxCount);
+	b2XForm xf;
+	xf.position = aabb.GetCenter();
+	xf.R.SetIdentity();
 
-	for (int32 i = 0; i < count; ++i)
+	b2QueryShape(m_broadPhase, callback, &box, xf);
+}
+
+void b2World::Query(b2QueryCallback* callback, const b2Shape* shape, const b2XForm& xf)
+{
+	switch (shape->GetType())
 	{
-		fixtures[i] = (b2Fixture*)results[i];
+	case b2_circleShape:
+		b2QueryShape(m_broadPhase, callback, (const b2CircleShape*)shape, xf);
+		break;
+
+	case b2_polygonShape:
+		b2QueryShape(m_broadPhase, callback, (const b2PolygonShape*)shape, xf);
+		break;
+
+	case b2_edgeShape:
+		b2QueryShape(m_broadPhase, callback, (const b2EdgeShape*)shape, xf);
+		break;
+
+	default:
+		b2Assert(false);
+		break;
 	}
+}
+
+// Keeps the k nearest fixtures, sorted by distance.
+struct b2WorldNearestWrapper : public b2BroadPhaseNearestCallback
+{
+	float32 NearestCallback(void* proxyUserData, float32 maxDistance)
+	{
+		b2Fixture* fixture = (b2Fixture*)proxyUserData;
+
+		if (contactFilter && contactFilter->RayCollide(userData, fixture) == false)
+		{
+			return maxDistance;
+		}
+
+		const b2Shape* shape = fixture->GetShape();
 
-	m_stackAllocator.Free(results);
-	return count;
+		b2DistanceInput input;
+		input.transformA = xf;
+		input.transformB = fixture->GetBody()->GetXForm();
+		input.useRadii = true;
+
+		b2SimplexCache cache;
+		cache.count = 0;
+		b2DistanceOutput output;
+
+		switch (shape->GetType())
+		{
+		case b2_circleShape:
+			b2Distance(&output, &cache, &input, &point, (const b2CircleShape*)shape);
+			break;
+
+		case b2_polygonShape:
+			b2Distance(&output, &cache, &input, &point, (const b2PolygonShape*)shape);
+			break;
+
+		case b2_edgeShape:
+			b2Distance(&output, &cache, &input, &point, (const b2EdgeShape*)shape);
+			break;
+
+		default:
+			b2Assert(false);
+			return maxDistance;
+		}
+
+		if (output.distance > maxDistance)
+		{
+			return maxDistance;
+		}
+
+		// Insertion sort, k is small.
+		int32 i = b2Min(count, maxCount - 1);
+		while (i > 0 && hits[i - 1].distance > output.distance)
+		{
+			hits[i] = hits[i - 1];
+			--i;
+		}
+
+		hits[i].fixture = fixture;
+		hits[i].point = output.pointB;
+		hits[i].distance = output.distance;
+		count = b2Min(count + 1, maxCount);
+
+		// Only fixtures closer than the k-th best are of interest now.
+		if (count == maxCount)
+		{
+			return hits[count - 1].distance;
+		}
+
+		return maxDistance;
+	}
+
+	b2ContactFilter* contactFilter;
+	void* userData;
+	b2CircleShape point;
+	b2XForm xf;
+	b2NearestHit* hits;
+	int32 maxCount;
+	int32 count;
+};
+
+int32 b2World::QueryNearest(const b2Vec2& point, float32 maxDistance, b2NearestHit* hits, int32 maxCount, void* userData)
+{
+	if (maxCount <= 0)
+	{
+		return 0;
+	}
+
+	b2WorldNearestWrapper wrapper;
+	wrapper.contactFilter = m_contactFilter;
+	wrapper.userData = userData;
+	wrapper.hits = hits;
+	wrapper.maxCount = maxCount;
+	wrapper.count = 0;
+
+	// The query point is a circle with no radius.
+	wrapper.point.m_radius = 0.0f;
+	wrapper.point.m_p.SetZero();
+	wrapper.xf.position = point;
+	wrapper.xf.R.SetIdentity();
+
+	m_broadPhase->QueryNearest(&wrapper, point, maxDistance);
+
+	return wrapper.count;
 }
 
-int32 b2World::Raycast(const b2Segment& segment, b2Fixture** fixtures, int32 maxCount, bool solidShapes, void* userData)
+// Keeps the closest hits sorted by fraction. Once the array is full the ray is
+// clipped to the farthest hit kept.
+class b2RaycastArrayCallback : public b2RayCastCallback
 {
-	m_raycastSegment = &segment;
-	m_raycastUserData = userData;
-	m_raycastSolidShape = solidShapes;
+public:
+	float32 ReportFixture(b2Fixture* fixture, const b2Vec2& point, const b2Vec2& normal, float32 fraction)
+	{
+		B2_NOT_USED(point);
+		B2_NOT_USED(normal);
+
+		if (m_count == m_maxCount && fraction >= m_fractions[m_count-1])
+		{
+			return m_fractions[m_count-1];
+		}
 
-	void** results = (void**)m_stackAllocator.Allocate(maxCount * sizeof(void*));
+		// Insertion sort. The last hit drops off when full.
+		int32 i = m_count < m_maxCount ? m_count++ : m_count - 1;
+		while (i > 0 && m_fractions[i-1] > fraction)
+		{
+			m_fractions[i] = m_fractions[i-1];
+			m_fixtures[i] = m_fixtures[i-1];
+			--i;
+		}
+		m_fractions[i] = fraction;
+		m_fixtures[i] = fixture;
+
+		if (m_count == m_maxCount)
+		{
+			return m_fractions[m_count-1];
+		}
 
-	int32 count = m_broadPhase->QuerySegment(segment,results,maxCount, &RaycastSortKey);
+		return 1.0f;
+	}
+
+	b2Fixture** m_fixtures;
+	float32* m_fractions;
+	int32 m_maxCount;
+	int32 m_count;
+};
 
-	for (int32 i = 0; i < count; ++i)
+int32 b2World::Raycast(const b2Segment& segment, b2Fixture** fixtures, int32 maxCount, bool solidShapes, void* userData)
+{
+	if (maxCount <= 0)
 	{
-		fixtures[i] = (b2Fixture*)results[i];
+		return 0;
 	}
 
-	m_stackAllocator.Free(results);
-	return count;
+	b2RaycastArrayCallback callback;
+	callback.m_fixtures = fixtures;
+	callback.m_fractions = (float32*)b2Alloc(maxCount * sizeof(float32));
+	callback.m_maxCount = maxCount;
+	callback.m_count = 0;
+
+	RayCast(&callback, segment, solidShapes, userData);
+
+	b2Free(callback.m_fractions);
+	return callback.m_count;
 }
 
+// Keeps the closest hit.
+class b2RaycastOneCallback : public b2RayCastCallback
+{
+public:
+	float32 ReportFixture(b2Fixture* fixture, const b2Vec2& point, const b2Vec2& normal, float32 fraction)
+	{
+		B2_NOT_USED(point);
+		m_fixture = fixture;
+		m_normal = normal;
+		m_fraction = fraction;
+		return fraction;
+	}
+
+	b2Fixture* m_fixture;
+	b2Vec2 m_normal;
+	float32 m_fraction;
+};
+
 b2Fixture* b2World::RaycastOne(const b2Segment& segment, float32* lambda, b2Vec2* normal, bool solidShapes, void* userData)
 {
-	int32 maxCount = 1;
-	b2Fixture* fixture;
+	b2RaycastOneCallback callback;
+	callback.m_fixture = NULL;
+	RayCast(&callback, segment, solidShapes, userData);
+
+	if (callback.m_fixture)
+	{
+		*lambda = callback.m_fraction;
+		*normal = callback.m_normal;
+	}
+
+	return callback.m_fixture;
+}
+
+// Runs the exact fixture test for each proxy hit by the broad-phase ray.
+struct b2WorldRayCastWrapper : public b2BroadPhaseRayCastCallback
+{
+	float32 RayCastCallback(const b2RayCastInput& input, void* proxyUserData)
+	{
+		b2Fixture* fixture = (b2Fixture*)proxyUserData;
+
+		if (contactFilter && contactFilter->RayCollide(userData, fixture) == false)
+		{
+			return -1.0f;
+		}
+
+		float32 lambda;
+		b2Vec2 normal;
+		normal.SetZero();
+		b2SegmentCollide collide = fixture->TestSegment(&lambda, &normal, *segment, input.maxFraction);
+
+		if (collide == b2_missCollide || (collide == b2_startsInsideCollide && solidShapes == false))
+		{
+			return -1.0f;
+		}
+
+		b2Vec2 point = segment->p1 + lambda * (segment->p2 - segment->p1);
+		return callback->ReportFixture(fixture, point, normal, lambda);
+	}
+
+	b2RayCastCallback* callback;
+	b2ContactFilter* contactFilter;
+	const b2Segment* segment;
+	void* userData;
+	bool solidShapes;
+};
+
+void b2World::RayCast(b2RayCastCallback* callback, const b2Segment& segment, bool solidShapes, void* userData)
+{
+	if (segment.p1 == segment.p2)
+	{
+		return;
+	}
+
+	b2WorldRayCastWrapper wrapper;
+	wrapper.callback = callback;
+	wrapper.contactFilter = m_contactFilter;
+	wrapper.segment = &segment;
+	wrapper.userData = userData;
+	wrapper.solidShapes = solidShapes;
+
+	b2RayCastInput input;
+	input.p1 = segment.p1;
+	input.p2 = segment.p2;
+	input.maxFraction = 1.0f;
+	m_broadPhase->RayCast(&wrapper, input);
+}
+
+// The first contact of a shape cast.
+struct b2ShapeCastOutput
+{
+	b2Vec2 point;
+	b2Vec2 normal;
+	float32 fraction;
+};
+
+// Sweep shapeA by translation against shapeB resting at xfB. Shapes that start out
+// overlapped touch at fraction zero, otherwise the time of impact gives the fraction.
+template <typename TA, typename TB>
+static bool b2ShapeCastPair(b2ShapeCastOutput* output, const TA* shapeA, const b2XForm& xfA, const b2Vec2& translation,
+							const TB* shapeB, const b2XForm& xfB, float32 maxFraction)
+{
+	float32 rA = shapeA->m_radius;
+	float32 rB = shapeB->m_radius;
+
+	b2DistanceInput distanceInput;
+	distanceInput.transformA = xfA;
+	distanceInput.transformB = xfB;
+	distanceInput.useRadii = false;
+
+	b2SimplexCache cache;
+	cache.count = 0;
+	b2DistanceOutput distanceOutput;
+	b2Distance(&distanceOutput, &cache, &distanceInput, shapeA, shapeB);
+
+	// Shapes that merely touch may still slide along each other.
+	if (distanceOutput.distance < rA + rB - b2_linearSlop)
+	{
+		output->point = 0.5f * (distanceOutput.pointA + distanceOutput.pointB);
+		output->normal.SetZero();
+		output->fraction = 0.0f;
+		return true;
+	}
+
+	b2TOIInput input;
+	input.sweepA.localCenter.SetZero();
+	input.sweepA.c0 = xfA.position;
+	input.sweepA.c = xfA.position + maxFraction * translation;
+	input.sweepA.a0 = xfA.R.GetAngle();
+	input.sweepA.a = input.sweepA.a0;
+	input.sweepA.t0 = 0.0f;
+	input.sweepB.localCenter.SetZero();
+	input.sweepB.c0 = xfB.position;
+	input.sweepB.c = xfB.position;
+	input.sweepB.a0 = xfB.R.GetAngle();
+	input.sweepB.a = input.sweepB.a0;
+	input.sweepB.t0 = 0.0f;
+
+	// Neither shape rotates.
+	input.sweepRadiusA = 0.0f;
+	input.sweepRadiusB = 0.0f;
+	input.tolerance = b2_linearSlop;
+
+	float32 alpha = b2TimeOfImpact(&input, shapeA, shapeB);
+	if (alpha >= 1.0f)
+	{
+		return false;
+	}
+
+	output->fraction = alpha * maxFraction;
+
+	// Find the contact at the time of impact.
+	distanceInput.transformA.position = xfA.position + output->fraction * translation;
+	b2Distance(&distanceOutput, &cache, &distanceInput, shapeA, shapeB);
+
+	output->normal = distanceOutput.pointA - distanceOutput.pointB;
+	output->normal.Normalize();
+	output->point = distanceOutput.pointB + rB * output->normal;
+	return true;
+}
+
+// Runs the time of impact for each proxy hit by the swept box and keeps the first hit.
+template <typename TA>
+struct b2WorldShapeCastWrapper : public b2BroadPhaseRayCastCallback
+{
+	float32 RayCastCallback(const b2RayCastInput& input, void* proxyUserData)
+	{
+		b2Fixture* fixture = (b2Fixture*)proxyUserData;
+
+		if (contactFilter && contactFilter->RayCollide(userData, fixture) == false)
+		{
+			return -1.0f;
+		}
+
+		const b2Shape* shapeB = fixture->GetShape();
+		const b2XForm& xfB = fixture->GetBody()->GetXForm();
+
+		b2ShapeCastOutput castOutput;
+		bool hit = false;
+		switch (shapeB->GetType())
+		{
+		case b2_circleShape:
+			hit = b2ShapeCastPair(&castOutput, shape, *xf, *translation, (const b2CircleShape*)shapeB, xfB, input.maxFraction);
+			break;
+
+		case b2_polygonShape:
+			hit = b2ShapeCastPair(&castOutput, shape, *xf, *translation, (const b2PolygonShape*)shapeB, xfB, input.maxFraction);
+			break;
+
+		case b2_edgeShape:
+			hit = b2ShapeCastPair(&castOutput, shape, *xf, *translation, (const b2EdgeShape*)shapeB, xfB, input.maxFraction);
+			break;
+
+		default:
+			b2Assert(false);
+			break;
+		}
+
+		if (hit == false)
+		{
+			return -1.0f;
+		}
+
+		hitFixture = fixture;
+		output = castOutput;
+
+		// A hit at the start cannot be beaten.
+		if (castOutput.fraction == 0.0f)
+		{
+			return 0.0f;
+		}
+
+		return castOutput.fraction;
+	}
+
+	b2ContactFilter* contactFilter;
+	void* userData;
+	const TA* shape;
+	const b2XForm* xf;
+	const b2Vec2* translation;
+	b2Fixture* hitFixture;
+	b2ShapeCastOutput output;
+};
+
+template <typename TA>
+static b2Fixture* b2CastShape(b2BroadPhase* broadPhase, b2ContactFilter* contactFilter, void* userData,
+							  const TA* shape, const b2XForm& xf, const b2Vec2& translation, b2ShapeCastOutput* output)
+{
+	b2WorldShapeCastWrapper<TA> wrapper;
+	wrapper.contactFilter = contactFilter;
+	wrapper.userData = userData;
+	wrapper.shape = shape;
+	wrapper.xf = &xf;
+	wrapper.translation = &translation;
+	wrapper.hitFixture = NULL;
+
+	// The broad-phase sweeps the AABB of the shape.
+	b2AABB aabb;
+	shape->ComputeAABB(&aabb, xf);
+
+	b2RayCastInput input;
+	input.p1 = aabb.GetCenter();
+	input.p2 = input.p1 + translation;
+	input.maxFraction = 1.0f;
+	broadPhase->BoxCast(&wrapper, input, aabb.GetExtents());
+
+	if (wrapper.hitFixture)
+	{
+		*output = wrapper.output;
+	}
 
-	int32 count = Raycast(segment, &fixture, maxCount, solidShapes, userData);
+	return wrapper.hitFixture;
+}
 
-	if(count==0)
-		return NULL;
+b2Fixture* b2World::ShapeCast(const b2Shape* shape, const b2XForm& xf, const b2Vec2& translation,
+							  float32* fraction, b2Vec2* point, b2Vec2* normal, void* userData)
+{
+	b2ShapeCastOutput output;
+	b2Fixture* fixture = NULL;
 
-	b2Assert(count==1);
+	switch (shape->GetType())
+	{
+	case b2_circleShape:
+		fixture = b2CastShape(m_broadPhase, m_contactFilter, userData, (const b2CircleShape*)shape, xf, translation, &output);
+		break;
 
-	//Redundantly do TestSegment a second time, as the previous one's results are inaccessible
+	case b2_polygonShape:
+		fixture = b2CastShape(m_broadPhase, m_contactFilter, userData, (const b2PolygonShape*)shape, xf, translation, &output);
+		break;
+
+	case b2_edgeShape:
+		fixture = b2CastShape(m_broadPhase, m_contactFilter, userData, (const b2EdgeShape*)shape, xf, translation, &output);
+		break;
+
+	default:
+		b2Assert(false);
+		break;
+	}
+
+	if (fixture)
+	{
+		*fraction = output.fraction;
+		*point = output.point;
+		*normal = output.normal;
+	}
 
-	fixture->TestSegment(lambda, normal,segment,1);
-	//We already know it returns true
 	return fixture;
 }
 
@@ -1133,69 +1731,52 @@ void b2World::DrawDebugData()
 	if (flags & b2DebugDraw::e_pairBit)
 	{
 		b2BroadPhase* bp = m_broadPhase;
-		b2Vec2 invQ;
-		invQ.Set(1.0f / bp->m_quantizationFactor.x, 1.0f / bp->m_quantizationFactor.y);
 		b2Color color(0.9f, 0.9f, 0.3f);
 
-		for (int32 i = 0; i < b2_tableCapacity; ++i)
+		for (int32 i = 0; i < bp->m_pairManager.m_pairCapacity; ++i)
 		{
-			uint16 index = bp->m_pairManager.m_hashTable[i];
-			while (index != b2_nullPair)
+			b2Pair* pair = bp->m_pairManager.m_pairs + i;
+			if (pair->proxyId1 == b2_nullProxy)
 			{
-				b2Pair* pair = bp->m_pairManager.m_pairs + index;
-				b2Proxy* p1 = bp->m_proxyPool + pair->proxyId1;
-				b2Proxy* p2 = bp->m_proxyPool + pair->proxyId2;
-
-				b2AABB b1, b2;
-				b1.lowerBound.x = bp->m_worldAABB.lowerBound.x + invQ.x * bp->m_bounds[0][p1->lowerBounds[0]].value;
-				b1.lowerBound.y = bp->m_worldAABB.lowerBound.y + invQ.y * bp->m_bounds[1][p1->lowerBounds[1]].value;
-				b1.upperBound.x = bp->m_worldAABB.lowerBound.x + invQ.x * bp->m_bounds[0][p1->upperBounds[0]].value;
-				b1.upperBound.y = bp->m_worldAABB.lowerBound.y + invQ.y * bp->m_bounds[1][p1->upperBounds[1]].value;
-				b2.lowerBound.x = bp->m_worldAABB.lowerBound.x + invQ.x * bp->m_bounds[0][p2->lowerBounds[0]].value;
-				b2.lowerBound.y = bp->m_worldAABB.lowerBound.y + invQ.y * bp->m_bounds[1][p2->lowerBounds[1]].value;
-				b2.upperBound.x = bp->m_worldAABB.lowerBound.x + invQ.x * bp->m_bounds[0][p2->upperBounds[0]].value;
-				b2.upperBound.y = bp->m_worldAABB.lowerBound.y + invQ.y * bp->m_bounds[1][p2->upperBounds[1]].value;
-
-				b2Vec2 x1 = 0.5f * (b1.lowerBound + b1.upperBound);
-				b2Vec2 x2 = 0.5f * (b2.lowerBound + b2.upperBound);
-
-				m_debugDraw->DrawSegment(x1, x2, color);
-
-				index = pair->next;
+				continue;
 			}
+
+			b2AABB b1 = bp->GetFatAABB(pair->proxyId1);
+			b2AABB b2 = bp->GetFatAABB(pair->proxyId2);
+
+			b2Vec2 x1 = 0.5f * (b1.lowerBound + b1.upperBound);
+			b2Vec2 x2 = 0.5f * (b2.lowerBound + b2.upperBound);
+
+			m_debugDraw->DrawSegment(x1, x2, color);
 		}
 	}
 
 	if (flags & b2DebugDraw::e_aabbBit)
 	{
 		b2BroadPhase* bp = m_broadPhase;
-		b2Vec2 worldLower = bp->m_worldAABB.lowerBound;
-		b2Vec2 worldUpper = bp->m_worldAABB.upperBound;
+		b2Vec2 worldLower = bp->GetWorldAABB().lowerBound;
+		b2Vec2 worldUpper = bp->GetWorldAABB().upperBound;
 
-		b2Vec2 invQ;
-		invQ.Set(1.0f / bp->m_quantizationFactor.x, 1.0f / bp->m_quantizationFactor.y);
 		b2Color color(0.9f, 0.3f, 0.9f);
-		for (int32 i = 0; i < b2_maxProxies; ++i)
+		for (b2Body* b = m_bodyList; b; b = b->GetNext())
 		{
-			b2Proxy* p = bp->m_proxyPool + i;
-			if (p->IsValid() == false)
+			for (b2Fixture* f = b->GetFixtureList(); f; f = f->GetNext())
 			{
-				continue;
-			}
+				if (f->m_proxyId == b2_nullProxy)
+				{
+					continue;
+				}
 
-			b2AABB b;
-			b.lowerBound.x = worldLower.x + invQ.x * bp->m_bounds[0][p->lowerBounds[0]].value;
-			b.lowerBound.y = worldLower.y + invQ.y * bp->m_bounds[1][p->lowerBounds[1]].value;
-			b.upperBound.x = worldLower.x + invQ.x * bp->m_bounds[0][p->upperBounds[0]].value;
-			b.upperBound.y = worldLower.y + invQ.y * bp->m_bounds[1][p->upperBounds[1]].value;
+				b2AABB aabb = bp->GetFatAABB(f->m_proxyId);
 
-			b2Vec2 vs[4];
-			vs[0].Set(b.lowerBound.x, b.lowerBound.y);
-			vs[1].Set(b.upperBound.x, b.lowerBound.y);
-			vs[2].Set(b.upperBound.x, b.upperBound.y);
-			vs[3].Set(b.lowerBound.x, b.upperBound.y);
+				b2Vec2 vs[4];
+				vs[0].Set(aabb.lowerBound.x, aabb.lowerBound.y);
+				vs[1].Set(aabb.upperBound.x, aabb.lowerBound.y);
+				vs[2].Set(aabb.upperBound.x, aabb.upperBound.y);
+				vs[3].Set(aabb.lowerBound.x, aabb.upperBound.y);
 
-			m_debugDraw->DrawPolygon(vs, 4, color);
+				m_debugDraw->DrawPolygon(vs, 4, color);
+			}
 		}
 
 		b2Vec2 vs[4];
@@ -1224,12 +1805,17 @@ void b2World::Validate()
 
 int32 b2World::GetProxyCount() const
 {
-	return m_broadPhase->m_proxyCount;
+	return m_broadPhase->GetProxyCount();
 }
 
 int32 b2World::GetPairCount() const
 {
-	return m_broadPhase->m_pairManager.m_pairCount;
+	return m_broadPhase->GetPairCount();
+}
+
+int32 b2World::GetProxyCapacity() const
+{
+	return m_broadPhase->GetProxyCapacity();
 }
 
 bool b2World::InRange(const b2AABB& aabb) const
@@ -1237,29 +1823,85 @@ bool b2World::InRange(const b2AABB& aabb) const
 	return m_broadPhase->InRange(aabb);
 }
 
-float32 b2World::RaycastSortKey(void* data)
+// Keeps the closest hit of each ray in a batch.
+struct b2WorldRayBatchWrapper : public b2BroadPhaseRayBatchCallback
 {
-	b2Fixture* fixture = (b2Fixture*)data;
-	b2Body* body = fixture->GetBody();
-	b2World* world = body->GetWorld();
-
-	if (world->m_contactFilter && !world->m_contactFilter->RayCollide(world->m_raycastUserData,fixture))
+	float32 RayCastCallback(const b2RayCastInput& input, void* proxyUserData, int32 rayIndex)
 	{
-		return -1;
-	}
+		b2Fixture* fixture = (b2Fixture*)proxyUserData;
 
-	float32 lambda;
-	b2SegmentCollide collide = fixture->TestSegment(&lambda, &world->m_raycastNormal, *world->m_raycastSegment, 1);
+		if (contactFilter && contactFilter->RayCollide(userData, fixture) == false)
+		{
+			return -1.0f;
+		}
 
-	if (world->m_raycastSolidShape && collide == b2_missCollide)
-	{
-		return -1;
+		const b2Segment& segment = segments[rayIndex];
+
+		float32 lambda;
+		b2Vec2 normal;
+		normal.SetZero();
+		b2SegmentCollide collide = fixture->TestSegment(&lambda, &normal, segment, input.maxFraction);
+
+		if (collide == b2_missCollide || (collide == b2_startsInsideCollide && solidShapes == false))
+		{
+			return -1.0f;
+		}
+
+		b2RayCastHit* hit = hits + rayIndex;
+		hit->fixture = fixture;
+		hit->point = segment.p1 + lambda * (segment.p2 - segment.p1);
+		hit->normal = normal;
+		hit->fraction = lambda;
+
+		// A hit at the start point cannot be beaten.
+		if (lambda == 0.0f)
+		{
+			return 0.0f;
+		}
+
+		return lambda;
 	}
 
-	if (!world->m_raycastSolidShape && collide != b2_hitCollide)
+	b2ContactFilter* contactFilter;
+	const b2Segment* segments;
+	b2RayCastHit* hits;
+	void* userData;
+	bool solidShapes;
+};
+
+void b2World::RayCastBatch(const b2Segment* segments, b2RayCastHit* hits, int32 count, bool solidShapes, void* userData)
+{
+	// Cast the rays in chunks, so the inputs live on the stack.
+	const int32 k_chunkSize = 8 * b2_rayPacketSize;
+	b2RayCastInput inputs[k_chunkSize];
+
+	b2WorldRayBatchWrapper wrapper;
+	wrapper.contactFilter = m_contactFilter;
+	wrapper.userData = userData;
+	wrapper.solidShapes = solidShapes;
+
+	for (int32 base = 0; base < count; base += k_chunkSize)
 	{
-		return -1;
-	}
+		int32 chunkCount = b2Min(count - base, k_chunkSize);
+
+		for (int32 i = 0; i < chunkCount; ++i)
+		{
+			const b2Segment& segment = segments[base + i];
+			inputs[i].p1 = segment.p1;
+			inputs[i].p2 = segment.p2;
 
-	return lambda;
+			// Degenerate rays are skipped.
+			inputs[i].maxFraction = 1.0f;
+			if (segment.p1 == segment.p2)
+			{
+				inputs[i].maxFraction = 0.0f;
+			}
+
+			hits[base + i].fixture = NULL;
+		}
+
+		wrapper.segments = segments + base;
+		wrapper.hits = hits + base;
+		m_broadPhase->RayCastBatch(&wrapper, inputs, chunkCount);
+	}
 }
@@ -30,9 +30,11 @@ struct b2BodyDef;
 struct b2JointDef;
 class b2Body;
 class b2Fixture;
+class b2Shape;
 class b2Joint;
 class b2Contact;
 class b2BroadPhase;
+struct b2BroadPhaseDef;
 class b2Controller;
 class b2ControllerDef;
 
@@ -46,9 +48,33 @@ struct b2TimeStep
 	bool warmStarting;
 };
 
+/// The closest hit of one ray of a batch. See b2World::RayCastBatch.
+struct b2RayCastHit
+{
+	b2Fixture* fixture;		///< NULL if the ray hit nothing
+	b2Vec2 point;
+	b2Vec2 normal;			///< zero for solid shapes that contain the start of the ray
+	float32 fraction;
+};
+
+/// A fixture found by a nearest query. See b2World::QueryNearest.
+struct b2NearestHit
+{
+	b2Fixture* fixture;
+	b2Vec2 point;			///< the closest point on the fixture
+	float32 distance;		///< zero if the query point is inside the fixture
+};
+
 /// The world class manages all physics entities, dynamic simulation,
 /// and asynchronous queries. The world also contains efficient memory
 /// management facilities.
+///
+/// The queries (Query, Raycast, RayCast, QueryNearest, ShapeCast and friends) keep
+/// their state on the stack or in memory allocated per call, so they are reentrant.
+/// Several threads may query the world at the same time while it is unlocked, that is
+/// outside of Step and the callbacks it makes, as long as nothing creates, destroys,
+/// or moves bodies or fixtures meanwhile. Contact filters used by queries must be
+/// thread-safe as well.
 class b2World
 {
 public:
@@ -56,7 +82,15 @@ public:
 	/// @param worldAABB a bounding box that completely encompasses all your shapes.
 	/// @param gravity the world gravity vector.
 	/// @param doSleep improve performance by not simulating inactive bodies.
-	b2World(const b2AABB& worldAABB, const b2Vec2& gravity, bool doSleep);
+	/// @param proxyCapacity the initial number of broad-phase proxies. The broad-phase
+	/// grows as needed, so this is only a hint to avoid reallocation.
+	b2World(const b2AABB& worldAABB, const b2Vec2& gravity, bool doSleep, int32 proxyCapacity = b2_proxyPoolSize);
+
+	/// Construct a world object with a specific broad-phase.
+	/// @param broadPhaseDef the broad-phase algorithm, world bounding box, and initial capacity.
+	/// @param gravity the world gravity vector.
+	/// @param doSleep improve performance by not simulating inactive bodies.
+	b2World(const b2BroadPhaseDef* broadPhaseDef, const b2Vec2& gravity, bool doSleep);
 
 	/// Destruct the world. All physics entities are destroyed and all heap memory is released.
 	~b2World();
@@ -79,6 +113,30 @@ public:
 	/// consume draw commands when you call Step().
 	void SetDebugDraw(b2DebugDraw* debugDraw);
 
+	/// Register a dispatcher to run the narrow-phase on several threads. The
+	/// contact callbacks are still made on the thread that calls Step, in the
+	/// same order as without a dispatcher.
+	void SetTaskDispatcher(b2TaskDispatcher* dispatcher);
+
+	/// Record the contact events of each step in arrays, see GetContactEvents.
+	/// This is off by default. The contact listener is called either way.
+	void SetContactEventsEnabled(bool flag);
+
+	/// Set the approach speed, in meters per second, above which a new touch
+	/// records a hit event. The default is b2_hitEventThreshold.
+	void SetHitEventThreshold(float32 speed);
+
+	/// Get the contact events recorded during the last step. The arrays stay valid
+	/// until the next step, so they can be processed in bulk, or in parallel, while
+	/// the world is unlocked. Contact events name the fixtures alive at the end of
+	/// the step; destroying a fixture does not remove its events from these arrays.
+	/// The sensor events are the ones passed to b2ContactListener::SensorEvents, and
+	/// are recorded even when contact events are disabled. Destroying a fixture sets
+	/// the sensor and fixture of its sensor events to NULL.
+	/// Note: contacts destroyed outside of Step, such as by DestroyBody, record no
+	/// end event.
+	b2ContactEvents GetContactEvents() const;
+
 	/// Create a rigid body given a definition. No reference to the definition
 	/// is retained.
 	/// @warning This function is locked during callbacks.
@@ -125,6 +183,20 @@ public:
 	/// @return the number of fixtures found in aabb.
 	int32 Query(const b2AABB& aabb, b2Fixture** fixtures, int32 maxCount);
 
+	/// Query the world for all fixtures whose shape overlaps the provided AABB.
+	/// Unlike the array query, each broad-phase candidate is tested against the
+	/// exact shape, and there is no result cap.
+	/// @param callback a user implemented callback class.
+	/// @param aabb the query box.
+	void Query(b2QueryCallback* callback, const b2AABB& aabb);
+
+	/// Query the world for all fixtures that overlap a shape. Each broad-phase
+	/// candidate is tested with b2Distance, and there is no result cap.
+	/// @param callback a user implemented callback class.
+	/// @param shape the query shape. It does not need to belong to a body.
+	/// @param xf the transform of the query shape.
+	void Query(b2QueryCallback* callback, const b2Shape* shape, const b2XForm& xf);
+
 	/// Query the world for all fixtures that intersect a given segment. You provide a fixture
 	/// pointer buffer of specified size. The number of fixtures found is returned, and the buffer
 	/// is filled in order of intersection
@@ -148,6 +220,55 @@ public:
 	/// @returns the colliding shape shape, or null if not found
 	b2Fixture* RaycastOne(const b2Segment& segment, float32* lambda, b2Vec2* normal, bool solidShapes, void* userData);
 
+	/// Find the fixtures closest to a point, nearest first. The tree broad-phase only
+	/// visits the nodes that can beat the current k-th best distance, and each candidate
+	/// is measured exactly with b2Distance. Use a maxCount of one and a finite maxDistance
+	/// to find the nearest fixture within a radius.
+	/// @param point the query point.
+	/// @param maxDistance only fixtures within this distance are found. Keep this
+	/// finite unless the world uses the tree broad-phase.
+	/// @param hits receives up to maxCount fixtures sorted by distance.
+	/// @param maxCount the number of fixtures to find.
+	/// @param userData passed through the worlds contact filter, with method RayCollide.
+	/// @return the number of fixtures found.
+	int32 QueryNearest(const b2Vec2& point, float32 maxDistance, b2NearestHit* hits, int32 maxCount, void* userData);
+
+	/// Ray-cast the world for all fixtures in the path of the ray. The callback
+	/// controls whether you get the closest hit, any hit, or all hits, see
+	/// b2RayCastCallback. Each fixture is tested once and there is no result cap.
+	/// @param callback a user implemented callback class.
+	/// @param segment the ray extends from p1 to p2.
+	/// @param solidShapes determines if shapes that the ray starts in are counted as hits.
+	/// @param userData passed through the worlds contact filter, with method RayCollide.
+	void RayCast(b2RayCastCallback* callback, const b2Segment& segment, bool solidShapes, void* userData);
+
+	/// Find the closest hit of many rays at once. This is much faster than calling
+	/// RaycastOne for each ray. The tree broad-phase traverses the rays in packets of
+	/// b2_rayPacketSize, so keep rays that start close together and point the same
+	/// way next to each other in the array.
+	/// @param segments the rays, each extending from p1 to p2.
+	/// @param hits receives the closest hit of each ray.
+	/// @param count the number of rays.
+	/// @param solidShapes determines if shapes that the ray starts in are counted as hits.
+	/// @param userData passed through the worlds contact filter, with method RayCollide.
+	void RayCastBatch(const b2Segment* segments, b2RayCastHit* hits, int32 count, bool solidShapes, void* userData);
+
+	/// Sweep a shape along a translation and find the first fixture it hits. Use this to
+	/// check if a shape fits along a path. The shape does not rotate during the sweep.
+	/// Fixtures that overlap the shape at the start are hit at fraction zero.
+	/// @param shape the shape to cast. It does not need to belong to a body.
+	/// @param xf the start transform of the shape.
+	/// @param translation the shape moves from xf to xf shifted by translation.
+	/// @param fraction returns the fraction of the translation at the first contact.
+	/// @param point returns the contact point on the surface of the fixture.
+	/// @param normal returns the fixture normal at the contact point, or zero if the
+	/// shapes overlap at the start.
+	/// @param userData passed through the worlds contact filter, with method RayCollide.
+	/// @returns the first fixture hit, or NULL if the path is clear. The outputs are only
+	/// set on a hit.
+	b2Fixture* ShapeCast(const b2Shape* shape, const b2XForm& xf, const b2Vec2& translation,
+						 float32* fraction, b2Vec2* point, b2Vec2* normal, void* userData);
+
 	/// Check if the AABB is within the broad-phase limits.
 	bool InRange(const b2AABB& aabb) const;
 
@@ -163,16 +284,22 @@ public:
 
 	/// Get the world contact list. With the returned contact, use b2Contact::GetNext to get
 	/// the next contact in the world list. A NULL contact indicates the end of the list.
+	/// Contacts are stored in arrays, so destroying a contact changes the order.
 	/// @return the head of the world contact list.
 	/// @warning contacts are 
 	b2Contact* GetContactList();
 
+	/// Get the contact of a handle.
+	/// @return the contact, or NULL if the contact was destroyed.
+	b2Contact* GetContact(const b2ContactHandle& handle);
+
 	/// Get the world controller list. With the returned controller, use b2Controller::GetNext to get
 	/// the next controller in the world list. A NULL controller indicates the end of the list.
 	/// @return the head of the world controller list.
 	b2Controller* GetControllerList();
 
 	/// Re-filter a fixture. This re-runs contact filtering on a fixture.
+	/// @warning This function is locked during callbacks.
 	void Refilter(b2Fixture* fixture);
 
 	/// Enable/disable warm starting. For testing.
@@ -190,13 +317,17 @@ public:
 	/// Get the number of broad-phase pairs.
 	int32 GetPairCount() const;
 
+	/// Get the number of broad-phase proxies that fit before the broad-phase must grow.
+	int32 GetProxyCapacity() const;
+
 	/// Get the number of bodies.
 	int32 GetBodyCount() const;
 
 	/// Get the number of joints.
 	int32 GetJointCount() const;
 
-	/// Get the number of contacts (each may have 0 or more contact points).
+	/// Get the number of contacts (each may have 0 or more contact points). Broad-phase
+	/// pairs only get a contact once their shapes are close.
 	int32 GetContactCount() const;
 
 	/// Get the number of controllers.
@@ -211,9 +342,12 @@ public:
 private:
 
 	friend class b2Body;
+	friend class b2Contact;
 	friend class b2ContactManager;
 	friend class b2Controller;
 
+	void Initialize(const b2BroadPhaseDef* broadPhaseDef, const b2Vec2& gravity, bool doSleep);
+
 	void Solve(const b2TimeStep& step);
 	void SolveTOI(const b2TimeStep& step);
 
@@ -221,9 +355,6 @@ private:
 	void DrawShape(b2Fixture* shape, const b2XForm& xf, const b2Color& color);
 	void DrawDebugData();
 
-	//Is it safe to pass private static function pointers?
-	static float32 RaycastSortKey(void* shape);
-
 	b2BlockAllocator m_blockAllocator;
 	b2StackAllocator m_stackAllocator;
 
@@ -236,14 +367,6 @@ private:
 	b2Joint* m_jointList;
 	b2Controller* m_controllerList;
 
-	b2Vec2 m_raycastNormal;
-	void* m_raycastUserData;
-	const b2Segment* m_raycastSegment;
-	bool m_raycastSolidShape;
-
-	// Do not access
-	b2Contact* m_contactList;
-
 	int32 m_bodyCount;
 	int32 m_contactCount;
 	int32 m_jointCount;
@@ -259,6 +382,7 @@ private:
 	b2ContactFilter* m_contactFilter;
 	b2ContactListener* m_contactListener;
 	b2DebugDraw* m_debugDraw;
+	b2TaskDispatcher* m_taskDispatcher;
 
 	// This is used to compute the time step ratio to
 	// support a variable time step.
@@ -288,7 +412,32 @@ inline b2Joint* b2World::GetJointList()
 
 inline b2Contact* b2World::GetContactList()
 {
-	return m_contactList;
+	return m_contactManager.FindContact(0, 0);
+}
+
+inline b2Contact* b2World::GetContact(const b2ContactHandle& handle)
+{
+	return m_contactManager.GetContact(handle);
+}
+
+inline b2ContactEvents b2World::GetContactEvents() const
+{
+	const b2ContactManager& cm = m_contactManager;
+
+	b2ContactEvents events;
+	events.beginEvents = cm.m_beginEvents.events;
+	events.beginCount = cm.m_beginEvents.count;
+	events.endEvents = cm.m_endEvents.events;
+	events.endCount = cm.m_endEvents.count;
+	events.hitEvents = cm.m_hitEvents.events;
+	events.hitCount = cm.m_hitEvents.count;
+	events.impulseEvents = cm.m_impulseEvents.events;
+	events.impulseCount = cm.m_impulseEvents.count;
+	events.sensorBeginEvents = cm.m_reportedBegins.events;
+	events.sensorBeginCount = cm.m_reportedBegins.count;
+	events.sensorEndEvents = cm.m_reportedEnds.events;
+	events.sensorEndCount = cm.m_reportedEnds.count;
+	return events;
 }
 
 inline b2Controller* b2World::GetControllerList()
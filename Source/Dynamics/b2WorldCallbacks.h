@@ -20,6 +20,7 @@
 #define B2_WORLD_CALLBACKS_H
 
 #include "../Common/b2Settings.h"
+#include "Contacts/b2Contact.h"
 
 struct b2Vec2;
 struct b2XForm;
@@ -85,6 +86,69 @@ struct b2ContactImpulse
 	float32 tangentImpulses[b2_maxManifoldPoints];
 };
 
+/// A sensor began or ceased to overlap a fixture. See b2ContactListener::SensorEvents
+/// and b2World::GetContactEvents.
+struct b2SensorEvent
+{
+	b2Fixture* sensor;
+	b2Fixture* fixture;		///< the other fixture, which may be a sensor too
+};
+
+/// Two fixtures began to touch. See b2World::GetContactEvents.
+struct b2ContactBeginEvent
+{
+	b2Fixture* fixtureA;
+	b2Fixture* fixtureB;
+	b2ContactHandle contact;
+};
+
+/// Two fixtures ceased to touch. The contact may be destroyed already.
+struct b2ContactEndEvent
+{
+	b2Fixture* fixtureA;
+	b2Fixture* fixtureB;
+	b2ContactHandle contact;
+};
+
+/// Two fixtures began to touch faster than the hit event threshold.
+struct b2ContactHitEvent
+{
+	b2Fixture* fixtureA;
+	b2Fixture* fixtureB;
+	b2ContactHandle contact;
+	b2Vec2 point;			///< the world point that approached fastest
+	b2Vec2 normal;			///< world vector pointing from A to B
+	float32 approachSpeed;	///< the speed of B toward A along the normal
+};
+
+/// The solver impulses of a touching contact. A contact may have several of
+/// these in one step because of time of impact sub-steps.
+struct b2ContactImpulseEvent
+{
+	b2Fixture* fixtureA;
+	b2Fixture* fixtureB;
+	b2ContactHandle contact;
+	int32 pointCount;
+	b2ContactImpulse impulse;
+};
+
+/// The contact events of a step, see b2World::GetContactEvents.
+struct b2ContactEvents
+{
+	const b2ContactBeginEvent* beginEvents;
+	int32 beginCount;
+	const b2ContactEndEvent* endEvents;
+	int32 endCount;
+	const b2ContactHitEvent* hitEvents;
+	int32 hitCount;
+	const b2ContactImpulseEvent* impulseEvents;
+	int32 impulseCount;
+	const b2SensorEvent* sensorBeginEvents;
+	int32 sensorBeginCount;
+	const b2SensorEvent* sensorEndEvents;
+	int32 sensorEndCount;
+};
+
 /// Implement this class to get contact information. You can use these results for
 /// things like sounds and game logic. You can also get contact results by
 /// traversing the contact lists after the time step. However, you might miss
@@ -100,11 +164,28 @@ public:
 	virtual ~b2ContactListener() {}
 
 	/// Called when two fixtures begin to touch.
+	/// Note: this is not called for sensors, see SensorEvents.
 	virtual void BeginContact(b2Contact* contact) { B2_NOT_USED(contact); }
 
 	/// Called when two fixtures cease to touch.
+	/// Note: this is not called for sensors, see SensorEvents.
 	virtual void EndContact(b2Contact* contact) { B2_NOT_USED(contact); }
 
+	/// Called once after the time step with the sensors that began and ceased to
+	/// overlap other fixtures during the step. Sensors have no contacts, they only
+	/// track whether the shapes overlap. The world is unlocked, so you may create and
+	/// destroy entities here. Destroying a fixture sets the sensor and fixture of its
+	/// events to NULL, so skip those entries.
+	/// Note: destroying a fixture reports no end event for it.
+	virtual void SensorEvents(const b2SensorEvent* beginEvents, int32 beginCount,
+							  const b2SensorEvent* endEvents, int32 endCount)
+	{
+		B2_NOT_USED(beginEvents);
+		B2_NOT_USED(beginCount);
+		B2_NOT_USED(endEvents);
+		B2_NOT_USED(endCount);
+	}
+
 	/// This is called after a contact is updated. This allows you to inspect a
 	/// contact before it goes to the solver. If you are careful, you can modify the
 	/// contact manifold (e.g. disable contact).
@@ -134,6 +215,64 @@ public:
 	}
 };
 
+/// Callback class for overlap queries. See b2World::Query.
+class b2QueryCallback
+{
+public:
+	virtual ~b2QueryCallback() {}
+
+	/// Called for each fixture that overlaps the query shape.
+	/// @return false to terminate the query.
+	virtual bool ReportFixture(b2Fixture* fixture) = 0;
+};
+
+/// Callback class for ray casts. See b2World::RayCast.
+/// The return value picks the mode of the ray cast:
+/// - return fraction to clip the ray to the hit, which finds the closest hit.
+/// - return 0 to stop at the first hit found, which is enough for line of sight.
+/// - return 1 to keep the ray, which reports every hit in no particular order.
+/// - return -1 to ignore the fixture.
+class b2RayCastCallback
+{
+public:
+	virtual ~b2RayCastCallback() {}
+
+	/// Called for each fixture hit by the ray.
+	/// @param fixture the fixture hit by the ray
+	/// @param point the point of initial intersection
+	/// @param normal the normal vector at the point of intersection. This is zero
+	/// for solid shapes that contain the start of the ray.
+	/// @param fraction the fraction along the ray at the point of intersection
+	/// @return -1 to ignore the fixture, 0 to terminate, fraction to clip the ray,
+	/// 1 to continue
+	virtual float32 ReportFixture(b2Fixture* fixture, const b2Vec2& point, const b2Vec2& normal, float32 fraction) = 0;
+};
+
+/// A range of independent work items, run by a b2TaskDispatcher.
+class b2Task
+{
+public:
+	virtual ~b2Task() {}
+
+	/// Run the items [begin, end). This may be called from any thread, and
+	/// concurrently for disjoint ranges.
+	virtual void Execute(int32 begin, int32 end) = 0;
+};
+
+/// Implement this class to run the parallel parts of the time step, such as
+/// the narrow-phase, on your own worker threads. Box2D never creates threads.
+/// Without a dispatcher the work runs on the thread that calls Step.
+class b2TaskDispatcher
+{
+public:
+	virtual ~b2TaskDispatcher() {}
+
+	/// Call task->Execute on ranges that cover [0, count) exactly once, and return
+	/// when all of them are done. The ranges may run concurrently.
+	/// @param grainSize a hint for the smallest range worth running on its own.
+	virtual void ParallelFor(b2Task* task, int32 count, int32 grainSize) = 0;
+};
+
 /// Color for debug drawing. Each value has the range [0,1].
 struct b2Color
 {